@@ -0,0 +1,56 @@
+/**
+ * @file arq.h
+ * Selective-repeat ARQ, reliable delivery of data packets to a unicast destination.
+ * - The message of such a packet starts with an ARQ header, and PH_ARQ_FLAG is set:
+ *   its sequence number, the oldest one its sender still waits on, then the acknowledgement of what the sender
+ *   received from the destination. Sequence numbers are per destination, and wrap around at 256.
+ * - The acknowledgement is cumulative, the next sequence number expected, with a bitmap of the ones received
+ *   after it. It rides on data going back to the peer, or else goes in an ACK packet after ARQ_ACK_DELAY_US.
+ * - At most the window size of packets wait on an acknowledgement per destination. Each is retransmitted once
+ *   unacknowledged for the retransmission timeout, or as soon as a packet sent after it is acknowledged, since
+ *   the line keeps the order. Up to ARQ_MAX_RETRIES times before it is given up on.
+ * - The timeout is estimated from the measured round trip time as in RFC 6298, and doubles on each retransmission.
+ *   Retransmitted packets give no measurement.
+ * - The receiver delivers packets in order, holds those after a gap until it is filled, and drops duplicates.
+ *   It skips a gap once the sender gives up on the packets in it.
+ * Frames sent by ARQ are kept, and retransmitted, until acknowledged. The transmitter hands them back through
+ * arq_release, and polls arq_pollFrame for retransmissions and ACKs. A packet from llc_send is complete once
+ * acknowledged, and failed once given up on. Only in packet mode.
+ */
+
+#ifndef ARQ_H_
+#define ARQ_H_
+
+#include "framepool.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// bytes ahead of the message of an ARQ data packet
+#define ARQ_HEADER_LEN 4
+// nodes exchanging reliable packets with this one at a time
+#define ARQ_MAX_PEERS 4
+// largest window, packets waiting on an acknowledgement per destination
+#define ARQ_MAX_WINDOW 8
+// a packet is given up on after this many retransmissions
+#define ARQ_MAX_RETRIES 6
+// an acknowledgement waits this long for data to ride on
+#define ARQ_ACK_DELAY_US 20000
+// retransmission timeout before the first measurement, and its bounds. The longest frame and its ACK take ~2.5 s
+#define ARQ_INITIAL_RTO_US 1000000
+#define ARQ_MIN_RTO_US 100000
+#define ARQ_MAX_RTO_US 4000000
+// prints the round trip estimates and counters when typed on the uart
+#define ARQ_STATS_COMMAND "!arq"
+
+void arq_init(uint8_t addr, unsigned int window);
+bool arq_enabled();
+bool arq_mayQueue(uint8_t dest);
+void arq_track(Frame *frame);
+void arq_stamp(Frame *frame);
+bool arq_release(Frame *frame);
+Frame *arq_pollFrame();
+bool arq_onFrame(Frame *frame);
+Frame *arq_pollDelivery();
+void arq_print();
+
+#endif /* ARQ_H_ */
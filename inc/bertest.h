@@ -0,0 +1,74 @@
+/**
+ * @file bertest.h
+ * Bit error rate test mode.
+ * The transmitter sends a continuous PRBS7/PRBS15/PRBS23 sequence with the normal bit timing, and the
+ * receiver checks the sampled bits against it. The checker synchronises itself to the sequence: it hunts
+ * by predicting every bit from the previously received ones, and once enough predictions in a row hold it
+ * runs a local copy of the generator and counts every mismatch as a bit error. Too many errors in a window
+ * means sync was lost; if sync comes back at a shifted phase of the old sequence, it was a slip.
+ */
+
+#ifndef BERTEST_H_
+#define BERTEST_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// the value is the order of the generator polynomial
+typedef enum {
+	BER_OFF = 0,
+	BER_PRBS7 = 7,		// x^7 + x^6 + 1
+	BER_PRBS15 = 15,	// x^15 + x^14 + 1
+	BER_PRBS23 = 23		// x^23 + x^18 + 1
+} BER_PATTERN;
+
+// consecutive correctly predicted bits needed to declare sync
+#define BER_SYNC_BITS 32
+// sync is lost when more than BER_LOSS_ERRORS of the last BER_WINDOW_BITS bits are in error
+#define BER_WINDOW_BITS 64
+#define BER_LOSS_ERRORS 16
+// errors less than this many bits apart belong to the same burst
+#define BER_BURST_GAP 16
+// largest phase shift, in bits, recognised as a slip when sync comes back
+#define BER_MAX_SLIP 8
+// burst length histogram, bin i counts bursts of 2^i to 2^(i+1)-1 bits
+#define BER_BURST_BINS 8
+// number of checked bits between reports
+#define BER_REPORT_BITS 10000
+
+// Fibonacci LFSR generating the sequence
+typedef struct {
+	uint32_t state;
+	uint32_t mask;
+	uint8_t order;
+	uint8_t tap;
+} Prbs;
+
+typedef struct {
+	uint32_t bits;
+	uint32_t errors;
+	uint32_t syncLosses;
+	uint32_t slips;
+	uint32_t bursts;
+	uint32_t maxBurstLen;
+	uint32_t burstHist[BER_BURST_BINS];
+} BerStats;
+
+void prbs_init(Prbs *prbs, BER_PATTERN pattern);
+
+/**
+ * @return the next bit of the sequence
+ */
+static inline int prbs_next(Prbs *prbs) {
+	int bit = ((prbs->state >> (prbs->order-1)) ^ (prbs->state >> (prbs->tap-1))) & 1;
+	prbs->state = ((prbs->state << 1) | bit) & prbs->mask;
+	return bit;
+}
+
+void ber_init(BER_PATTERN pattern);
+void ber_rxBit(int bit);
+bool ber_reportDue();
+void ber_report();
+const BerStats *ber_getStats();
+
+#endif /* BERTEST_H_ */
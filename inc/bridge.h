@@ -0,0 +1,52 @@
+/**
+ * @file bridge.h
+ * Two-port learning bridge, splitting the bus into two segments that only share the traffic crossing between them.
+ * - The source of every frame heard on a port is learned in a hash table, and forgotten after BRIDGE_AGING_US
+ *   without a frame from it.
+ * - A frame is forwarded to the other port unless its destination was learned on the port it came from.
+ *   Broadcasts and unknown destinations are forwarded.
+ * - Forwarding is cut-through: the decision is taken as soon as the dest byte is received, and the other port
+ *   sends the frame while it is still being received (Frame.growing). A frame whose reception fails is cut short,
+ *   its copy then fails its CRC. A corrupted frame received complete is still forwarded.
+ * - A frame heard on a port from the source of a frame the port is still sending is the bridge's own copy heard
+ *   back, it is dropped. Any other frame is learned, so a node moving to the other segment is learned there by
+ *   its first frame. Should it send while the bridge still holds one of its frames for that segment, that frame
+ *   is taken for the copy and lost.
+ * Receivers report frames through bridge_onHeader and bridge_onFrameEnd, transmitters poll bridge_pollFrame
+ * and hand frames back through bridge_release. Port n is network interface n, see link.h.
+ * Only in packet mode, and not in stream mode.
+ */
+
+#ifndef BRIDGE_H_
+#define BRIDGE_H_
+
+#include "framepool.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define BRIDGE_NUM_PORTS 2
+// learned addresses, a power of two
+#define BRIDGE_TABLE_SIZE 32
+// a learned address is forgotten after this long without a frame from it
+#define BRIDGE_AGING_US 300000000
+// prints the learned addresses and counters when typed on the uart
+#define BRIDGE_STATS_COMMAND "!bridge"
+
+typedef enum {
+	// not forwarded, the frame is for the receiving node as usual
+	BRIDGE_LOCAL,
+	// forwarded, the bridge took the frame. The receiver keeps filling it, and ends it with bridge_onFrameEnd
+	BRIDGE_FORWARD,
+	// the bridge's own copy heard back, to drop
+	BRIDGE_ECHO
+} BRIDGE_DECISION;
+
+void bridge_init(bool enabled);
+bool bridge_enabled();
+BRIDGE_DECISION bridge_onHeader(int port, Frame *frame);
+void bridge_onFrameEnd(int port, bool complete);
+Frame *bridge_pollFrame(int port);
+bool bridge_release(Frame *frame);
+void bridge_print();
+
+#endif /* BRIDGE_H_ */
@@ -0,0 +1,23 @@
+/**
+ * @file chat.h
+ * UART chat application, a client of the link layer library, see llc.h.
+ * Every line typed on the uart is sent to the dest node, and every message received is printed with the
+ * link quality of its frame. Lines starting with '!' are commands printing the state of the link layer instead,
+ * such as LQ_DUMP_COMMAND or ARQ_STATS_COMMAND.
+ */
+
+#ifndef CHAT_H_
+#define CHAT_H_
+
+#include "llc.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// A message typed as "!<class> text" is sent in that PH_CLASS, 0 to 3. Others go out as best effort
+#define CHAT_CLASS_PREFIX	'!'
+
+void chat_init(uint8_t dest, bool packetMode);
+const LlcCallbacks *chat_callbacks();
+void chat_update();
+
+#endif /* CHAT_H_ */
@@ -0,0 +1,60 @@
+/**
+ * @file critical.h
+ * Critical sections for state shared between ISRs and the main loop, or between ISRs of different priorities.
+ * BASEPRI is raised to ISR_PRIO_CEILING, masking every interrupt source of the node but leaving faults and
+ * priority 0 alone, see isr.h. It is only ever raised on entry, and the previous mask is restored on exit, so
+ * sections nest and may be entered from ISRs.
+ * The longest section is kept, from the outermost entry to its exit. It bounds the entry latency of the EXTI
+ * edges, see isr_print.
+ */
+
+#ifndef CRITICAL_H_
+#define CRITICAL_H_
+
+#include "isr.h"
+#include "io_definitions.h"
+#include <inttypes.h>
+
+// only accessed through the functions below, exposed so they can be inlined
+extern uint32_t critical_since;
+extern uint32_t critical_maxCycles;
+#ifndef __arm__
+// BASEPRI of the host builds of tools/, which have no interrupts to mask but nest the same way
+extern uint32_t critical_hostBasepri;
+#endif
+
+/**
+ * masks interrupts up to ISR_PRIO_CEILING
+ * @return the previous mask, to pass to critical_exit
+ */
+static inline uint32_t critical_enter() {
+	uint32_t basepri;
+#ifdef __arm__
+	__asm volatile ("mrs %0, basepri" : "=r" (basepri) :: "memory");
+	__asm volatile ("msr basepri_max, %0" :: "r" (ISR_PRIO_FIELD(ISR_PRIO_CEILING)) : "memory");
+#else
+	basepri = critical_hostBasepri;
+	critical_hostBasepri = ISR_PRIO_FIELD(ISR_PRIO_CEILING);
+#endif
+	if (!basepri)
+		critical_since = *(DWT_CYCCNT);
+	return basepri;
+}
+
+/**
+ * restores the interrupt mask from before the matching critical_enter
+ */
+static inline void critical_exit(uint32_t basepri) {
+	if (!basepri) {
+		uint32_t cycles = *(DWT_CYCCNT) - critical_since;
+		if (cycles > critical_maxCycles)
+			critical_maxCycles = cycles;
+	}
+#ifdef __arm__
+	__asm volatile ("msr basepri, %0" :: "r" (basepri) : "memory");
+#else
+	critical_hostBasepri = basepri;
+#endif
+}
+
+#endif /* CRITICAL_H_ */
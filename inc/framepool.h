@@ -0,0 +1,70 @@
+/**
+ * @file framepool.h
+ * Pool of fixed-size frame buffers shared by the transmitter and the receiver.
+ * Frames are allocated and freed in O(1) from a free list, and handed between the ISRs and the main loop
+ * through FrameQueues. Both are safe to use from either side.
+ * A frame holds a serialized packet (see ph_serialize), or the raw bytes of a message outside of packet mode.
+ */
+
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#include "packet_header.h"
+#include "linkquality.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// the longest serialized packet
+#define FP_FRAME_SIZE sizeof(PacketHeader)
+// number of frames in the pool, in flight and waiting to be transmitted or displayed. ARQ holds on to frames
+// until they are acknowledged, and to received ones until they are in order
+#define FP_NUM_FRAMES 12
+
+// MONITOR_TIMER times of a frame's way through the node, see latency.h. A sent frame is stamped when it is queued,
+// wins the line, and its first and last half-bits go out. A received frame at its first and last edges, once the
+// receiver completes it and once it is delivered to the application
+typedef enum {
+	FP_ENQUEUED,
+	FP_ACQUIRED,
+	FP_FIRST_EDGE,
+	FP_LAST_EDGE,
+	FP_RECEIVED,
+	FP_DELIVERED,
+	FP_NUM_STAMPS
+} FP_STAMP;
+
+typedef struct Frame {
+	// link in the free list or a FrameQueue
+	struct Frame *next;
+	uint16_t len;
+	// cut-through forwarding: the frame is sent while it is still being received, len grows until it ends
+	volatile bool growing;
+	// PH_CLASS the frame is sent with
+	uint8_t cls;
+	// llc_send handle of the message the frame carries, reported back once it is done with. 0 for none
+	uint16_t handle;
+	// MONITOR_TIMER times, FP_FIRST_EDGE of a received frame is what time sync and the MAC timestamp it with
+	uint32_t stamps[FP_NUM_STAMPS];
+	// edge timing of a received frame
+	LinkQuality lq;
+	uint8_t data[FP_FRAME_SIZE];
+} Frame;
+
+// FIFO of frames
+typedef struct {
+	Frame *head;
+	Frame *tail;
+	volatile unsigned int count;
+} FrameQueue;
+
+void fp_init();
+Frame *fp_alloc();
+void fp_free(Frame *frame);
+unsigned int fp_available();
+
+void fq_push(FrameQueue *queue, Frame *frame);
+void fq_pushFront(FrameQueue *queue, Frame *frame);
+Frame *fq_pop(FrameQueue *queue);
+Frame *fq_peek(FrameQueue *queue);
+
+#endif /* FRAMEPOOL_H_ */
@@ -12,7 +12,7 @@
 
 enum GPIOs
 {
-    A, B, C, D
+    A, B, C, D, E, F, G, H
 };
 
 /* GPIO structure */
@@ -30,13 +30,16 @@ typedef struct
     uint32_t AFRH;
 } GPIO;
 
+// Clock enable bits, in the order of the ports
 #define GPIOA_EN 0
 #define GPIOB_EN 1
 #define GPIOC_EN 2
 #define GPIOD_EN 3
 
 
-// Base addresses
+// Base addresses, the ports follow each other GPIO_STRIDE apart
+#define GPIOA_ADDR 0x40020000
+#define GPIO_STRIDE 0x400
 #define GPIOA_BASE ((volatile GPIO *) 0x40020000)
 #define GPIOB_BASE ((volatile GPIO *) 0x40020400)
 #define GPIOC_BASE ((volatile GPIO *) 0x40020800)
@@ -49,11 +52,74 @@ typedef struct
 #define ODR5 5
 // MODER bits
 #define MODER5 10
+// BSRR: writing 1 to bit n sets pin n, to bit n+16 resets it. Writing 0 leaves a pin alone
+#define BSRR_RESET 16
 
 void init_GPIO(enum GPIOs gpio);
+void enable_input_mode(enum GPIOs gpio, int pin);
 void enable_output_mode(enum GPIOs gpio, int pin);
 void enable_af_mode(enum GPIOs gpio, int pin, int af_num);
-volatile GPIO* select_gpio(enum GPIOs gpio);
+void enable_open_drain(enum GPIOs gpio, int pin);
+
+/*
+ * The pin functions below are inlined, they are called from the ISRs. A port known at compile time resolves to its
+ * address, one known at run time is an add. Pins are driven through BSRR, a single write that leaves the other pins
+ * alone: a read-modify-write of ODR interrupted by an ISR driving a pin of the same port would undo its change.
+ */
+
+static inline volatile GPIO* select_gpio(enum GPIOs gpio)
+{
+    return (volatile GPIO *) (uintptr_t) (GPIOA_ADDR + GPIO_STRIDE * gpio);
+}
+
+/**
+ * Sets the pins of the low half of bits and resets those of the high half, in a single write
+ */
+static inline void gpio_writeBsrr(volatile GPIO *gpio, uint32_t bits)
+{
+#ifdef __arm__
+    gpio->BSRR = bits;
+#else
+    // the host builds of tools/ map the registers as plain memory, see tools/host.h. A set wins over a reset
+    gpio->ODR = (gpio->ODR & ~(bits >> BSRR_RESET)) | (bits & 0xFFFF);
+#endif
+}
+
+static inline void set_pin(enum GPIOs gpio, int pin)
+{
+    gpio_writeBsrr(select_gpio(gpio), 1 << pin);
+}
+
+static inline void reset_pin(enum GPIOs gpio, int pin)
+{
+    gpio_writeBsrr(select_gpio(gpio), 1 << (pin + BSRR_RESET));
+}
+
+/**
+ * sets the pin if level is nonzero, resets it otherwise
+ */
+static inline void write_pin(enum GPIOs gpio, int pin, int level)
+{
+    gpio_writeBsrr(select_gpio(gpio), level ? 1 << pin : 1 << (pin + BSRR_RESET));
+}
+
+/**
+ * @return the level on an input pin, 0 or 1
+ */
+static inline int read_pin(enum GPIOs gpio, int pin)
+{
+    return (select_gpio(gpio)->IDR >> pin) & 1;
+}
+
+/**
+ * Only the pin itself may be driven by an ISR preempting this, the other pins of the port are left alone
+ */
+static inline void toggle_pin(enum GPIOs gpio, int pin)
+{
+    volatile GPIO *gpio_ptr = select_gpio(gpio);
+
+    gpio_writeBsrr(gpio_ptr, gpio_ptr->ODR & (1 << pin) ? 1 << (pin + BSRR_RESET) : 1 << pin);
+}
 
 
 #endif /* GPIO_H_ */
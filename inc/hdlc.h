@@ -0,0 +1,57 @@
+/**
+ * @file hdlc.h
+ * HDLC-style framing used by the streaming mode of the link.
+ * Frames are delimited by the flag sequence 0x7E and the frame content is bit stuffed
+ * (a 0 is inserted after every five consecutive 1s) so the flag can never appear inside a frame.
+ * This lets a sender transmit frames back-to-back without releasing the line, since the receiver
+ * splits frames on flags rather than on the monitor going IDLE.
+ * Bits are handled MSB -> LSB, the same order the transmitter puts them on the line.
+ */
+
+#ifndef HDLC_H_
+#define HDLC_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// the flag sequence delimiting frames
+#define HDLC_FLAG 0x7E
+
+// returned by hdlc_txNextBit once the closing flag has been sent
+#define HDLC_TX_DONE (-1)
+
+// maximum number of bits a frame of size bytes takes once stuffed and delimited by flags.
+// Back-to-back frames share a flag, the closing flag of one frame opens the next
+#define HDLC_MAX_STUFFED_BITS(size) (8*(size) + (8*(size))/5 + 2*8)
+
+typedef struct {
+	const uint8_t *frame;
+	unsigned int size;
+	unsigned int byte;
+	uint8_t bit;
+	uint8_t ones;
+	uint8_t stage;
+} HdlcTx;
+
+typedef enum {
+	HDLC_RX_NONE,	// nothing to report for this bit
+	HDLC_RX_BYTE,	// a destuffed byte is ready
+	HDLC_RX_FRAME,	// a closing flag ended a frame of at least one whole byte
+	HDLC_RX_ABORT	// the current frame is invalid (abort sequence or misaligned flag), drop it
+} HDLC_RX_EVENT;
+
+typedef struct {
+	uint8_t ones;
+	uint8_t byte;
+	uint8_t nbits;
+	uint16_t nbytes;
+	bool inFrame;
+} HdlcRx;
+
+void hdlc_txStart(HdlcTx *tx, const void *frame, unsigned int size, bool openFlag);
+int hdlc_txNextBit(HdlcTx *tx);
+
+void hdlc_rxReset(HdlcRx *rx);
+HDLC_RX_EVENT hdlc_rxBit(HdlcRx *rx, int bit, uint8_t *byteOut);
+
+#endif /* HDLC_H_ */
@@ -6,6 +6,7 @@
 #define IO_DEFINITIONS
 
 // **SYSCFG**
+#define SYSCFG_EXTICR1	(volatile uint32_t*)0x40013808
 #define SYSCFG_EXTICR2	(volatile uint32_t*)0x4001380C
 #define SYSCFG_EXTICR3	(volatile uint32_t *)0x40013810
 
@@ -16,7 +17,7 @@
 #define EXTI_PR         (volatile uint32_t *)0x40013c14 // Interrupt pending register
 
 // ***RCC registers***
-#define RCC_APB2ENR	    (volatile uint32_t *)0x40023844
+#define RCC_APB2ENR ((volatile uint32_t *) 0x40023844)
 
 // ***SysTick***
 #define F_CPU 16000000UL
@@ -28,6 +29,13 @@
 #define STK_CLKSOURCE_F 2
 #define STK_CNTFLAG_F 16
 
+// ***DWT cycle counter*** (Cortex-M4 debug unit, free running at F_CPU once enabled)
+#define DEMCR			(volatile uint32_t*) 0xE000EDFC
+#define DWT_CTRL		(volatile uint32_t*) 0xE0001000
+#define DWT_CYCCNT		(volatile uint32_t*) 0xE0001004
+#define DEMCR_TRCENA_F 24
+#define DWT_CYCCNTENA_F 0
+
 // **NVIC**
 #define NVIC_ISER0 		((volatile uint32_t*)0xE000E100)
 #define NVIC_IPR0 		((volatile uint32_t*)0xE000E400)
@@ -36,7 +44,14 @@
 #define NVIC_IPR3 		((volatile uint32_t*)0xE000E40C)
 #define NVIC_IPR4 		((volatile uint32_t*)0xE000E410)
 #define NVIC_IPR5 		((volatile uint32_t*)0xE000E414)
-#define NVIC_ISER1 		((volatile uint32_t*)0xE000E11C)
+#define NVIC_ISER1 		((volatile uint32_t*)0xE000E104)
+// one 8-bit priority field per IRQ, of which the top 4 bits are implemented
+#define NVIC_IPR_BYTE	((volatile uint8_t*)0xE000E400)
+
+// **SCB**
+#define SCB_AIRCR		((volatile uint32_t*)0xE000ED0C)
+#define AIRCR_VECTKEY	(0x05FA << 16)
+#define AIRCR_PRIGROUP_F 8
 
 
 #endif // IO_DEFINITIONS
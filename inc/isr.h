@@ -5,12 +5,167 @@
  *      Author: liangy
  */
 
+/**
+ * @file isr.h
+ * Interrupt priorities, in one place. Every source the node uses has a preemption priority in isr.c, and is
+ * enabled through isr_enableIrq which sets it:
+ * - the EXTI edges of the receive pins go first. Their timestamps are the edge timing of the monitor and the
+ *   link quality, and the sampling of the bits
+ * - then the receivers' half-bit timeouts, the transmitters' bit clocks, the MONITOR_TIMER and the uart
+ * All 4 priority bits preempt, there are no subpriorities, see ISR_PRIGROUP. Critical sections raise BASEPRI to
+ * ISR_PRIO_CEILING, see critical.h, which masks every source of the node. Priority 0 stays above them.
+ * The worst-case entry latency of each source is kept, see isr_print:
+ * - timers, from their counter when the ISR is entered: the time since the event, see isr_entered
+ * - EXTI lines, from the edges the node drives itself. The transmitter stamps the DWT cycle counter right before
+ *   it changes the level of its pin, see isr_edgeDriven, and the EXTI ISR of the receive pin looped back to it
+ *   takes the cycles since as it is entered, see isr_edgeEntered. So the latency includes the line's delay. The
+ *   edges of other nodes have no timestamp, they wait the same but for critical sections, whose longest one is
+ *   measured in critical_exit. During a collision another node's edge may be taken for the node's own
+ * The cycles each handler runs are kept too, from its first line to its last, see isr_start and isr_exited. The
+ * ISRs preempting it are left out, and so are the 12 cycles the core takes to stack and unstack it.
+ */
+
 #ifndef ISR_H_
 #define ISR_H_
 
+#include "io_definitions.h"
 #include <inttypes.h>
+#include <stdbool.h>
 
 #define ISER0 (volatile uint32_t *) 0xE000E100
 #define ISER1 (volatile uint32_t *) 0xE000E104
 
+// IRQ numbers, see the vector table in startup_stm32.s
+#define IRQ_EXTI2			8
+#define IRQ_EXTI4			10
+#define IRQ_EXTI9_5			23
+#define IRQ_TIM1_BRK_TIM9	24
+#define IRQ_TIM1_UP_TIM10	25
+#define IRQ_TIM1_TRG_COM_TIM11	26
+#define IRQ_TIM1_CC			27
+#define IRQ_TIM2			28
+#define IRQ_TIM3			29
+#define IRQ_TIM4			30
+#define IRQ_USART2			38
+#define IRQ_TIM8_BRK_TIM12	43
+#define IRQ_TIM8_UP_TIM13	44
+#define IRQ_TIM8_TRG_COM_TIM14	45
+#define IRQ_TIM8_CC			46
+#define IRQ_TIM5			50
+#define IRQ_TIM6_DAC		54
+#define IRQ_TIM7			55
+
+// implemented priority bits, the top ones of each 8-bit field. All of them are preemption priority
+#define ISR_PRIO_BITS 4
+#define ISR_PRIGROUP (7 - ISR_PRIO_BITS)
+#define ISR_PRIO_FIELD(prio) ((prio) << (8 - ISR_PRIO_BITS))
+
+// preemption priorities, lower is more urgent
+#define ISR_PRIO_EDGE		1
+#define ISR_PRIO_HALFBIT	2
+#define ISR_PRIO_TX_BIT		3
+#define ISR_PRIO_MONITOR	4
+#define ISR_PRIO_UART		5
+// critical sections mask this priority, and every one below it
+#define ISR_PRIO_CEILING	ISR_PRIO_EDGE
+// prints the priorities and entry latencies when typed on the uart
+#define ISR_COMMAND "!isr"
+
+typedef enum {
+	ISR_EXTI2,
+	ISR_EXTI4,
+	ISR_EXTI9_5,
+	ISR_TIM9,
+	ISR_TIM2,
+	ISR_TIM3,
+	ISR_TIM4,
+	ISR_TIM5,
+	ISR_USART2,
+	ISR_NUM_SOURCES
+} ISR_SOURCE;
+
+// only accessed through the functions below, exposed so they can be inlined into the ISRs
+extern uint32_t isr_maxLatency[ISR_NUM_SOURCES];
+extern volatile uint32_t isr_drivenAt[ISR_NUM_SOURCES];
+extern volatile bool isr_driven[ISR_NUM_SOURCES];
+extern uint32_t isr_cycles[ISR_NUM_SOURCES];
+extern uint32_t isr_calls[ISR_NUM_SOURCES];
+extern uint32_t isr_maxCycles[ISR_NUM_SOURCES];
+extern volatile uint32_t isr_spentCycles;
+
+// the start of a handler's run, see isr_start
+typedef struct {
+	uint32_t start;
+	// isr_spentCycles at the start, what the handlers preempting it add to it is theirs
+	uint32_t spentAt;
+} IsrTiming;
+
+void isr_init();
+void isr_enableIrq(int irq);
+void isr_print();
+
+/**
+ * accounts the entry latency of an ISR, in cycles since its event. Called first thing in the ISR
+ */
+static inline void isr_entered(ISR_SOURCE source, uint32_t cycles) {
+	if (cycles > isr_maxLatency[source])
+		isr_maxLatency[source] = cycles;
+}
+
+/**
+ * starts timing a handler. Called first thing in it
+ */
+static inline void isr_start(IsrTiming *t) {
+	t->start = *(DWT_CYCCNT);
+	t->spentAt = isr_spentCycles;
+}
+
+/**
+ * accounts the cycles of a handler since isr_start, less the handlers that preempted it meanwhile. Called last
+ * thing in it. isr_spentCycles counts every handler once, the preempting ones within the one they preempted
+ */
+static inline void isr_exited(ISR_SOURCE source, const IsrTiming *t) {
+#ifdef __arm__
+	__asm volatile ("cpsid i" ::: "memory");
+#endif
+	uint32_t total = *(DWT_CYCCNT) - t->start;
+	uint32_t cycles = total - (isr_spentCycles - t->spentAt);
+	isr_spentCycles = t->spentAt + total;
+#ifdef __arm__
+	__asm volatile ("cpsie i" ::: "memory");
+#endif
+	isr_cycles[source] += cycles;
+	isr_calls[source]++;
+	if (cycles > isr_maxCycles[source])
+		isr_maxCycles[source] = cycles;
+}
+
+/**
+ * the transmitter changes the level of its pin, the receive pin looped back to it interrupts on the edge. Called
+ * right before the write, from the transmitter's ISR: the edge ISR preempts it as soon as the edge is back
+ * @param exti the EXTI source of the receive pin
+ */
+static inline void isr_edgeDriven(ISR_SOURCE exti) {
+	isr_drivenAt[exti] = *(DWT_CYCCNT);
+	isr_driven[exti] = true;
+}
+
+/**
+ * the transmitter's ISR is entered again, an edge it drove that didn't interrupt by now was lost in a collision
+ */
+static inline void isr_edgeCleared(ISR_SOURCE exti) {
+	isr_driven[exti] = false;
+}
+
+/**
+ * accounts the entry latency of an EXTI ISR since the edge driven by isr_edgeDriven, if there was one. Called first
+ * thing in the ISR
+ */
+static inline void isr_edgeEntered(ISR_SOURCE exti) {
+	if (isr_driven[exti]) {
+		isr_driven[exti] = false;
+		isr_entered(exti, *(DWT_CYCCNT) - isr_drivenAt[exti]);
+	}
+}
+
 #endif /* ISR_H_ */
@@ -0,0 +1,51 @@
+/**
+ * @file latency.h
+ * Where the latency of a frame goes. Frames are stamped with the MONITOR_TIMER at each step of their way through
+ * the node, see FP_STAMP, and the time between two steps is added to the histogram of that stage once the frame
+ * is done with:
+ * - sent frames: queueing and backoff until the line is won, from there to the first half-bit, and the airtime
+ * - received frames: the airtime, from the last edge to the receiver completing the frame as the line goes IDLE,
+ *   and from there to the application getting it
+ * - one way: messages sent with LLC_TIMESTAMP carry the synchronized time they were queued in a STAMPED packet,
+ *   see timesync.h. The receiver takes it from the synchronized time they are delivered at
+ * Histogram bins are powers of two of us. Stamping is a load and a store, see lat_stamp.
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "framepool.h"
+#include "monitor.h"
+#include <inttypes.h>
+
+// bin 0 counts 0 us, bin n [2^(n-1), 2^n) us. The last one everything above
+#define LAT_BINS 24
+// bytes the send time takes ahead of the message of a STAMPED packet
+#define LAT_STAMP_LEN 4
+// prints the histograms when typed on the uart
+#define LAT_COMMAND "!lat"
+
+typedef enum {
+	LAT_TX_QUEUE,
+	LAT_TX_ACCESS,
+	LAT_TX_AIR,
+	LAT_RX_AIR,
+	LAT_RX_COMPLETE,
+	LAT_RX_DELIVER,
+	LAT_ONE_WAY,
+	LAT_NUM_STAGES
+} LAT_STAGE;
+
+void lat_add(LAT_STAGE stage, uint32_t us);
+void lat_txDone(const Frame *frame);
+void lat_rxDone(const Frame *frame);
+void lat_print();
+
+/**
+ * stamps a frame with the current MONITOR_TIMER time. Safe from ISRs
+ */
+static inline void lat_stamp(Frame *frame, FP_STAMP stamp) {
+	frame->stamps[stamp] = MONITOR_TIMER_BASE->CNT;
+}
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,65 @@
+/**
+ * @file link.h
+ * Network interfaces. Each one is a bus of its own, with its own pins and timers, see link_configs:
+ * - a transmit pin, and a receive pin whose EXTI line is its pin number
+ * - a timer clocking the transmitted half-bits, and one for the receiver's half-bit timeout
+ * - a compare channel of the MONITOR_TIMER for the monitor's timeout. The timer itself is the shared time base
+ * The transmitter, receiver and monitor keep the state of each interface apart. Each ISR serves the interface of
+ * its hardware, whose index it passes on as a constant. Everything above the link layer runs on the primary
+ * interface, the others carry bridged traffic, see bridge.h. Bridge port n is interface n.
+ * The ISRs of each interface, and the cycles spent in them, are counted with the DWT cycle counter, see
+ * link_printLoad.
+ */
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include "gpio.h"
+#include "tim.h"
+#include "io_definitions.h"
+#include "isr.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define LINK_MAX 2
+// the interface of the MAC, and everything above it
+#define LINK_PRIMARY 0
+
+typedef struct {
+	enum GPIOs txGpio;
+	uint8_t txPin;
+	enum GPIOs rxGpio;
+	uint8_t rxPin;
+	enum TIMs txTimer;
+	enum TIMs halfBitTimer;
+	// CC1 + monitorChannel of the MONITOR_TIMER
+	uint8_t monitorChannel;
+	// the EXTI ISR of the receive pin, for its entry latency, see isr_edgeDriven
+	ISR_SOURCE rxIsr;
+} LinkConfig;
+
+extern const LinkConfig link_configs[LINK_MAX];
+// only accessed through the functions below, exposed so they can be inlined into the ISRs
+extern volatile uint32_t link_isrCycles[LINK_MAX];
+extern volatile uint32_t link_isrCalls[LINK_MAX];
+
+void link_init(int count);
+int link_count();
+void link_printLoad();
+
+/**
+ * @return the timestamp an ISR starts at, to pass to link_isrExit
+ */
+static inline uint32_t link_isrEnter() {
+	return *(DWT_CYCCNT);
+}
+
+/**
+ * accounts the cycles since link_isrEnter, and the ISR, to the ISR load of an interface
+ */
+static inline void link_isrExit(int iface, uint32_t start) {
+	link_isrCycles[iface] += *(DWT_CYCCNT) - start;
+	link_isrCalls[iface]++;
+}
+
+#endif /* LINK_H_ */
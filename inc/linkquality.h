@@ -0,0 +1,85 @@
+/**
+ * @file linkquality.h
+ * Link quality indicator built from the timing of the receive edges.
+ * Every edge interval of a manchester frame is nominally one or two half-bit periods. The receiver
+ * feeds each edge's cycle count to lq_edge, which tracks the deviation from the nominal interval per
+ * frame (min/max/mean and edges outside of the window) and adds it to a cumulative histogram.
+ * Drift shows as a mean offset, jitter as a wide min/max, reflections and collisions as out of window edges.
+ * Each interface has its own LinkQualityState. Edges are timestamped with the DWT cycle counter, see link_init.
+ */
+
+#ifndef LINKQUALITY_H_
+#define LINKQUALITY_H_
+
+#include "transmitter.h"
+#include "io_definitions.h"
+#include <inttypes.h>
+
+// nominal half-bit period in cycles (the transmit timers run at F_CPU)
+#define LQ_HALFBIT_CYCLES TRANSMISSION_TICKS
+
+// histogram bins are 2^LQ_BIN_SHIFT cycles wide (16us), centered around a deviation of 0
+#define LQ_BIN_SHIFT 8
+#define LQ_HIST_BINS 16
+// edges deviating by more than this many cycles (+-128us, ~25% of a half-bit) are out of window
+#define LQ_WINDOW ((LQ_HIST_BINS/2) << LQ_BIN_SHIFT)
+
+// typed as a message, dumps the histogram instead of transmitting
+#define LQ_DUMP_COMMAND "!lq"
+
+// per frame statistics, deviations are in cycles
+typedef struct {
+	int32_t minDev;
+	int32_t maxDev;
+	uint32_t sumAbsDev;
+	uint16_t edges;
+	uint16_t outOfWindow;
+} LinkQuality;
+
+typedef struct {
+	LinkQuality frame;
+	uint32_t lastEdge;
+	uint32_t hist[LQ_HIST_BINS];
+	uint32_t histOutOfWindow;
+} LinkQualityState;
+
+void lq_init(LinkQualityState *s);
+void lq_frameStart(LinkQualityState *s, uint32_t now);
+void lq_frameEnd(LinkQualityState *s, LinkQuality *out);
+void lq_print(const LinkQuality *lq);
+void lq_dump(const LinkQualityState *s);
+
+/**
+ * @return the timestamp to pass to lq_edge/lq_frameStart
+ */
+static inline uint32_t lq_now() {
+	return *(DWT_CYCCNT);
+}
+
+/**
+ * accounts for one edge of the frame being received. A handful of cycles: no division or branches
+ * beyond the interval classification.
+ */
+static inline void lq_edge(LinkQualityState *s, uint32_t now) {
+	uint32_t interval = now - s->lastEdge;
+	s->lastEdge = now;
+
+	// closest nominal interval: one or two half-bits
+	int32_t dev = (int32_t)interval - (interval < 3*LQ_HALFBIT_CYCLES/2 ? LQ_HALFBIT_CYCLES : 2*LQ_HALFBIT_CYCLES);
+
+	if (dev < -LQ_WINDOW || dev >= LQ_WINDOW) {
+		s->frame.outOfWindow++;
+		s->histOutOfWindow++;
+		return;
+	}
+
+	if (dev < s->frame.minDev)
+		s->frame.minDev = dev;
+	if (dev > s->frame.maxDev)
+		s->frame.maxDev = dev;
+	s->frame.sumAbsDev += dev < 0 ? -dev : dev;
+	s->frame.edges++;
+	s->hist[(dev + LQ_WINDOW) >> LQ_BIN_SHIFT]++;
+}
+
+#endif /* LINKQUALITY_H_ */
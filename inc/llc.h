@@ -0,0 +1,116 @@
+/**
+ * @file llc.h
+ * Link layer library API, what an application sends and receives messages through.
+ * - llc_send queues a message and returns at once with a handle to it, or an error if it can't be queued now.
+ *   The message is built into a frame right away, the caller's buffer may be reused when it returns.
+ * - Once the transmitter, or the ARQ for a reliable message, is done with it, the message is reported
+ *   through the onSent or onFailed callback with its handle.
+ * - Received messages are handed to the onReceive callback in place, in the frame they came in.
+ *   The packet is only valid until the callback returns.
+ * - llc_poll runs the link layer and calls the callbacks. It never blocks, call it from the main loop. Or run its
+ *   halves as scheduler tasks, see sched.h: llc_pollTx on SCHED_EV_TX, and llc_pollRx on SCHED_EV_FRAME.
+ *   Both need SCHED_EV_MONITOR and SCHED_EV_TICK too, for what is still polled.
+ * - Messages sent with LLC_TIMESTAMP carry the time they were sent, for the receiver to measure their one way
+ *   latency, see latency.h.
+ * - The layers below print nothing. Collisions, dropped frames, give-ups and the MAC's events are reported
+ *   through the onEvent callback, see LLC_EVENT.
+ * Callbacks are called from llc_poll or its halves only, never from an ISR. In packet mode messages go to the dest they are
+ * sent to, routed through the network layer when it is beyond the bus. Otherwise they are the frame as is.
+ */
+
+#ifndef LLC_H_
+#define LLC_H_
+
+#include "framepool.h"
+#include "linkquality.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// llc_send flags: the message is acknowledged and retransmitted when ARQ is on, see arq.h. Ignored for broadcast
+// and routed messages
+#define LLC_RELIABLE 0x01
+// llc_send flags: the message carries the synchronized time it is sent at, see latency.h. Only once this node is
+// synced, and not for reliable or routed messages
+#define LLC_TIMESTAMP 0x20
+// llc_send flags: PH_CLASS the message is sent in, best effort by default
+#define LLC_CLASS(cls) (0x10 | (cls) << 1)
+#define LLC_GET_CLASS(flags) ((flags) & 0x10 ? (flags) >> 1 & 0x03 : PH_CLASS_BEST_EFFORT)
+
+// llc_send errors. LLC_ERR_BUSY is temporary: no frame is free, or the ARQ window to dest is full
+#define LLC_ERR_BUSY -1
+#define LLC_ERR_TOO_LONG -2
+
+// completion events not yet handed to the callbacks, at most one per frame
+#define LLC_MAX_EVENTS 16
+// link events not yet handed to onEvent, a power of two. Past this many, drops add up in the last one queued and
+// other events are lost
+#define LLC_MAX_LINK_EVENTS 16
+
+// what the layers below report through onEvent, with the iface, addr and value of LlcLinkEvent
+typedef enum {
+	// a frame being received was cut short by a collision. lq is the edge timing of what was received
+	LLC_EV_COLLISION,
+	// value frames dropped: no frame was free to receive them, or they were given up on after too many collisions
+	LLC_EV_RX_DROPPED,
+	LLC_EV_TX_DROPPED,
+	// BER test: the sequence goes again value ms after a collision
+	LLC_EV_BER_BACKOFF,
+	// the ARQ gave up on packet value to addr
+	LLC_EV_ARQ_GAVE_UP,
+	// the MAC synced to the beacon of addr, value slots
+	LLC_EV_MAC_SYNCED,
+	// token ring: another node holds the token too, or it collided. Either way it is dropped
+	LLC_EV_TOKEN_DUPLICATE,
+	LLC_EV_TOKEN_COLLISION,
+	// token ring: the token was lost and this node regenerated it
+	LLC_EV_TOKEN_LOST,
+	// token ring: this node left the ring. addr does not answer, it was removed from it
+	LLC_EV_TOKEN_LEFT,
+	LLC_EV_TOKEN_REMOVED,
+} LLC_EVENT;
+
+// a received message, pointing into the frame it came in
+typedef struct {
+	uint8_t src;
+	uint8_t dest;
+	uint8_t cls;
+	// false if the packet failed its checks, its fields may be garbage
+	bool valid;
+	const uint8_t *msg;
+	uint16_t length;
+	// MONITOR_TIMER time of the first edge of the frame, and its edge timing
+	uint32_t start;
+	const LinkQuality *lq;
+	// LLC_TIMESTAMP: the synchronized time the message was sent at
+	bool stamped;
+	uint32_t sent;
+} LlcPacket;
+
+typedef struct {
+	LLC_EVENT type;
+	uint8_t iface;
+	uint8_t addr;
+	uint32_t value;
+	LinkQuality lq;
+} LlcLinkEvent;
+
+typedef void (*LlcDoneCallback)(int handle);
+typedef void (*LlcReceiveCallback)(const LlcPacket *packet);
+typedef void (*LlcEventCallback)(const LlcLinkEvent *event);
+
+typedef struct {
+	LlcDoneCallback onSent;
+	LlcDoneCallback onFailed;
+	LlcReceiveCallback onReceive;
+	LlcEventCallback onEvent;
+} LlcCallbacks;
+
+void llc_init(uint8_t addr, bool packetMode, bool streamMode, const LlcCallbacks *callbacks);
+int llc_send(uint8_t dest, const void *buf, unsigned int len, uint8_t flags);
+void llc_poll();
+void llc_pollTx();
+void llc_pollRx();
+void llc_complete(Frame *frame, bool sent);
+void llc_report(LLC_EVENT type, int iface, uint8_t addr, uint32_t value, const LinkQuality *lq);
+
+#endif /* LLC_H_ */
@@ -0,0 +1,136 @@
+/**
+ * @file mac.h
+ * Medium access control, decides when the transmitter may put a frame on the line.
+ * - MAC_CSMA: the original random access. Send when the monitor is IDLE, back off randomly after a collision.
+ *   A collision is only noticed once the monitor times out, so a long frame wastes its whole length. Data frames
+ *   longer than the RTS threshold reserve the line first: once the frame wins the line, a short RTS carrying the
+ *   duration of the exchange goes instead. The destination answers with a CTS carrying what is left of it, and
+ *   the frame follows. Every other node hearing either defers until the exchange is over (the monitor's NAV).
+ *   Without a CTS, the RTS counts as a collision of the frame. Only in packet mode, never for broadcasts.
+ * - MAC_TDMA: time is split in superframes, each started by a beacon from a coordinator node. The beacon
+ *   lists which node owns each of the slots following it. A node only sends in its own slots, and only a frame
+ *   that fits in what is left of the slot.
+ * - MAC_SLOTTED_ALOHA: the same beacons and slots, but no slot has an owner. Any node may start a frame, only
+ *   right at the start of a slot, which halves the vulnerable period of unslotted starts. After a collision the
+ *   frame is retried after a random number of slots.
+ * In both slotted modes nodes align to the first edge of the beacon, and stop sending after MAC_BEACON_LOSS
+ * superframes without one.
+ * - MAC_TOKEN: a logical ring in address order. The node holding the token sends up to MAC_TOKEN_MAX_FRAMES
+ *   frames, then passes the token to the next address it knows of. Addresses are learned from the link control
+ *   frames heard, which are parsed and checked. Data frames are not, a corrupted source would add a node that
+ *   isn't there.
+ *   - A pass is confirmed by the successor's next transmission. Unconfirmed, it is retried once, then the
+ *     successor is dropped from the ring and the token goes to the one after.
+ *   - A lost token is regenerated by the first node to see the line quiet for MAC_TOKEN_LOSS_US, plus a
+ *     delay growing with its address so only one does.
+ *   - A holder is heard well within MAC_TOKEN_LOSS_US: with nothing to send it passes the token at once, and it
+ *     gives up the rest of its hold once the line has been quiet for MAC_TOKEN_KEEPALIVE_US. Alone in the ring,
+ *     it passes the token to itself.
+ *   - A holder that hears another node transmit has a duplicate token, it drops its own. A collision drops it too.
+ *   - Every MAC_TOKEN_SOLICIT_US, a holder sends a solicit before passing the token. Nodes not in the ring
+ *     answer it with a join, and the ring learns their address.
+ *   - A node that hears the token passed over its address, by a holder that doesn't know of it yet, is out of
+ *     the ring and joins again at the next solicit.
+ *   - A node leaves with mac_leave(): once it holds the token, it passes it on flagged as its last, and every
+ *     node hearing that removes it from the ring.
+ * - MAC_ARBITRATION: CSMA without destructive collisions, like CAN. The line is wired-AND, the transmit pin is
+ *   open-drain and the low level is dominant. A frame starts with a dominant start bit, then the arbitration field
+ *   (priority, then source address) NRZ-coded, then a recessive delimiter, then the Manchester frame as usual.
+ *   Each field bit is read back on the receive pin. A sender reading dominant while sending recessive lost to a
+ *   frame with a lower field, it stops driving without disturbing it, and retries once the line is IDLE.
+ *   Priority 0 wins. The monitor keeps the line BUSY over the field, which can be dominant for longer than
+ *   the idle timeout.
+ * The modes other than CSMA and arbitration exchange link control packets, so they need packet mode.
+ */
+
+#ifndef MAC_H_
+#define MAC_H_
+
+#include "framepool.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "hdlc.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+typedef enum {
+	MAC_RES_NONE,
+	MAC_RES_PENDING,	// RTS sent, waiting for the CTS
+	MAC_RES_GRANTED,	// CTS received, the frame goes next
+	MAC_RES_FAILED		// no CTS in time
+} MAC_RESERVATION;
+
+typedef enum {
+	MAC_CSMA,
+	MAC_TDMA,
+	MAC_SLOTTED_ALOHA,
+	MAC_TOKEN,
+	MAC_ARBITRATION
+} MAC_MODE;
+
+// duration of a data bit on the line, two half-bit periods
+#define MAC_BIT_US (2 * TRANSMISSION_TICKS / (F_CPU / 1000000))
+
+// longest frame in bytes allowed in the slotted modes, this sets the slot length
+#define MAC_SLOT_MAX_FRAME 32
+#define MAC_TDMA_MAX_SLOTS 16
+// slots per superframe in slotted ALOHA, after the beacon's
+#define MAC_ALOHA_SLOTS 16
+// margin for the main loop starting a frame late
+#define MAC_SLOT_GUARD_US 2000
+// a slot fits the longest frame, stuffed in stream mode, and the monitor going IDLE after it
+#define MAC_SLOT_US (HDLC_MAX_STUFFED_BITS(MAC_SLOT_MAX_FRAME) * MAC_BIT_US + TRANSMISSION_TIMEOUT_US + MAC_SLOT_GUARD_US)
+// superframes without a beacon before a node stops sending
+#define MAC_BEACON_LOSS 3
+// slotted ALOHA: a frame may only start this soon after the slot boundary
+#define MAC_ALOHA_START_US MAC_SLOT_GUARD_US
+// slotted ALOHA: a collided frame is retried 1 to this many slots later
+#define MAC_ALOHA_BACKOFF_SLOTS 8
+
+// token: frames sent per token hold
+#define MAC_TOKEN_MAX_FRAMES 4
+// token: the successor must have started transmitting this long after the token was passed
+#define MAC_TOKEN_PASS_US 50000
+// token: quiet line time after which the token is lost. Each address waits MAC_TOKEN_CLAIM_STEP_US more
+#define MAC_TOKEN_LOSS_US 200000u
+#define MAC_TOKEN_CLAIM_STEP_US 2000u
+// token: a holder not sending passes the token once the line has been quiet this long. Alone in the ring, it passes
+// the token to itself
+#define MAC_TOKEN_KEEPALIVE_US (MAC_TOKEN_LOSS_US / 4)
+// token: how often nodes outside the ring are invited in, and how long they have to answer
+#define MAC_TOKEN_SOLICIT_US 2000000
+#define MAC_TOKEN_JOIN_WINDOW_US MAC_TOKEN_KEEPALIVE_US
+
+// arbitration: start bit, priority, source address, delimiter
+#define MAC_ARB_PRIORITY_BITS 3
+#define MAC_ARB_BITS (1 + MAC_ARB_PRIORITY_BITS + 8 + 1)
+// a lower priority wins, so the traffic classes map to voice 0 .. background 6
+#define MAC_ARB_CLASS_PRIORITY(cls) (2*(PH_NUM_CLASSES-1 - (cls)))
+
+// RTS/CTS: data frames longer than this many bytes reserve the line. 0 never does
+#define MAC_RTS_THRESHOLD 64
+// from the end of a frame to the answer starting: the monitor going IDLE, then the main loop reacting
+#define MAC_TURNAROUND_US (TRANSMISSION_TIMEOUT_US + MAC_SLOT_GUARD_US)
+
+// typed on the uart to leave or rejoin the token ring
+#define MAC_LEAVE_COMMAND "!leave"
+#define MAC_JOIN_COMMAND "!join"
+
+void mac_init(MAC_MODE mode, uint8_t addr);
+void mac_setCoordinator(const uint8_t *schedule, int slots);
+MAC_MODE mac_getMode();
+unsigned int mac_maxFrameLen();
+Frame *mac_pollControlFrame(bool dataPending);
+bool mac_mayTransmit(const Frame *frame, unsigned int bits);
+uint16_t mac_arbitrationField(uint8_t priority);
+void mac_onCollision();
+void mac_leave();
+void mac_join();
+bool mac_onFrame(const Frame *frame);
+void mac_setRtsThreshold(unsigned int bytes);
+bool mac_needsReservation(const Frame *frame);
+Frame *mac_requestToSend(const Frame *frame, unsigned int bits);
+MAC_RESERVATION mac_reservation();
+void mac_endReservation();
+
+#endif /* MAC_H_ */
@@ -1,10 +1,11 @@
 /**
  * @file monitor.h
  * This is the header file for the monitor module which exposes its API.
- * The monitor uses:
- * - the systick
- * - an external interrupt on EXTI9_5 (PC9) in order to monitor transmission
- * - PB13-PB14-PB15 to real-time output the monitor state, this maps to TS_IDLE, TS_BUSY, TS_COLLISION
+ * There is a monitor per interface, see link.h. The monitor uses:
+ * - TIM5, free-running at 1 MHz to timestamp edges, with a compare channel per interface as its timeout deadline
+ * Besides the line state, it keeps the NAV: the time until which an overheard RTS/CTS reserved the line
+ * - the receiver's edge interrupt of each interface, or EXTI9_5 (PC9) for the primary one, in order to monitor transmission
+ * - PB13-PB14-PB15 to real-time output the monitor state of the primary interface, this maps to TS_IDLE, TS_BUSY, TS_COLLISION
  */
 
 // this configures the monitor so that it can run
@@ -12,6 +13,8 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include "tim.h"
+#include <inttypes.h>
 #include <stdbool.h>
 
 typedef enum {
@@ -20,19 +23,56 @@ typedef enum {
 	MS_COLLISION
 } MONITOR_STATE;
 
+// called from the monitor's ISRs whenever the state of an interface changes
+typedef void (*MonitorCallback)(int iface, MONITOR_STATE newState);
+
 // The period of time until a data transmission timeout occurs
 // The monitor enters the TS_IDLE or TS_COLLISION states when that happens
 #define TRANSMISSION_TIMEOUT_US 1110
 
+// Free-running timer for edge timestamps and the timeout. 32-bit, so it wraps after ~71 minutes
+// Update the corresponding ISR handler as well
+#define MONITOR_TIMER TIM5
+#define MONITOR_TIMER_BASE TIM5_BASE
+#define MONITOR_TIMER_PSC 15 // 16 MHz / (15+1) -> 1 us ticks
+
+// Channel load estimates. Busy and collision time are accounted per window, and each window is folded into
+// an EWMA with weight 1/2^MONITOR_EWMA_SHIFT. Estimates are fixed-point with MONITOR_Q16_ONE as 1.0
+#define MONITOR_LOAD_WINDOW_US 100000
+#define MONITOR_EWMA_SHIFT 3
+#define MONITOR_Q16_ONE 65536
+// windows folded in at most when catching up, the EWMA forgets anything older
+#define MONITOR_MAX_WINDOWS 64
+// prints the load statistics when typed on the uart
+#define MONITOR_LOAD_COMMAND "!load"
+
+// running totals since monitor_start, in MONITOR_TIMER ticks (us)
+typedef struct {
+	uint64_t idleUs;
+	uint64_t busyUs;	// includes collisions
+	uint64_t collisionUs;
+	uint32_t transmissions; // IDLE -> BUSY
+	uint32_t collisions;
+} MonitorStats;
+
 
 void monitor_start(bool exti9_enable);
-MONITOR_STATE monitor_getState();
-void monitor_jam();
+MONITOR_STATE monitor_getState(int iface);
+void monitor_setCallback(int iface, MonitorCallback callback);
+void monitor_jam(int iface);
+void monitor_setArbitrationWindow(int iface, uint32_t us);
+uint32_t monitor_now();
+uint32_t monitor_getLastEdge(int iface);
+void monitor_setNav(int iface, uint32_t until);
+bool monitor_navActive(int iface);
+uint32_t monitor_getIdleSince(int iface);
+uint32_t monitor_getUtilization(int iface);
+uint32_t monitor_getCollisionProbability(int iface);
+void monitor_getStats(int iface, MonitorStats *stats);
+void monitor_printLoad();
 
 void setupPinInterrupt();
-void SysTick_Handler();
+void TIM5_IRQHandler();
 void EXTI9_5_IRQHandler();
-void configTimer(uint32_t);
-void resetTimer(uint32_t);
-void monitor_Edge_Intrr();
+void monitor_onEdge(int iface);
 #endif // MONITOR_H
@@ -0,0 +1,36 @@
+/**
+ * @file network.h
+ * Network layer, multi-hop delivery of data packets to nodes beyond the bus.
+ * - A packet to a destination reached through another node is a ROUTED packet. Its message starts with a
+ *   network header: the node it comes from, the node it goes to, and a hop count (TTL).
+ * - The link src and dest of a ROUTED packet are those of its current hop. Each node it is addressed to either
+ *   delivers it, or decrements its TTL and sends it on to the next hop. It is dropped once the TTL runs out.
+ * - The next hop of every address is in a 256 entry table. A destination is reached directly until given a route.
+ * Forwarded packets stay in their frame, they are rewritten in place and polled by the transmitter through
+ * net_pollFrame. Routed packets are not made reliable by ARQ. Only in packet mode.
+ */
+
+#ifndef NETWORK_H_
+#define NETWORK_H_
+
+#include "framepool.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// bytes ahead of the message of a ROUTED packet
+#define NET_HEADER_LEN 3
+// hops a packet from this node may take
+#define NET_DEFAULT_TTL 8
+// prints the routes and forwarding counters when typed on the uart
+#define NET_STATS_COMMAND "!net"
+
+void net_init(uint8_t addr);
+void net_addRoute(uint8_t dest, uint8_t via);
+bool net_isRouted(uint8_t dest);
+void net_route(Frame *frame);
+bool net_onFrame(Frame *frame);
+Frame *net_pollFrame();
+Frame *net_pollDelivery();
+void net_print();
+
+#endif /* NETWORK_H_ */
@@ -13,6 +13,56 @@
 
 // maximum size put in PacketHeader.length
 #define PH_MSG_SIZE 0xFF
+// bytes of a serialized packet other than its message
+#define PH_OVERHEAD (sizeof(PacketHeader) - PH_MSG_SIZE)
+// offsets of fields in a serialized packet
+#define PH_SRC_OFFSET 2
+#define PH_DEST_OFFSET 3
+#define PH_LENGTH_OFFSET 4
+#define PH_FLAGS_OFFSET 5
+#define PH_MSG_OFFSET 6
+
+// The CRC, when crc_flag has it, covers the header from src to crc_flag as well as the message, so that a corrupted
+// type, class or address is caught like a corrupted message. Only data may be sent without it, see ph_parse.
+// crc_flag keeps the CRC flag in bit 0, the traffic class in bits 1-2, the ARQ flag in bit 3, and the frame type
+// in its upper nibble. The ARQ flag marks a data packet whose message starts with an ARQ header, see arq.h
+#define PH_CRC_FLAG 0x01
+#define PH_ARQ_FLAG 0x08
+#define PH_CLASS_SHIFT 1
+#define PH_CLASS_MASK 0x06
+#define PH_GET_CLASS(flags) (((flags) & PH_CLASS_MASK) >> PH_CLASS_SHIFT)
+#define PH_SET_CLASS(pkt, cls) ((pkt)->crc_flag = ((pkt)->crc_flag & ~PH_CLASS_MASK) | ((cls) << PH_CLASS_SHIFT))
+#define PH_TYPE_SHIFT 4
+#define PH_TYPE_MASK 0xF0
+#define PH_GET_TYPE(flags) (((flags) & PH_TYPE_MASK) >> PH_TYPE_SHIFT)
+#define PH_SET_TYPE(pkt, type) ((pkt)->crc_flag = ((pkt)->crc_flag & ~PH_TYPE_MASK) | ((type) << PH_TYPE_SHIFT))
+
+// frame types. Link control frames are made and consumed by the MAC, the others are sent like data
+typedef enum {
+	PH_TYPE_DATA = 0,
+	PH_TYPE_BEACON = 1,
+	PH_TYPE_TOKEN = 2,
+	PH_TYPE_SOLICIT = 3,
+	PH_TYPE_JOIN = 4,
+	PH_TYPE_RTS = 5,
+	PH_TYPE_CTS = 6,
+	PH_TYPE_ACK = 7,
+	PH_TYPE_SYNC = 8,
+	PH_TYPE_FOLLOW_UP = 9,
+	PH_TYPE_ROUTED = 10,
+	// data whose message starts with the time it was sent, see latency.h
+	PH_TYPE_STAMPED = 11
+} PH_TYPE;
+#define PH_IS_LINK_CONTROL(type) ((type) >= PH_TYPE_BEACON && (type) <= PH_TYPE_CTS)
+
+// traffic classes, in increasing priority. A higher class waits less for the line, see transmitter.c
+typedef enum {
+	PH_CLASS_BACKGROUND = 0,
+	PH_CLASS_BEST_EFFORT = 1,
+	PH_CLASS_VIDEO = 2,
+	PH_CLASS_VOICE = 3
+} PH_CLASS;
+#define PH_NUM_CLASSES 4
 
 typedef struct {
 	uint8_t synch;
@@ -29,7 +79,9 @@ typedef struct {
 void ph_init();
 void ph_create(PacketHeader *out, uint8_t src, uint8_t dest, bool crc_flag, const void* msg, uint8_t size);
 bool ph_parse(PacketHeader *out, const void* buf, unsigned int size);
+unsigned int ph_serialize(void *out, const PacketHeader *pkt);
 uint8_t ph_compute_crc8(void *msg, unsigned int size);
+uint8_t ph_compute_fcs(const void *hdr);
 
 
 #endif /* PACKET_HEADER_H_ */
@@ -2,6 +2,9 @@
 #define RECEIVER_H
 
 #include "tim.h"
+#include "bertest.h"
+#include "framepool.h"
+#include "linkquality.h"
 #include <stdbool.h>
 
 // The transmission bit rate dictates the ticks used for the timers
@@ -9,20 +12,28 @@
 // ticks = 16E6 / (f_hz - 1.3%f_hz) / 2
 #define HALFBIT_TIMEOUT_TICKS	8107 // 986.8 bps, this amount of tricks correspond approximately to 507us.
 
-// Input pin used for receive
-#define RECEIVE_GPIO	C
-#define RECEIVE_PIN		9
-
 // initiates the receiver module
-void receiver_init(bool packet_mode);
+// stream_mode splits frames on HDLC flags rather than the line going IDLE, see hdlc.h
+void receiver_init(bool packet_mode, bool stream_mode);
+
+// BER test mode, checks the received bits against a PRBS and reports the error statistics instead of frames
+void receiver_setBerTest(BER_PATTERN pattern);
 
 // Main routine update, this should execute inside a while(1); by what uses this module.
 void receiver_mainRoutineUpdate();
 
-// Input Capture Timer ISR used for receiving. Update if using a different timer
-void TIM3_IRQHandler();
+// the next received frame for the application, see llc.h for reading one
+Frame *receiver_pollFrame();
+
+// the edge deviation histogram of an interface, see linkquality.h
+const LinkQualityState *receiver_getLinkQuality(int iface);
+
+// Edge ISRs of the receive pins, see link_configs
+void EXTI4_IRQHandler();
+void EXTI2_IRQHandler();
 
-// Counter Timer for Half bit timeout. Indicates whether to sample on the next half clock period or not
+// Counter Timers for Half bit timeout. Indicates whether to sample on the next half clock period or not
 void TIM4_IRQHandler();
+void TIM1_BRK_TIM9_IRQHandler();
 
 #endif // RECEIVER_H
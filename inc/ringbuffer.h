@@ -1,24 +1,145 @@
+/**
+ * @file ringbuffer.h
+ * Lock-free single-producer single-consumer ring, for handing elements between an ISR and the main routine.
+ * RING_DEFINE(Name, prefix, type, size) defines the ring type Name of size elements of type, and its functions
+ * prefix_put, prefix_get and so on. For example, RING_DEFINE(ByteRing, br, uint8_t, 64) defines ByteRing and
+ * br_put(ByteRing *ring, uint8_t element).
+ * - size is a power of two. put and get are free-running counts of the elements put and taken, they wrap around
+ *   at 2^32 and are masked into the buffer. So the count is put - get even across the wrap, empty is put == get
+ *   and full is put - get == size, every slot of the buffer is used
+ * - one side only ever puts, the other only ever gets, no critical section is needed. Each side writes its own
+ *   count only, and publishes it with a release store once the elements are written or read. The other side
+ *   reads it with an acquire load before touching the elements. On the Cortex-M4 these are a DMB, on a host they
+ *   order threads as well
+ * - a full ring refuses elements, nothing is ever overwritten
+ * - putN and getN copy up to n elements in at most two memcpy. writeSpan and readSpan give the contiguous run of
+ *   free or held elements in place, to fill or read without copying, and commit or consume ends the access
+ */
+
 #ifndef RINGBUFFER_H_
 #define RINGBUFFER_H_
 
-// should be a value that is divisible by 2 and 4. This makes the buffer able to contain
-// uint16_t and uint32_t elements as well.
-#define BUF_SIZE 1028
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
 
-//Ring Buffer Structure
-typedef struct
-{
-    unsigned int put;
-    unsigned int get;
-    char buffer[BUF_SIZE];
-} RingBuffer;
+// the other side's count, its elements are written or read before it
+#define RING_ACQUIRE(count) __atomic_load_n(&(count), __ATOMIC_ACQUIRE)
+// this side's count, after its elements are written or read
+#define RING_RELEASE(count, value) __atomic_store_n(&(count), (value), __ATOMIC_RELEASE)
+// this side's count, only ever written by itself
+#define RING_OWN(count) __atomic_load_n(&(count), __ATOMIC_RELAXED)
 
-//Function Declaration
-void put(volatile RingBuffer* buffer, char element);
-char get(volatile RingBuffer* buffer);
-char peek(volatile RingBuffer* buffer);
-int hasSpace(volatile RingBuffer*);
-int hasElement(volatile RingBuffer*);
-int numElements(volatile RingBuffer*);
+#define RING_DEFINE(Name, prefix, type, size) \
+	_Static_assert((size) > 0 && ((size) & ((size)-1)) == 0, #Name " size must be a power of two"); \
+	\
+	typedef struct { \
+		uint32_t put; \
+		uint32_t get; \
+		type buffer[size]; \
+	} Name; \
+	\
+	/* empties the ring. Neither side may use it meanwhile */ \
+	static inline void prefix##_init(Name *ring) { \
+		RING_RELEASE(ring->put, 0); \
+		RING_RELEASE(ring->get, 0); \
+	} \
+	\
+	/* @return the elements held. The consumer may take them all, the producer may count some already taken */ \
+	static inline uint32_t prefix##_count(Name *ring) { \
+		return RING_ACQUIRE(ring->put) - RING_ACQUIRE(ring->get); \
+	} \
+	\
+	/* @return the elements that fit. The producer may put them all */ \
+	static inline uint32_t prefix##_space(Name *ring) { \
+		return (size) - prefix##_count(ring); \
+	} \
+	\
+	/* producer: @return false if the ring is full, the element is not put */ \
+	static inline bool prefix##_put(Name *ring, type element) { \
+		uint32_t put = RING_OWN(ring->put); \
+		if (put - RING_ACQUIRE(ring->get) == (size)) \
+			return false; \
+		ring->buffer[put & ((size)-1)] = element; \
+		RING_RELEASE(ring->put, put + 1); \
+		return true; \
+	} \
+	\
+	/* consumer: @return false if the ring is empty */ \
+	static inline bool prefix##_get(Name *ring, type *element) { \
+		uint32_t get = RING_OWN(ring->get); \
+		if (RING_ACQUIRE(ring->put) == get) \
+			return false; \
+		*element = ring->buffer[get & ((size)-1)]; \
+		RING_RELEASE(ring->get, get + 1); \
+		return true; \
+	} \
+	\
+	/* consumer: the oldest element, left in the ring. @return false if the ring is empty */ \
+	static inline bool prefix##_peek(Name *ring, type *element) { \
+		uint32_t get = RING_OWN(ring->get); \
+		if (RING_ACQUIRE(ring->put) == get) \
+			return false; \
+		*element = ring->buffer[get & ((size)-1)]; \
+		return true; \
+	} \
+	\
+	/* producer: puts up to n elements, as many as fit. @return how many were put */ \
+	static inline uint32_t prefix##_putN(Name *ring, const type *elements, uint32_t n) { \
+		uint32_t put = RING_OWN(ring->put); \
+		uint32_t space = (size) - (put - RING_ACQUIRE(ring->get)); \
+		uint32_t at = put & ((size)-1); \
+		if (n > space) \
+			n = space; \
+		uint32_t first = n < (size) - at ? n : (size) - at; \
+		memcpy(&ring->buffer[at], elements, first * sizeof(type)); \
+		memcpy(&ring->buffer[0], elements + first, (n - first) * sizeof(type)); \
+		RING_RELEASE(ring->put, put + n); \
+		return n; \
+	} \
+	\
+	/* consumer: takes up to n elements, as many as held. @return how many were taken */ \
+	static inline uint32_t prefix##_getN(Name *ring, type *elements, uint32_t n) { \
+		uint32_t get = RING_OWN(ring->get); \
+		uint32_t held = RING_ACQUIRE(ring->put) - get; \
+		uint32_t at = get & ((size)-1); \
+		if (n > held) \
+			n = held; \
+		uint32_t first = n < (size) - at ? n : (size) - at; \
+		memcpy(elements, &ring->buffer[at], first * sizeof(type)); \
+		memcpy(elements + first, &ring->buffer[0], (n - first) * sizeof(type)); \
+		RING_RELEASE(ring->get, get + n); \
+		return n; \
+	} \
+	\
+	/* producer: the free elements up to the end of the buffer, to write in place before prefix##_commit */ \
+	/* @return how many there are, the rest of the space follows at the start of the buffer */ \
+	static inline uint32_t prefix##_writeSpan(Name *ring, type **span) { \
+		uint32_t put = RING_OWN(ring->put); \
+		uint32_t space = (size) - (put - RING_ACQUIRE(ring->get)); \
+		uint32_t at = put & ((size)-1); \
+		*span = &ring->buffer[at]; \
+		return space < (size) - at ? space : (size) - at; \
+	} \
+	\
+	/* producer: puts the first n elements written to the span of prefix##_writeSpan */ \
+	static inline void prefix##_commit(Name *ring, uint32_t n) { \
+		RING_RELEASE(ring->put, RING_OWN(ring->put) + n); \
+	} \
+	\
+	/* consumer: the held elements up to the end of the buffer, to read in place before prefix##_consume */ \
+	/* @return how many there are, the rest follow at the start of the buffer */ \
+	static inline uint32_t prefix##_readSpan(Name *ring, type **span) { \
+		uint32_t get = RING_OWN(ring->get); \
+		uint32_t held = RING_ACQUIRE(ring->put) - get; \
+		uint32_t at = get & ((size)-1); \
+		*span = &ring->buffer[at]; \
+		return held < (size) - at ? held : (size) - at; \
+	} \
+	\
+	/* consumer: takes the first n elements of the span of prefix##_readSpan */ \
+	static inline void prefix##_consume(Name *ring, uint32_t n) { \
+		RING_RELEASE(ring->get, RING_OWN(ring->get) + n); \
+	}
 
 #endif /* RINGBUFFER_H_ */
@@ -0,0 +1,47 @@
+/**
+ * @file sched.h
+ * Run-to-completion event scheduler, the main loop of the node.
+ * - ISRs post events with sched_post: a byte on the uart, a frame completed by the receiver, a change of a monitor
+ *   state, a frame done with by the transmitter, or a timer of the timer wheel due, see timerwheel.h
+ * - tasks are added in priority order, each with the events it runs on. sched_run takes the posted events and runs
+ *   every task waiting on one of them, highest priority first. A task runs until it returns, it is never preempted
+ *   by another task, only by ISRs
+ * - with no events posted the core sleeps in WFI until an interrupt posts one
+ * Timeouts post events from timers, see sched_postTimer. What still polls the time instead, the slotted and token
+ * MACs and the BER test, starts the tick: SCHED_EV_TICK every SCHED_TICK_US. The longest run of each task is kept,
+ * see sched_print, and so is its longest wake latency: from the first post of an event it runs on, stamped with the
+ * DWT cycle counter, until it starts. For the rx task on SCHED_EV_FRAME, that is from a frame completing in the
+ * monitor's ISR until it is delivered.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <inttypes.h>
+
+// events, ORed together into the set a task waits on
+#define SCHED_EV_UART		0x01
+#define SCHED_EV_FRAME		0x02
+#define SCHED_EV_MONITOR	0x04
+#define SCHED_EV_TX			0x08
+#define SCHED_EV_TICK		0x10
+#define SCHED_EV_TIMER		0x20
+#define SCHED_NUM_EVENTS	6
+
+#define SCHED_MAX_TASKS 8
+#define SCHED_TICK_US 1000
+// prints the task run times when typed on the uart
+#define SCHED_COMMAND "!sched"
+// the events a timer posts through sched_postTimer
+#define SCHED_TIMER_ARG(events) ((void *)(uintptr_t)(events))
+
+typedef void (*SchedTask)();
+
+void sched_addTask(const char *name, SchedTask task, uint32_t events);
+void sched_post(uint32_t events);
+void sched_postTimer(void *events);
+void sched_startTick();
+void sched_run();
+void sched_print();
+
+#endif /* SCHED_H_ */
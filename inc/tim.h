@@ -36,6 +36,32 @@ enum EDGE_TYPEs
     RISING, FALLING, BOTH
 };
 
+/* The structure for TIMER1 and 8, the advanced timers. Every other timer has a subset of these registers, at the
+ * same offsets. TIMER6 and 7, the basic timers, have CR1, CR2, DIER, SR, EGR, CNT, PSC and ARR only */
+typedef struct
+{
+    uint32_t CR1;
+    uint32_t CR2;
+    uint32_t SMCR;
+    uint32_t DIER;
+    uint32_t SR;
+    uint32_t EGR;
+    uint32_t CCMR1;
+    uint32_t CCMR2;
+    uint32_t CCER;
+    uint32_t CNT;
+    uint32_t PSC;
+    uint32_t ARR;
+    uint32_t RCR;
+    uint32_t CCR1;
+    uint32_t CCR2;
+    uint32_t CCR3;
+    uint32_t CCR4;
+    uint32_t BDTR;
+    uint32_t DCR;
+    uint32_t DMAR;
+} TIMER;
+
 /* The structure for TIMER2 to 5 */
 typedef struct
 {
@@ -61,7 +87,7 @@ typedef struct
     uint32_t DMAR;
 } TIMER2to5;
 
-/* The structure for TIMER9 to 14 */
+/* The structure for TIMER9 to 14. TIMER10, 11, 13 and 14 have a single channel, CCR1 only */
 typedef struct
 {
     uint32_t CR1;
@@ -97,18 +123,37 @@ typedef struct
 #define TIM13EN 7
 #define TIM14EN 8
 
+// Timer addresses
+#define TIM1_ADDR   0x40010000
+#define TIM2_ADDR   0x40000000
+#define TIM3_ADDR   0x40000400
+#define TIM4_ADDR   0x40000800
+#define TIM5_ADDR   0x40000C00
+#define TIM6_ADDR   0x40001000
+#define TIM7_ADDR   0x40001400
+#define TIM8_ADDR   0x40010400
+#define TIM9_ADDR   0x40014000
+#define TIM10_ADDR  0x40014400
+#define TIM11_ADDR  0x40014800
+#define TIM12_ADDR  0x40001800
+#define TIM13_ADDR  0x40001C00
+#define TIM14_ADDR  0x40002000
+
 // Timer based addresses
-#define TIM2_BASE ((volatile TIMER2to5 *) 0x40000000)
-#define TIM3_BASE ((volatile TIMER2to5 *) 0x40000400)
-#define TIM4_BASE ((volatile TIMER2to5 *) 0x40000800)
-#define TIM9_BASE ((volatile TIMER2to5 *) 0x40014000)
-
-// The interrupt enable bits
-#define TIM2_INTERRUPT_EN 28
-#define TIM3_INTERRUPT_EN 29
-#define TIM4_INTERRUPT_EN 30
-#define TIM5_INTERRUPT_EN 18
-#define TIM9_INTERRUPT_EN 24
+#define TIM1_BASE  ((volatile TIMER *) TIM1_ADDR)
+#define TIM2_BASE  ((volatile TIMER2to5 *) TIM2_ADDR)
+#define TIM3_BASE  ((volatile TIMER2to5 *) TIM3_ADDR)
+#define TIM4_BASE  ((volatile TIMER2to5 *) TIM4_ADDR)
+#define TIM5_BASE  ((volatile TIMER2to5 *) TIM5_ADDR)
+#define TIM6_BASE  ((volatile TIMER *) TIM6_ADDR)
+#define TIM7_BASE  ((volatile TIMER *) TIM7_ADDR)
+#define TIM8_BASE  ((volatile TIMER *) TIM8_ADDR)
+#define TIM9_BASE  ((volatile TIMER9to14 *) TIM9_ADDR)
+#define TIM10_BASE ((volatile TIMER9to14 *) TIM10_ADDR)
+#define TIM11_BASE ((volatile TIMER9to14 *) TIM11_ADDR)
+#define TIM12_BASE ((volatile TIMER9to14 *) TIM12_ADDR)
+#define TIM13_BASE ((volatile TIMER9to14 *) TIM13_ADDR)
+#define TIM14_BASE ((volatile TIMER9to14 *) TIM14_ADDR)
 
 // CR1 bits
 #define CEN     0
@@ -120,6 +165,8 @@ typedef struct
 #define CC1P    1
 #define CC1NP   3
 #define CC1E    0
+// EGR bits
+#define UG      0
 // DIER bits
 #define UIE     0
 #define CC1IE   1
@@ -127,56 +174,133 @@ typedef struct
 #define UIF     0
 #define CC1IF   1
 
+/*
+ * The functions below are inlined, they are called from the ISRs. Each is a single access to a register of the
+ * timer, a timer known at compile time resolves to its address then. A timer only known at run time, from
+ * link_configs for example, costs a load from the table of tim_regs. The status flags are cleared by writing 0, and
+ * written 1 the others are left alone, so they are cleared with a single write rather than a read-modify-write
+ * that could clear a flag set meanwhile.
+ * Setting a timer up takes several accesses, those functions are in tim.c.
+ */
+
+/**
+ * @return the registers of a timer, in the layout of the advanced timers. Only access the ones it has
+ */
+static inline volatile TIMER *tim_regs(enum TIMs tim)
+{
+    static volatile TIMER * const regs[] = {
+        [TIM1] = (volatile TIMER *) TIM1_ADDR,
+        [TIM2] = (volatile TIMER *) TIM2_ADDR,
+        [TIM3] = (volatile TIMER *) TIM3_ADDR,
+        [TIM4] = (volatile TIMER *) TIM4_ADDR,
+        [TIM5] = (volatile TIMER *) TIM5_ADDR,
+        [TIM6] = (volatile TIMER *) TIM6_ADDR,
+        [TIM7] = (volatile TIMER *) TIM7_ADDR,
+        [TIM8] = (volatile TIMER *) TIM8_ADDR,
+        [TIM9] = (volatile TIMER *) TIM9_ADDR,
+        [TIM10] = (volatile TIMER *) TIM10_ADDR,
+        [TIM11] = (volatile TIMER *) TIM11_ADDR,
+        [TIM12] = (volatile TIMER *) TIM12_ADDR,
+        [TIM13] = (volatile TIMER *) TIM13_ADDR,
+        [TIM14] = (volatile TIMER *) TIM14_ADDR,
+    };
+    return regs[tim];
+}
+
+/**
+ * Clears flags of a status register. They are cleared by writing 0 and the others are left alone by writing 1,
+ * so there is no read-modify-write for a flag raised meanwhile to be lost in.
+ */
+static inline void tim_clearFlags(volatile uint32_t *sr, uint32_t flags)
+{
+#ifdef __arm__
+    *sr = ~flags;
+#else
+    // the host builds of tools/ map the registers as plain memory, see tools/host.h
+    *sr &= ~flags;
+#endif
+}
+
 /**
  * Enable the system clock for one timer
  */
 void enable_timer_clk(enum TIMs tim);
 
 /**
- * Sets the value for CCR1 register
- *
+ * Sets the value in CCR1.
+ * Args:
+ * ticks: the number of ticks needs to be set in CCR1.
  */
-void set_ccr1(enum TIMs tim, uint32_t ticks);
+static inline void set_ccr1(enum TIMs tim, uint32_t ticks)
+{
+    tim_regs(tim)->CCR1 = ticks;
+}
 
 /**
  * Sets the value in ARR.
  * Args:
  * ticks: the number of ticks needs to be set in ARR.
  */
-void set_arr(enum TIMs tim, uint32_t ticks);
+static inline void set_arr(enum TIMs tim, uint32_t ticks)
+{
+    tim_regs(tim)->ARR = ticks;
+}
 
 /**
  * sets CNT to 0, can be useful for one-pulse mode?
  */
-void clear_cnt(enum TIMs tim);
+static inline void clear_cnt(enum TIMs tim)
+{
+    tim_regs(tim)->CNT = 0;
+}
 
+static inline void set_psc(enum TIMs tim, uint32_t ticks)
+{
+    tim_regs(tim)->PSC = ticks;
+}
 
 /**
- * Logs timer's interrupt into NVIC register.
+ * Logs timer's interrupt into NVIC register, at its priority from isr.c.
  */
 void log_tim_interrupt(enum TIMs tim);
 
 /**
  * Starts counting.
  */
-void start_counter(enum TIMs tim);
+static inline void start_counter(enum TIMs tim)
+{
+    tim_regs(tim)->CR1 |= 1 << CEN;
+}
 
 /**
  * Stops counting.
  */
-void stop_counter(enum TIMs tim);
-
-void set_psc(enum TIMs tim, uint32_t ticks);
+static inline void stop_counter(enum TIMs tim)
+{
+    tim_regs(tim)->CR1 &= ~(1 << CEN);
+}
 
 /*********This section is for the counter mode************/
 
-void set_to_counter_mode(enum TIMs tim);
+static inline void set_to_counter_mode(enum TIMs tim)
+{
+    tim_regs(tim)->CR1 |= 1 << URS;
+}
 
-void enable_counter_mode_interrupt(enum TIMs tim);
+static inline void enable_counter_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER |= 1 << UIE;
+}
 
-void disable_counter_mode_interrupt(enum TIMs tim);
+static inline void disable_counter_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER &= ~(1 << UIE);
+}
 
-void clear_counter_mode_pending_flag(enum TIMs tim);
+static inline void clear_counter_mode_pending_flag(enum TIMs tim)
+{
+    tim_clearFlags(&tim_regs(tim)->SR, 1 << UIF);
+}
 
 /*********************************************************/
 
@@ -184,11 +308,20 @@ void clear_counter_mode_pending_flag(enum TIMs tim);
 
 void set_to_input_capture_mode(enum TIMs tim);
 
-void enable_input_capture_mode_interrupt(enum TIMs tim);
+static inline void enable_input_capture_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER |= 1 << CC1IE;
+}
 
-void disable_input_capture_mode_interrupt(enum TIMs tim);
+static inline void disable_input_capture_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER &= ~(1 << CC1IE);
+}
 
-void clear_input_capture_mode_pending_flag(enum TIMs tim);
+static inline void clear_input_capture_mode_pending_flag(enum TIMs tim)
+{
+    tim_clearFlags(&tim_regs(tim)->SR, 1 << CC1IF);
+}
 
 /********************************************************/
 
@@ -202,27 +335,42 @@ void set_to_output_cmp_mode(enum TIMs tim);
 /**
  * Enables the output of the timer.
  */
-void enable_output_output_cmp_mode(enum TIMs tim);
+static inline void enable_output_output_cmp_mode(enum TIMs tim)
+{
+    tim_regs(tim)->CCER |= 1;
+}
 
 /**
  * Disable the output of the timer.
  */
-void disable_output_output_cmp_mode(enum TIMs tim);
+static inline void disable_output_output_cmp_mode(enum TIMs tim)
+{
+    tim_regs(tim)->CCER &= ~1;
+}
 
 /**
  * Enables the update event interrupt.
  */
-void enable_output_cmp_mode_interrupt(enum TIMs tim);
+static inline void enable_output_cmp_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER |= 1;
+}
 
 /**
  * Disables the update event interrupt.
  */
-void disable_output_cmp_mode_interrupt(enum TIMs tim);
+static inline void disable_output_cmp_mode_interrupt(enum TIMs tim)
+{
+    tim_regs(tim)->DIER &= ~1;
+}
 
 /**
  * Clears the pending flag for the interrupt.
  */
-void clear_output_cmp_mode_pending_flag(enum TIMs tim);
+static inline void clear_output_cmp_mode_pending_flag(enum TIMs tim)
+{
+    tim_clearFlags(&tim_regs(tim)->SR, 1 << UIF);
+}
 
 /********************************************************/
 
@@ -0,0 +1,58 @@
+/**
+ * @file timerwheel.h
+ * Software timers for the link layer's timeouts, all driven by one compare channel of the MONITOR_TIMER.
+ * Timers are kept in a hierarchical wheel of TW_LEVELS levels of TW_SLOTS slots. Level 0 holds the timers due
+ * within TW_SLOTS ticks, each slot of level n covers TW_SLOTS^n ticks. Whenever level 0 wraps around, the slot
+ * of level 1 that is due next is moved down, and so on up the levels. So:
+ * - tw_start and tw_cancel are O(1): a timer is linked into, or out of, the list of its slot
+ * - a tick runs the timers of one level 0 slot, and moves a slot down every TW_SLOTS ticks
+ * The compare channel only interrupts when the next level 0 slot holding a timer is due, or level 0 wraps while
+ * timers are waiting in the levels above it. Its ISR posts SCHED_EV_TIMER, and tw_run catches the wheel up from
+ * the scheduler's task, so callbacks run in the main routine, never from an ISR.
+ * Timers are due a whole number of ticks of TW_TICK_US from now, they run up to one tick late, never early.
+ */
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// a tick is 2^TW_TICK_SHIFT MONITOR_TIMER us, so ticks wrap along with the counter
+#define TW_TICK_SHIFT 8
+#define TW_TICK_US (1 << TW_TICK_SHIFT)
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_LEVELS 4
+// the wheel spans 2^24 ticks, the 32 bits of the MONITOR_TIMER. Longer timeouts are cut to it (~71 minutes)
+#define TW_MAX_TICKS ((1u << (TW_LEVELS * TW_SLOT_BITS)) - 1)
+// compare channel of the MONITOR_TIMER, CC1 + TW_CHANNEL. The links use the ones before
+#define TW_CHANNEL 3
+
+typedef void (*TwCallback)(void *arg);
+
+// a timer, embedded in whatever it times. Zero initialized it is stopped
+typedef struct TwTimer {
+	// list of the slot the timer waits in. pprev points to the link to it, NULL while it is stopped
+	struct TwTimer *next;
+	struct TwTimer **pprev;
+	// tick the timer is due at
+	uint32_t expires;
+	TwCallback callback;
+	void *arg;
+} TwTimer;
+
+void tw_init();
+void tw_start(TwTimer *timer, uint32_t us, TwCallback callback, void *arg);
+void tw_cancel(TwTimer *timer);
+void tw_run();
+void tw_onCompare();
+
+/**
+ * @return true if the timer is waiting to run
+ */
+static inline bool tw_active(const TwTimer *timer) {
+	return timer->pprev != 0;
+}
+
+#endif /* TIMERWHEEL_H_ */
@@ -0,0 +1,42 @@
+/**
+ * @file timesync.h
+ * Bus-wide time synchronization, so nodes share the clock of a master node.
+ * - The master sends a SYNC packet every TIMESYNC_PERIOD_US. Every node, the master included as it hears its own
+ *   packets back, timestamps its first edge with the MONITOR_TIMER, so all of them timestamp the same edge.
+ *   The master then sends a FOLLOW_UP packet carrying its timestamp of it.
+ * - Each SYNC and FOLLOW_UP pair gives the other nodes a sample of the master's clock against their own.
+ *   An alpha-beta filter tracks the offset between the two clocks and the drift of theirs, in ppb.
+ * - The synchronized clock is the master's, in us. It wraps around with the MONITOR_TIMER.
+ * - A node following a master is synced until TIMESYNC_LOSS_PERIODS periods go by without a sample.
+ *   An error over TIMESYNC_STEP_US restarts the filter, as when the master changes.
+ * Propagation on the bus is negligible, the path delay is not measured. Only in packet mode.
+ */
+
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include "framepool.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// time between SYNC packets from the master
+#define TIMESYNC_PERIOD_US 1000000
+// periods without a sample before the clock is considered lost
+#define TIMESYNC_LOSS_PERIODS 4
+// filter gains: the offset moves by 1/2^ALPHA of the error, the drift by 1/2^BETA of the error over the interval
+#define TIMESYNC_ALPHA_SHIFT 1
+#define TIMESYNC_BETA_SHIFT 3
+// an error this large restarts the filter rather than being filtered
+#define TIMESYNC_STEP_US 1000
+// prints the sync state when typed on the uart
+#define TIMESYNC_COMMAND "!sync"
+
+void timesync_init(uint8_t addr, bool master);
+Frame *timesync_pollFrame();
+bool timesync_onFrame(const Frame *frame);
+bool timesync_synced();
+uint32_t timesync_now();
+uint32_t timesync_toMaster(uint32_t local);
+void timesync_print();
+
+#endif /* TIMESYNC_H_ */
@@ -2,31 +2,38 @@
 #define TRANSMITTER_H
 
 #include "tim.h"
+#include "bertest.h"
 #include <inttypes.h>
 #include <stdbool.h>
 
-// Timer dedicated for the transmission
-// Update the corresponding ISR handler as well
-#define TRANSMITTER_TIMER TIM2
-
 // The transmission bit rate dictates the ticks used for the timers
 // ticks = 1E6/f_hz / 0.0625 / 2
 #define TRANSMISSION_TICKS	8000 // f_hz = 1000 bps -> 500 us ticks. (1 tick = 62.5 ns)
 
 // For retransmission, determines the number of uniform random points rom 0s to 1.000s to timeout on.
 #define TRANSMITTER_N_MAX	200 // N_MAX, must at least be 180
-
-// Output pin used for transmission
-#define TRANSMISSION_GPIO	C
-#define TRANSMISSION_PIN	9
+// The backoff grows with the monitor's collision probability estimate, up to this many times
+#define TRANSMITTER_BACKOFF_SCALE	4
+// CSMA contention slot, two bit times: the first edge of a transmission reaches every monitor within it
+#define TRANSMITTER_SLOT_US	2000
 
 // initiates the transmitter module
-void transmitter_init(uint8_t srcAddr, uint8_t destAddr, bool packet_mode);
+// stream_mode flag delimits frames so a backlog can be sent back-to-back without going idle, see hdlc.h
+void transmitter_init(bool packet_mode, bool stream_mode);
+
+// queues a frame for transmission in its traffic class, see llc.h for building one.
+// framepool.h includes this header through linkquality.h, hence the struct tag
+struct Frame;
+void transmitter_queue(struct Frame *frame);
+
+// BER test mode, sends a continuous PRBS instead of frames. BER_OFF sends frames again
+void transmitter_setBerTest(BER_PATTERN pattern);
 
 // Main routine update, this should execute inside a while(1); by what uses this module.
 void transmitter_mainRoutineUpdate();
 
-// Timer ISR used for transmission. Update if using a different timer
+// Timer ISRs used for transmission, see link_configs
 void TIM2_IRQHandler();
+void TIM3_IRQHandler();
 
 #endif // TRANSMITTER_H
@@ -26,6 +26,10 @@
 #define UE 13 //UART enable
 #define TE 3  // Transmitter enable
 #define RE 2  // Receiver enable
+#define RXNEIE 5  // RXNE interrupt enable
+
+// received bytes buffered until read, a power of two
+#define UART_RX_SIZE 256
 
 // Status register bits
 #define TXE 7  // Transmit register empty
@@ -34,6 +38,8 @@
 // Function prototypes
 extern void init_usart2(uint32_t baud, uint32_t sysclk);
 extern char usart2_getch();
+extern int usart2_hasch();
+extern uint32_t usart2_overruns();
 extern void usart2_putch(char c);
 
 #endif /* UART_DRIVER_H_ */
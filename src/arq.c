@@ -0,0 +1,532 @@
+/**
+ * @file arq.c
+ * Selective-repeat ARQ, see arq.h
+ */
+
+#include "arq.h"
+#include "packet_header.h"
+#include "monitor.h"
+#include "llc.h"
+#include "link.h"
+#include "sched.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <string.h>
+
+// ARQ header of a data packet, offsets in its message
+#define ARQ_SEQ 0
+#define ARQ_BASE 1
+#define ARQ_ACK 2
+#define ARQ_SACK 3
+// ACK packet message
+#define ACK_ACK 0
+#define ACK_SACK 1
+#define ACK_LEN 2
+// the bitmap covers the window after the cumulative acknowledgement. Its top bit tells the acknowledgement is
+// valid, a node that never received from its peer has nothing to acknowledge yet
+#define SACK_VALID 0x80
+
+// window slot of a sequence number. 256 is a multiple of the window, so this holds across the wrap around
+#define SLOT(seq) ((seq) % ARQ_MAX_WINDOW)
+
+// a packet sent to a peer, from being queued until acknowledged
+typedef struct {
+	// NULL once acknowledged or given up on
+	Frame *frame;
+	// handed back by the transmitter, its timer runs from sentAt
+	bool sent;
+	uint32_t sentAt;
+	uint8_t tries;
+	// a packet sent after it was acknowledged. The line keeps the order, so it was lost
+	bool lost;
+	// wakes the transmitter once the retransmission timeout is over
+	TwTimer timer;
+} ArqSlot;
+
+typedef struct {
+	bool used;
+	uint8_t addr;
+	uint32_t lastUsed;
+	// sender: oldest unacknowledged and next sequence numbers, the packets in between
+	uint8_t sndUna;
+	uint8_t sndNext;
+	ArqSlot slots[ARQ_MAX_WINDOW];
+	// round trip estimates, us. srtt is 0 until the first measurement
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t rto;
+	// receiver: next sequence number expected, and the packets received after it
+	bool rcvSynced;
+	uint8_t rcvNext;
+	Frame *held[ARQ_MAX_WINDOW];
+	bool ackPending;
+	uint32_t ackDue;
+	TwTimer ackTimer;
+	// counters for arq_print
+	uint32_t sent;
+	uint32_t retransmitted;
+	uint32_t givenUp;
+	uint32_t duplicates;
+} ArqPeer;
+
+static uint8_t addr = 0;
+static unsigned int window = 0;
+static ArqPeer peers[ARQ_MAX_PEERS];
+// frames the transmitter is done with, handed over from its ISR
+static FrameQueue released = {0};
+// received packets, in order and with the ARQ header removed
+static FrameQueue delivered = {0};
+
+static ArqPeer *findPeer(uint8_t peer, bool create);
+static bool peerIdle(const ArqPeer *p);
+static uint8_t sackBits(const ArqPeer *p);
+static void onAck(ArqPeer *p, uint8_t ack, uint8_t sack);
+static void acked(ArqPeer *p, uint8_t seq, bool *anyAcked, uint32_t *lastSentAt);
+static void measure(ArqPeer *p, uint32_t rtt);
+static void advance(ArqPeer *p);
+static void onData(ArqPeer *p, Frame *frame, uint8_t seq, uint8_t base);
+static void deliverHeld(ArqPeer *p);
+static void deliver(Frame *frame);
+static Frame *ackFrame(ArqPeer *p);
+
+/**
+ * @param window packets waiting on an acknowledgement per destination, at most ARQ_MAX_WINDOW. 0 turns ARQ off
+ */
+void arq_init(uint8_t arq_addr, unsigned int arq_window) {
+	addr = arq_addr;
+	window = arq_window > ARQ_MAX_WINDOW ? ARQ_MAX_WINDOW : arq_window;
+	memset(peers, 0, sizeof(peers));
+}
+
+bool arq_enabled() {
+	return window != 0;
+}
+
+/**
+ * @return true if a packet to dest may be queued now, false while its window is full
+ */
+bool arq_mayQueue(uint8_t dest) {
+	ArqPeer *p = findPeer(dest, true);
+	return p && (uint8_t)(p->sndNext - p->sndUna) < window;
+}
+
+/**
+ * makes a serialized data packet reliable: inserts the ARQ header in its message and keeps it until acknowledged.
+ * arq_mayQueue must have allowed it, and the message must have room for the header
+ */
+void arq_track(Frame *frame) {
+	ArqPeer *p = findPeer(frame->data[PH_DEST_OFFSET], true);
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	uint8_t len = frame->data[PH_LENGTH_OFFSET];
+
+	if (!p)
+		return;
+
+	memmove(msg + ARQ_HEADER_LEN, msg, len);
+	msg[ARQ_SEQ] = p->sndNext;
+	frame->data[PH_LENGTH_OFFSET] = len + ARQ_HEADER_LEN;
+	frame->data[PH_FLAGS_OFFSET] |= PH_ARQ_FLAG;
+	frame->len += ARQ_HEADER_LEN;
+
+	ArqSlot *slot = &p->slots[SLOT(p->sndNext++)];
+	slot->frame = frame;
+	slot->sent = false;
+	slot->tries = 0;
+	slot->lost = false;
+	p->sent++;
+	arq_stamp(frame);
+}
+
+/**
+ * refreshes the acknowledgement carried by an ARQ data or ACK packet, right before it goes on the line
+ */
+void arq_stamp(Frame *frame) {
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET];
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	bool data = PH_GET_TYPE(flags) == PH_TYPE_DATA && (flags & PH_ARQ_FLAG);
+	ArqPeer *p;
+
+	if (frame->len < PH_OVERHEAD || (!data && PH_GET_TYPE(flags) != PH_TYPE_ACK))
+		return;
+	if (!(p = findPeer(frame->data[PH_DEST_OFFSET], false)))
+		return;
+
+	if (data) {
+		msg[ARQ_BASE] = p->sndUna;
+		msg[ARQ_ACK] = p->rcvNext;
+		msg[ARQ_SACK] = sackBits(p);
+	}
+	else {
+		msg[ACK_ACK] = p->rcvNext;
+		msg[ACK_SACK] = sackBits(p);
+	}
+	p->ackPending = false;
+	tw_cancel(&p->ackTimer);
+	frame->data[frame->len-1] = (flags & PH_CRC_FLAG) ? ph_compute_fcs(&frame->data[PH_SRC_OFFSET]) : 0xAA;
+}
+
+/**
+ * called by the transmitter, from its ISR, for every frame it is done with: sent, or dropped after collisions
+ * @return true if ARQ keeps the frame, it must not be freed
+ */
+bool arq_release(Frame *frame) {
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET];
+
+	if (!window || frame->len < PH_OVERHEAD || PH_GET_TYPE(flags) != PH_TYPE_DATA || !(flags & PH_ARQ_FLAG))
+		return false;
+	fq_push(&released, frame);
+	return true;
+}
+
+/**
+ * runs the retransmission and acknowledgement timers. Polled by the transmitter, which their timers wake
+ * @return a packet to queue for transmission, a retransmission or an ACK. NULL if there is none
+ */
+Frame *arq_pollFrame() {
+	uint32_t now = monitor_now();
+	Frame *frame;
+
+	// frames the transmitter is done with start their timer, unless acknowledged meanwhile
+	while ((frame = fq_pop(&released))) {
+		ArqPeer *p = findPeer(frame->data[PH_DEST_OFFSET], false);
+		ArqSlot *slot = p ? &p->slots[SLOT(frame->data[PH_MSG_OFFSET + ARQ_SEQ])] : NULL;
+		if (slot && slot->frame == frame) {
+			slot->sent = true;
+			slot->sentAt = now;
+			tw_start(&slot->timer, p->rto, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+		}
+		else {
+			fp_free(frame);
+		}
+	}
+
+	for (int i = 0; i < ARQ_MAX_PEERS; i++) {
+		ArqPeer *p = &peers[i];
+		if (!p->used)
+			continue;
+
+		for (uint8_t seq = p->sndUna; seq != p->sndNext; seq++) {
+			ArqSlot *slot = &p->slots[SLOT(seq)];
+			bool timedOut = now - slot->sentAt >= p->rto;
+			if (!slot->frame || !slot->sent || !(slot->lost || timedOut))
+				continue;
+
+			if (slot->tries == ARQ_MAX_RETRIES) {
+				llc_report(LLC_EV_ARQ_GAVE_UP, LINK_PRIMARY, p->addr, seq, NULL);
+				llc_complete(slot->frame, false);
+				tw_cancel(&slot->timer);
+				fp_free(slot->frame);
+				slot->frame = NULL;
+				p->givenUp++;
+				advance(p);
+				continue;
+			}
+			slot->tries++;
+			slot->sent = false;
+			slot->lost = false;
+			p->retransmitted++;
+			// one backoff per loss, not for each of the packets timing out after the oldest. A loss told by the
+			// acknowledgement says nothing of the round trip time
+			if (seq == p->sndUna && timedOut)
+				p->rto = 2*p->rto < ARQ_MAX_RTO_US ? 2*p->rto : ARQ_MAX_RTO_US;
+			return slot->frame;
+		}
+
+		// no data to ride on came in time
+		if (p->ackPending && (int32_t)(now - p->ackDue) >= 0)
+			return ackFrame(p);
+	}
+	return NULL;
+}
+
+/**
+ * handles a received packet of the reliable mode. Data packets for this node are held until they can be
+ * delivered in order, see arq_pollDelivery
+ * @return true if ARQ took the frame, the receiver must not display or free it
+ */
+bool arq_onFrame(Frame *frame) {
+	static PacketHeader pkt;
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET];
+	bool data = PH_GET_TYPE(flags) == PH_TYPE_DATA && (flags & PH_ARQ_FLAG);
+
+	if (!window || frame->len < PH_OVERHEAD || (!data && PH_GET_TYPE(flags) != PH_TYPE_ACK))
+		return false;
+	// a corrupted packet can't be trusted, it is displayed as invalid and its sender times out
+	if (!ph_parse(&pkt, frame->data, frame->len) || pkt.length < (data ? ARQ_HEADER_LEN : ACK_LEN))
+		return false;
+
+	// exchanges between other nodes, and our own packets heard back
+	ArqPeer *p = pkt.dest == addr ? findPeer(pkt.src, true) : NULL;
+	if (!p) {
+		fp_free(frame);
+		return true;
+	}
+
+	if (!data) {
+		onAck(p, pkt.msg[ACK_ACK], pkt.msg[ACK_SACK]);
+		fp_free(frame);
+		return true;
+	}
+	onAck(p, pkt.msg[ARQ_ACK], pkt.msg[ARQ_SACK]);
+	onData(p, frame, pkt.msg[ARQ_SEQ], pkt.msg[ARQ_BASE]);
+	return true;
+}
+
+/**
+ * @return the next received packet to display, in order, without its ARQ header. NULL if there is none
+ */
+Frame *arq_pollDelivery() {
+	return fq_pop(&delivered);
+}
+
+/**
+ * prints the state of each peer
+ */
+void arq_print() {
+	for (int i = 0; i < ARQ_MAX_PEERS; i++) {
+		ArqPeer *p = &peers[i];
+		if (!p->used)
+			continue;
+		printf(">> arq %x: in flight=%u/%u srtt=%lu us rttvar=%lu us rto=%lu us\r\n", p->addr,
+				(uint8_t)(p->sndNext - p->sndUna), window, (unsigned long)p->srtt, (unsigned long)p->rttvar,
+				(unsigned long)p->rto);
+		printf(">> sent=%lu retransmitted=%lu given up=%lu duplicates=%lu\r\n", (unsigned long)p->sent,
+				(unsigned long)p->retransmitted, (unsigned long)p->givenUp, (unsigned long)p->duplicates);
+	}
+}
+
+/**
+ * @param create take over a free or idle entry if the peer has none
+ * @return the entry of a peer, NULL if there is none
+ */
+static ArqPeer *findPeer(uint8_t peer, bool create) {
+	ArqPeer *victim = NULL;
+
+	for (int i = 0; i < ARQ_MAX_PEERS; i++) {
+		ArqPeer *p = &peers[i];
+		if (p->used && p->addr == peer) {
+			p->lastUsed = monitor_now();
+			return p;
+		}
+		// a free entry, or else the idle one used the longest ago
+		if (peerIdle(p) && (!victim || (victim->used && (!p->used || (int32_t)(p->lastUsed - victim->lastUsed) < 0))))
+			victim = p;
+	}
+	if (!create || !victim)
+		return NULL;
+
+	memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	victim->addr = peer;
+	victim->lastUsed = monitor_now();
+	victim->rto = ARQ_INITIAL_RTO_US;
+	return victim;
+}
+
+/**
+ * @return true if nothing is outstanding with the peer either way, so its entry may be reused
+ */
+static bool peerIdle(const ArqPeer *p) {
+	if (!p->used)
+		return true;
+	if (p->sndUna != p->sndNext || p->ackPending)
+		return false;
+	for (int i = 0; i < ARQ_MAX_WINDOW; i++) {
+		if (p->held[i])
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @return the selective acknowledgement: bit i set if rcvNext+1+i was received
+ */
+static uint8_t sackBits(const ArqPeer *p) {
+	if (!p->rcvSynced)
+		return 0;
+
+	uint8_t bits = SACK_VALID;
+	for (int i = 0; i < ARQ_MAX_WINDOW-1; i++) {
+		if (p->held[SLOT(p->rcvNext + 1 + i)])
+			bits |= 1 << i;
+	}
+	return bits;
+}
+
+/**
+ * handles the acknowledgement from a peer, releasing the packets it covers
+ */
+static void onAck(ArqPeer *p, uint8_t ack, uint8_t sack) {
+	uint8_t outstanding = p->sndNext - p->sndUna;
+	bool anyAcked = false;
+	uint32_t lastSentAt = 0;
+
+	if (!(sack & SACK_VALID))
+		return;
+
+	// a cumulative acknowledgement behind the window is an old one
+	if ((uint8_t)(ack - p->sndUna) <= outstanding) {
+		for (uint8_t seq = p->sndUna; seq != ack; seq++)
+			acked(p, seq, &anyAcked, &lastSentAt);
+	}
+	for (int i = 0; i < ARQ_MAX_WINDOW-1; i++) {
+		uint8_t seq = ack + 1 + i;
+		if ((sack & (1 << i)) && (uint8_t)(seq - p->sndUna) < outstanding)
+			acked(p, seq, &anyAcked, &lastSentAt);
+	}
+
+	// the packets sent before one that got through were lost, they go again without waiting for their timeout
+	for (uint8_t seq = p->sndUna; anyAcked && seq != p->sndNext; seq++) {
+		ArqSlot *slot = &p->slots[SLOT(seq)];
+		if (slot->frame && slot->sent && !slot->lost && (int32_t)(lastSentAt - slot->sentAt) > 0) {
+			slot->lost = true;
+			sched_post(SCHED_EV_TX);
+		}
+	}
+	advance(p);
+}
+
+/**
+ * releases an acknowledged packet. If the transmitter still holds it, it is freed once handed back
+ * @param anyAcked set if the packet was sent and acknowledged now
+ * @param lastSentAt when the last of those was sent
+ */
+static void acked(ArqPeer *p, uint8_t seq, bool *anyAcked, uint32_t *lastSentAt) {
+	ArqSlot *slot = &p->slots[SLOT(seq)];
+
+	if (!slot->frame)
+		return;
+	if (slot->sent && (!*anyAcked || (int32_t)(slot->sentAt - *lastSentAt) > 0)) {
+		*anyAcked = true;
+		*lastSentAt = slot->sentAt;
+	}
+	llc_complete(slot->frame, true);
+	tw_cancel(&slot->timer);
+	if (slot->sent) {
+		// retransmitted packets are not measured, their acknowledgement may be for any of the copies
+		if (slot->tries == 0)
+			measure(p, monitor_now() - slot->sentAt);
+		fp_free(slot->frame);
+	}
+	slot->frame = NULL;
+}
+
+/**
+ * updates the round trip estimates and the retransmission timeout with a measurement, as in RFC 6298
+ */
+static void measure(ArqPeer *p, uint32_t rtt) {
+	if (!p->srtt) {
+		p->srtt = rtt;
+		p->rttvar = rtt / 2;
+	}
+	else {
+		uint32_t err = p->srtt > rtt ? p->srtt - rtt : rtt - p->srtt;
+		p->rttvar = (3*p->rttvar + err) / 4;
+		p->srtt = (7*p->srtt + rtt) / 8;
+	}
+
+	p->rto = p->srtt + 4*p->rttvar;
+	if (p->rto < ARQ_MIN_RTO_US)
+		p->rto = ARQ_MIN_RTO_US;
+	else if (p->rto > ARQ_MAX_RTO_US)
+		p->rto = ARQ_MAX_RTO_US;
+}
+
+/**
+ * moves the window past the packets done with
+ */
+static void advance(ArqPeer *p) {
+	while (p->sndUna != p->sndNext && !p->slots[SLOT(p->sndUna)].frame)
+		p->sndUna++;
+}
+
+/**
+ * handles a received data packet: holds it in its place in the window, and delivers what is in order
+ * @param base oldest packet its sender still waits on, the sender gave up on what is before it
+ */
+static void onData(ArqPeer *p, Frame *frame, uint8_t seq, uint8_t base) {
+	// the sender is at most a window behind, further means it restarted
+	if (!p->rcvSynced || (int8_t)(base - p->rcvNext) < -ARQ_MAX_WINDOW) {
+		for (int i = 0; i < ARQ_MAX_WINDOW; i++) {
+			if (p->held[i])
+				fp_free(p->held[i]);
+			p->held[i] = NULL;
+		}
+		p->rcvNext = base;
+		p->rcvSynced = true;
+	}
+
+	// skip the packets given up on, delivering the ones held after them
+	while ((int8_t)(base - p->rcvNext) > 0) {
+		Frame *next = p->held[SLOT(p->rcvNext)];
+		p->held[SLOT(p->rcvNext)] = NULL;
+		if (next)
+			deliver(next);
+		p->rcvNext++;
+	}
+
+	// acknowledged even if it's a duplicate, the acknowledgement it was sent again for was lost
+	if (!p->ackPending) {
+		p->ackPending = true;
+		p->ackDue = monitor_now() + ARQ_ACK_DELAY_US;
+		tw_start(&p->ackTimer, ARQ_ACK_DELAY_US, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+	}
+
+	// behind rcvNext it was delivered already, and no sender gets a window ahead
+	if ((uint8_t)(seq - p->rcvNext) >= ARQ_MAX_WINDOW || p->held[SLOT(seq)]) {
+		p->duplicates++;
+		fp_free(frame);
+		return;
+	}
+	p->held[SLOT(seq)] = frame;
+	deliverHeld(p);
+}
+
+/**
+ * delivers the packets held from rcvNext on, up to the next gap
+ */
+static void deliverHeld(ArqPeer *p) {
+	Frame *frame;
+
+	while ((frame = p->held[SLOT(p->rcvNext)])) {
+		p->held[SLOT(p->rcvNext)] = NULL;
+		deliver(frame);
+		p->rcvNext++;
+	}
+}
+
+/**
+ * removes the ARQ header from a received packet and queues it for display
+ */
+static void deliver(Frame *frame) {
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	uint8_t len = frame->data[PH_LENGTH_OFFSET] - ARQ_HEADER_LEN;
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET] & ~PH_ARQ_FLAG;
+
+	memmove(msg, msg + ARQ_HEADER_LEN, len);
+	frame->data[PH_LENGTH_OFFSET] = len;
+	frame->data[PH_FLAGS_OFFSET] = flags;
+	frame->len -= ARQ_HEADER_LEN;
+	frame->data[frame->len-1] = (flags & PH_CRC_FLAG) ? ph_compute_fcs(&frame->data[PH_SRC_OFFSET]) : 0xAA;
+	fq_push(&delivered, frame);
+}
+
+/**
+ * @return an ACK packet to the peer, NULL if no frame is free. The acknowledgement stays pending then
+ */
+static Frame *ackFrame(ArqPeer *p) {
+	static PacketHeader pkt;
+	uint8_t msg[ACK_LEN] = {0};
+
+	Frame *frame = fp_alloc();
+	if (!frame)
+		return NULL;
+
+	ph_create(&pkt, addr, p->addr, true, msg, ACK_LEN);
+	PH_SET_TYPE(&pkt, PH_TYPE_ACK);
+	PH_SET_CLASS(&pkt, PH_CLASS_VOICE);
+	frame->cls = PH_CLASS_VOICE;
+	frame->len = ph_serialize(frame->data, &pkt);
+	arq_stamp(frame);
+	return frame;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file bertest.c
+ * PRBS generator and self-synchronising bit error checker, see bertest.h
+ */
+
+#include "bertest.h"
+#include <stdio.h>
+#include <string.h>
+
+static BER_PATTERN pattern = BER_OFF;
+static BerStats stats;
+// local copy of the generator, valid in sync
+static Prbs ref;
+// where the generator would be if sync had not been lost, to detect slips
+static Prbs lost;
+static bool lostValid = false;
+static bool inSync = false;
+// hunting: the last received bits, and how many of them were predicted correctly in a row
+static uint32_t hunt = 0;
+static int huntBits = 0;
+static int huntGood = 0;
+// errors in the current window
+static int windowBits = 0;
+static int windowErrors = 0;
+// current error burst
+static uint32_t sinceLastError = 0;
+static uint32_t burstLen = 0;
+static bool inBurst = false;
+// bits checked at the last report
+static uint32_t reportedBits = 0;
+
+static void acquire();
+static void loseSync();
+static void endBurst();
+
+/**
+ * seeds a generator for the pattern with all ones
+ */
+void prbs_init(Prbs *prbs, BER_PATTERN pattern) {
+	prbs->order = pattern;
+	prbs->tap = pattern == BER_PRBS23 ? 18 : pattern - 1;
+	prbs->mask = (1UL << pattern) - 1;
+	prbs->state = prbs->mask;
+}
+
+/**
+ * starts checking received bits against the pattern, clearing the statistics
+ */
+void ber_init(BER_PATTERN ber_pattern) {
+	pattern = ber_pattern;
+	memset(&stats, 0, sizeof(stats));
+	prbs_init(&ref, pattern);
+	prbs_init(&lost, pattern);
+	lostValid = inSync = inBurst = false;
+	hunt = huntBits = huntGood = 0;
+	windowBits = windowErrors = 0;
+	reportedBits = 0;
+}
+
+/**
+ * checks one received bit. Called from the receiver's sampling ISR
+ */
+void ber_rxBit(int bit) {
+	if (pattern == BER_OFF)
+		return;
+
+	if (!inSync) {
+		// predict the bit from the ones received before it
+		int predicted = ((hunt >> (ref.order-1)) ^ (hunt >> (ref.tap-1))) & 1;
+		huntGood = huntBits >= ref.order && predicted == bit ? huntGood+1 : 0;
+		hunt = ((hunt << 1) | bit) & ref.mask;
+		huntBits++;
+		if (lostValid)
+			prbs_next(&lost);
+		// a stuck line predicts itself as all zeros, that's not the sequence
+		if (huntGood >= BER_SYNC_BITS && hunt != 0)
+			acquire();
+		return;
+	}
+
+	stats.bits++;
+	sinceLastError++;
+	windowBits++;
+
+	if (prbs_next(&ref) != bit) {
+		stats.errors++;
+		windowErrors++;
+		if (!inBurst || sinceLastError > BER_BURST_GAP) {
+			if (inBurst)
+				endBurst();
+			inBurst = true;
+			burstLen = 1;
+			stats.bursts++;
+		}
+		else {
+			burstLen += sinceLastError;
+		}
+		sinceLastError = 0;
+	}
+	else if (inBurst && sinceLastError > BER_BURST_GAP) {
+		endBurst();
+	}
+
+	if (windowBits == BER_WINDOW_BITS) {
+		if (windowErrors > BER_LOSS_ERRORS)
+			loseSync();
+		windowBits = windowErrors = 0;
+	}
+}
+
+/**
+ * @return true once BER_REPORT_BITS more bits were checked since the last report
+ */
+bool ber_reportDue() {
+	return pattern != BER_OFF && stats.bits - reportedBits >= BER_REPORT_BITS;
+}
+
+/**
+ * prints the statistics over USART2. The BER is given in parts per billion
+ */
+void ber_report() {
+	uint32_t ppb = stats.bits ? (uint32_t)((uint64_t)stats.errors * 1000000000ULL / stats.bits) : 0;
+	reportedBits = stats.bits;
+
+	printf("<< BER PRBS%d: %s, bits=%lu errors=%lu ber=%lu ppb, sync lost=%lu slips=%lu\r\n", pattern,
+			inSync ? "in sync" : "hunting", (unsigned long)stats.bits, (unsigned long)stats.errors,
+			(unsigned long)ppb, (unsigned long)stats.syncLosses, (unsigned long)stats.slips);
+	printf("<< bursts=%lu max length=%lu bits, length histogram:", (unsigned long)stats.bursts,
+			(unsigned long)stats.maxBurstLen);
+	for (int i = 0; i<BER_BURST_BINS; i++)
+		printf(" %lu", (unsigned long)stats.burstHist[i]);
+	printf("\r\n");
+}
+
+const BerStats *ber_getStats() {
+	return &stats;
+}
+
+/**
+ * the hunt register predicted enough bits in a row, it becomes the local generator.
+ * If sync was lost before, the phase of the new sequence against the old one tells if a slip happened
+ */
+static void acquire() {
+	inSync = true;
+	ref.state = hunt;
+	windowBits = windowErrors = 0;
+	sinceLastError = 0;
+
+	if (!lostValid)
+		return;
+	lostValid = false;
+
+	Prbs ahead = lost, behind = ref;
+	for (int d = 1; d<=BER_MAX_SLIP; d++) {
+		prbs_next(&ahead);
+		prbs_next(&behind);
+		// bits were dropped (the received sequence is ahead) or inserted (it is behind)
+		if (ahead.state == ref.state || behind.state == lost.state) {
+			stats.slips++;
+			return;
+		}
+	}
+}
+
+static void loseSync() {
+	stats.syncLosses++;
+	if (inBurst)
+		endBurst();
+	inSync = false;
+	lost = ref;
+	lostValid = true;
+	hunt = huntBits = huntGood = 0;
+}
+
+static void endBurst() {
+	int bin = 0;
+	inBurst = false;
+	if (burstLen > stats.maxBurstLen)
+		stats.maxBurstLen = burstLen;
+	while ((burstLen >> (bin+1)) && bin < BER_BURST_BINS-1)
+		bin++;
+	stats.burstHist[bin]++;
+}
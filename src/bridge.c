@@ -0,0 +1,238 @@
+/**
+ * @file bridge.c
+ * Two-port learning bridge, see bridge.h
+ */
+
+#include "bridge.h"
+#include "packet_header.h"
+#include "monitor.h"
+#include "critical.h"
+#include "sched.h"
+#include <stdio.h>
+
+// start of the probe sequence of an address. Multiplying by an odd number permutes the 8-bit addresses
+#define HASH(addr) ((uint8_t)((addr) * 167u) & (BRIDGE_TABLE_SIZE-1))
+
+typedef struct {
+	bool used;
+	uint8_t addr;
+	uint8_t port;
+	uint32_t lastSeen;
+} BridgeEntry;
+
+static bool enabled = false;
+// open addressing with linear probing. Aged entries stay in place, as probe sequences run through them
+static BridgeEntry table[BRIDGE_TABLE_SIZE];
+// frames to send on each port
+static FrameQueue outQueue[BRIDGE_NUM_PORTS];
+// frame being received on each port while it is forwarded, and whether its transmitter is done with it already
+static Frame *receiving[BRIDGE_NUM_PORTS];
+static bool abandoned[BRIDGE_NUM_PORTS];
+// frames forwarded to each port that its transmitter hasn't handed back, their copies are heard back on it
+static Frame *sending[BRIDGE_NUM_PORTS][FP_NUM_FRAMES];
+// counters for bridge_print
+static uint32_t forwarded = 0;
+static uint32_t filtered = 0;
+static uint32_t echoes = 0;
+static uint32_t cutShort = 0;
+static uint32_t moved = 0;
+
+static BridgeEntry *lookup(uint8_t addr);
+static void learn(uint8_t addr, int port);
+static bool isEcho(int port, uint8_t src);
+static void track(int port, Frame *frame);
+
+void bridge_init(bool bridge_enabled) {
+	enabled = bridge_enabled;
+	for (int i = 0; i < BRIDGE_TABLE_SIZE; i++)
+		table[i].used = false;
+	for (int p = 0; p < BRIDGE_NUM_PORTS; p++) {
+		outQueue[p] = (FrameQueue){0};
+		receiving[p] = NULL;
+		abandoned[p] = false;
+		for (int i = 0; i < FP_NUM_FRAMES; i++)
+			sending[p][i] = NULL;
+	}
+	forwarded = filtered = echoes = cutShort = moved = 0;
+}
+
+bool bridge_enabled() {
+	return enabled;
+}
+
+/**
+ * learns the source of a frame and decides whether to forward it, once its dest byte is received. Receiver ISR
+ * @param port the port the frame is received on
+ * @param frame holding at least the bytes up to PH_DEST_OFFSET
+ */
+BRIDGE_DECISION bridge_onHeader(int port, Frame *frame) {
+	uint8_t src = frame->data[PH_SRC_OFFSET];
+	uint8_t dest = frame->data[PH_DEST_OFFSET];
+	int out = !port;
+
+	if (isEcho(port, src)) {
+		echoes++;
+		return BRIDGE_ECHO;
+	}
+	BridgeEntry *e = lookup(src);
+	if (e && e->port != port)
+		moved++;
+	learn(src, port);
+
+	e = dest == 0xFF ? NULL : lookup(dest);
+	if (e && e->port == port) {
+		filtered++;
+		return BRIDGE_LOCAL;
+	}
+
+	frame->growing = true;
+	frame->cls = PH_GET_CLASS(frame->data[PH_FLAGS_OFFSET]);
+	receiving[port] = frame;
+	abandoned[port] = false;
+	track(out, frame);
+	fq_push(&outQueue[out], frame);
+	forwarded++;
+	// cut-through: the other port starts sending it while it is still received
+	sched_post(SCHED_EV_TX);
+	return BRIDGE_FORWARD;
+}
+
+/**
+ * ends the reception of the frame forwarded from a port. Receiver ISR
+ * @param complete false if the frame was cut short, by a collision or a lost bit
+ */
+void bridge_onFrameEnd(int port, bool complete) {
+	uint32_t mask = critical_enter();
+	Frame *frame = receiving[port];
+	receiving[port] = NULL;
+	if (frame) {
+		frame->growing = false;
+		// ends its copy at the next byte, or right away if it isn't sent yet
+		if (!complete) {
+			frame->len = 0;
+			if (!abandoned[port])
+				cutShort++;
+		}
+		if (abandoned[port])
+			fp_free(frame);
+	}
+	critical_exit(mask);
+}
+
+/**
+ * @return a frame to send on the port, NULL if there is none. It may still be growing
+ */
+Frame *bridge_pollFrame(int port) {
+	return fq_pop(&outQueue[port]);
+}
+
+/**
+ * hands back a frame a transmitter is done with, sent or dropped. Transmitter ISR
+ * @return true if it is still being received, the bridge frees it once it ends. Otherwise the caller frees it
+ */
+bool bridge_release(Frame *frame) {
+	bool held = false;
+	uint32_t mask = critical_enter();
+	for (int p = 0; p < BRIDGE_NUM_PORTS; p++) {
+		if (receiving[p] == frame) {
+			abandoned[p] = held = true;
+			cutShort++;
+		}
+		for (int i = 0; i < FP_NUM_FRAMES; i++) {
+			if (sending[p][i] == frame)
+				sending[p][i] = NULL;
+		}
+	}
+	critical_exit(mask);
+	return held;
+}
+
+/**
+ * prints the learned addresses and the counters
+ */
+void bridge_print() {
+	uint32_t now = monitor_now();
+	for (int i = 0; i < BRIDGE_TABLE_SIZE; i++) {
+		if (table[i].used && now - table[i].lastSeen < BRIDGE_AGING_US)
+			printf(">> bridge: %x on port %u, seen %lu s ago\r\n", table[i].addr, table[i].port,
+					(unsigned long)((now - table[i].lastSeen) / 1000000));
+	}
+	printf(">> bridge: forwarded=%lu filtered=%lu echoes=%lu cut short=%lu moved=%lu\r\n",
+			(unsigned long)forwarded, (unsigned long)filtered, (unsigned long)echoes, (unsigned long)cutShort,
+			(unsigned long)moved);
+}
+
+/**
+ * @return the entry of a learned address that hasn't aged, NULL if there is none
+ */
+static BridgeEntry *lookup(uint8_t addr) {
+	uint32_t now = monitor_now();
+	for (int i = 0, slot = HASH(addr); i < BRIDGE_TABLE_SIZE; i++, slot = (slot + 1) & (BRIDGE_TABLE_SIZE-1)) {
+		BridgeEntry *e = &table[slot];
+		if (!e->used)
+			return NULL;
+		if (e->addr == addr)
+			return now - e->lastSeen < BRIDGE_AGING_US ? e : NULL;
+	}
+	return NULL;
+}
+
+/**
+ * records that addr is on port. Its entry is reused if it has one, else the first free or aged one it probes.
+ * A full table replaces the stalest entry probed
+ */
+static void learn(uint8_t addr, int port) {
+	uint32_t now = monitor_now();
+	BridgeEntry *slotFor = NULL;
+	BridgeEntry *stalest = NULL;
+
+	for (int i = 0, slot = HASH(addr); i < BRIDGE_TABLE_SIZE; i++, slot = (slot + 1) & (BRIDGE_TABLE_SIZE-1)) {
+		BridgeEntry *e = &table[slot];
+		if (!e->used) {
+			if (!slotFor)
+				slotFor = e;
+			break;
+		}
+		if (e->addr == addr) {
+			slotFor = e;
+			break;
+		}
+		if (!slotFor && now - e->lastSeen >= BRIDGE_AGING_US)
+			slotFor = e;
+		if (!stalest || now - e->lastSeen > now - stalest->lastSeen)
+			stalest = e;
+	}
+	if (!slotFor)
+		slotFor = stalest;
+
+	slotFor->used = true;
+	slotFor->addr = addr;
+	slotFor->port = port;
+	slotFor->lastSeen = now;
+}
+
+/**
+ * @return true if a frame from src is being sent on the port: the frame heard is its copy
+ */
+static bool isEcho(int port, uint8_t src) {
+	bool echo = false;
+	uint32_t mask = critical_enter();
+	for (int i = 0; i < FP_NUM_FRAMES && !echo; i++)
+		echo = sending[port][i] && sending[port][i]->data[PH_SRC_OFFSET] == src;
+	critical_exit(mask);
+	return echo;
+}
+
+/**
+ * records a frame forwarded to a port, until bridge_release hands it back
+ */
+static void track(int port, Frame *frame) {
+	uint32_t mask = critical_enter();
+	for (int i = 0; i < FP_NUM_FRAMES; i++) {
+		if (!sending[port][i]) {
+			sending[port][i] = frame;
+			break;
+		}
+	}
+	critical_exit(mask);
+}
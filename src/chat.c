@@ -0,0 +1,238 @@
+/**
+ * @file chat.c
+ * UART chat application, see chat.h
+ */
+
+#include "chat.h"
+#include "receiver.h"
+#include "monitor.h"
+#include "packet_header.h"
+#include "mac.h"
+#include "arq.h"
+#include "timesync.h"
+#include "network.h"
+#include "bridge.h"
+#include "link.h"
+#include "latency.h"
+#include "sched.h"
+#include "isr.h"
+#include "uart_driver.h"
+#include <stdio.h>
+#include <string.h>
+
+// dest address that determines the node to send to
+static uint8_t dest = 0;
+static bool packetMode = false;
+
+static void onFailed(int handle);
+static void onReceive(const LlcPacket *packet);
+static void onEvent(const LlcLinkEvent *event);
+static bool runCommand(const char *line);
+static bool sendMessage(const uint8_t *msg, int size);
+
+static const LlcCallbacks callbacks = {
+	.onSent = NULL,
+	.onFailed = onFailed,
+	.onReceive = onReceive,
+	.onEvent = onEvent,
+};
+
+void chat_init(uint8_t chat_dest, bool packet_mode) {
+	dest = chat_dest;
+	packetMode = packet_mode;
+}
+
+/**
+ * @return the callbacks to start the link layer with, see llc_init
+ */
+const LlcCallbacks *chat_callbacks() {
+	return &callbacks;
+}
+
+/**
+ * reads what arrived on the uart without blocking, and sends a line once it is complete. Run on SCHED_EV_UART,
+ * and on SCHED_EV_TX while a line waits for the link layer to take it
+ */
+void chat_update() {
+	// only transmit a fully received message from the uart
+	static bool gotMessage = false;
+	// buffer of the data sent through UART
+	static uint8_t dataBuf[PH_MSG_SIZE];
+	// cursor that makes sure not to retrieve more than PH_MSG_SIZE bytes into dataBuf
+	static int dataCur = 0;
+	static uint32_t shownOverruns = 0;
+	uint32_t overruns = usart2_overruns();
+
+	// typed faster than the lines are taken, the uart buffer ran full
+	if (overruns != shownOverruns) {
+		printf(">> ERROR: %lu bytes dropped on the uart, buffer full\r\n", (unsigned long)(overruns - shownOverruns));
+		shownOverruns = overruns;
+	}
+
+	// read the uart without blocking, so the link layer keeps being serviced
+	while (usart2_hasch() && !gotMessage) {
+		char c = usart2_getch();
+
+		// data to transmit received, transmit it
+		if (c == '\r') {
+			dataBuf[dataCur] = '\0';
+
+			// just pressed enter, or a command. Don't care about that message
+			if (!strcmp((char*)dataBuf, "\0e\0p") || runCommand((char*)dataBuf)) {
+				dataBuf[0] = dataCur = 0;
+				gotMessage = false;
+			}
+			else {
+				gotMessage = true;
+			}
+		}
+		// read in data until new line or max buffer size reached
+		else if (dataCur < PH_MSG_SIZE-1) {
+			dataBuf[dataCur++] = c;
+		}
+	}
+
+	// send the message as soon as the link layer takes it
+	if (gotMessage && sendMessage(dataBuf, dataCur)) {
+		gotMessage = false;
+		// clear message
+		dataBuf[0] = dataCur = 0;
+		// the next line may have been typed already
+		if (usart2_hasch())
+			sched_post(SCHED_EV_UART);
+	}
+}
+
+/**
+ * @return true if the line was a command, and was run
+ */
+static bool runCommand(const char *line) {
+	if (!strcmp(line, LQ_DUMP_COMMAND)) {
+		for (int i = 0; i < link_count(); i++) {
+			printf("interface %d ", i);
+			lq_dump(receiver_getLinkQuality(i));
+		}
+	}
+	else if (!strcmp(line, MONITOR_LOAD_COMMAND))
+		monitor_printLoad();
+	else if (!strcmp(line, MAC_LEAVE_COMMAND))
+		mac_leave();
+	else if (!strcmp(line, MAC_JOIN_COMMAND))
+		mac_join();
+	else if (!strcmp(line, ARQ_STATS_COMMAND))
+		arq_print();
+	else if (!strcmp(line, TIMESYNC_COMMAND))
+		timesync_print();
+	else if (!strcmp(line, NET_STATS_COMMAND))
+		net_print();
+	else if (!strcmp(line, BRIDGE_STATS_COMMAND))
+		bridge_print();
+	else if (!strcmp(line, LAT_COMMAND))
+		lat_print();
+	else if (!strcmp(line, SCHED_COMMAND))
+		sched_print();
+	else if (!strcmp(line, ISR_COMMAND))
+		isr_print();
+	else
+		return false;
+	return true;
+}
+
+/**
+ * sends a line typed on the uart, in its traffic class, and echoes it
+ * @return false if the link layer is busy, the message should be sent again later
+ */
+static bool sendMessage(const uint8_t *msg, int size) {
+	uint8_t flags = LLC_RELIABLE | LLC_TIMESTAMP;
+
+	// "!<class> " picks the traffic class, see CHAT_CLASS_PREFIX
+	if (size >= 3 && msg[0] == CHAT_CLASS_PREFIX && msg[1] >= '0' && msg[1] < '0' + PH_NUM_CLASSES
+			&& msg[2] == ' ') {
+		flags |= LLC_CLASS(msg[1] - '0');
+		msg += 3;
+		size -= 3;
+	}
+
+	// outside of packet mode the null terminator goes along, for display
+	int handle = llc_send(dest, msg, packetMode ? size : size + 1, flags);
+	if (handle == LLC_ERR_BUSY)
+		return false;
+	if (handle == LLC_ERR_TOO_LONG) {
+		printf(">> ERROR: message too long for a %d byte frame\r\n", mac_maxFrameLen());
+		return true;
+	}
+
+	// echo message
+	if (packetMode)
+		printf("> #%d dest=%x, length=%d, class=%d\r\n", handle, dest, size, LLC_GET_CLASS(flags));
+	printf("> %.*s\r\n", size, msg);
+	return true;
+}
+
+/**
+ * a message was given up on
+ */
+static void onFailed(int handle) {
+	printf(">> ERROR: message #%d not delivered\r\n", handle);
+}
+
+/**
+ * prints a received message, along with the link quality of the frame it came in
+ */
+static void onReceive(const LlcPacket *packet) {
+	if (packetMode) {
+		if (!packet->valid)
+			printf("<< ERROR: invalid packet\r\n");
+
+		printf("< src=%x, dest=%x, length=%d, class=%d\r\n", packet->src, packet->dest, packet->length, packet->cls);
+		printf("< %.*s\r\n", packet->length, packet->msg);
+	}
+	else {
+		printf("< %.*s", packet->length, packet->msg);
+	}
+	lq_print(packet->lq);
+}
+
+/**
+ * prints what the layers below report, see LLC_EVENT
+ */
+static void onEvent(const LlcLinkEvent *event) {
+	switch (event->type) {
+	case LLC_EV_COLLISION:
+		printf("<< COLLISION! (interface %d)\r\n", event->iface);
+		lq_print(&event->lq);
+		break;
+	case LLC_EV_RX_DROPPED:
+		printf("<< ERROR: %lu frames dropped on interface %d, no free frame buffer\r\n",
+				(unsigned long)event->value, event->iface);
+		break;
+	case LLC_EV_TX_DROPPED:
+		printf(">> ERROR: %lu frames dropped on interface %d, retry limit reached\r\n",
+				(unsigned long)event->value, event->iface);
+		break;
+	case LLC_EV_BER_BACKOFF:
+		printf(">> Retransmitting in %lu ms...\r\n", (unsigned long)event->value);
+		break;
+	case LLC_EV_ARQ_GAVE_UP:
+		printf(">> ARQ: gave up on %lu to %x\r\n", (unsigned long)event->value, event->addr);
+		break;
+	case LLC_EV_MAC_SYNCED:
+		printf(">> MAC: synced to beacon from %x, %lu slots\r\n", event->addr, (unsigned long)event->value);
+		break;
+	case LLC_EV_TOKEN_DUPLICATE:
+		printf(">> TOKEN: duplicate token, dropped\r\n");
+		break;
+	case LLC_EV_TOKEN_COLLISION:
+		printf(">> TOKEN: collision, dropped\r\n");
+		break;
+	case LLC_EV_TOKEN_LOST:
+		printf(">> TOKEN: token lost, regenerated\r\n");
+		break;
+	case LLC_EV_TOKEN_LEFT:
+		printf(">> TOKEN: left the ring\r\n");
+		break;
+	case LLC_EV_TOKEN_REMOVED:
+		printf(">> TOKEN: %x does not answer, removed from the ring\r\n", event->addr);
+		break;
+	}
+}
@@ -0,0 +1,116 @@
+/**
+ * @file framepool.c
+ * Fixed-size frame buffer pool and frame queues, see framepool.h
+ */
+
+#include "framepool.h"
+#include "critical.h"
+#include <stddef.h>
+
+static Frame pool[FP_NUM_FRAMES];
+// singly linked list of the free frames
+static Frame *freeList = NULL;
+static volatile unsigned int available = 0;
+
+/**
+ * puts every frame of the pool in the free list
+ */
+void fp_init() {
+	freeList = NULL;
+	for (int i = 0; i<FP_NUM_FRAMES; i++) {
+		pool[i].next = freeList;
+		freeList = &pool[i];
+	}
+	available = FP_NUM_FRAMES;
+}
+
+/**
+ * @return an empty frame, or NULL if the pool is exhausted
+ */
+Frame *fp_alloc() {
+	uint32_t mask = critical_enter();
+	Frame *frame = freeList;
+	if (frame) {
+		freeList = frame->next;
+		available--;
+	}
+	critical_exit(mask);
+
+	if (frame) {
+		frame->next = NULL;
+		frame->len = 0;
+		frame->growing = false;
+		frame->handle = 0;
+		frame->cls = PH_CLASS_BEST_EFFORT;
+	}
+	return frame;
+}
+
+/**
+ * returns a frame to the pool. It must not be in a queue anymore
+ */
+void fp_free(Frame *frame) {
+	uint32_t mask = critical_enter();
+	frame->next = freeList;
+	freeList = frame;
+	available++;
+	critical_exit(mask);
+}
+
+/**
+ * @return the number of free frames
+ */
+unsigned int fp_available() {
+	return available;
+}
+
+/**
+ * appends a frame to the back of the queue
+ */
+void fq_push(FrameQueue *queue, Frame *frame) {
+	frame->next = NULL;
+	uint32_t mask = critical_enter();
+	if (queue->tail)
+		queue->tail->next = frame;
+	else
+		queue->head = frame;
+	queue->tail = frame;
+	queue->count++;
+	critical_exit(mask);
+}
+
+/**
+ * adds a frame to the front of the queue, ahead of the frames already waiting
+ */
+void fq_pushFront(FrameQueue *queue, Frame *frame) {
+	uint32_t mask = critical_enter();
+	frame->next = queue->head;
+	queue->head = frame;
+	if (!queue->tail)
+		queue->tail = frame;
+	queue->count++;
+	critical_exit(mask);
+}
+
+/**
+ * @return the frame at the front of the queue, removed from it. NULL if the queue is empty
+ */
+Frame *fq_pop(FrameQueue *queue) {
+	uint32_t mask = critical_enter();
+	Frame *frame = queue->head;
+	if (frame) {
+		queue->head = frame->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		queue->count--;
+	}
+	critical_exit(mask);
+	return frame;
+}
+
+/**
+ * @return the frame at the front of the queue, left in it. NULL if the queue is empty
+ */
+Frame *fq_peek(FrameQueue *queue) {
+	return queue->head;
+}
@@ -10,23 +10,7 @@
 
 void init_GPIO(enum GPIOs gpio)
 {
-    switch (gpio)
-    {
-    case A:
-        *RCC_AHB1ENR |= 1 << GPIOA_EN;
-        break;
-    case B:
-        *RCC_AHB1ENR |= 1 << GPIOB_EN;
-        break;
-    case C:
-        *RCC_AHB1ENR |= 1 << GPIOC_EN;
-        break;
-    case D:
-        *RCC_AHB1ENR |= 1 << GPIOD_EN;
-        break;
-    default:
-        break;
-    }
+    *RCC_AHB1ENR |= 1 << (GPIOA_EN + gpio);
 }
 
 void enable_input_mode(enum GPIOs gpio, int pin)
@@ -46,6 +30,18 @@ void enable_output_mode(enum GPIOs gpio, int pin)
 
 }
 
+/**
+ * Makes an output pin open-drain, with the internal pull-up holding it high when released
+ */
+void enable_open_drain(enum GPIOs gpio, int pin)
+{
+	volatile GPIO *gpio_ptr = select_gpio(gpio);
+
+    gpio_ptr->OTYPER |= 1 << pin;
+    gpio_ptr->PUPDR &= ~(0b11 << 2*pin);
+    gpio_ptr->PUPDR |= 0b01 << 2*pin;
+}
+
 void enable_af_mode(enum GPIOs gpio, int pin, int af_num)
 {
 	volatile GPIO *gpio_ptr = select_gpio(gpio);
@@ -64,25 +60,3 @@ void enable_af_mode(enum GPIOs gpio, int pin, int af_num)
         gpio_ptr->AFRH |= (af_num << (4 * (pin - 8)));
     }
 }
-
-inline volatile GPIO* select_gpio(enum GPIOs gpio) {
-    volatile GPIO *gpio_ptr = 0;
-    switch (gpio)
-    {
-    case A:
-        gpio_ptr = GPIOA_BASE;
-        break;
-    case B:
-        gpio_ptr = GPIOB_BASE;
-        break;
-    case C:
-        gpio_ptr = GPIOC_BASE;
-        break;
-    case D:
-    	gpio_ptr = GPIOD_BASE;
-    	break;
-    default:
-        break;
-    }
-    return gpio_ptr;
-}
@@ -0,0 +1,143 @@
+/**
+ * @file hdlc.c
+ * HDLC-style flag framing and bit stuffing, see hdlc.h
+ */
+
+#include "hdlc.h"
+
+// stages of the transmit state machine
+enum {
+	TX_OPEN_FLAG,
+	TX_DATA,
+	TX_CLOSE_FLAG,
+	TX_DONE
+};
+
+static inline HDLC_RX_EVENT appendBit(HdlcRx *rx, int bit, uint8_t *byteOut);
+
+/**
+ * prepares the encoder to send one frame: opening flag, stuffed frame content, closing flag.
+ * The frame buffer must stay valid until hdlc_txNextBit returns HDLC_TX_DONE
+ * @param openFlag false if the frame directly follows another one, whose closing flag opens it
+ */
+void hdlc_txStart(HdlcTx *tx, const void *frame, unsigned int size, bool openFlag) {
+	tx->frame = frame;
+	tx->size = size;
+	tx->byte = 0;
+	tx->bit = 0;
+	tx->ones = 0;
+	tx->stage = openFlag ? TX_OPEN_FLAG : (size != 0 ? TX_DATA : TX_CLOSE_FLAG);
+}
+
+/**
+ * @return the next bit to put on the line, or HDLC_TX_DONE once the closing flag was sent
+ */
+int hdlc_txNextBit(HdlcTx *tx) {
+	int bit;
+
+	switch (tx->stage) {
+	case TX_OPEN_FLAG:
+	case TX_CLOSE_FLAG:
+		bit = (HDLC_FLAG >> (7-tx->bit)) & 1;
+		if (++tx->bit == 8) {
+			tx->bit = 0;
+			if (tx->stage == TX_OPEN_FLAG)
+				tx->stage = tx->size != 0 ? TX_DATA : TX_CLOSE_FLAG;
+			else
+				tx->stage = TX_DONE;
+		}
+		return bit;
+
+	case TX_DATA:
+		// five 1s in a row, stuff a 0 so the content can't be mistaken for a flag
+		if (tx->ones == 5) {
+			tx->ones = 0;
+			if (tx->byte == tx->size)
+				tx->stage = TX_CLOSE_FLAG;
+			return 0;
+		}
+		bit = (tx->frame[tx->byte] >> (7-tx->bit)) & 1;
+		tx->ones = bit ? tx->ones+1 : 0;
+		if (++tx->bit == 8) {
+			tx->bit = 0;
+			// keep stuffing after the last byte if it ended in five 1s
+			if (++tx->byte == tx->size && tx->ones != 5)
+				tx->stage = TX_CLOSE_FLAG;
+		}
+		return bit;
+
+	default:
+		return HDLC_TX_DONE;
+	}
+}
+
+/**
+ * resets the decoder so it hunts for the next opening flag
+ */
+void hdlc_rxReset(HdlcRx *rx) {
+	rx->ones = 0;
+	rx->byte = 0;
+	rx->nbits = 0;
+	rx->nbytes = 0;
+	rx->inFrame = false;
+}
+
+/**
+ * feeds one received bit to the decoder.
+ * 1s are held back until the next 0 tells whether they are data, part of a flag or an abort,
+ * so a byte is reported at most a few bits after its last bit arrived.
+ * @param byteOut set when HDLC_RX_BYTE is returned
+ */
+HDLC_RX_EVENT hdlc_rxBit(HdlcRx *rx, int bit, uint8_t *byteOut) {
+	HDLC_RX_EVENT event = HDLC_RX_NONE;
+
+	if (bit) {
+		// seven 1s in a row is an abort/idle sequence
+		if (++rx->ones == 7) {
+			event = rx->inFrame && rx->nbytes ? HDLC_RX_ABORT : HDLC_RX_NONE;
+			hdlc_rxReset(rx);
+			rx->ones = 7;
+		}
+		else if (rx->ones > 7) {
+			rx->ones = 7;
+		}
+		return event;
+	}
+
+	// 0 after six 1s: flag. The flag's leading 0 was already appended as a data bit
+	if (rx->ones == 6) {
+		if (rx->inFrame && rx->nbytes != 0)
+			event = rx->nbits == 1 ? HDLC_RX_FRAME : HDLC_RX_ABORT;
+		hdlc_rxReset(rx);
+		rx->inFrame = true;
+		return event;
+	}
+
+	if (!rx->inFrame) {
+		rx->ones = 0;
+		return HDLC_RX_NONE;
+	}
+
+	// release the held back 1s, then the 0 unless it was stuffed
+	bool stuffed = rx->ones == 5;
+	while (rx->ones) {
+		rx->ones--;
+		if (appendBit(rx, 1, byteOut) == HDLC_RX_BYTE)
+			event = HDLC_RX_BYTE;
+	}
+	if (!stuffed && appendBit(rx, 0, byteOut) == HDLC_RX_BYTE)
+		event = HDLC_RX_BYTE;
+
+	return event;
+}
+
+static inline HDLC_RX_EVENT appendBit(HdlcRx *rx, int bit, uint8_t *byteOut) {
+	rx->byte = (rx->byte << 1) | bit;
+	if (++rx->nbits == 8) {
+		*byteOut = rx->byte;
+		rx->nbits = 0;
+		rx->nbytes++;
+		return HDLC_RX_BYTE;
+	}
+	return HDLC_RX_NONE;
+}
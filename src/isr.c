@@ -0,0 +1,83 @@
+/**
+ * @file isr.c
+ * Interrupt priorities and entry latencies, see isr.h
+ */
+
+#include "isr.h"
+#include "critical.h"
+#include "io_definitions.h"
+#include <stdio.h>
+
+typedef struct {
+	int irq;
+	uint8_t priority;
+	const char *name;
+} IsrSource;
+
+static const IsrSource sources[ISR_NUM_SOURCES] = {
+	[ISR_EXTI2]		= {IRQ_EXTI2, ISR_PRIO_EDGE, "EXTI2 edge"},
+	[ISR_EXTI4]		= {IRQ_EXTI4, ISR_PRIO_EDGE, "EXTI4 edge"},
+	[ISR_EXTI9_5]	= {IRQ_EXTI9_5, ISR_PRIO_EDGE, "EXTI9 edge"},
+	[ISR_TIM9]		= {IRQ_TIM1_BRK_TIM9, ISR_PRIO_HALFBIT, "TIM9 half-bit"},
+	[ISR_TIM4]		= {IRQ_TIM4, ISR_PRIO_HALFBIT, "TIM4 half-bit"},
+	[ISR_TIM2]		= {IRQ_TIM2, ISR_PRIO_TX_BIT, "TIM2 tx bit"},
+	[ISR_TIM3]		= {IRQ_TIM3, ISR_PRIO_TX_BIT, "TIM3 tx bit"},
+	[ISR_TIM5]		= {IRQ_TIM5, ISR_PRIO_MONITOR, "TIM5 monitor"},
+	[ISR_USART2]	= {IRQ_USART2, ISR_PRIO_UART, "USART2"},
+};
+
+uint32_t isr_maxLatency[ISR_NUM_SOURCES];
+volatile uint32_t isr_drivenAt[ISR_NUM_SOURCES];
+volatile bool isr_driven[ISR_NUM_SOURCES];
+uint32_t isr_cycles[ISR_NUM_SOURCES];
+uint32_t isr_calls[ISR_NUM_SOURCES];
+uint32_t isr_maxCycles[ISR_NUM_SOURCES];
+volatile uint32_t isr_spentCycles = 0;
+uint32_t critical_since = 0;
+uint32_t critical_maxCycles = 0;
+#ifndef __arm__
+uint32_t critical_hostBasepri = 0;
+#endif
+
+/**
+ * makes every priority bit a preemption priority. Before any interrupt is enabled
+ */
+void isr_init() {
+	*(SCB_AIRCR) = AIRCR_VECTKEY | (*(SCB_AIRCR) & ~(0xFFFF0000 | 0b111 << AIRCR_PRIGROUP_F))
+			| ISR_PRIGROUP << AIRCR_PRIGROUP_F;
+}
+
+/**
+ * sets the priority of an IRQ from the table above, and enables it in the NVIC. IRQs missing from it get the
+ * lowest priority
+ */
+void isr_enableIrq(int irq) {
+	uint8_t priority = (1 << ISR_PRIO_BITS) - 1;
+
+	for (int i = 0; i < ISR_NUM_SOURCES; i++) {
+		if (sources[i].irq == irq)
+			priority = sources[i].priority;
+	}
+	// the field is replaced, not ORed into
+	NVIC_IPR_BYTE[irq] = ISR_PRIO_FIELD(priority);
+	*(NVIC_ISER0 + irq/32) = 1 << (irq%32);
+}
+
+/**
+ * prints the priority, worst-case entry latency and run time of each source, and the longest critical section
+ */
+void isr_print() {
+	for (int i = 0; i < ISR_NUM_SOURCES; i++) {
+		printf(">> %s: priority %d", sources[i].name, sources[i].priority);
+		if (sources[i].priority == ISR_PRIO_EDGE)
+			printf(", worst entry latency %lu cycles after the node's own edges", (unsigned long)isr_maxLatency[i]);
+		else if (i != ISR_USART2)
+			printf(", worst entry latency %lu cycles", (unsigned long)isr_maxLatency[i]);
+		if (isr_calls[i])
+			printf(", %lu runs of mean %lu cycles, max %lu cycles", (unsigned long)isr_calls[i],
+					(unsigned long)(isr_cycles[i] / isr_calls[i]), (unsigned long)isr_maxCycles[i]);
+		printf("\r\n");
+	}
+	// what the edges of other nodes may wait on top
+	printf(">> longest critical section: %lu cycles\r\n", (unsigned long)critical_maxCycles);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file latency.c
+ * Latency histograms per stage, see latency.h
+ */
+
+#include "latency.h"
+#include <stdio.h>
+
+typedef struct {
+	uint32_t bins[LAT_BINS];
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+} LatencyHistogram;
+
+static const char *stageNames[LAT_NUM_STAGES] = {
+	[LAT_TX_QUEUE]		= "tx queue+backoff",
+	[LAT_TX_ACCESS]		= "tx line to 1st edge",
+	[LAT_TX_AIR]		= "tx airtime",
+	[LAT_RX_AIR]		= "rx airtime",
+	[LAT_RX_COMPLETE]	= "rx last edge to complete",
+	[LAT_RX_DELIVER]	= "rx complete to app",
+	[LAT_ONE_WAY]		= "one way",
+};
+
+// tx stages are added from the transmitter's ISR, the others from the main routine
+static LatencyHistogram histograms[LAT_NUM_STAGES];
+
+/**
+ * adds a latency to the histogram of a stage
+ */
+void lat_add(LAT_STAGE stage, uint32_t us) {
+	LatencyHistogram *h = &histograms[stage];
+	int bin = us ? 32 - __builtin_clz(us) : 0;
+
+	h->bins[bin < LAT_BINS ? bin : LAT_BINS-1]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max)
+		h->max = us;
+}
+
+/**
+ * accounts a frame the transmitter sent. Called from its ISR
+ */
+void lat_txDone(const Frame *frame) {
+	const uint32_t *t = frame->stamps;
+
+	lat_add(LAT_TX_QUEUE, t[FP_ACQUIRED] - t[FP_ENQUEUED]);
+	lat_add(LAT_TX_ACCESS, t[FP_FIRST_EDGE] - t[FP_ACQUIRED]);
+	lat_add(LAT_TX_AIR, t[FP_LAST_EDGE] - t[FP_FIRST_EDGE]);
+}
+
+/**
+ * accounts a received frame delivered to the application
+ */
+void lat_rxDone(const Frame *frame) {
+	const uint32_t *t = frame->stamps;
+
+	lat_add(LAT_RX_AIR, t[FP_LAST_EDGE] - t[FP_FIRST_EDGE]);
+	lat_add(LAT_RX_COMPLETE, t[FP_RECEIVED] - t[FP_LAST_EDGE]);
+	lat_add(LAT_RX_DELIVER, t[FP_DELIVERED] - t[FP_RECEIVED]);
+}
+
+/**
+ * prints the non-empty bins of every stage
+ */
+void lat_print() {
+	for (int s = 0; s < LAT_NUM_STAGES; s++) {
+		LatencyHistogram *h = &histograms[s];
+
+		printf(">> %s: n=%lu", stageNames[s], (unsigned long)h->count);
+		if (h->count)
+			printf(" mean=%lu us max=%lu us", (unsigned long)(h->sum / h->count), (unsigned long)h->max);
+		printf("\r\n");
+
+		for (int i = 0; i < LAT_BINS; i++) {
+			if (!h->bins[i])
+				continue;
+			if (i == 0)
+				printf("   0 us: %lu\r\n", (unsigned long)h->bins[i]);
+			else if (i == LAT_BINS-1)
+				printf("   >= %lu us: %lu\r\n", (unsigned long)1 << (i-1), (unsigned long)h->bins[i]);
+			else
+				printf("   [%lu, %lu) us: %lu\r\n", (unsigned long)1 << (i-1), (unsigned long)1 << i,
+						(unsigned long)h->bins[i]);
+		}
+	}
+}
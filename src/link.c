@@ -0,0 +1,68 @@
+/**
+ * @file link.c
+ * Network interfaces, see link.h
+ */
+
+#include "link.h"
+#include <stdio.h>
+
+// the ISRs of each interface's timers and receive pin pass it by its index here, a change goes to them too
+const LinkConfig link_configs[LINK_MAX] = {
+	// PC9 -> PC4
+	{.txGpio = C, .txPin = 9, .rxGpio = C, .rxPin = 4, .txTimer = TIM2, .halfBitTimer = TIM4, .monitorChannel = 0,
+			.rxIsr = ISR_EXTI4},
+	// PC10 -> PC2
+	{.txGpio = C, .txPin = 10, .rxGpio = C, .rxPin = 2, .txTimer = TIM3, .halfBitTimer = TIM9, .monitorChannel = 1,
+			.rxIsr = ISR_EXTI2},
+};
+
+volatile uint32_t link_isrCycles[LINK_MAX];
+volatile uint32_t link_isrCalls[LINK_MAX];
+
+static int count = 1;
+// cycle and ISR counts at the last link_printLoad
+static uint32_t shownAt = 0;
+static uint32_t shownCycles[LINK_MAX];
+static uint32_t shownCalls[LINK_MAX];
+
+/**
+ * @param count interfaces in use, the first ones of link_configs. The primary one at least
+ */
+void link_init(int link_count) {
+	count = link_count < 1 ? 1 : link_count > LINK_MAX ? LINK_MAX : link_count;
+
+	// the DWT cycle counter times the ISRs
+	*(DEMCR) |= 1<<DEMCR_TRCENA_F;
+	*(DWT_CTRL) |= 1<<DWT_CYCCNTENA_F;
+	shownAt = *(DWT_CYCCNT);
+	for (int i = 0; i < LINK_MAX; i++)
+		shownCycles[i] = link_isrCycles[i] = shownCalls[i] = link_isrCalls[i] = 0;
+}
+
+int link_count() {
+	return count;
+}
+
+/**
+ * prints the share of the CPU each interface's ISRs took since the last call. The cycle counter wraps around
+ * every ~268 s, calls further apart than that are wrong
+ */
+void link_printLoad() {
+	uint32_t now = *(DWT_CYCCNT);
+	uint32_t elapsed = now - shownAt;
+
+	if (!elapsed)
+		return;
+
+	for (int i = 0; i < count; i++) {
+		uint32_t cycles = link_isrCycles[i] - shownCycles[i];
+		uint32_t calls = link_isrCalls[i] - shownCalls[i];
+		shownCycles[i] += cycles;
+		shownCalls[i] += calls;
+		printf("<< interface %d: isr load=%lu.%02lu%% (%lu cycles in %lu ms, %lu isrs of %lu cycles)\r\n", i,
+				(unsigned long)((uint64_t)cycles * 100 / elapsed), (unsigned long)((uint64_t)cycles * 10000 / elapsed % 100),
+				(unsigned long)cycles, (unsigned long)(elapsed / (F_CPU / 1000)), (unsigned long)calls,
+				(unsigned long)(calls ? cycles / calls : 0));
+	}
+	shownAt = now;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file linkquality.c
+ * Per frame edge timing statistics and cumulative histogram, see linkquality.h
+ */
+
+#include "linkquality.h"
+#include <stdio.h>
+#include <string.h>
+
+// converts cycles to ns for display
+#define CYCLES_TO_NS(c) ((c) * 1000 / (int32_t)(F_CPU / 1000000))
+
+/**
+ * clears the histogram
+ */
+void lq_init(LinkQualityState *s) {
+	memset(s, 0, sizeof(*s));
+	lq_frameStart(s, 0);
+}
+
+/**
+ * starts the statistics of a new frame at its first edge. The first edge has no interval
+ */
+void lq_frameStart(LinkQualityState *s, uint32_t now) {
+	s->lastEdge = now;
+	s->frame.minDev = INT32_MAX;
+	s->frame.maxDev = INT32_MIN;
+	s->frame.sumAbsDev = 0;
+	s->frame.edges = 0;
+	s->frame.outOfWindow = 0;
+}
+
+/**
+ * hands out the statistics of the frame that just ended, and starts the next frame's at the last edge.
+ * In stream mode frames are back-to-back so the next frame's first interval is still valid.
+ */
+void lq_frameEnd(LinkQualityState *s, LinkQuality *out) {
+	*out = s->frame;
+	lq_frameStart(s, s->lastEdge);
+}
+
+/**
+ * prints the link quality indicator of one frame
+ */
+void lq_print(const LinkQuality *lq) {
+	if (lq->edges == 0) {
+		printf("<< lqi: no edges in window, out of window=%u\r\n", lq->outOfWindow);
+		return;
+	}
+	printf("<< lqi: edges=%u dev min=%ldns max=%ldns mean=%ldns, out of window=%u\r\n", lq->edges,
+			(long)CYCLES_TO_NS(lq->minDev), (long)CYCLES_TO_NS(lq->maxDev),
+			(long)CYCLES_TO_NS((int32_t)(lq->sumAbsDev / lq->edges)), lq->outOfWindow);
+}
+
+/**
+ * prints the cumulative histogram of edge deviations from the nominal interval
+ */
+void lq_dump(const LinkQualityState *s) {
+	printf("edge deviation histogram (bin = %ldns)\r\n", (long)CYCLES_TO_NS(1 << LQ_BIN_SHIFT));
+	for (int i = 0; i<LQ_HIST_BINS; i++) {
+		int32_t from = (i << LQ_BIN_SHIFT) - LQ_WINDOW;
+		printf("[%7ldns, %7ldns): %lu\r\n", (long)CYCLES_TO_NS(from), (long)CYCLES_TO_NS(from + (1 << LQ_BIN_SHIFT)),
+				(unsigned long)s->hist[i]);
+	}
+	printf("out of window: %lu\r\n", (unsigned long)s->histOutOfWindow);
+}
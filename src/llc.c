@@ -0,0 +1,272 @@
+/**
+ * @file llc.c
+ * Link layer library API, see llc.h
+ */
+
+#include "llc.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "packet_header.h"
+#include "mac.h"
+#include "arq.h"
+#include "network.h"
+#include "timesync.h"
+#include "latency.h"
+#include "critical.h"
+#include "sched.h"
+#include <string.h>
+
+// a message the transmitter or the ARQ is done with
+typedef struct {
+	uint16_t handle;
+	bool sent;
+} LlcEvent;
+
+static uint8_t addr = 0;
+static bool packetMode = false;
+static LlcCallbacks callbacks;
+// handle of the last message sent, 0 is never one
+static uint16_t lastHandle = 0;
+// completion events, pushed from the transmitter's ISR and the ARQ, popped by llc_poll
+static LlcEvent events[LLC_MAX_EVENTS];
+static volatile unsigned int eventHead = 0;
+static volatile unsigned int eventTail = 0;
+// link events, pushed from the layers below and their ISRs, popped by llc_poll
+static LlcLinkEvent linkEvents[LLC_MAX_LINK_EVENTS];
+static volatile unsigned int linkEventHead = 0;
+static volatile unsigned int linkEventTail = 0;
+
+static void stampFrame(Frame *frame);
+static void receive(Frame *frame);
+static void reportLinkEvents();
+
+/**
+ * starts the transmitter and the receiver
+ * @param callbacks called from llc_poll, any of them may be NULL
+ */
+void llc_init(uint8_t llc_addr, bool packet_mode, bool stream_mode, const LlcCallbacks *llc_callbacks) {
+	addr = llc_addr;
+	packetMode = packet_mode;
+	memset(&callbacks, 0, sizeof(callbacks));
+	if (llc_callbacks)
+		callbacks = *llc_callbacks;
+
+	transmitter_init(packet_mode, stream_mode);
+	receiver_init(packet_mode, stream_mode);
+}
+
+/**
+ * queues a message for transmission, see llc.h. Never blocks
+ * @param flags LLC_RELIABLE, LLC_TIMESTAMP and LLC_CLASS
+ * @return the handle the message is reported with, > 0. Or LLC_ERR_BUSY to try again later, LLC_ERR_TOO_LONG
+ */
+int llc_send(uint8_t dest, const void *buf, unsigned int len, uint8_t flags) {
+	// a dest beyond the bus is reached through another node, otherwise in reliable mode the message waits for
+	// room in the window to dest
+	bool routed = packetMode && net_isRouted(dest);
+	bool reliable = packetMode && (flags & LLC_RELIABLE) && arq_enabled() && dest != 0xFF && !routed;
+	bool stamped = packetMode && (flags & LLC_TIMESTAMP) && !reliable && !routed && timesync_synced();
+	unsigned int header = reliable ? ARQ_HEADER_LEN : routed ? NET_HEADER_LEN : stamped ? LAT_STAMP_LEN : 0;
+	unsigned int overhead = packetMode ? PH_OVERHEAD + header : 0;
+
+	if (overhead + len > mac_maxFrameLen() || len + header > (packetMode ? PH_MSG_SIZE : FP_FRAME_SIZE))
+		return LLC_ERR_TOO_LONG;
+	if (reliable && !arq_mayQueue(dest))
+		return LLC_ERR_BUSY;
+
+	Frame *frame = fp_alloc();
+	if (!frame)
+		return LLC_ERR_BUSY;
+	frame->cls = LLC_GET_CLASS(flags);
+
+	if (packetMode) {
+		PacketHeader pkt;
+		ph_create(&pkt, addr, dest, true, buf, len);
+		PH_SET_CLASS(&pkt, frame->cls);
+		frame->len = ph_serialize(frame->data, &pkt);
+		if (reliable)
+			arq_track(frame);
+		else if (routed)
+			net_route(frame);
+		else if (stamped)
+			stampFrame(frame);
+	}
+	else {
+		memcpy(frame->data, buf, len);
+		frame->len = len;
+	}
+
+	if (++lastHandle > INT16_MAX)
+		lastHandle = 1;
+	frame->handle = lastHandle;
+	transmitter_queue(frame);
+	sched_post(SCHED_EV_TX);
+	return frame->handle;
+}
+
+/**
+ * runs the link layer once, then hands the completed and received messages to the callbacks
+ */
+void llc_poll() {
+	llc_pollTx();
+	llc_pollRx();
+}
+
+/**
+ * runs the transmitter once, then hands the completed messages to the callbacks. The sending half of llc_poll
+ */
+void llc_pollTx() {
+	transmitter_mainRoutineUpdate();
+
+	while (eventTail != eventHead) {
+		LlcEvent event = events[eventTail % LLC_MAX_EVENTS];
+		eventTail++;
+		if (event.sent && callbacks.onSent)
+			callbacks.onSent(event.handle);
+		else if (!event.sent && callbacks.onFailed)
+			callbacks.onFailed(event.handle);
+	}
+	reportLinkEvents();
+}
+
+/**
+ * runs the receiver once, then hands the received messages to the callbacks. The receiving half of llc_poll
+ */
+void llc_pollRx() {
+	Frame *frame;
+	bool received = false;
+
+	receiver_mainRoutineUpdate();
+
+	while ((frame = receiver_pollFrame())) {
+		receive(frame);
+		fp_free(frame);
+		received = true;
+	}
+	// the layers below may have answers or forwarded packets to send
+	if (received)
+		sched_post(SCHED_EV_TX);
+	reportLinkEvents();
+}
+
+/**
+ * reports that a frame from llc_send is done with. Called by the transmitter, from its ISR, and by the ARQ
+ * @param sent false if it was given up on
+ */
+void llc_complete(Frame *frame, bool sent) {
+	if (!frame->handle)
+		return;
+
+	// one event per frame at most, the queue can't overflow
+	uint32_t mask = critical_enter();
+	events[eventHead % LLC_MAX_EVENTS] = (LlcEvent){frame->handle, sent};
+	eventHead++;
+	critical_exit(mask);
+	frame->handle = 0;
+}
+
+/**
+ * reports a link event for onEvent, see LLC_EVENT. Called by the layers below, from their ISRs too
+ * @param lq LLC_EV_COLLISION: the edge timing of the frame, copied. NULL otherwise
+ */
+void llc_report(LLC_EVENT type, int iface, uint8_t addr, uint32_t value, const LinkQuality *lq) {
+	uint32_t mask = critical_enter();
+	LlcLinkEvent *last = &linkEvents[(linkEventHead - 1) % LLC_MAX_LINK_EVENTS];
+	bool adds = type == LLC_EV_RX_DROPPED || type == LLC_EV_TX_DROPPED;
+
+	if (adds && linkEventHead != linkEventTail && last->type == type && last->iface == iface) {
+		last->value += value;
+	}
+	else if (linkEventHead - linkEventTail < LLC_MAX_LINK_EVENTS) {
+		LlcLinkEvent *e = &linkEvents[linkEventHead % LLC_MAX_LINK_EVENTS];
+		*e = (LlcLinkEvent){.type = type, .iface = iface, .addr = addr, .value = value};
+		if (lq)
+			e->lq = *lq;
+		linkEventHead++;
+	}
+	critical_exit(mask);
+	sched_post(SCHED_EV_MONITOR);
+}
+
+/**
+ * hands the link events to onEvent. A drop may still add to the last one while it is copied
+ */
+static void reportLinkEvents() {
+	while (linkEventTail != linkEventHead) {
+		uint32_t mask = critical_enter();
+		LlcLinkEvent event = linkEvents[linkEventTail % LLC_MAX_LINK_EVENTS];
+		linkEventTail++;
+		critical_exit(mask);
+		if (callbacks.onEvent)
+			callbacks.onEvent(&event);
+	}
+}
+
+/**
+ * makes a serialized data packet STAMPED: inserts the synchronized time in front of its message
+ */
+static void stampFrame(Frame *frame) {
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	uint8_t len = frame->data[PH_LENGTH_OFFSET];
+	uint8_t flags = (frame->data[PH_FLAGS_OFFSET] & ~PH_TYPE_MASK) | PH_TYPE_STAMPED << PH_TYPE_SHIFT;
+	uint32_t now = timesync_now();
+
+	memmove(msg + LAT_STAMP_LEN, msg, len);
+	for (int i = 0; i < LAT_STAMP_LEN; i++)
+		msg[i] = now >> 8*(LAT_STAMP_LEN-1 - i);
+	len += LAT_STAMP_LEN;
+	frame->data[PH_LENGTH_OFFSET] = len;
+	frame->data[PH_FLAGS_OFFSET] = flags;
+	frame->len += LAT_STAMP_LEN;
+	frame->data[frame->len-1] = (flags & PH_CRC_FLAG) ? ph_compute_fcs(&frame->data[PH_SRC_OFFSET]) : 0xAA;
+}
+
+/**
+ * hands a received frame to the onReceive callback, the packet pointing into it
+ */
+static void receive(Frame *frame) {
+	LlcPacket packet = {0};
+	uint8_t *data = frame->data;
+
+	lat_stamp(frame, FP_DELIVERED);
+	lat_rxDone(frame);
+	if (!callbacks.onReceive)
+		return;
+
+	packet.start = frame->stamps[FP_FIRST_EDGE];
+	packet.lq = &frame->lq;
+	if (!packetMode) {
+		packet.valid = true;
+		packet.msg = data;
+		packet.length = frame->len;
+		callbacks.onReceive(&packet);
+		return;
+	}
+
+	// as ph_parse does, without copying the message
+	packet.src = data[PH_SRC_OFFSET];
+	packet.dest = data[PH_DEST_OFFSET];
+	packet.cls = PH_GET_CLASS(data[PH_FLAGS_OFFSET]);
+	packet.msg = &data[PH_MSG_OFFSET];
+	packet.length = data[PH_LENGTH_OFFSET];
+	if (frame->len > PH_OVERHEAD && frame->len == PH_OVERHEAD + packet.length) {
+		uint8_t fcs = data[frame->len-1];
+		packet.valid = (data[PH_FLAGS_OFFSET] & PH_CRC_FLAG) ? ph_compute_fcs(&data[PH_SRC_OFFSET]) == fcs
+				: fcs == 0xAA && PH_GET_TYPE(data[PH_FLAGS_OFFSET]) == PH_TYPE_DATA;
+	}
+	else {
+		packet.length = frame->len > PH_MSG_OFFSET ? frame->len - PH_MSG_OFFSET : 0;
+	}
+
+	// the send time goes ahead of the message, the one way latency only makes sense on a synchronized clock
+	if (packet.valid && PH_GET_TYPE(data[PH_FLAGS_OFFSET]) == PH_TYPE_STAMPED && packet.length >= LAT_STAMP_LEN) {
+		for (int i = 0; i < LAT_STAMP_LEN; i++)
+			packet.sent = packet.sent << 8 | packet.msg[i];
+		packet.stamped = true;
+		packet.msg += LAT_STAMP_LEN;
+		packet.length -= LAT_STAMP_LEN;
+		if (timesync_synced())
+			lat_add(LAT_ONE_WAY, timesync_toMaster(frame->stamps[FP_DELIVERED]) - packet.sent);
+	}
+	callbacks.onReceive(&packet);
+}
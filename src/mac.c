@@ -0,0 +1,697 @@
+/**
+ * @file mac.c
+ * Medium access control modes, see mac.h
+ */
+
+#include "mac.h"
+#include "packet_header.h"
+#include "link.h"
+#include "llc.h"
+#include "sched.h"
+#include "timerwheel.h"
+#include "critical.h"
+#include <stdlib.h>
+#include <string.h>
+
+// beacon message: superframe sequence number, number of slots, then in TDMA the address owning each slot
+#define BEACON_SEQ 0
+#define BEACON_SLOTS 1
+#define BEACON_SCHEDULE 2
+// token message flags
+#define TOKEN_LEAVING 0x01
+// RTS and CTS message: the remaining duration of the exchange after the frame, in us, MSB first
+#define RESERVATION_LEN 4
+
+static MAC_MODE mode = MAC_CSMA;
+static uint8_t addr = 0;
+
+// slotted modes state
+static bool coordinator = false;
+static bool synced = false;
+static uint8_t seq = 0;
+// the superframe of the last beacon heard
+static uint8_t schedule[MAC_TDMA_MAX_SLOTS];
+static int numSlots = 0;
+// coordinator: the superframe the next beacon announces
+static uint8_t beaconSchedule[MAC_TDMA_MAX_SLOTS];
+static int beaconSlots = 0;
+// MONITOR_TIMER time of the first edge of the last beacon
+static uint32_t superframeStart = 0;
+// coordinator: when the next beacon is due
+static uint32_t nextBeacon = 0;
+// slotted ALOHA and token: set by a collision, handled at the next chance to send
+static volatile bool collided = false;
+// a deadline left behind would read as in the future again once the MONITOR_TIMER is 2^31 past it
+static bool backingOff = false;
+static uint32_t backoffUntil = 0;
+
+// token ring state
+typedef enum {
+	TK_IDLE,		// waiting for the token
+	TK_HOLDING,		// may send data frames
+	TK_SOLICITING,	// solicit sent, listening for joins before passing the token
+	TK_PASSING,		// token passed, waiting for the successor to transmit
+	TK_OFF			// left the ring
+} TOKEN_STATE;
+static TOKEN_STATE tokenState = TK_IDLE;
+// bitmap of the addresses in the ring
+static uint32_t members[256/32];
+// data frames sent during this hold. Also taken by mac_mayTransmit from the transmitter ISR in stream mode, so
+// only changed with interrupts masked, see holdToken
+static volatile int tokenFrames = 0;
+static uint8_t successor = 0;
+static int passTries = 0;
+// start of the SOLICITING or PASSING wait, reset once the frame that started it is heard on the line
+static uint32_t tokenSince = 0;
+static bool tokenHeard = false;
+static uint32_t lastSolicit = 0;
+static bool inRing = false;
+static bool joinPending = false;
+static uint8_t solicitor = 0;
+static bool leavePending = false;
+static bool leaving = false;
+
+// RTS/CTS state
+static unsigned int rtsThreshold = MAC_RTS_THRESHOLD;
+static volatile MAC_RESERVATION reservation = MAC_RES_NONE;
+static uint8_t rtsDest = 0;
+static uint32_t ctsDeadline = 0;
+// wakes the transmitter at the deadline. Left to run out when the reservation ends first, it may end in an ISR
+static TwTimer ctsTimer;
+// CTS answering an RTS, handed to the transmitter at its next poll
+static Frame *ctsFrame = NULL;
+
+static Frame *controlFrame(PH_TYPE type, uint8_t dest, const uint8_t *msg, int size);
+static inline uint32_t superframeUs();
+static bool slotTime(uint32_t *t);
+static bool tdmaMayTransmit(unsigned int bits);
+static bool alohaMayTransmit(unsigned int bits);
+static Frame *tokenPoll(bool dataPending);
+static void tokenOnFrame(const PacketHeader *pkt);
+static void holdToken(int used);
+static Frame *passToken(bool retry);
+static uint8_t nextMember(uint8_t from);
+static inline uint32_t frameUs(unsigned int bits);
+static void reservationOnFrame(const PacketHeader *pkt);
+static Frame *reservationFrame(PH_TYPE type, uint8_t dest, uint32_t us);
+
+void mac_init(MAC_MODE mac_mode, uint8_t mac_addr) {
+	mode = mac_mode;
+	addr = mac_addr;
+	coordinator = synced = collided = backingOff = false;
+	numSlots = beaconSlots = 0;
+	memset(members, 0, sizeof(members));
+	tokenState = TK_IDLE;
+	inRing = joinPending = leavePending = leaving = false;
+	reservation = MAC_RES_NONE;
+	lastSolicit = monitor_now();
+	monitor_setArbitrationWindow(LINK_PRIMARY, mode == MAC_ARBITRATION ? MAC_ARB_BITS * MAC_BIT_US : 0);
+	// slots, beacons and the token are kept by polling the time
+	if (mode == MAC_TDMA || mode == MAC_SLOTTED_ALOHA || mode == MAC_TOKEN)
+		sched_startTick();
+}
+
+/**
+ * makes this node send the beacons. In TDMA the slots go to the given owners, an address may own several.
+ * In slotted ALOHA no slot has an owner, and a superframe has MAC_ALOHA_SLOTS slots.
+ * Called again, the new schedule goes out with the next beacon, on time. More nodes than MAC_TDMA_MAX_SLOTS take
+ * turns this way, over several superframes
+ */
+void mac_setCoordinator(const uint8_t *slotOwners, int slots) {
+	if (!coordinator)
+		nextBeacon = monitor_now();
+	coordinator = true;
+	if (mode == MAC_SLOTTED_ALOHA) {
+		beaconSlots = MAC_ALOHA_SLOTS;
+	}
+	else {
+		if (slots > MAC_TDMA_MAX_SLOTS)
+			slots = MAC_TDMA_MAX_SLOTS;
+		memcpy(beaconSchedule, slotOwners, slots);
+		beaconSlots = slots;
+	}
+}
+
+MAC_MODE mac_getMode() {
+	return mode;
+}
+
+/**
+ * @return the longest frame, in bytes, that may be queued in this mode. Frames of the slotted modes fit a slot,
+ * the token holder and the arbitration winner send whole frames
+ */
+unsigned int mac_maxFrameLen() {
+	bool slotted = mode == MAC_TDMA || mode == MAC_SLOTTED_ALOHA;
+	return slotted ? MAC_SLOT_MAX_FRAME : FP_FRAME_SIZE;
+}
+
+/**
+ * @param dataPending whether the transmitter has frames waiting
+ * @return a link control frame to send ahead of the queued frames, or NULL. Polled by the transmitter
+ * while it is not sending
+ */
+Frame *mac_pollControlFrame(bool dataPending) {
+	uint8_t msg[BEACON_SCHEDULE + MAC_TDMA_MAX_SLOTS];
+
+	if (mode == MAC_TOKEN)
+		return tokenPoll(dataPending);
+
+	if (mode == MAC_CSMA) {
+		Frame *frame = ctsFrame;
+		ctsFrame = NULL;
+		return frame;
+	}
+
+	if (!coordinator || (int32_t)(monitor_now() - nextBeacon) < 0)
+		return NULL;
+
+	int owners = mode == MAC_TDMA ? beaconSlots : 0;
+	msg[BEACON_SEQ] = seq++;
+	msg[BEACON_SLOTS] = beaconSlots;
+	memcpy(&msg[BEACON_SCHEDULE], beaconSchedule, owners);
+	Frame *frame = controlFrame(PH_TYPE_BEACON, 0xFF, msg, BEACON_SCHEDULE + owners);
+
+	// realigned once the beacon is heard back on the line
+	if (frame)
+		nextBeacon = monitor_now() + (1 + beaconSlots) * MAC_SLOT_US;
+	return frame;
+}
+
+/**
+ * @param bits length of the frame on the line
+ * @return true if the frame may be started now. The monitor must still be IDLE
+ */
+bool mac_mayTransmit(const Frame *frame, unsigned int bits) {
+	if (mode == MAC_CSMA || mode == MAC_ARBITRATION)
+		return true;
+
+	// link control frames go out as soon as they are made. other packets wait their turn like data
+	uint8_t type = PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]);
+	if (PH_IS_LINK_CONTROL(type))
+		return true;
+
+	switch (mode) {
+	case MAC_TDMA:
+		return tdmaMayTransmit(bits);
+	case MAC_SLOTTED_ALOHA:
+		return alohaMayTransmit(bits);
+	default: {
+		// the frame is started right away, so it counts against the hold
+		uint32_t mask = critical_enter();
+		bool may = tokenState == TK_HOLDING && tokenFrames < MAC_TOKEN_MAX_FRAMES;
+		if (may)
+			tokenFrames++;
+		critical_exit(mask);
+		return may;
+	}
+	}
+}
+
+/**
+ * @return the arbitration bits sent ahead of a frame, MSB first: dominant start bit, priority, this node's
+ * address, recessive delimiter
+ */
+uint16_t mac_arbitrationField(uint8_t priority) {
+	priority &= (1 << MAC_ARB_PRIORITY_BITS) - 1;
+	return (priority << 9) | (addr << 1) | 1;
+}
+
+/**
+ * called by the transmitter when its frame collided. Slotted ALOHA backs off, a token holder drops its token
+ * as another node must think it has one too, and TDMA retries in the next owned slot
+ */
+void mac_onCollision() {
+	collided = true;
+}
+
+/**
+ * token mode: leaves the ring the next time this node holds the token
+ */
+void mac_leave() {
+	if (tokenState != TK_OFF)
+		leavePending = true;
+}
+
+/**
+ * token mode: rejoins the ring, at the next solicit or by regenerating the token if the line is quiet
+ */
+void mac_join() {
+	leavePending = false;
+	if (tokenState == TK_OFF)
+		tokenState = TK_IDLE;
+}
+
+/**
+ * handles link control frames received on the line
+ * @return true if the frame was one, it should not be displayed
+ */
+bool mac_onFrame(const Frame *frame) {
+	static PacketHeader pkt;
+
+	if (frame->len < PH_OVERHEAD)
+		return false;
+
+	// ARQ, time sync and routed packets are sent like data, and are for those modules
+	uint8_t type = PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]);
+	if (!PH_IS_LINK_CONTROL(type)) {
+		// a token holder hearing another node's data has a duplicate token
+		if (mode == MAC_TOKEN && tokenState == TK_HOLDING && frame->data[PH_SRC_OFFSET] != addr) {
+			llc_report(LLC_EV_TOKEN_DUPLICATE, LINK_PRIMARY, 0, 0, NULL);
+			tokenState = TK_IDLE;
+		}
+		return false;
+	}
+	// a corrupted control frame is still not for display
+	if (!ph_parse(&pkt, frame->data, frame->len))
+		return true;
+
+	switch (PH_GET_TYPE(pkt.crc_flag)) {
+	case PH_TYPE_BEACON:
+		if (mode == MAC_CSMA || pkt.length < BEACON_SCHEDULE)
+			break;
+		if (!synced)
+			llc_report(LLC_EV_MAC_SYNCED, LINK_PRIMARY, pkt.src, pkt.msg[BEACON_SLOTS], NULL);
+		synced = true;
+		superframeStart = frame->stamps[FP_FIRST_EDGE];
+		numSlots = pkt.msg[BEACON_SLOTS];
+		if (mode == MAC_TDMA) {
+			if (numSlots > MAC_TDMA_MAX_SLOTS)
+				numSlots = MAC_TDMA_MAX_SLOTS;
+			if (numSlots > pkt.length - BEACON_SCHEDULE)
+				numSlots = pkt.length - BEACON_SCHEDULE;
+			memcpy(schedule, &pkt.msg[BEACON_SCHEDULE], numSlots);
+		}
+		if (coordinator)
+			nextBeacon = superframeStart + superframeUs();
+		break;
+	case PH_TYPE_RTS:
+	case PH_TYPE_CTS:
+		if (mode == MAC_CSMA && pkt.length >= RESERVATION_LEN)
+			reservationOnFrame(&pkt);
+		break;
+	default:
+		if (mode == MAC_TOKEN)
+			tokenOnFrame(&pkt);
+		break;
+	}
+	return true;
+}
+
+/**
+ * sets the length above which data frames reserve the line in CSMA, 0 turns RTS/CTS off
+ */
+void mac_setRtsThreshold(unsigned int bytes) {
+	rtsThreshold = bytes;
+}
+
+/**
+ * @return true if the frame should be sent with an RTS/CTS exchange
+ */
+bool mac_needsReservation(const Frame *frame) {
+	if (mode != MAC_CSMA || !rtsThreshold || frame->len <= rtsThreshold || frame->len < PH_OVERHEAD)
+		return false;
+	uint8_t type = PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]);
+	return (type == PH_TYPE_DATA || type == PH_TYPE_ROUTED || type == PH_TYPE_STAMPED) && frame->data[PH_DEST_OFFSET] != 0xFF;
+}
+
+/**
+ * starts a reservation for a frame that won the line. The RTS goes out in its place, right away
+ * @param bits length of the frame on the line
+ * @return the RTS, in the class of the frame. NULL if no frame is free
+ */
+Frame *mac_requestToSend(const Frame *frame, unsigned int bits) {
+	uint32_t ctsUs = frameUs(HDLC_MAX_STUFFED_BITS(PH_OVERHEAD + RESERVATION_LEN));
+
+	Frame *rts = reservationFrame(PH_TYPE_RTS, frame->data[PH_DEST_OFFSET],
+			MAC_TURNAROUND_US + ctsUs + MAC_TURNAROUND_US + frameUs(bits));
+	if (!rts)
+		return NULL;
+	rts->cls = frame->cls;
+
+	reservation = MAC_RES_PENDING;
+	rtsDest = frame->data[PH_DEST_OFFSET];
+	ctsDeadline = monitor_now() + frameUs(HDLC_MAX_STUFFED_BITS(rts->len)) + MAC_TURNAROUND_US + ctsUs
+			+ MAC_SLOT_GUARD_US;
+	// the transmitter finds the reservation FAILED past the deadline
+	tw_start(&ctsTimer, ctsDeadline - monitor_now() + 1, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+	return rts;
+}
+
+/**
+ * @return the state of the reservation started by mac_requestToSend
+ */
+MAC_RESERVATION mac_reservation() {
+	if (reservation == MAC_RES_PENDING && (int32_t)(monitor_now() - ctsDeadline) > 0)
+		reservation = MAC_RES_FAILED;
+	return reservation;
+}
+
+/**
+ * the transmitter is done with the reservation: the frame went out, or it gave up on it
+ */
+void mac_endReservation() {
+	reservation = MAC_RES_NONE;
+}
+
+/**
+ * @return a packet of the given type, from this node, in a pool frame. NULL if no frame is free
+ */
+static Frame *controlFrame(PH_TYPE type, uint8_t dest, const uint8_t *msg, int size) {
+	static PacketHeader pkt;
+
+	Frame *frame = fp_alloc();
+	if (!frame)
+		return NULL;
+
+	ph_create(&pkt, addr, dest, true, msg, size);
+	PH_SET_TYPE(&pkt, type);
+	// link control is what keeps the MAC going, it goes ahead of any data
+	PH_SET_CLASS(&pkt, PH_CLASS_VOICE);
+	frame->cls = PH_CLASS_VOICE;
+	frame->len = ph_serialize(frame->data, &pkt);
+	return frame;
+}
+
+/**
+ * @return an RTS or CTS reserving the line for the given time after its end, NULL if no frame is free
+ */
+static Frame *reservationFrame(PH_TYPE type, uint8_t dest, uint32_t us) {
+	uint8_t msg[RESERVATION_LEN];
+
+	for (int i = 0; i < RESERVATION_LEN; i++)
+		msg[i] = us >> 8*(RESERVATION_LEN-1 - i);
+	return controlFrame(type, dest, msg, RESERVATION_LEN);
+}
+
+/**
+ * @return the time a frame holds the line, until the monitor is IDLE again
+ */
+static inline uint32_t frameUs(unsigned int bits) {
+	return bits * MAC_BIT_US + TRANSMISSION_TIMEOUT_US;
+}
+
+/**
+ * CSMA handling of a received RTS or CTS. Nodes it isn't for defer for the duration it carries, the destination
+ * of an RTS answers it, and the CTS grants the reservation
+ */
+static void reservationOnFrame(const PacketHeader *pkt) {
+	uint32_t us = 0;
+
+	// our own, heard back on the line
+	if (pkt->src == addr)
+		return;
+
+	for (int i = 0; i < RESERVATION_LEN; i++)
+		us = us << 8 | pkt->msg[i];
+
+	if (pkt->dest != addr) {
+		monitor_setNav(LINK_PRIMARY, monitor_now() + us);
+		return;
+	}
+
+	if (PH_GET_TYPE(pkt->crc_flag) == PH_TYPE_CTS) {
+		if (reservation == MAC_RES_PENDING && pkt->src == rtsDest)
+			reservation = MAC_RES_GRANTED;
+		return;
+	}
+
+	// an RTS for this node isn't answered while the line is reserved for someone else
+	if (monitor_navActive(LINK_PRIMARY))
+		return;
+	uint32_t ctsUs = MAC_TURNAROUND_US + frameUs(HDLC_MAX_STUFFED_BITS(PH_OVERHEAD + RESERVATION_LEN));
+	if (ctsFrame)
+		fp_free(ctsFrame);
+	ctsFrame = reservationFrame(PH_TYPE_CTS, pkt->src, us > ctsUs ? us - ctsUs : 0);
+}
+
+/**
+ * @return the length of a superframe, the beacon slot and every other slot
+ */
+static inline uint32_t superframeUs() {
+	return (1 + numSlots) * MAC_SLOT_US;
+}
+
+/**
+ * @param t set to the time since the start of the superframe
+ * @return false if not synced to a beacon. Also called from the transmitter ISR in stream mode,
+ * so losing the beacons isn't printed. The next beacon resyncs
+ */
+static bool slotTime(uint32_t *t) {
+	if (!synced)
+		return false;
+
+	*t = monitor_now() - superframeStart;
+	if (*t >= MAC_BEACON_LOSS * superframeUs()) {
+		synced = false;
+		return false;
+	}
+	*t %= superframeUs();
+	return true;
+}
+
+/**
+ * a frame may start in a slot this node owns, if it ends with the line IDLE again before the slot is over
+ */
+static bool tdmaMayTransmit(unsigned int bits) {
+	uint32_t t;
+	if (!slotTime(&t))
+		return false;
+
+	// slot 0 is the beacon's, and past the last slot the next beacon is late
+	int slot = t / MAC_SLOT_US - 1;
+	if (slot < 0 || slot >= numSlots || schedule[slot] != addr)
+		return false;
+
+	uint32_t left = (slot + 2) * MAC_SLOT_US - t;
+	return bits * MAC_BIT_US + TRANSMISSION_TIMEOUT_US <= left;
+}
+
+/**
+ * a frame may start right at the start of any slot but the beacon's, unless it is backing off
+ */
+static bool alohaMayTransmit(unsigned int bits) {
+	uint32_t t;
+	if (!slotTime(&t))
+		return false;
+
+	int slot = t / MAC_SLOT_US - 1;
+	uint32_t intoSlot = t % MAC_SLOT_US;
+	if (slot < 0 || slot >= numSlots)
+		return false;
+
+	// retry after a random number of slots, counted from the start of the current one
+	if (collided) {
+		collided = false;
+		backoffUntil = monitor_now() - intoSlot + (1 + rand() % MAC_ALOHA_BACKOFF_SLOTS) * MAC_SLOT_US;
+		backingOff = true;
+	}
+	if (backingOff) {
+		if ((int32_t)(monitor_now() - backoffUntil) < 0)
+			return false;
+		backingOff = false;
+	}
+
+	return intoSlot < MAC_ALOHA_START_US && bits * MAC_BIT_US + TRANSMISSION_TIMEOUT_US <= MAC_SLOT_US - intoSlot;
+}
+
+/**
+ * token mode state machine, run from the main routine through mac_pollControlFrame
+ */
+static Frame *tokenPoll(bool dataPending) {
+	uint8_t none = 0;
+	uint32_t now = monitor_now();
+	bool quiet = monitor_getState(LINK_PRIMARY) == MS_IDLE;
+
+	// another node thinks it holds the token too
+	if (collided) {
+		collided = false;
+		if (tokenState == TK_HOLDING) {
+			llc_report(LLC_EV_TOKEN_COLLISION, LINK_PRIMARY, 0, 0, NULL);
+			tokenState = TK_IDLE;
+		}
+	}
+
+	switch (tokenState) {
+	case TK_IDLE:
+		if (joinPending) {
+			joinPending = false;
+			return controlFrame(PH_TYPE_JOIN, solicitor, &none, 1);
+		}
+		// the lowest address sees the quiet line first and regenerates the token
+		if (quiet && now - monitor_getLastEdge(LINK_PRIMARY) >= MAC_TOKEN_LOSS_US + addr * MAC_TOKEN_CLAIM_STEP_US) {
+			llc_report(LLC_EV_TOKEN_LOST, LINK_PRIMARY, 0, 0, NULL);
+			holdToken(0);
+			passTries = 0;
+			inRing = true;
+		}
+		return NULL;
+
+	case TK_HOLDING: {
+		// what is queued still goes out, the token then leaves with the last pass
+		if (leavePending && !dataPending) {
+			leavePending = false;
+			leaving = true;
+		}
+		// the other nodes take a line quiet for MAC_TOKEN_LOSS_US for a lost token, a holder that isn't sending
+		// passes it on well before
+		bool stalled = quiet && now - monitor_getLastEdge(LINK_PRIMARY) >= MAC_TOKEN_KEEPALIVE_US;
+		if (dataPending && tokenFrames < MAC_TOKEN_MAX_FRAMES && !stalled)
+			return NULL;
+		if (now - lastSolicit >= MAC_TOKEN_SOLICIT_US) {
+			Frame *frame = controlFrame(PH_TYPE_SOLICIT, 0xFF, &none, 1);
+			if (frame) {
+				lastSolicit = tokenSince = now;
+				tokenHeard = false;
+				tokenState = TK_SOLICITING;
+			}
+			return frame;
+		}
+		passTries = 0;
+		Frame *frame = passToken(false);
+		// alone in the ring the token is kept, and passed to this node itself to keep the line from going quiet
+		if (!frame && tokenState == TK_HOLDING && stalled)
+			frame = controlFrame(PH_TYPE_TOKEN, addr, &none, 1);
+		return frame;
+	}
+
+	case TK_SOLICITING:
+		// the window starts once the solicit is heard, if it never is it still ends
+		if (!quiet || now - tokenSince < MAC_TOKEN_JOIN_WINDOW_US)
+			return NULL;
+		passTries = 0;
+		return passToken(false);
+
+	case TK_PASSING:
+		// any transmission after the token was heard is the successor's
+		if (tokenHeard && (int32_t)(monitor_getLastEdge(LINK_PRIMARY) - tokenSince) > 0) {
+			if (leaving) {
+				llc_report(LLC_EV_TOKEN_LEFT, LINK_PRIMARY, 0, 0, NULL);
+				tokenState = TK_OFF;
+				leaving = inRing = false;
+			}
+			else {
+				tokenState = TK_IDLE;
+			}
+			return NULL;
+		}
+		if (!quiet || now - tokenSince < MAC_TOKEN_PASS_US)
+			return NULL;
+		// retry once, then the successor is gone
+		if (++passTries >= 2) {
+			llc_report(LLC_EV_TOKEN_REMOVED, LINK_PRIMARY, successor, 0, NULL);
+			members[successor/32] &= ~(1UL << (successor%32));
+			passTries = 0;
+		}
+		return passToken(passTries > 0);
+
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * takes the token, with a number of the frames of the hold already used
+ */
+static void holdToken(int used) {
+	uint32_t mask = critical_enter();
+	tokenFrames = used;
+	tokenState = TK_HOLDING;
+	critical_exit(mask);
+}
+
+/**
+ * passes the token to the next address in the ring. Alone in the ring, the token is kept
+ * @param retry the token goes to the same successor again
+ */
+static Frame *passToken(bool retry) {
+	uint8_t flags = leaving ? TOKEN_LEAVING : 0;
+
+	if (!retry)
+		successor = nextMember(addr);
+
+	if (successor == addr) {
+		if (leaving) {
+			llc_report(LLC_EV_TOKEN_LEFT, LINK_PRIMARY, 0, 0, NULL);
+			tokenState = TK_OFF;
+			leaving = inRing = false;
+		}
+		else {
+			holdToken(0);
+		}
+		return NULL;
+	}
+
+	Frame *frame = controlFrame(PH_TYPE_TOKEN, successor, &flags, 1);
+	if (frame) {
+		tokenState = TK_PASSING;
+		tokenSince = monitor_now();
+		tokenHeard = false;
+	}
+	return frame;
+}
+
+/**
+ * token mode handling of a received link control packet
+ */
+static void tokenOnFrame(const PacketHeader *pkt) {
+	uint8_t type = PH_GET_TYPE(pkt->crc_flag);
+
+	// our own frames, heard back on the line. The waits they start begin at their end
+	if (pkt->src == addr) {
+		if ((type == PH_TYPE_TOKEN && tokenState == TK_PASSING) || (type == PH_TYPE_SOLICIT && tokenState == TK_SOLICITING)) {
+			tokenSince = monitor_now();
+			tokenHeard = true;
+		}
+		return;
+	}
+
+	// a leaving node's last pass
+	if (type == PH_TYPE_TOKEN && (pkt->msg[0] & TOKEN_LEAVING))
+		members[pkt->src/32] &= ~(1UL << (pkt->src%32));
+	else
+		members[pkt->src/32] |= 1UL << (pkt->src%32);
+
+	if (tokenState == TK_HOLDING && type != PH_TYPE_JOIN) {
+		llc_report(LLC_EV_TOKEN_DUPLICATE, LINK_PRIMARY, 0, 0, NULL);
+		tokenState = TK_IDLE;
+	}
+
+	switch (type) {
+	case PH_TYPE_TOKEN:
+		if (pkt->dest != addr) {
+			// passed over, the holder doesn't know of this node. A pass to the holder itself skips everyone
+			unsigned int span = (uint8_t)(pkt->dest - pkt->src) ? (uint8_t)(pkt->dest - pkt->src) : 256;
+			if (inRing && tokenState == TK_IDLE && (uint8_t)(addr - pkt->src) < span)
+				inRing = false;
+			break;
+		}
+		// a node that left may still get the token from a node that missed its last pass, it passes it on
+		leaving = tokenState == TK_OFF;
+		inRing = !leaving;
+		holdToken(leaving ? MAC_TOKEN_MAX_FRAMES : 0);
+		passTries = 0;
+		break;
+	case PH_TYPE_SOLICIT:
+		lastSolicit = monitor_now();
+		// joiners answering the same solicit collide, half of them wait for the next one
+		if (!inRing && tokenState == TK_IDLE && (rand() & 1)) {
+			joinPending = true;
+			solicitor = pkt->src;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @return the next address in the ring after from, wrapping around. This node's own address if it is alone
+ */
+static uint8_t nextMember(uint8_t from) {
+	for (int i = 1; i<256; i++) {
+		uint8_t a = from + i;
+		if (a != addr && (members[a/32] & (1UL << (a%32))))
+			return a;
+	}
+	return addr;
+}
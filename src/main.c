@@ -1,7 +1,20 @@
 #include "uart_driver.h"
 #include "tim.h"
-#include "ringbuffer.h"
+#include "framepool.h"
 #include "receiver.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "mac.h"
+#include "arq.h"
+#include "timesync.h"
+#include "network.h"
+#include "bridge.h"
+#include "link.h"
+#include "llc.h"
+#include "chat.h"
+#include "sched.h"
+#include "timerwheel.h"
+#include "isr.h"
 #include "packet_header.h"
 #include <inttypes.h>
 #include <stdio.h>
@@ -9,22 +22,62 @@
 
 // main
 int main(void){
-	// Initiate/start modules
+	// Initiate/start modules. The priorities are grouped before any interrupt is enabled
+	isr_init();
 	init_usart2(19200, F_CPU);
 	ph_init();
+	fp_init();
 
 	const bool EXTI9_ENABLE = false;
 	const bool PACKET_MODE = true;
+	const bool STREAM_MODE = false; // flag delimited frames, sent back-to-back when there's a backlog
 	const uint8_t SRC = 0xAA;
 	const uint8_t DEST = 0xBB;
+	// BER test: the sending node sets BER_TX, the peer BER_RX to the same pattern. Both on one node loop back
+	const BER_PATTERN BER_TX = BER_OFF;
+	const BER_PATTERN BER_RX = BER_OFF;
+	// every MAC but CSMA and ARBITRATION needs PACKET_MODE. In TDMA and slotted ALOHA, one node is the coordinator, and sends
+	// the beacons. In TDMA, these give out the slots in TDMA_SCHEDULE
+	const MAC_MODE MAC = MAC_CSMA;
+	const bool MAC_COORDINATOR = false;
+	const uint8_t TDMA_SCHEDULE[] = {SRC, DEST};
+	// CSMA in PACKET_MODE: data frames longer than this many bytes reserve the line with RTS/CTS. 0 never does
+	const unsigned int RTS_THRESHOLD = MAC_RTS_THRESHOLD;
+	// PACKET_MODE: packets to DEST are acknowledged and retransmitted, with up to this many unacknowledged. 0 is off
+	const unsigned int ARQ_WINDOW = 0;
+	// PACKET_MODE: this node's clock is the bus time, the others synchronize to it. One node at most
+	const bool TIMESYNC_MASTER = false;
+	// PACKET_MODE: {destination, next hop} of nodes beyond the bus, reached through another node
+	const uint8_t ROUTES[][2] = {};
+	const int NUM_ROUTES = sizeof(ROUTES) / sizeof(ROUTES[0]);
+	// PACKET_MODE without STREAM_MODE: the node bridges its bus to a second one on its second interface, see
+	// bridge.h and link.h
+	const bool BRIDGE = false;
 
+	link_init(BRIDGE ? 2 : 1);
 	monitor_start(EXTI9_ENABLE); // exti9_enable = true if transmitter is used alone
-	transmitter_init(SRC, DEST, PACKET_MODE);
-	receiver_init(PACKET_MODE);
+	tw_init();
+	mac_init(MAC, SRC);
+	if (MAC_COORDINATOR)
+		mac_setCoordinator(TDMA_SCHEDULE, sizeof(TDMA_SCHEDULE));
+	mac_setRtsThreshold(RTS_THRESHOLD);
+	arq_init(SRC, ARQ_WINDOW);
+	timesync_init(SRC, PACKET_MODE && TIMESYNC_MASTER);
+	bridge_init(BRIDGE);
+	net_init(SRC);
+	for (int i = 0; i < NUM_ROUTES; i++)
+		net_addRoute(ROUTES[i][0], ROUTES[i][1]);
+	// the uart chat is the application, sending to DEST
+	chat_init(DEST, PACKET_MODE);
+	llc_init(SRC, PACKET_MODE, STREAM_MODE, chat_callbacks());
+	transmitter_setBerTest(BER_TX);
+	receiver_setBerTest(BER_RX);
 
-	// Main routine
-	while (1) {
-		transmitter_mainRoutineUpdate();
-		receiver_mainRoutineUpdate();
-	}
+	// Main routine: the link layer and the chat run as tasks when their events are posted, highest priority
+	// first. Timers go first, their callbacks are short. Received frames go ahead, the uart is the slowest
+	sched_addTask("timers", tw_run, SCHED_EV_TIMER);
+	sched_addTask("rx", llc_pollRx, SCHED_EV_FRAME | SCHED_EV_MONITOR | SCHED_EV_TICK);
+	sched_addTask("tx", llc_pollTx, SCHED_EV_TX | SCHED_EV_MONITOR | SCHED_EV_TICK);
+	sched_addTask("chat", chat_update, SCHED_EV_UART | SCHED_EV_TX);
+	sched_run();
 }
@@ -2,7 +2,13 @@
 #include "delay.h"
 #include "gpio.h"
 #include "io_definitions.h"
+#include "critical.h"
+#include "link.h"
+#include "sched.h"
+#include "timerwheel.h"
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 
 // LED Light Status
 #define LED_IDLE_PB13 (1<<13)
@@ -12,19 +18,51 @@
 // Output mode for LEDs
 #define GPIOB_LEDS_OUTPUT_MODE (0b010101 << 26)
 
-// monitor state as observed on monitor line
-MONITOR_STATE monitorState;
-
-// either 1 or 0, updated by the pin interrupt
-static int lineState;
+// the monitor of one interface
+typedef struct {
+	// monitor state as observed on its line
+	volatile MONITOR_STATE state;
+	// notified of state changes, lets the receiver end frames as soon as the line goes idle
+	MonitorCallback callback;
+	// either 1 or 0, updated by the pin interrupt
+	int lineState;
+	// MONITOR_TIMER count at the last edge. The timeout is due TRANSMISSION_TIMEOUT_US after it
+	volatile uint32_t lastEdge;
+	// MONITOR_TIMER count at the first edge of the transmission, and how long after it the line is BUSY regardless
+	// of edges. The NRZ arbitration field of MAC_ARBITRATION may hold the line low longer than the timeout
+	uint32_t busySince;
+	uint32_t arbitrationUs;
+	// virtual carrier sense: the line is reserved until nav by an overheard RTS or CTS. Dropped by the first edge past it
+	volatile uint32_t nav;
+	volatile bool navSet;
+	// load accounting: totals, the window being accounted, and the estimates of past windows
+	MonitorStats stats;
+	// when the current state started, or the current window if it started later
+	uint32_t stateSince;
+	uint32_t windowStart;
+	uint32_t windowBusy;
+	uint32_t windowTransmissions;
+	uint32_t windowCollisions;
+	volatile uint32_t utilization;
+	volatile uint32_t collisionProbability;
+} MonitorLink;
+
+static MonitorLink monitors[LINK_MAX];
 
 // This macro lets the reciever handles its own interrupt driven logic with PC9.
 // if disabled, no interrupt is hooked on PC9 even though the PC9 line is monitered.
 // (instead, the pin interrupt logic monitor_Edge_Intrr is exposed to be used for a pin connected to PC9)
 static bool exti9Enable;
 
-static inline void updateMonitorState(MONITOR_STATE newState);
+static inline void updateMonitorState(MonitorLink *m, MONITOR_STATE newState, uint32_t at);
+static void initMonitorTimer();
+static void onTimeout(int iface);
+static void accountState(MonitorLink *m, uint32_t until);
+static void advanceWindows(MonitorLink *m, uint32_t now);
 
+/**
+ * starts the monitor of every interface, see link_init
+ */
 void monitor_start(bool exti9_enable) {
 		exti9Enable = exti9_enable;
 		// enable GPIOB and set LEDs for updating monitor status
@@ -42,7 +80,15 @@ void monitor_start(bool exti9_enable) {
 //		enable_output_mode(C, 8);
 //		GPIOC_BASE->ODR &= ~(1<<8);
 
-		updateMonitorState(MS_IDLE);
+		initMonitorTimer();
+		for (int i = 0; i < link_count(); i++) {
+			MonitorLink *m = &monitors[i];
+			// the totals count from here
+			memset(m, 0, sizeof(*m));
+			m->stateSince = m->windowStart = MONITOR_TIMER_BASE->CNT;
+			m->lineState = 1;
+			updateMonitorState(m, MS_IDLE, m->stateSince);
+		}
 
 		setupPinInterrupt();
 }
@@ -50,19 +96,26 @@ void monitor_start(bool exti9_enable) {
 /**
  * returns the monitor state, without exposing the variable outside this module
  */
-MONITOR_STATE monitor_getState() {
-	return monitorState;
+MONITOR_STATE monitor_getState(int iface) {
+	return monitors[iface].state;
+}
+
+/**
+ * registers a function to call from interrupt context whenever the monitor state of an interface changes
+ */
+void monitor_setCallback(int iface, MonitorCallback callback) {
+	monitors[iface].callback = callback;
 }
 
 void setupPinInterrupt(){
 	// Enable Clock to SysCFG
 	*(RCC_APB2ENR) |= 1<<14;
 
-	// Enable Clocks for GPIOC
-	init_GPIO(C);
-
-	// PC4 is input signal to monitor
-	enable_input_mode(C, 4);
+	// the receive pins are the input signals to monitor
+	for (int i = 0; i < link_count(); i++) {
+		init_GPIO(link_configs[i].rxGpio);
+		enable_input_mode(link_configs[i].rxGpio, link_configs[i].rxPin);
+	}
 
 	// in case the monitor module handles its own pin interrupt.
 	if (exti9Enable) {
@@ -80,109 +133,356 @@ void setupPinInterrupt(){
 		// Set to rising edge
 		*(EXTI_RTSR) |= 1<<9;
 
-		// Set priority to max TODO: this was wrong, but worked by coincidence (23->24)
-		*(NVIC_IPR5) |= 0xF0 << 24;
-
-		// Enable Interrupt in NVIC (Vector table interrupt enable)
-		*(NVIC_ISER0) |= 1<<23;
+		// Enable Interrupt in NVIC, at the priority of the edges
+		isr_enableIrq(IRQ_EXTI9_5);
 	}
 }
 
-// configures the systick timer load value to the specified t_us and resets its val
-void configTimer(uint32_t t_us) {
-	// set load
-	*(STK_LOAD) = 16 * t_us; // 1 us = 16
-
-	// reset val
-	*(STK_VAL) = 0;
+/**
+ * starts MONITOR_TIMER free-running over its full 32-bit range. The compare channel of an interface only
+ * interrupts while its line is BUSY, when it holds the timeout deadline
+ */
+static void initMonitorTimer() {
+	enable_timer_clk(MONITOR_TIMER);
+	set_psc(MONITOR_TIMER, MONITOR_TIMER_PSC);
+	set_arr(MONITOR_TIMER, 0xFFFFFFFF);
+	// load the prescaler now, rather than after the first 2^32 ticks
+	MONITOR_TIMER_BASE->EGR |= 1<<UG;
+	clear_cnt(MONITOR_TIMER);
+	start_counter(MONITOR_TIMER);
+	// register and enable within the NVIC
+	log_tim_interrupt(MONITOR_TIMER);
 }
 
-// resets the timer so it time outs after t_us
-void resetTimer(uint32_t t_us) {
-	// disable timer
-	*(STK_CTRL) &= ~(1<<STK_ENABLE_F);
+/**
+ * accounts the entry latency of the MONITOR_TIMER ISR, from the match of a compare channel. The timer counts in us
+ */
+static inline void entered(uint8_t channel) {
+	uint32_t us = MONITOR_TIMER_BASE->CNT - (&MONITOR_TIMER_BASE->CCR1)[channel];
+	isr_entered(ISR_TIM5, us * (F_CPU / 1000000));
+}
 
-	// configure timer
-	// set load
-	*(STK_LOAD) = 16 * t_us; // 1 us = 16
-	// reset val
-	*(STK_VAL) = 0;
+/**
+ * MONITOR_TIMER ISR -- dispatches the compare channels that matched to their interface, and the timer wheel's
+ */
+void TIM5_IRQHandler() {
+	IsrTiming t;
+	isr_start(&t);
+	for (int i = 0; i < link_count(); i++) {
+		uint32_t flag = 1 << (CC1IF + link_configs[i].monitorChannel);
+		if (!(MONITOR_TIMER_BASE->SR & flag) || !(MONITOR_TIMER_BASE->DIER & flag))
+			continue;
+		uint32_t start = link_isrEnter();
+		entered(link_configs[i].monitorChannel);
+		tim_clearFlags(&MONITOR_TIMER_BASE->SR, flag);
+		// the edges preempt this ISR, and move the deadline and the line state it decides on
+		uint32_t mask = critical_enter();
+		onTimeout(i);
+		critical_exit(mask);
+		link_isrExit(i, start);
+	}
 
-	// Turn on counter, and enable interrupt
-	*(STK_CTRL) |= (1<<STK_ENABLE_F) | (1<<STK_CLKSOURCE_F) | (1<<STK_TICKINT_F);
+	uint32_t wheel = 1 << (CC1IF + TW_CHANNEL);
+	if ((MONITOR_TIMER_BASE->SR & wheel) && (MONITOR_TIMER_BASE->DIER & wheel)) {
+		entered(TW_CHANNEL);
+		tim_clearFlags(&MONITOR_TIMER_BASE->SR, wheel);
+		tw_onCompare();
+	}
+	isr_exited(ISR_TIM5, &t);
 }
 
 /**
- * Systick ISR -- used to detect transmission timeout, and sets the state to TS_IDLE or TS_COLLISION
+ * the timeout deadline of an interface was reached. It was set at the first edge of the transmission and
+ * is not moved by the edges after it, so if the line changed since, the real deadline is moved to TRANSMISSION_TIMEOUT_US
+ * after the last edge. Otherwise the transmission timed out and the state is set to TS_IDLE or TS_COLLISION.
  */
-void SysTick_Handler() {
-	// disable timer
-	*(STK_CTRL) &= ~(1<<STK_ENABLE_F);
+static void onTimeout(int iface) {
+	MonitorLink *m = &monitors[iface];
+	uint8_t channel = link_configs[iface].monitorChannel;
+
+	uint32_t edge = m->lastEdge;
+	uint32_t deadline = edge + TRANSMISSION_TIMEOUT_US;
+	if (m->arbitrationUs && (int32_t)(m->busySince + m->arbitrationUs + TRANSMISSION_TIMEOUT_US - deadline) > 0)
+		deadline = m->busySince + m->arbitrationUs + TRANSMISSION_TIMEOUT_US;
+	// signed difference, correct across the counter wrapping. The compare only matches on equality, so the counter
+	// is checked again once the deadline is written: if it went past it meanwhile, the match would only come
+	// after the counter wrapped, and the timeout is taken now instead
+	if ((int32_t)(deadline - MONITOR_TIMER_BASE->CNT) > 0) {
+		(&MONITOR_TIMER_BASE->CCR1)[channel] = deadline;
+		if ((int32_t)(deadline - MONITOR_TIMER_BASE->CNT) > 0)
+			return;
+	}
+
+	MONITOR_TIMER_BASE->DIER &= ~(1 << (CC1IE + channel));
 
 	// TODO: DEBUG toggle every timeout period
 //	*(GPIOC_ODR) ^= (1<<8);
 
 	// set to TS_IDLE or TS_COLLISION based on line state
-	// and update PB13-PB14-PB15
-	if(lineState != 0){
-		updateMonitorState(MS_IDLE);
+	// and update PB13-PB14-PB15. The line has been in that state since the last edge
+	if(m->lineState != 0){
+		updateMonitorState(m, MS_IDLE, edge);
 	}
 	else {
-		updateMonitorState(MS_COLLISION);
+		updateMonitorState(m, MS_COLLISION, edge);
 	}
 }
 
 /**
  * EXTI9_5 ISR -- Updates the line state and sets the transmission state to busy
- * also resets the timeout systick timer
+ * and arms the timeout
  */
 void EXTI9_5_IRQHandler() {
+	IsrTiming t;
+	isr_start(&t);
 	// Verify Interrupt is from EXTI9
 	if ((*(EXTI_PR)&(1<<9)) != 0) {
-		monitor_Edge_Intrr();
+		monitor_onEdge(LINK_PRIMARY);
 		// Clear Interrupt
 		*(EXTI_PR) |= 1<<9;
 	}
+	isr_exited(ISR_EXTI9_5, &t);
 }
 
 /**
- * triggers on EXTI4. EXTI9 is no longer supported. TODO: remomve that, as this merges with the reciever pin, rather than the transmit pin
+ * an edge on the receive pin of an interface, called from the receiver's EXTI ISR. It only timestamps the edge,
+ * the compare ISR moves the deadline from it, see onTimeout. Host instructions per edge, see isrcount_test: 32 with
+ * the SysTick timeout before, 15 with the TIM5 compare, but the compare ISR then ran on 835 of 1000 edges at 31, 41
+ * per edge in all. With the NAV and the arbitration window since, 49 here and 151 in all
  */
-void monitor_Edge_Intrr(){
-		// reset counter
-		resetTimer(TRANSMISSION_TIMEOUT_US);
+void monitor_onEdge(int iface){
+		MonitorLink *m = &monitors[iface];
+		const LinkConfig *cfg = &link_configs[iface];
+
+		// timestamp the edge, the timeout ISR moves its deadline from this
+		m->lastEdge = MONITOR_TIMER_BASE->CNT;
+		if (m->navSet && (int32_t)(m->lastEdge - m->nav) > 0)
+			m->navSet = false;
 		// update line state
-		lineState = (GPIOC_BASE->IDR &(1<<4))>>4;
-		// change state
-		updateMonitorState(MS_BUSY);
+		m->lineState = read_pin(cfg->rxGpio, cfg->rxPin);
+		// only the first edge of a transmission changes state, and arms the timeout
+		if (m->state != MS_BUSY) {
+			updateMonitorState(m, MS_BUSY, m->lastEdge);
+			m->busySince = m->lastEdge;
+			(&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel] = m->lastEdge + m->arbitrationUs + TRANSMISSION_TIMEOUT_US;
+			// the compare also matches while disarmed, drop that
+			tim_clearFlags(&MONITOR_TIMER_BASE->SR, 1 << (CC1IF + cfg->monitorChannel));
+			MONITOR_TIMER_BASE->DIER |= 1 << (CC1IE + cfg->monitorChannel);
+		}
 }
 
 /**
  * if the monitor state is busy, this forces it to collission. This is for testing purposes, mainly.
  */
-void monitor_jam(){
-	if (monitorState == MS_BUSY) {
-		updateMonitorState(MS_COLLISION);
+void monitor_jam(int iface){
+	if (monitors[iface].state == MS_BUSY) {
+		updateMonitorState(&monitors[iface], MS_COLLISION, MONITOR_TIMER_BASE->CNT);
+	}
+}
+
+/**
+ * keeps the line BUSY for this long after the first edge of a transmission, whatever its edges. 0 to disable
+ */
+void monitor_setArbitrationWindow(int iface, uint32_t us) {
+	monitors[iface].arbitrationUs = us;
+}
+
+/**
+ * @return the MONITOR_TIMER time in us. Wraps around, compare times by their unsigned difference
+ */
+uint32_t monitor_now() {
+	return MONITOR_TIMER_BASE->CNT;
+}
+
+/**
+ * @return the MONITOR_TIMER time of the last edge seen on the line
+ */
+uint32_t monitor_getLastEdge(int iface) {
+	return monitors[iface].lastEdge;
+}
+
+/**
+ * reserves the line for another node's frame exchange until the given MONITOR_TIMER time. Only ever extends
+ * the reservation
+ */
+void monitor_setNav(int iface, uint32_t until) {
+	MonitorLink *m = &monitors[iface];
+	uint32_t mask = critical_enter();
+	if (!m->navSet || (int32_t)(until - m->nav) > 0) {
+		m->nav = until;
+		m->navSet = true;
+	}
+	critical_exit(mask);
+}
+
+/**
+ * @return true while the line is reserved by an overheard RTS or CTS, even though it may be IDLE
+ */
+bool monitor_navActive(int iface) {
+	return monitors[iface].navSet && (int32_t)(monitors[iface].nav - MONITOR_TIMER_BASE->CNT) > 0;
+}
+
+/**
+ * @return the MONITOR_TIMER time the line is free from: when it went IDLE after its last edge, or the end of the
+ * reservation if that is later. In the future while BUSY or reserved
+ */
+uint32_t monitor_getIdleSince(int iface) {
+	MonitorLink *m = &monitors[iface];
+	uint32_t mask = critical_enter();
+	uint32_t since = m->lastEdge + TRANSMISSION_TIMEOUT_US;
+	if (m->navSet && (int32_t)(m->nav - since) > 0)
+		since = m->nav;
+	critical_exit(mask);
+	return since;
+}
+
+/**
+ * @return the EWMA of the fraction of time the line was busy, MONITOR_Q16_ONE meaning always
+ */
+uint32_t monitor_getUtilization(int iface) {
+	uint32_t mask = critical_enter();
+	advanceWindows(&monitors[iface], MONITOR_TIMER_BASE->CNT);
+	critical_exit(mask);
+	return monitors[iface].utilization;
+}
+
+/**
+ * @return the EWMA of the fraction of transmissions that ended in a collision, MONITOR_Q16_ONE meaning all
+ */
+uint32_t monitor_getCollisionProbability(int iface) {
+	uint32_t mask = critical_enter();
+	advanceWindows(&monitors[iface], MONITOR_TIMER_BASE->CNT);
+	critical_exit(mask);
+	return monitors[iface].collisionProbability;
+}
+
+/**
+ * copies the running totals, including the time spent in the current state so far
+ */
+void monitor_getStats(int iface, MonitorStats *out) {
+	MonitorLink *m = &monitors[iface];
+	uint32_t mask = critical_enter();
+	advanceWindows(m, MONITOR_TIMER_BASE->CNT);
+	accountState(m, MONITOR_TIMER_BASE->CNT);
+	*out = m->stats;
+	critical_exit(mask);
+}
+
+/**
+ * prints the load statistics of every interface, and the share of the CPU their ISRs take
+ */
+void monitor_printLoad() {
+	for (int i = 0; i < link_count(); i++) {
+		MonitorStats s;
+		monitor_getStats(i, &s);
+		uint32_t u = monitor_getUtilization(i), p = monitor_getCollisionProbability(i);
+
+		printf("<< interface %d load: utilization=%lu%% collision probability=%lu%%\r\n", i,
+				(unsigned long)(u * 100 >> 16), (unsigned long)(p * 100 >> 16));
+		printf("<< idle=%lu ms busy=%lu ms collision=%lu ms, transmissions=%lu collisions=%lu\r\n",
+				(unsigned long)(s.idleUs / 1000), (unsigned long)(s.busyUs / 1000), (unsigned long)(s.collisionUs / 1000),
+				(unsigned long)s.transmissions, (unsigned long)s.collisions);
+	}
+	link_printLoad();
+}
+
+/**
+ * adds the time spent in the current state, from stateSince until the given time, to the totals and the window
+ */
+static void accountState(MonitorLink *m, uint32_t until) {
+	uint32_t elapsed = until - m->stateSince;
+	// a timeout dates its transition back to the last edge, which may be before a window a reader already closed
+	if ((int32_t)elapsed < 0)
+		return;
+
+	m->stateSince = until;
+	if (m->state == MS_IDLE) {
+		m->stats.idleUs += elapsed;
+		return;
+	}
+	m->stats.busyUs += elapsed;
+	m->windowBusy += elapsed;
+	if (m->state == MS_COLLISION)
+		m->stats.collisionUs += elapsed;
+}
+
+/**
+ * closes every window that ended before now, folding each into the estimates
+ */
+static void advanceWindows(MonitorLink *m, uint32_t now) {
+	uint32_t behind = (now - m->windowStart) / MONITOR_LOAD_WINDOW_US;
+
+	// a long stretch in one state leaves nothing of the older estimate, only the last windows need folding in
+	if (behind > MONITOR_MAX_WINDOWS) {
+		m->windowStart += (behind - MONITOR_MAX_WINDOWS) * MONITOR_LOAD_WINDOW_US;
+		if ((int32_t)(m->windowStart - m->stateSince) > 0)
+			accountState(m, m->windowStart);
+		m->windowBusy = m->windowTransmissions = m->windowCollisions = 0;
+	}
+
+	while (now - m->windowStart >= MONITOR_LOAD_WINDOW_US) {
+		uint32_t windowEnd = m->windowStart + MONITOR_LOAD_WINDOW_US;
+		if ((int32_t)(windowEnd - m->stateSince) > 0)
+			accountState(m, windowEnd);
+
+		int32_t sample = m->windowBusy >= MONITOR_LOAD_WINDOW_US ? MONITOR_Q16_ONE
+				: (int32_t)(((uint64_t)m->windowBusy << 16) / MONITOR_LOAD_WINDOW_US);
+		m->utilization += (sample - (int32_t)m->utilization) >> MONITOR_EWMA_SHIFT;
+
+		// with no transmission there is nothing to say about collisions
+		if (m->windowTransmissions) {
+			sample = m->windowCollisions >= m->windowTransmissions ? MONITOR_Q16_ONE
+					: (int32_t)((m->windowCollisions << 16) / m->windowTransmissions);
+			m->collisionProbability += (sample - (int32_t)m->collisionProbability) >> MONITOR_EWMA_SHIFT;
+		}
+
+		m->windowStart = windowEnd;
+		m->windowBusy = m->windowTransmissions = m->windowCollisions = 0;
 	}
 }
 
 /**
- * updates the monitor_state, as well as output signals indicating the state
+ * updates the monitor state of an interface, as well as output signals indicating the state of the primary one
+ * @param at MONITOR_TIMER time the line entered the new state, for the load accounting
  */
-static inline void updateMonitorState(MONITOR_STATE newState) {
-	GPIOB_BASE->ODR &= ~(0b111 << 13);
-	switch (newState) {
-	case MS_IDLE:
-		monitorState = MS_IDLE;
-		GPIOB_BASE->ODR |= (LED_IDLE_PB13);
-		break;
-	case MS_BUSY:
-		monitorState = MS_BUSY;
-		GPIOB_BASE->ODR |= (LED_BUSY_PB14);
-		break;
-	case MS_COLLISION:
-		monitorState = MS_COLLISION;
-		GPIOB_BASE->ODR |= (LED_COLLISION_PB15);
-		break;
+static inline void updateMonitorState(MonitorLink *m, MONITOR_STATE newState, uint32_t at) {
+	MONITOR_STATE oldState = m->state;
+
+	if (newState != oldState) {
+		advanceWindows(m, at);
+		accountState(m, at);
+		if (newState == MS_BUSY && oldState == MS_IDLE) {
+			m->stats.transmissions++;
+			m->windowTransmissions++;
+		}
+		else if (newState == MS_COLLISION) {
+			m->stats.collisions++;
+			m->windowCollisions++;
+		}
+	}
+	m->state = newState;
+
+	if (m == &monitors[LINK_PRIMARY]) {
+		// a single write resets the LEDs and sets the one of the state, a set wins over a reset in BSRR
+		uint32_t leds = (0b111 << 13) << BSRR_RESET;
+		switch (newState) {
+		case MS_IDLE:
+			leds |= LED_IDLE_PB13;
+			break;
+		case MS_BUSY:
+			leds |= LED_BUSY_PB14;
+			break;
+		case MS_COLLISION:
+			leds |= LED_COLLISION_PB15;
+			break;
+		}
+		gpio_writeBsrr(GPIOB_BASE, leds);
+	}
+
+	if (newState != oldState) {
+		if (m->callback)
+			m->callback(m - monitors, newState);
+		// the transmitter waits on the line
+		sched_post(SCHED_EV_MONITOR);
 	}
 }
@@ -0,0 +1,153 @@
+/**
+ * @file network.c
+ * Network layer, see network.h
+ */
+
+#include "network.h"
+#include "packet_header.h"
+#include <stdio.h>
+#include <string.h>
+
+// network header of a ROUTED packet, offsets in its message
+#define NET_ORIGIN 0
+#define NET_DEST 1
+#define NET_TTL 2
+
+static uint8_t addr = 0;
+// next hop of every destination, the destination itself when it is on the bus
+static uint8_t nextHop[256];
+// packets to send on, and packets for this node with the network header removed
+static FrameQueue forwarded = {0};
+static FrameQueue delivered = {0};
+// counters for net_print
+static uint32_t forwardCount = 0;
+static uint32_t deliverCount = 0;
+static uint32_t expiredCount = 0;
+
+static void setHop(Frame *frame, uint8_t dest);
+
+void net_init(uint8_t net_addr) {
+	addr = net_addr;
+	for (int i = 0; i < 256; i++)
+		nextHop[i] = i;
+}
+
+/**
+ * packets to dest are sent through via. A route to dest through itself makes it reached directly again
+ */
+void net_addRoute(uint8_t dest, uint8_t via) {
+	nextHop[dest] = via;
+}
+
+/**
+ * @return true if packets to dest go through another node, and must be ROUTED
+ */
+bool net_isRouted(uint8_t dest) {
+	return dest != 0xFF && nextHop[dest] != dest;
+}
+
+/**
+ * makes a serialized data packet from this node a ROUTED packet to the next hop of its destination:
+ * inserts the network header in its message. The message must have room for the header
+ */
+void net_route(Frame *frame) {
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	uint8_t len = frame->data[PH_LENGTH_OFFSET];
+	uint8_t dest = frame->data[PH_DEST_OFFSET];
+
+	memmove(msg + NET_HEADER_LEN, msg, len);
+	msg[NET_ORIGIN] = addr;
+	msg[NET_DEST] = dest;
+	msg[NET_TTL] = NET_DEFAULT_TTL;
+	frame->data[PH_LENGTH_OFFSET] = len + NET_HEADER_LEN;
+	frame->len += NET_HEADER_LEN;
+	frame->data[PH_FLAGS_OFFSET] = (frame->data[PH_FLAGS_OFFSET] & ~PH_TYPE_MASK) | PH_TYPE_ROUTED << PH_TYPE_SHIFT;
+	setHop(frame, dest);
+}
+
+/**
+ * handles a received ROUTED packet: delivers it if it is for this node, see net_pollDelivery, or else sends it on
+ * @return true if the network layer took the frame, the receiver must not display or free it
+ */
+bool net_onFrame(Frame *frame) {
+	static PacketHeader pkt;
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET];
+	uint8_t *msg = &frame->data[PH_MSG_OFFSET];
+	uint8_t len;
+
+	if (frame->len < PH_OVERHEAD || PH_GET_TYPE(flags) != PH_TYPE_ROUTED)
+		return false;
+	// a corrupted packet can't be trusted to be sent on, it is displayed as invalid
+	if (!ph_parse(&pkt, frame->data, frame->len) || pkt.length < NET_HEADER_LEN)
+		return false;
+	len = pkt.length;
+
+	// hops between other nodes, and our own packets heard back
+	if (frame->data[PH_DEST_OFFSET] != addr) {
+		fp_free(frame);
+		return true;
+	}
+
+	// for this node: back to a data packet from the node it comes from
+	if (msg[NET_DEST] == addr) {
+		frame->data[PH_SRC_OFFSET] = msg[NET_ORIGIN];
+		frame->data[PH_DEST_OFFSET] = addr;
+		frame->data[PH_FLAGS_OFFSET] = flags & ~PH_TYPE_MASK;
+		len -= NET_HEADER_LEN;
+		memmove(msg, msg + NET_HEADER_LEN, len);
+		frame->data[PH_LENGTH_OFFSET] = len;
+		frame->len -= NET_HEADER_LEN;
+		frame->data[frame->len-1] = (flags & PH_CRC_FLAG) ? ph_compute_fcs(&frame->data[PH_SRC_OFFSET]) : 0xAA;
+		fq_push(&delivered, frame);
+		deliverCount++;
+		return true;
+	}
+
+	if (msg[NET_TTL] <= 1) {
+		fp_free(frame);
+		expiredCount++;
+		return true;
+	}
+	msg[NET_TTL]--;
+	frame->data[PH_SRC_OFFSET] = addr;
+	frame->cls = PH_GET_CLASS(flags);
+	setHop(frame, msg[NET_DEST]);
+	fq_push(&forwarded, frame);
+	forwardCount++;
+	return true;
+}
+
+/**
+ * @return a packet to send on, to queue for transmission in its traffic class. NULL if there is none
+ */
+Frame *net_pollFrame() {
+	return fq_pop(&forwarded);
+}
+
+/**
+ * @return the next received packet for this node to display, without its network header. NULL if there is none
+ */
+Frame *net_pollDelivery() {
+	return fq_pop(&delivered);
+}
+
+/**
+ * prints the routes and forwarding counters
+ */
+void net_print() {
+	for (int i = 0; i < 256; i++) {
+		if (nextHop[i] != i)
+			printf(">> net: %x via %x\r\n", i, nextHop[i]);
+	}
+	printf(">> net: forwarded=%lu delivered=%lu ttl expired=%lu\r\n", (unsigned long)forwardCount,
+			(unsigned long)deliverCount, (unsigned long)expiredCount);
+}
+
+/**
+ * addresses a ROUTED packet to the next hop of dest, and updates its CRC for the new header
+ */
+static void setHop(Frame *frame, uint8_t dest) {
+	frame->data[PH_DEST_OFFSET] = nextHop[dest];
+	if (frame->data[PH_FLAGS_OFFSET] & PH_CRC_FLAG)
+		frame->data[frame->len-1] = ph_compute_fcs(&frame->data[PH_SRC_OFFSET]);
+}
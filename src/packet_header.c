@@ -7,6 +7,7 @@
 
 #include "packet_header.h"
 #include <stdlib.h>
+#include <string.h>
 
 // Polynomial: x^8+x^2+x+1, as per the CRC-8-CCITT standard. (do not include the highest degree polynomial: X^8)
 #define CRC8_POLYNOMIAL ((1<<2)|(1<<1)|(1<<0))
@@ -40,7 +41,7 @@ void ph_create(PacketHeader *out, uint8_t src, uint8_t dest, bool crc_flag, cons
 	out->crc_flag = crc_flag;
 	memcpy(out->msg, msg, size);
 	if (out->crc_flag)
-		out->crc8_fcs = ph_compute_crc8(out->msg, out->length);
+		out->crc8_fcs = ph_compute_fcs(&out->src);
 	else
 		out->crc8_fcs = 0xAA;
 }
@@ -49,9 +50,9 @@ void ph_create(PacketHeader *out, uint8_t src, uint8_t dest, bool crc_flag, cons
  * Parses the header from a buffer message.
  * if the format of the header is invalid, false is returned.
  * Invalid format is:
- *	- buffer too small to encode full content
- * 	- crc_flag is 0, but crc8_fcs is not 0xAA
- * 	- crc_flag is 1, but computed crc8 does not match with crc8_fcs
+ *	- buffer not the size of the full content
+ * 	- crc_flag is 0, but crc8_fcs is not 0xAA, or the type is not data
+ * 	- crc_flag is 1, but the crc8 computed over the header and the message does not match with crc8_fcs
  * @param buf The buffer to parse
  * @return parsing status
  */
@@ -67,28 +68,46 @@ bool ph_parse(PacketHeader *out, const void* buf, unsigned int size) {
 	out->length = ((PacketHeader*)buf)->length;
 	out->crc_flag = ((PacketHeader*)buf)->crc_flag;
 
-	// make sure that the size of the buffer accounts for the message content
-	if (size < sizeof(PacketHeader) - PH_MSG_SIZE + out->length)
+	// make sure that the size of the buffer is that of the message content. A corrupted length would have the CRC
+	// cover a different range, and compare it with a byte that isn't the FCS
+	if (size != sizeof(PacketHeader) - PH_MSG_SIZE + out->length)
 		return false;
 
 	// parse message
 	memcpy(out->msg, &((PacketHeader*)buf)->msg, out->length);
 
-	// make sure that the CRC field makes sense semantically. (must be 0xAA if no CRC)
-	if (!out->crc_flag && ((uint8_t*)buf)[size-1] != 0xAA) {
-		return false;
-	}
-	else {
-		// parse CRC field
-		out->crc8_fcs = ((uint8_t*)buf)[size-1];
-		// confirm CRC field
-		if (ph_compute_crc8(out->msg, out->length) != out->crc8_fcs){
-			return false;
-		}
-	}
-	return true;
+	// parse CRC field
+	out->crc8_fcs = ((uint8_t*)buf)[size-1];
+	// make sure that the CRC field makes sense semantically. (must be 0xAA if no CRC). Without the CRC nothing
+	// catches a corrupted type, which could make data a link control frame, so those must have it
+	if (!(out->crc_flag & PH_CRC_FLAG))
+		return out->crc8_fcs == 0xAA && PH_GET_TYPE(out->crc_flag) == PH_TYPE_DATA;
+	// confirm CRC field
+	return ph_compute_fcs(&out->src) == out->crc8_fcs;
 }
 
+/**
+ * Writes the packet header into a buffer in the order it is sent on the line, which is the
+ * layout ph_parse expects. Only length bytes of the message are written. The CRC is computed here, after the
+ * type and class were set in crc_flag.
+ * @param out buffer of at least sizeof(PacketHeader) bytes
+ * @return number of bytes written
+ */
+unsigned int ph_serialize(void *out, const PacketHeader *pkt) {
+	uint8_t *buf = out;
+	unsigned int size = 0;
+	buf[size++] = pkt->synch;
+	buf[size++] = pkt->ver;
+	buf[size++] = pkt->src;
+	buf[size++] = pkt->dest;
+	buf[size++] = pkt->length;
+	buf[size++] = pkt->crc_flag;
+	memcpy(&buf[size], pkt->msg, pkt->length);
+	size += pkt->length;
+	buf[size] = (pkt->crc_flag & PH_CRC_FLAG) ? ph_compute_fcs(&buf[PH_SRC_OFFSET]) : pkt->crc8_fcs;
+	size++;
+	return size;
+}
 
 /**
  * Computes the CRC8 checksum for the a message.
@@ -102,6 +121,16 @@ uint8_t ph_compute_crc8(void *msg, unsigned int size) {
 	return crc;
 }
 
+/**
+ * Computes the frame check sequence of a packet: the CRC8 of its header from src to crc_flag, and its message.
+ * These are laid out the same in a PacketHeader and a serialized packet.
+ * @param hdr the src field of either
+ */
+uint8_t ph_compute_fcs(const void *hdr) {
+	const uint8_t *bytes = hdr;
+	return ph_compute_crc8((void *)bytes, PH_MSG_OFFSET - PH_SRC_OFFSET + bytes[PH_LENGTH_OFFSET - PH_SRC_OFFSET]);
+}
+
 /**
  * computes the CRC8 for one byte. This should only be used to populate crc8_lookup_table
  * @param byte value to compute CRC8 of
@@ -1,39 +1,82 @@
 #include "receiver.h"
 #include "clock.h"
-#include "ringbuffer.h"
+#include "framepool.h"
 #include "tim.h"
 #include "gpio.h"
 #include "monitor.h"
-#include "uart_driver.h"
-#include "monitor.h"
 #include "packet_header.h"
+#include "hdlc.h"
+#include "linkquality.h"
+#include "bertest.h"
+#include "mac.h"
+#include "arq.h"
+#include "timesync.h"
+#include "network.h"
+#include "bridge.h"
+#include "link.h"
+#include "latency.h"
+#include "llc.h"
+#include "sched.h"
+#include "isr.h"
+#include "critical.h"
 #include "io_definitions.h"
 #include <inttypes.h>
-#include <stdio.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 
-// buffer to hold the received message
-static RingBuffer receiveBuf = {0, 0};
-// variable to hold each byte as it arrives
-static int currBit;
-static uint8_t dataByte = 0;
-// flag that indicates the start of a message
-static bool currentlyReceiving = false;
-// flag to sample on the line per the input capture ISR
-static bool sample = true;
+// receive state of an interface, see link.h
+typedef struct {
+	// frame the received bytes go to, allocated on the first byte of a frame
+	Frame *rxFrame;
+	// set when no frame was free for the frame being received, or it is the bridge's own copy. Its bytes are ignored
+	// until it ends
+	bool rxOverflow;
+	// bridge: rxFrame is forwarded while it is received, it ends with bridge_onFrameEnd
+	bool rxForwarded;
+	// variable to hold each byte as it arrives
+	int currBit;
+	uint8_t dataByte;
+	// flag that indicates the start of a message
+	bool currentlyReceiving;
+	// MONITOR_TIMER time of the first edge of the frame being received
+	uint32_t frameStart;
+	bool inArbitration;
+	// flag to sample on the line per the input capture ISR
+	bool sample;
+	HdlcRx hdlcRx;
+	LinkQualityState lq;
+} RxLink;
+
+static RxLink links[LINK_MAX];
+static bool bridging = false;
+// complete frames waiting for the main routine, from the primary interface
+static FrameQueue rxQueue = {0};
+// MAC_ARBITRATION: the NRZ arbitration field ahead of each frame is skipped, the frame starts after it
+static bool arbitration = false;
 // if true, only send packets.
 static bool packetMode = false;
+// if true, frames are split on HDLC flags instead of the line going IDLE
+static bool streamMode = false;
+// BER test on the primary interface, sampled bits go to the checker instead of frames
+static BER_PATTERN berPattern = BER_OFF;
 // Forward reference
-static void initExternalInterrupt();
+static void initExternalInterrupt(int iface);
 //static void initInputCapture(enum TIMs);
 static void initCounterTimer(enum TIMs);
 static inline void stopTimeoutTimer();
 static inline void startTimeoutTimer(uint32_t);
+static void onMonitorState(int iface, MONITOR_STATE state);
+static inline void onExti(int iface);
+static inline void onEdge(int iface);
+static inline void onHalfBitTimeout(int iface);
+static inline void receiveByte(int iface, uint8_t byte);
+static inline void receiveStreamBit(int iface, int bit);
+static void completeFrame(int iface);
+static void dropFrame(int iface);
 
 // initiates the receiver module
-void receiver_init(bool packet_mode) {
-	init_usart2(19200, F_CPU);
+void receiver_init(bool packet_mode, bool stream_mode) {
 	init_GPIO(C);
 	// DEBUG: PC6 - Sample Toggle
 	enable_output_mode(C, 6);
@@ -41,136 +84,379 @@ void receiver_init(bool packet_mode) {
 	enable_output_mode(C, 8);
 
 	packetMode = packet_mode;
+	streamMode = stream_mode;
+	arbitration = mac_getMode() == MAC_ARBITRATION;
+	bridging = bridge_enabled() && packetMode && !streamMode;
+
+	for (int i = 0; i < link_count(); i++) {
+		links[i].sample = true;
+		hdlc_rxReset(&links[i].hdlcRx);
+		lq_init(&links[i].lq);
+
+		// frames end in the monitor's ISR, so they are queued even if the main routine is busy
+		monitor_setCallback(i, onMonitorState);
 
-	// the receive pin has to change based on the specific timer.
-	initExternalInterrupt();
-	initCounterTimer(TIM4);
+		initExternalInterrupt(i);
+		initCounterTimer(link_configs[i].halfBitTimer);
+	}
+}
+
+/**
+ * checks the sampled bits against a PRBS rather than receiving frames. See bertest.h
+ */
+void receiver_setBerTest(BER_PATTERN pattern) {
+	berPattern = pattern;
+	ber_init(pattern);
+	// the reports are polled
+	if (pattern != BER_OFF)
+		sched_startTick();
 }
 
 // Main routine update, this should execute inside a while(1); by what uses this module.
 void receiver_mainRoutineUpdate() {
-	// buffer to retrieve from the receive ringer buffer and a cursor into it
-	static uint8_t msgBuf[sizeof(PacketHeader)];
-	static int msgCur = 0;
-	// the packet representation of the buffer
-	static PacketHeader pkt;
-
-	if (monitor_getState() == MS_IDLE) {
-		// reset the transmission state, since we're IDLE. Next transmission is a new transmission
-		currBit = dataByte = 0;
-		currentlyReceiving = false;
-
-		// set for beginning of transmission, first bit automatically captured as zero
-		if (!sample)
-			sample = true;
-	}
-
-	if (currentlyReceiving) {
-		if (monitor_getState() == MS_COLLISION) {
-			printf("<< COLLISION!\r\n");
-			// cease all receiving
-			stop_counter(TIM4);
-			currentlyReceiving = false;
-			// drop partially received message
-			receiveBuf.put = receiveBuf.get = 0;
+	if (ber_reportDue())
+		ber_report();
+}
+
+/**
+ * hands the received frames to the layers they are for
+ * @return the next frame for the application, NULL if there is none. The caller frees it
+ */
+Frame *receiver_pollFrame() {
+	Frame *frame;
+
+	while ((frame = fq_pop(&rxQueue))) {
+		// link control frames are for the MAC, time sync packets for the time sync, reliable data and its
+		// acknowledgements for the ARQ, routed packets for the network layer
+		if (packetMode && (mac_onFrame(frame) || timesync_onFrame(frame))) {
+			fp_free(frame);
+		}
+		else if (!packetMode || (!arq_onFrame(frame) && !net_onFrame(frame))) {
+			return frame;
 		}
 	}
+	// reliable data, handed back in order and without duplicates, and routed packets for this node
+	if ((frame = arq_pollDelivery()) || (frame = net_pollDelivery()))
+		return frame;
+	return NULL;
+}
 
-	if (!currentlyReceiving && hasElement(&receiveBuf)) {
-		// grab the transmitted message, and display it
-		msgCur = 0;
-		while (hasElement(&receiveBuf) && msgCur < sizeof(PacketHeader)) {
-			msgBuf[msgCur++] = get(&receiveBuf);
-		}
+/**
+ * @return the edge deviation histogram of an interface, see lq_dump
+ */
+const LinkQualityState *receiver_getLinkQuality(int iface) {
+	return &links[iface].lq;
+}
 
-		if (packetMode) {
-			if (!ph_parse(&pkt, msgBuf, msgCur))
-				printf("<< ERROR: invalid packet\r\n");
+/**
+ * monitor ISR callback. The end of a transmission ends the frame being received: in idle mode
+ * going IDLE completes it, otherwise it is partial and dropped.
+ */
+static void onMonitorState(int iface, MONITOR_STATE state) {
+	RxLink *l = &links[iface];
 
-			if (pkt.length < PH_MSG_SIZE-1)
-				pkt.msg[pkt.length] = '\0'; // this is to display the string, since the null terminator of a string literal is not part of the msg
+	if (state == MS_BUSY)
+		return;
 
-			printf("< src=%x, dest=%x, length=%d, crc8=%x\r\n", pkt.src, pkt.dest, pkt.length, pkt.crc8_fcs);
-			printf("< %s\r\n", pkt.msg);
-		}
-		else {
-			if (msgCur < PH_MSG_SIZE-1)
-				msgBuf[msgCur+1] = '\0'; // for proper display
-			printf("< %s", msgBuf);
-		}
+	if (state == MS_COLLISION && l->currentlyReceiving) {
+		// cease all receiving
+		stop_counter(link_configs[iface].halfBitTimer);
+		LinkQuality lq;
+		lq_frameEnd(&l->lq, &lq);
+		llc_report(LLC_EV_COLLISION, iface, 0, 0, &lq);
+		dropFrame(iface);
+	}
+	else if (state == MS_IDLE && !streamMode) {
+		completeFrame(iface);
 	}
+	else {
+		dropFrame(iface);
+	}
+
+	// reset the transmission state. Next transmission is a new transmission
+	l->currBit = l->dataByte = 0;
+	l->currentlyReceiving = false;
+	l->inArbitration = false;
+	hdlc_rxReset(&l->hdlcRx);
+	// set for beginning of transmission, first bit automatically captured as zero
+	l->sample = true;
 }
 
+// the EXTI line of each interface's receive pin in link_configs, PC4 and PC2
 void EXTI4_IRQHandler() {
+	IsrTiming t;
+	isr_start(&t);
+	isr_edgeEntered(ISR_EXTI4);
+	onExti(0);
+	isr_exited(ISR_EXTI4, &t);
+}
 
-	// Verify Interrupt is from EXTI4
-	if (!((*(EXTI_PR)&(1<<4)) != 0))
+void EXTI2_IRQHandler() {
+	IsrTiming t;
+	isr_start(&t);
+	isr_edgeEntered(ISR_EXTI2);
+	onExti(1);
+	isr_exited(ISR_EXTI2, &t);
+}
+
+/**
+ * EXTI ISR of the receive pin of an interface
+ */
+static inline void onExti(int iface) {
+	int line = link_configs[iface].rxPin;
+
+	// Verify Interrupt is from the line
+	if (!((*(EXTI_PR)&(1<<line)) != 0))
 		return;
 
-	// Clear Interrupt
-	*(EXTI_PR) |= 1<<4;
+	// Clear Interrupt. The bits are cleared by writing 1, writing the others 0 keeps other lines pending
+	*(EXTI_PR) = 1<<line;
+
+	uint32_t start = link_isrEnter();
+	onEdge(iface);
+	link_isrExit(iface, start);
+}
+
+/**
+ * an edge on the receive pin of an interface
+ */
+static inline void onEdge(int iface) {
+	RxLink *l = &links[iface];
+	const LinkConfig *cfg = &link_configs[iface];
+	bool primary = iface == LINK_PRIMARY;
 
 	// monitor the state of transmission
-	monitor_Edge_Intrr();
+	monitor_onEdge(iface);
+
+	// the arbitration field starts with the first edge of a transmission. The first edge past its end is
+	// Manchester, the mid-bit edge of the first data bit, as if the frame started from an idle line
+	if (primary && arbitration && !l->currentlyReceiving) {
+		if (!l->inArbitration) {
+			l->inArbitration = true;
+			l->frameStart = monitor_getLastEdge(iface);
+			return;
+		}
+		if (monitor_getLastEdge(iface) - l->frameStart < MAC_ARB_BITS * MAC_BIT_US)
+			return;
+		l->inArbitration = false;
+	}
+
+	// edge timing for the link quality indicator, the first edge of a frame has no interval
+	if (l->currentlyReceiving) {
+		lq_edge(&l->lq, lq_now());
+	}
+	else {
+		lq_frameStart(&l->lq, lq_now());
+		// in arbitration mode the frame started at the arbitration field
+		if (!primary || !arbitration)
+			l->frameStart = monitor_getLastEdge(iface);
+	}
 
 	// case when we're in a half clock period edge
-	if (sample) {
+	if (l->sample) {
 		// set timeout based on stamp of when edge occurred
-		clear_cnt(TIM4);
-		start_counter(TIM4);
+		clear_cnt(cfg->halfBitTimer);
+		start_counter(cfg->halfBitTimer);
 
 		// we should not sample next edge, unless timeout
-		sample = false;
+		l->sample = false;
 
 		// sample bit
-		if ( !!(GPIOC_BASE->IDR & (1<<4))) {
-			dataByte |= (1<< (7-currBit));
+		int bit = read_pin(cfg->rxGpio, cfg->rxPin);
+		if (primary && berPattern != BER_OFF) {
+			ber_rxBit(bit);
 		}
-		else {
-			dataByte &= ~(1<< (7-currBit));
+		else if (streamMode) {
+			receiveStreamBit(iface, bit);
 		}
-
-		currBit++;
-
-		if (currBit == 8) {
-			put(&receiveBuf, dataByte);
-			currBit = 0;
+		else {
+			if (bit) {
+				l->dataByte |= (1<< (7-l->currBit));
+			}
+			else {
+				l->dataByte &= ~(1<< (7-l->currBit));
+			}
+
+			l->currBit++;
+
+			if (l->currBit == 8) {
+				receiveByte(iface, l->dataByte);
+				l->currBit = 0;
+			}
 		}
 
 		// If this is the very first bit, indicate the start of a transmission
-		if (!currentlyReceiving)
-			currentlyReceiving = true;
+		if (!l->currentlyReceiving)
+			l->currentlyReceiving = true;
 
 		// DEBUG PC6: toggle to track sample ISR calls
-		GPIOC_BASE->ODR ^= 1<<6;
+		if (primary)
+			toggle_pin(C, 6);
 	}
 	// case when we're in a clock period edge
 	else {
 		// the next edge is guaranteed to be a half clock period edge, where we always sample
-		sample = true;
+		l->sample = true;
 
 		// disable timeout, next edge occurs 100% of the time as per the manchester encoding
 		// TODO: use input capture, set timeout based on stamp of when edge occurred
-		stop_counter(TIM4);
+		stop_counter(cfg->halfBitTimer);
 
 	}
 }
 
 
-// Counter Timer for Half bit timeout. Indicates whether to sample on the next half clock period or not
+// Counter Timer for Half bit timeout. Indicates whether to sample on the next half clock period or not.
+// The counter runs at F_CPU and restarts on the match of the timeout, so it holds the cycles since. Each timer
+// times the interface of its entry in link_configs
 void TIM4_IRQHandler() {
-	clear_output_cmp_mode_pending_flag(TIM4);
+	IsrTiming t;
+	isr_start(&t);
+	isr_entered(ISR_TIM4, TIM4_BASE->CNT);
+	onHalfBitTimeout(0);
+	isr_exited(ISR_TIM4, &t);
+}
+
+void TIM1_BRK_TIM9_IRQHandler() {
+	IsrTiming t;
+	isr_start(&t);
+	isr_entered(ISR_TIM9, TIM9_BASE->CNT);
+	onHalfBitTimeout(1);
+	isr_exited(ISR_TIM9, &t);
+}
+
+static inline void onHalfBitTimeout(int iface) {
+	uint32_t start = link_isrEnter();
+	enum TIMs timer = link_configs[iface].halfBitTimer;
+	// the edges preempt this ISR, and restart the timer and clear the sample of the same interface
+	uint32_t mask = critical_enter();
+
+	clear_output_cmp_mode_pending_flag(timer);
 
 	// DEBUG PC8: toggle to track ISR calls (halftime)
-	GPIOC_BASE->ODR ^= 1<<8;
+	if (iface == LINK_PRIMARY)
+		toggle_pin(C, 8);
 
 	// if this timeout occurs, we're at bit period edge, the next must be a sample.
-	sample = true;
+	links[iface].sample = true;
 
 	// timeout occurred, shouldn't occur again unless a half bit period measures to a bit period.
-	stop_counter(TIM4);
+	stop_counter(timer);
+	critical_exit(mask);
+	link_isrExit(iface, start);
+}
+
+/**
+ * stores a received byte in the frame being received. Its frame is allocated on the first byte,
+ * if none is free the frame is lost and its bytes are ignored until it ends.
+ */
+static inline void receiveByte(int iface, uint8_t byte) {
+	RxLink *l = &links[iface];
+
+	if (!l->rxFrame) {
+		if (l->rxOverflow)
+			return;
+		l->rxFrame = fp_alloc();
+		if (!l->rxFrame) {
+			l->rxOverflow = true;
+			llc_report(LLC_EV_RX_DROPPED, iface, 0, 1, NULL);
+			return;
+		}
+		l->rxFrame->stamps[FP_FIRST_EDGE] = l->frameStart;
+	}
+
+	// anything longer than a packet can't be valid, keep what fits
+	if (l->rxFrame->len < FP_FRAME_SIZE)
+		l->rxFrame->data[l->rxFrame->len++] = byte;
+
+	// the bridge forwards the frame once it knows where it goes, and drops its own copies
+	if (bridging && l->rxFrame->len == PH_DEST_OFFSET+1) {
+		switch (bridge_onHeader(iface, l->rxFrame)) {
+		case BRIDGE_FORWARD:
+			l->rxForwarded = true;
+			break;
+		case BRIDGE_ECHO:
+			fp_free(l->rxFrame);
+			l->rxFrame = NULL;
+			l->rxOverflow = true;
+			break;
+		default:
+			break;
+		}
+	}
 }
 
+/**
+ * stream mode: feeds a sampled bit to the HDLC decoder, storing destuffed bytes in the frame
+ * and queueing the frame once its closing flag arrives
+ */
+static inline void receiveStreamBit(int iface, int bit) {
+	RxLink *l = &links[iface];
+	uint8_t byte;
+
+	switch (hdlc_rxBit(&l->hdlcRx, bit, &byte)) {
+	case HDLC_RX_BYTE:
+		receiveByte(iface, byte);
+		break;
+	case HDLC_RX_FRAME:
+		completeFrame(iface);
+		// the next frame starts right after the flag
+		l->frameStart = monitor_getLastEdge(iface);
+		break;
+	case HDLC_RX_ABORT:
+		dropFrame(iface);
+		lq_frameStart(&l->lq, l->lq.lastEdge);
+		l->frameStart = monitor_getLastEdge(iface);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * queues the frame being received for display. The upper layers only run on the primary interface, the
+ * others only carry bridged frames
+ */
+static void completeFrame(int iface) {
+	RxLink *l = &links[iface];
+
+	if (l->rxForwarded) {
+		bridge_onFrameEnd(iface, true);
+		l->rxFrame = NULL;
+		l->rxForwarded = false;
+	}
+	if (l->rxFrame && iface != LINK_PRIMARY) {
+		fp_free(l->rxFrame);
+		l->rxFrame = NULL;
+	}
+	if (l->rxFrame) {
+		lq_frameEnd(&l->lq, &l->rxFrame->lq);
+		l->rxFrame->stamps[FP_LAST_EDGE] = monitor_getLastEdge(iface);
+		lat_stamp(l->rxFrame, FP_RECEIVED);
+		fq_push(&rxQueue, l->rxFrame);
+		l->rxFrame = NULL;
+		sched_post(SCHED_EV_FRAME);
+	}
+	l->rxOverflow = false;
+}
+
+/**
+ * drops the partially received frame. Complete frames queued before it are kept
+ */
+static void dropFrame(int iface) {
+	RxLink *l = &links[iface];
+
+	if (l->rxForwarded) {
+		bridge_onFrameEnd(iface, false);
+		l->rxFrame = NULL;
+		l->rxForwarded = false;
+	}
+	if (l->rxFrame) {
+		fp_free(l->rxFrame);
+		l->rxFrame = NULL;
+	}
+	l->rxOverflow = false;
+}
 
 // initiates the counter timer based on the HALFBIT_TIMEOUT_TICKS
 static void initCounterTimer(enum TIMs TIMER) {
@@ -188,30 +474,34 @@ static void initCounterTimer(enum TIMs TIMER) {
 	log_tim_interrupt(TIMER);
 }
 
-static void initExternalInterrupt(){
+/**
+ * connects the receive pin of an interface to its EXTI line, interrupting on both edges
+ */
+static void initExternalInterrupt(int iface){
+	const LinkConfig *cfg = &link_configs[iface];
+	int line = cfg->rxPin;
+	// EXTI0-4 have their own vector, EXTI5-9 and EXTI10-15 share one
+	int irq = line < 5 ? 6 + line : line < 10 ? 23 : 40;
+
 	// Enable Clock to SysCFG
 	*(RCC_APB2ENR) |= 1<<14;
-	// Enable Clock for PC4
-	init_GPIO(C);
-	enable_input_mode(C, 4);
+	// Enable Clock for the receive pin
+	init_GPIO(cfg->rxGpio);
+	enable_input_mode(cfg->rxGpio, line);
 
-	// Connect Syscfg to EXTI4, C-line
-	*(SYSCFG_EXTICR2) &= ~(0b1111<<0);
-	*(SYSCFG_EXTICR2) |= (0b0010<<0);
+	// Connect Syscfg to the EXTI line, 4 bits per line selecting the port
+	*(SYSCFG_EXTICR1 + line/4) &= ~(0b1111<<(4*(line%4)));
+	*(SYSCFG_EXTICR1 + line/4) |= (cfg->rxGpio<<(4*(line%4)));
 
-	// Unmask EXTI4 in EXTI
-	*(EXTI_IMR) |= 1<<4;
+	// Unmask the line in EXTI
+	*(EXTI_IMR) |= 1<<line;
 
 	// Set falling edge
-	*(EXTI_FTSR) |= 1<<4;
+	*(EXTI_FTSR) |= 1<<line;
 
 	// Set to rising edge
-	*(EXTI_RTSR) |= 1<<4;
+	*(EXTI_RTSR) |= 1<<line;
 
-	// Set priority to max (IP[2*4+2] = IP2[24:], where each field is 8-bits, and NVIC idx 10 is field 2
-	*(NVIC_IPR2) |= 0xF0 << 24;
-
-	// Enable Interrupt in NVIC (Vector table interrupt enable)
-	*(NVIC_ISER0) |= 1<<10;
+	// Enable Interrupt in NVIC, at the priority of the edges
+	isr_enableIrq(irq);
 }
-
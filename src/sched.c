@@ -0,0 +1,157 @@
+/**
+ * @file sched.c
+ * Run-to-completion event scheduler, see sched.h
+ */
+
+#include "sched.h"
+#include "timerwheel.h"
+#include "critical.h"
+#include "io_definitions.h"
+#include <stdio.h>
+
+typedef struct {
+	const char *name;
+	SchedTask run;
+	uint32_t events;
+	// DWT cycles, the longest run and all of them
+	uint32_t runs;
+	uint32_t maxCycles;
+	uint64_t totalCycles;
+	// DWT cycles from the first post of an event it ran on until it started, the longest and all of them
+	uint32_t maxWaitCycles;
+	uint64_t totalWaitCycles;
+} SchedTaskEntry;
+
+// in priority order, the first one runs first
+static SchedTaskEntry tasks[SCHED_MAX_TASKS];
+static int numTasks = 0;
+// posted from ISRs, taken by sched_run
+static volatile uint32_t pending = 0;
+// DWT time of the first post of each pending event, by bit
+static volatile uint32_t postedAt[SCHED_NUM_EVENTS];
+static TwTimer tickTimer;
+
+static void onTick(void *arg);
+static void runTask(SchedTaskEntry *t, uint32_t events, const uint32_t *stamps);
+
+/**
+ * adds a task below the ones added before it
+ * @param events SCHED_EV the task runs on
+ */
+void sched_addTask(const char *name, SchedTask task, uint32_t events) {
+	if (numTasks == SCHED_MAX_TASKS)
+		return;
+	tasks[numTasks++] = (SchedTaskEntry){.name = name, .run = task, .events = events};
+}
+
+/**
+ * posts events for the tasks waiting on them. Safe from ISRs
+ */
+void sched_post(uint32_t events) {
+	uint32_t mask = critical_enter();
+	uint32_t now = *(DWT_CYCCNT);
+	uint32_t first = events & ~pending;
+
+	// an event posted again before it is taken waits since its first post
+	for (int i = 0; i < SCHED_NUM_EVENTS; i++) {
+		if (first & (1 << i))
+			postedAt[i] = now;
+	}
+	pending |= events;
+	critical_exit(mask);
+}
+
+/**
+ * posts events once a timer is due. A TwCallback, with the events as its arg, see SCHED_TIMER_ARG
+ */
+void sched_postTimer(void *events) {
+	sched_post((uintptr_t)events);
+}
+
+/**
+ * starts posting SCHED_EV_TICK every SCHED_TICK_US. The timer wheel is started first
+ */
+void sched_startTick() {
+	if (!tw_active(&tickTimer))
+		tw_start(&tickTimer, SCHED_TICK_US, onTick, NULL);
+}
+
+/**
+ * runs the tasks forever
+ */
+void sched_run() {
+	uint32_t stamps[SCHED_NUM_EVENTS];
+
+	while (1) {
+		// events posted between the check and WFI would be missed if interrupts weren't masked in between. This
+		// masks through PRIMASK, not with critical_enter: an interrupt masked by BASEPRI doesn't end WFI, one masked
+		// by PRIMASK does, and is taken once unmasked
+#ifdef __arm__
+		__asm volatile ("cpsid i" ::: "memory");
+#endif
+		uint32_t events = pending;
+		pending = 0;
+		for (int i = 0; i < SCHED_NUM_EVENTS; i++)
+			stamps[i] = postedAt[i];
+#ifdef __arm__
+		if (!events)
+			__asm volatile ("wfi");
+		__asm volatile ("cpsie i" ::: "memory");
+#endif
+
+		for (int i = 0; i < numTasks; i++) {
+			if (tasks[i].events & events)
+				runTask(&tasks[i], events, stamps);
+		}
+	}
+}
+
+/**
+ * prints how often and how long each task ran, and how long it waited to
+ */
+void sched_print() {
+	for (int i = 0; i < numTasks; i++) {
+		SchedTaskEntry *t = &tasks[i];
+		printf(">> task %s: runs=%lu", t->name, (unsigned long)t->runs);
+		if (t->runs) {
+			printf(" mean=%lu cycles max=%lu cycles", (unsigned long)(t->totalCycles / t->runs),
+					(unsigned long)t->maxCycles);
+			printf(" wake latency mean=%lu cycles max=%lu cycles", (unsigned long)(t->totalWaitCycles / t->runs),
+					(unsigned long)t->maxWaitCycles);
+		}
+		printf("\r\n");
+	}
+}
+
+/**
+ * posts the tick, and starts its timer again
+ */
+static void onTick(void *arg) {
+	(void)arg;
+	sched_post(SCHED_EV_TICK);
+	tw_start(&tickTimer, SCHED_TICK_US, onTick, NULL);
+}
+
+/**
+ * runs a task to completion, and accounts its run time and how long it waited since the first post of its events
+ * @param stamps DWT time of the first post of each of the events, by bit
+ */
+static void runTask(SchedTaskEntry *t, uint32_t events, const uint32_t *stamps) {
+	uint32_t start = *(DWT_CYCCNT);
+	uint32_t wait = 0;
+
+	for (int i = 0; i < SCHED_NUM_EVENTS; i++) {
+		if ((t->events & events & (1 << i)) && start - stamps[i] > wait)
+			wait = start - stamps[i];
+	}
+	t->run();
+	uint32_t cycles = *(DWT_CYCCNT) - start;
+
+	t->totalWaitCycles += wait;
+	if (wait > t->maxWaitCycles)
+		t->maxWaitCycles = wait;
+	t->runs++;
+	t->totalCycles += cycles;
+	if (cycles > t->maxCycles)
+		t->maxCycles = cycles;
+}
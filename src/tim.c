@@ -17,323 +17,54 @@ static void input_capture_mode(volatile uint32_t *CCMR1,
         volatile uint32_t *CCER, enum EDGE_TYPEs edge_type);
 static void set_edge_type(volatile uint32_t *CCER, enum EDGE_TYPEs edge_type);
 
+/* The clock enable bit and the interrupts of each timer. TIMER1 and 8 have their capture compare interrupts on a
+ * vector of their own, ccIrq. The other timers have all of theirs on irq, and no ccIrq */
+static const struct
+{
+    volatile uint32_t *enr;
+    uint8_t en;
+    int8_t irq;
+    int8_t ccIrq;
+} timers[] = {
+    [TIM1]  = {RCC_APB2ENR, TIM1EN, IRQ_TIM1_UP_TIM10, IRQ_TIM1_CC},
+    [TIM2]  = {RCC_APB1ENR, TIM2EN, IRQ_TIM2, -1},
+    [TIM3]  = {RCC_APB1ENR, TIM3EN, IRQ_TIM3, -1},
+    [TIM4]  = {RCC_APB1ENR, TIM4EN, IRQ_TIM4, -1},
+    [TIM5]  = {RCC_APB1ENR, TIM5EN, IRQ_TIM5, -1},
+    [TIM6]  = {RCC_APB1ENR, TIM6EN, IRQ_TIM6_DAC, -1},
+    [TIM7]  = {RCC_APB1ENR, TIM7EN, IRQ_TIM7, -1},
+    [TIM8]  = {RCC_APB2ENR, TIM8EN, IRQ_TIM8_UP_TIM13, IRQ_TIM8_CC},
+    [TIM9]  = {RCC_APB2ENR, TIM9EN, IRQ_TIM1_BRK_TIM9, -1},
+    [TIM10] = {RCC_APB2ENR, TIM10EN, IRQ_TIM1_UP_TIM10, -1},
+    [TIM11] = {RCC_APB2ENR, TIM11EN, IRQ_TIM1_TRG_COM_TIM11, -1},
+    [TIM12] = {RCC_APB1ENR, TIM12EN, IRQ_TIM8_BRK_TIM12, -1},
+    [TIM13] = {RCC_APB1ENR, TIM13EN, IRQ_TIM8_UP_TIM13, -1},
+    [TIM14] = {RCC_APB1ENR, TIM14EN, IRQ_TIM8_TRG_COM_TIM14, -1},
+};
+
 /**
  * Configure the clock for the timer.
  */
 void enable_timer_clk(enum TIMs tim)
 {
-    switch (tim)
-    {
-    case TIM2:
-        *RCC_APB1ENR |= 1 << TIM2EN;
-        break;
-    case TIM3:
-        *RCC_APB1ENR |= 1 << TIM3EN; // enable the timer.
-        break;
-    case TIM4:
-    	*RCC_APB1ENR |= 1 << TIM4EN;
-    	break;
-    default:
-        // Keep empty
-        break;
-    }
-}
-
-/**
- * Sets the value in CCR1.
- * Args:
- * ticks: the number of ticks needs to be set in CCR1.
- */
-void set_ccr1(enum TIMs tim, uint32_t ticks)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CCR1 = ticks;
-        break;
-    case TIM3:
-        TIM3_BASE->CCR1 = ticks;
-        break;
-    case TIM4:
-    	TIM4_BASE->CCR1 = ticks;
-    	break;
-    default:
-        // Keep empty
-        break;
-    }
-}
-
-/**
- * Sets the value in ARR.
- * Args:
- * ticks: the number of ticks needs to be set in ARR.
- */
-void set_arr(enum TIMs tim, uint32_t ticks)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->ARR = ticks;
-        break;
-    case TIM3:
-        TIM3_BASE->ARR = ticks;
-        break;
-    case TIM4:
-    	TIM4_BASE->ARR = ticks;
-    	break;
-    default:
-        // Keep empty
-        break;
-    }
-}
-
-void clear_cnt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CNT = 0;
-        break;
-    case TIM3:
-        TIM3_BASE->CNT = 0;
-        break;
-    case TIM4:
-    	TIM4_BASE->CNT = 0;
-    	break;
-    default:
-        break;
-    }
-}
-
-void set_psc(enum TIMs tim, uint32_t ticks)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->PSC = ticks;
-        break;
-    case TIM3:
-        TIM3_BASE->PSC = ticks;
-        break;
-    case TIM4:
-    	TIM4_BASE->PSC = ticks;
-    	break;
-    default:
-        break;
-    }
+    *timers[tim].enr |= 1 << timers[tim].en;
 }
 
 /**
- * Logs timer's interrupt into NVIC register.
+ * Logs timer's interrupt into NVIC register, at its priority from isr.c.
  */
 void log_tim_interrupt(enum TIMs tim)
 {
-    switch (tim)
-    {
-    case TIM2:
-        *ISER0 |= 1 << TIM2_INTERRUPT_EN;
-        break;
-    case TIM3:
-        *ISER0 |= 1 << TIM3_INTERRUPT_EN;
-        break;
-    case TIM4:
-        *ISER0 |= 1 << TIM4_INTERRUPT_EN;
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Starts counting.
- */
-void start_counter(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CR1 |= 1 << CEN;
-        break;
-    case TIM3:
-        TIM3_BASE->CR1 |= 1 << CEN;
-        break;
-    case TIM4:
-    	TIM4_BASE->CR1 |= 1 << CEN;
-    	break;
-    default:
-        break;
-    }
-}
-
-/**
- * Stops counting.
- */
-void stop_counter(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CR1 &= ~(1 << CEN);
-        break;
-    case TIM3:
-        TIM3_BASE->CR1 &= ~(1 << CEN);
-        break;
-    case TIM4:
-    	TIM4_BASE->CR1 &= ~(1 << CEN);
-    	break;
-    default:
-        break;
-    }
-}
-
-/*********This section is for the counter mode************/
-
-void set_to_counter_mode(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CR1 |= 1 << URS;
-        break;
-    case TIM3:
-        TIM3_BASE->CR1 |= 1 << URS;
-        break;
-    case TIM4:
-        TIM4_BASE->CR1 |= 1 << URS;
-        break;
-    default:
-        break;
-    }
-}
-
-void enable_counter_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER |= 1 << UIE;
-        break;
-    case TIM3:
-        TIM3_BASE->DIER |= 1 << UIE;
-        break;
-    case TIM4:
-        TIM4_BASE->DIER |= 1 << UIE;
-        break;
-    default:
-        break;
-    }
-}
-
-void disable_counter_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER &= ~(1 << UIE);
-        break;
-    case TIM3:
-        TIM3_BASE->DIER &= ~(1 << UIE);
-        break;
-    case TIM4:
-        TIM4_BASE->DIER &= ~(1 << UIE);
-        break;
-    default:
-        break;
-    }
-}
-
-void clear_counter_mode_pending_flag(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->SR &= ~(1 << UIF);
-        break;
-    case TIM3:
-        TIM3_BASE->SR &= ~(1 << UIF);
-        break;
-    case TIM4:
-        TIM4_BASE->SR &= ~(1 << UIF);
-        break;
-    default:
-        break;
-    }
+    isr_enableIrq(timers[tim].irq);
+    if (timers[tim].ccIrq >= 0)
+        isr_enableIrq(timers[tim].ccIrq);
 }
 
-/*********************************************************/
-
 /*********This section is for input capture mode**********/
 
 void set_to_input_capture_mode(enum TIMs tim)
 {
-    switch (tim)
-    {
-    case TIM2:
-        input_capture_mode(&(TIM2_BASE->CCMR1), &(TIM2_BASE->CCER), BOTH);
-        break;
-    case TIM3:
-        input_capture_mode(&(TIM3_BASE->CCMR1), &(TIM3_BASE->CCER), BOTH);
-        break;
-    case TIM4:
-        input_capture_mode(&(TIM4_BASE->CCMR1), &(TIM4_BASE->CCER), BOTH);
-        break;
-    default:
-        break;
-    }
-}
-
-void enable_input_capture_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER |= 1 << CC1IE;
-        break;
-    case TIM3:
-        TIM3_BASE->DIER |= 1 << CC1IE;
-        break;
-    case TIM4:
-        TIM4_BASE->DIER |= 1 << CC1IE;
-        break;
-    default:
-        break;
-    }
-}
-
-void disable_input_capture_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER &= ~(1 << CC1IE);
-        break;
-    case TIM3:
-        TIM3_BASE->DIER &= ~(1 << CC1IE);
-        break;
-    case TIM4:
-        TIM4_BASE->DIER &= ~(1 << CC1IE);
-        break;
-    default:
-        break;
-    }
-}
-
-void clear_input_capture_mode_pending_flag(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->SR &= ~(1 << CC1IF);
-        break;
-    case TIM3:
-        TIM3_BASE->SR &= ~(1 << CC1IF);
-        break;
-    case TIM4:
-        TIM4_BASE->SR &= ~(1 << CC1IF);
-        break;
-    default:
-        break;
-    }
+    input_capture_mode(&(tim_regs(tim)->CCMR1), &(tim_regs(tim)->CCER), BOTH);
 }
 
 /********************************************************/
@@ -345,125 +76,7 @@ void clear_input_capture_mode_pending_flag(enum TIMs tim)
  */
 void set_to_output_cmp_mode(enum TIMs tim)
 {
-    switch (tim)
-    {
-    case TIM2:
-        output_cmp_mode(&(TIM2_BASE->CCMR1));
-        break;
-    case TIM3:
-        output_cmp_mode(&(TIM3_BASE->CCMR1));
-        break;
-    case TIM4:
-        output_cmp_mode(&(TIM4_BASE->CCMR1));
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Enables the output of the timer.
- */
-void enable_output_output_cmp_mode(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CCER |= 1;
-        break;
-    case TIM3:
-        TIM3_BASE->CCER |= 1;
-        break;
-    case TIM4:
-        TIM4_BASE->CCER |= 1;
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Disable the output of the timer.
- */
-void disable_output_output_cmp_mode(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->CCER &= ~1;
-        break;
-    case TIM3:
-        TIM3_BASE->CCER &= ~1;
-        break;
-    case TIM4:
-        TIM4_BASE->CCER &= ~1;
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Clears the pending flag for the interrupt.
- */
-void clear_output_cmp_mode_pending_flag(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->SR &= ~(1 << UIF);
-        break;
-    case TIM3:
-        TIM3_BASE->SR &= ~(1 << UIF);
-        break;
-    case TIM4:
-        TIM4_BASE->SR &= ~(1 << UIF);
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Enables the update event interrupt.
- */
-void enable_output_cmp_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER |= 1;
-        break;
-    case TIM3:
-        TIM3_BASE->DIER |= 1;
-        break;
-    case TIM4:
-        TIM4_BASE->DIER |= 1;
-        break;
-    default:
-        break;
-    }
-}
-
-/**
- * Disables the update event interrupt.
- */
-void disable_output_cmp_mode_interrupt(enum TIMs tim)
-{
-    switch (tim)
-    {
-    case TIM2:
-        TIM2_BASE->DIER &= ~1;
-        break;
-    case TIM3:
-        TIM3_BASE->DIER &= ~1;
-        break;
-    case TIM4:
-        TIM4_BASE->DIER &= ~1;
-        break;
-    default:
-        break;
-    }
+    output_cmp_mode(&(tim_regs(tim)->CCMR1));
 }
 
 /********************************************************/
@@ -0,0 +1,191 @@
+/**
+ * @file timerwheel.c
+ * Hierarchical timer wheel, see timerwheel.h
+ */
+
+#include "timerwheel.h"
+#include "monitor.h"
+#include "sched.h"
+#include "critical.h"
+#include <string.h>
+
+#define SLOT_MASK (TW_SLOTS-1)
+
+// the lists of timers waiting in each slot
+static TwTimer *wheel[TW_LEVELS][TW_SLOTS];
+// level 0 slots holding a timer, bit n for slot n
+static uint64_t occupied = 0;
+static unsigned int numTimers = 0;
+// the last tick the wheel ran. Its low 24 bits follow the MONITOR_TIMER
+static uint32_t now = 0;
+
+static inline uint32_t hwTicks();
+static void link(TwTimer *timer);
+static void unlink(TwTimer *timer);
+static void tick();
+static void rearm();
+
+/**
+ * starts the wheel with no timers, at the current MONITOR_TIMER time. The monitor is started first
+ */
+void tw_init() {
+	memset(wheel, 0, sizeof(wheel));
+	occupied = 0;
+	numTimers = 0;
+	now = hwTicks();
+	rearm();
+}
+
+/**
+ * (re)starts a timer. Main routine only
+ * @param us time from now it is due in, rounded up to whole ticks
+ * @param callback called with arg from tw_run once the timer is due
+ */
+void tw_start(TwTimer *timer, uint32_t us, TwCallback callback, void *arg) {
+	// the wheel may not have caught up with the MONITOR_TIMER yet, the timer is due counting from the latter
+	uint32_t lag = (hwTicks() - now) & TW_MAX_TICKS;
+	// a tick of the current one may be over already
+	uint32_t ticks = (us >> TW_TICK_SHIFT) + ((us & (TW_TICK_US-1)) != 0) + 1;
+
+	if (tw_active(timer))
+		unlink(timer);
+	timer->expires = now + (ticks < TW_MAX_TICKS - lag ? lag + ticks : TW_MAX_TICKS);
+	timer->callback = callback;
+	timer->arg = arg;
+	link(timer);
+	rearm();
+}
+
+/**
+ * stops a timer, if it is waiting. Main routine only
+ */
+void tw_cancel(TwTimer *timer) {
+	// the compare channel is left armed, waking once for nothing at worst
+	if (tw_active(timer))
+		unlink(timer);
+}
+
+/**
+ * catches the wheel up to the MONITOR_TIMER, running the timers due on the way. The task of SCHED_EV_TIMER
+ */
+void tw_run() {
+	uint32_t target = now + ((hwTicks() - now) & TW_MAX_TICKS);
+
+	while (now != target) {
+		// an empty wheel has nothing to move down
+		if (!numTimers) {
+			now = target;
+			break;
+		}
+		tick();
+	}
+	rearm();
+}
+
+/**
+ * the compare channel matched, its flag cleared. Called from the MONITOR_TIMER ISR
+ */
+void tw_onCompare() {
+	sched_post(SCHED_EV_TIMER);
+}
+
+/**
+ * @return the tick the MONITOR_TIMER is in, 24 bits
+ */
+static inline uint32_t hwTicks() {
+	return MONITOR_TIMER_BASE->CNT >> TW_TICK_SHIFT;
+}
+
+/**
+ * adds a timer to the slot its tick is in, on the lowest level that reaches that far from now
+ */
+static void link(TwTimer *timer) {
+	uint32_t delta = timer->expires - now;
+	int level = 0;
+
+	while (level < TW_LEVELS-1 && delta >= 1u << (TW_SLOT_BITS * (level+1)))
+		level++;
+	int slot = timer->expires >> (TW_SLOT_BITS * level) & SLOT_MASK;
+
+	TwTimer **head = &wheel[level][slot];
+	timer->next = *head;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+	if (level == 0)
+		occupied |= 1ull << slot;
+	numTimers++;
+}
+
+/**
+ * removes a timer from the list of its slot
+ */
+static void unlink(TwTimer *timer) {
+	TwTimer **pprev = timer->pprev;
+
+	*pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = pprev;
+	// it was the last one of a level 0 slot
+	if (pprev >= &wheel[0][0] && pprev < &wheel[0][TW_SLOTS] && !*pprev)
+		occupied &= ~(1ull << (pprev - &wheel[0][0]));
+	timer->pprev = NULL;
+	numTimers--;
+}
+
+/**
+ * advances the wheel one tick. When level 0 wraps, the slot of level 1 due next is moved down, and when that one
+ * wraps as well, the slot of level 2, and so on. Then the timers of the level 0 slot of the tick run
+ */
+static void tick() {
+	TwTimer *timer;
+	uint32_t index;
+
+	now++;
+	index = now & SLOT_MASK;
+	for (int level = 1; level < TW_LEVELS && index == 0; level++) {
+		index = now >> (TW_SLOT_BITS * level) & SLOT_MASK;
+		timer = wheel[level][index];
+		wheel[level][index] = NULL;
+		while (timer) {
+			TwTimer *next = timer->next;
+			numTimers--;
+			link(timer);
+			timer = next;
+		}
+	}
+
+	// a callback may start its timer again, it is due a tick later at least
+	while ((timer = wheel[0][now & SLOT_MASK])) {
+		unlink(timer);
+		timer->callback(timer->arg);
+	}
+}
+
+/**
+ * arms the compare channel for the next level 0 slot holding a timer, or for level 0 wrapping if the timers are
+ * all on the levels above it. With no timers it is turned off
+ */
+static void rearm() {
+	uint32_t index = now & SLOT_MASK;
+	// the slots left in the current turn of level 0, the ones before it are a turn away
+	uint64_t ahead = occupied & ~((2ull << index) - 1);
+	uint32_t flag = 1 << (CC1IF + TW_CHANNEL);
+	uint32_t mask = critical_enter();
+
+	if (!numTimers) {
+		MONITOR_TIMER_BASE->DIER &= ~(1 << (CC1IE + TW_CHANNEL));
+		critical_exit(mask);
+		return;
+	}
+
+	uint32_t wakeAt = (now - index + (ahead ? __builtin_ctzll(ahead) : TW_SLOTS)) << TW_TICK_SHIFT;
+	(&MONITOR_TIMER_BASE->CCR1)[TW_CHANNEL] = wakeAt;
+	tim_clearFlags(&MONITOR_TIMER_BASE->SR, flag);
+	MONITOR_TIMER_BASE->DIER |= 1 << (CC1IE + TW_CHANNEL);
+	// the counter went past it already, it won't match again until it wraps
+	if ((int32_t)(wakeAt - MONITOR_TIMER_BASE->CNT) <= 0)
+		sched_post(SCHED_EV_TIMER);
+	critical_exit(mask);
+}
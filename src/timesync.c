@@ -0,0 +1,236 @@
+/**
+ * @file timesync.c
+ * Bus-wide time synchronization, see timesync.h
+ */
+
+#include "timesync.h"
+#include "packet_header.h"
+#include "monitor.h"
+#include "sched.h"
+#include "timerwheel.h"
+#include <stdio.h>
+
+// SYNC message: sequence number. FOLLOW_UP message: the sequence number of the SYNC, then its timestamp MSB first
+#define SYNC_SEQ 0
+#define SYNC_LEN 1
+#define FOLLOW_UP_TIME 1
+#define FOLLOW_UP_LEN 5
+
+static uint8_t addr = 0;
+static bool master = false;
+
+// master: when the last SYNC was made, and the timestamp of it heard back, for the FOLLOW_UP
+static uint8_t seq = 0;
+static uint32_t lastSync = 0;
+// wakes the transmitter when the next SYNC is due
+static TwTimer syncTimer;
+static bool followUpPending = false;
+static uint32_t syncTime = 0;
+
+// other nodes: the master followed, and the local timestamp of its last SYNC
+static bool following = false;
+static uint8_t masterAddr = 0;
+static uint8_t syncSeq = 0;
+static bool syncHeard = false;
+static uint32_t syncLocal = 0;
+// filter state: the master's time at the local time of the last sample, and the drift of the local clock
+static int samples = 0;
+static uint32_t baseMaster = 0;
+static uint32_t baseLocal = 0;
+static int32_t driftPpb = 0;
+static int32_t lastError = 0;
+
+static Frame *syncFrame(PH_TYPE type, const uint8_t *msg, int size);
+static void onSample(uint32_t masterTime, uint32_t localTime);
+
+/**
+ * @param master this node's clock is the bus time, it sends the SYNC packets
+ */
+void timesync_init(uint8_t ts_addr, bool ts_master) {
+	addr = ts_addr;
+	master = ts_master;
+	following = syncHeard = followUpPending = false;
+	samples = 0;
+	driftPpb = 0;
+	lastSync = monitor_now();
+	if (master)
+		tw_start(&syncTimer, TIMESYNC_PERIOD_US, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+}
+
+/**
+ * the master's SYNC and FOLLOW_UP packets. Polled by the transmitter
+ * @return a packet to queue for transmission, NULL if there is none
+ */
+Frame *timesync_pollFrame() {
+	uint8_t msg[FOLLOW_UP_LEN];
+
+	if (!master)
+		return NULL;
+
+	if (followUpPending) {
+		msg[SYNC_SEQ] = seq;
+		for (int i = 0; i < 4; i++)
+			msg[FOLLOW_UP_TIME + i] = syncTime >> 8*(3 - i);
+		Frame *frame = syncFrame(PH_TYPE_FOLLOW_UP, msg, FOLLOW_UP_LEN);
+		if (frame)
+			followUpPending = false;
+		// out of frames, tried again a tick later
+		else
+			tw_start(&syncTimer, 0, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+		return frame;
+	}
+
+	if (monitor_now() - lastSync < TIMESYNC_PERIOD_US)
+		return NULL;
+	msg[SYNC_SEQ] = ++seq;
+	Frame *frame = syncFrame(PH_TYPE_SYNC, msg, SYNC_LEN);
+	if (frame)
+		lastSync = monitor_now();
+	// out of frames, tried again a tick later
+	tw_start(&syncTimer, frame ? TIMESYNC_PERIOD_US : 0, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+	return frame;
+}
+
+/**
+ * handles a received SYNC or FOLLOW_UP packet, timestamped by the first edge of its frame
+ * @return true if the frame was one, it should not be displayed
+ */
+bool timesync_onFrame(const Frame *frame) {
+	static PacketHeader pkt;
+	uint8_t type;
+
+	if (frame->len < PH_OVERHEAD)
+		return false;
+	type = PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]);
+	if (type != PH_TYPE_SYNC && type != PH_TYPE_FOLLOW_UP)
+		return false;
+	if (!ph_parse(&pkt, frame->data, frame->len) || pkt.length < (type == PH_TYPE_SYNC ? SYNC_LEN : FOLLOW_UP_LEN))
+		return true;
+
+	// the master's own SYNC heard back, its timestamp goes out in the FOLLOW_UP
+	if (master) {
+		if (pkt.src == addr && type == PH_TYPE_SYNC && pkt.msg[SYNC_SEQ] == seq) {
+			syncTime = frame->stamps[FP_FIRST_EDGE];
+			followUpPending = true;
+		}
+		return true;
+	}
+
+	// follow the first master heard, or another one once it is lost
+	if (!timesync_synced() && type == PH_TYPE_SYNC && (!following || pkt.src != masterAddr)) {
+		following = true;
+		masterAddr = pkt.src;
+		samples = 0;
+	}
+	if (!following || pkt.src != masterAddr)
+		return true;
+
+	if (type == PH_TYPE_SYNC) {
+		syncSeq = pkt.msg[SYNC_SEQ];
+		syncLocal = frame->stamps[FP_FIRST_EDGE];
+		syncHeard = true;
+	}
+	else if (syncHeard && pkt.msg[SYNC_SEQ] == syncSeq) {
+		uint32_t masterTime = 0;
+		for (int i = 0; i < 4; i++)
+			masterTime = masterTime << 8 | pkt.msg[FOLLOW_UP_TIME + i];
+		onSample(masterTime, syncLocal);
+		syncHeard = false;
+	}
+	return true;
+}
+
+/**
+ * @return true if the synchronized clock follows a master. Always true on the master
+ */
+bool timesync_synced() {
+	if (master)
+		return true;
+	return samples >= 2 && monitor_now() - baseLocal < TIMESYNC_LOSS_PERIODS * TIMESYNC_PERIOD_US;
+}
+
+/**
+ * @return the synchronized clock, in us
+ */
+uint32_t timesync_now() {
+	return timesync_toMaster(monitor_now());
+}
+
+/**
+ * converts a MONITOR_TIMER time, such as the start of a received frame, to the synchronized clock
+ */
+uint32_t timesync_toMaster(uint32_t local) {
+	if (master || samples == 0)
+		return local;
+
+	int32_t elapsed = local - baseLocal;
+	return baseMaster + elapsed + (int32_t)((int64_t)elapsed * driftPpb / 1000000000);
+}
+
+/**
+ * prints the sync state
+ */
+void timesync_print() {
+	if (master) {
+		printf(">> sync: master, seq=%u\r\n", seq);
+		return;
+	}
+	printf(">> sync: %s to %x, samples=%d, last error=%ld us, drift=%ld ppb\r\n", timesync_synced() ? "synced" : "not synced",
+			masterAddr, samples, (long)lastError, (long)driftPpb);
+}
+
+/**
+ * @return a SYNC or FOLLOW_UP packet from this node, NULL if no frame is free
+ */
+static Frame *syncFrame(PH_TYPE type, const uint8_t *msg, int size) {
+	static PacketHeader pkt;
+
+	Frame *frame = fp_alloc();
+	if (!frame)
+		return NULL;
+
+	ph_create(&pkt, addr, 0xFF, true, msg, size);
+	PH_SET_TYPE(&pkt, type);
+	// queueing delay is harmless, the edge is timestamped on the line. It still shouldn't wait behind data
+	PH_SET_CLASS(&pkt, PH_CLASS_VOICE);
+	frame->cls = PH_CLASS_VOICE;
+	frame->len = ph_serialize(frame->data, &pkt);
+	return frame;
+}
+
+/**
+ * alpha-beta filter update with a sample of the master's clock against the local one
+ */
+static void onSample(uint32_t masterTime, uint32_t localTime) {
+	// the first sample sets the offset, the second a first drift estimate
+	if (samples == 0 || (samples == 1 && localTime == baseLocal)) {
+		baseMaster = masterTime;
+		baseLocal = localTime;
+		driftPpb = 0;
+		lastError = 0;
+		samples = 1;
+		return;
+	}
+	if (samples == 1) {
+		int32_t interval = localTime - baseLocal;
+		driftPpb = (int64_t)((int32_t)(masterTime - baseMaster) - interval) * 1000000000 / interval;
+		baseMaster = masterTime;
+		baseLocal = localTime;
+		samples++;
+		return;
+	}
+
+	int32_t interval = localTime - baseLocal;
+	uint32_t predicted = timesync_toMaster(localTime);
+	lastError = masterTime - predicted;
+	if (lastError > TIMESYNC_STEP_US || lastError < -TIMESYNC_STEP_US) {
+		samples = 0;
+		onSample(masterTime, localTime);
+		return;
+	}
+
+	baseMaster = predicted + (lastError >> TIMESYNC_ALPHA_SHIFT);
+	baseLocal = localTime;
+	driftPpb += (int64_t)lastError * 1000000000 / interval >> TIMESYNC_BETA_SHIFT;
+	samples++;
+}
@@ -1,60 +1,164 @@
 #include "transmitter.h"
 #include "clock.h"
-#include "ringbuffer.h"
+#include "framepool.h"
 #include "tim.h"
 #include "gpio.h"
 #include "monitor.h"
 #include "packet_header.h"
+#include "hdlc.h"
+#include "linkquality.h"
+#include "bertest.h"
+#include "mac.h"
+#include "arq.h"
+#include "timesync.h"
+#include "network.h"
+#include "bridge.h"
+#include "link.h"
+#include "llc.h"
+#include "latency.h"
+#include "sched.h"
+#include "isr.h"
+#include "timerwheel.h"
 #include <inttypes.h>
-#include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
-// transmission buffer to put the manchester encoded bytes in for transmission
-static RingBuffer transBuf = {0, 0};
-// used by the timer ISR, determines which bit to send at the time of execution
-static int currBit = 0;
-static int currByte = 0;
-// flags to tell whether a transmission is going, and whether the last one was complete. (no COLLISION)
-static bool inTransmission = false;
-static bool transmissionComplete = true;
-static bool retransmissionTimeoutActive = false;
+// nextHalfBit() result when a higher priority sender won the arbitration
+#define ARBITRATION_LOST -2
+
+// CSMA contention parameters of a traffic class, after 802.11e EDCA. A frame waits for AIFSN slots of idle line,
+// then for a random backoff of 0..cw slots that only counts down while the line stays idle. cw starts at cwMin
+// and doubles on every collision up to cwMax, the frame is dropped after retryLimit retries
+typedef struct {
+	uint8_t aifsn;
+	uint16_t cwMin;
+	uint16_t cwMax;
+	uint8_t retryLimit;
+} EdcaParams;
+
+static const EdcaParams edcaParams[PH_NUM_CLASSES] = {
+	[PH_CLASS_BACKGROUND]	= {7, 15, 255, 4},
+	[PH_CLASS_BEST_EFFORT]	= {3, 15, 63, 7},
+	[PH_CLASS_VIDEO]		= {2, 7, 15, 7},
+	[PH_CLASS_VOICE]		= {2, 3, 7, 7},
+};
+
+typedef struct {
+	// frames waiting for transmission, the one at the front is on the line while its class sends
+	FrameQueue queue;
+	uint16_t cw;
+	uint8_t retries;
+	// backoff left to count down, drawn when the class starts contending for its front frame
+	bool backoffDrawn;
+	uint32_t backoffUs;
+} TxClass;
+
+// transmit state of an interface, see link.h. The MAC only runs on the primary one, the others contend in plain CSMA
+typedef struct {
+	int iface;
+	TxClass classes[PH_NUM_CLASSES];
+	// start of the idle period being counted down, and how long the line had been idle when last seen
+	uint32_t idleFrom;
+	uint32_t idleUs;
+	// RTS or CTS at the front of its class, sent without contending. The class of the frame an RTS reserves for
+	Frame *reservationFrame;
+	int reservedCls;
+	// frame being sent by the timer ISR, NULL once the transmission is over
+	Frame *txFrame;
+	// used by the timer ISR, determines which bit to send at the time of execution
+	int currBit;
+	int currByte;
+	// manchester state: the data bit being sent, and whether its second half-bit is next
+	int currDataBit;
+	bool secondHalf;
+	// raises the PC5 sync signal on the first half-bit of a transmission
+	bool syncPending;
+	// txFrame is stamped with its first half-bit, see latency.h
+	bool stampPending;
+	// stream mode encoder for txFrame
+	HdlcTx hdlcTx;
+	// MAC_ARBITRATION: the field sent ahead of txFrame, the bit being sent, and whether its second half-bit is next
+	uint16_t arbField;
+	int arbBit;
+	bool arbSecondHalf;
+	// flags to tell whether a transmission is going, and whether the last one was complete. (no COLLISION)
+	bool inTransmission;
+	bool transmissionComplete;
+	// BER test: waits out the random timeout before the sequence goes again after a collision
+	TwTimer retransmissionTimer;
+	// wakes the transmitter once the countdown of the first class to win the contention runs out
+	TwTimer contentionTimer;
+} TxLink;
+
+static TxLink links[LINK_MAX];
+// the MAC's arbitration mode, on the primary interface
+static bool arbitration = false;
 
 // input state
 // determines whether to transmit packets or not
 static bool packetMode = false;
-// src address that determines this sender node
-static uint8_t src = 0;
-// dest address that determines the node to send to
-static uint8_t dest = 0;
+// if true, frames are flag delimited and may be sent back-to-back without releasing the line
+static bool streamMode = false;
+// BER test on the primary interface, the sequence is sent instead of frames
+static BER_PATTERN berPattern = BER_OFF;
+static Prbs txPrbs;
 
 // Forward references
-static void transmitByte(uint8_t);
-static void transmitMessage(const PacketHeader *pkt);
-static uint16_t encodeManchester(uint8_t);
-static void initTransmissionTimer();
-static void toggleRetransmission(bool retransmission);
-static void startTransmission();
-static void stopTransmission();
-
-void transmitter_init(uint8_t src_addr, uint8_t dest_addr, bool packet_mode) {
+static void serviceLink(TxLink *l);
+static Frame *peekFrame(TxLink *l);
+static Frame *nextFrame(TxLink *l);
+static Frame *contend(TxLink *l);
+static void drawBackoff(TxLink *l, TxClass *tc);
+static void consumeIdle(TxLink *l, int cls, uint32_t idle);
+static void queueFrame(TxLink *l, Frame *frame);
+static void releaseFrame(Frame *frame, bool sent);
+static void frameSent(TxLink *l, Frame *frame);
+static void frameCollided(TxLink *l, int cls);
+static void reservationCollided(TxLink *l);
+static void startFrame(TxLink *l, Frame *frame, bool openFlag);
+static bool mayStart(TxLink *l, const Frame *frame);
+static unsigned int frameBits(const Frame *frame);
+static inline bool berActive(const TxLink *l);
+static inline void onTimer(int iface);
+static inline int nextHalfBit(TxLink *l);
+static inline int nextDataBit(TxLink *l);
+static inline int nextArbitrationHalfBit(TxLink *l);
+static void initTransmissionTimer(enum TIMs timer);
+static void scheduleRetransmission(TxLink *l);
+static void onRetransmissionTimeout(void *arg);
+static void startTransmission(TxLink *l);
+static void stopTransmission(TxLink *l);
+
+void transmitter_init(bool packet_mode, bool stream_mode) {
 	// module input
 	packetMode = packet_mode;
-	src = src_addr;
-	dest = dest_addr;
-
-	init_usart2(19200, F_CPU);
-	initTransmissionTimer();
-
-	// Enable transmission pin
-	init_GPIO(TRANSMISSION_GPIO);
-	enable_output_mode(TRANSMISSION_GPIO, TRANSMISSION_PIN);
-
+	streamMode = stream_mode;
+	arbitration = mac_getMode() == MAC_ARBITRATION;
+
+	for (int i = 0; i < link_count(); i++) {
+		TxLink *l = &links[i];
+		const LinkConfig *cfg = &link_configs[i];
+
+		l->iface = i;
+		l->arbBit = MAC_ARB_BITS;
+		l->transmissionComplete = true;
+		for (int c = 0; c < PH_NUM_CLASSES; c++)
+			l->classes[c].cw = edcaParams[c].cwMin;
+
+		initTransmissionTimer(cfg->txTimer);
+
+		// Enable transmission pin
+		init_GPIO(cfg->txGpio);
+		enable_output_mode(cfg->txGpio, cfg->txPin);
+		// arbitration needs a wired-AND line, senders only ever pull it low
+		if (arbitration && i == LINK_PRIMARY)
+			enable_open_drain(cfg->txGpio, cfg->txPin);
+	}
 
 
-	// Init rng, used for retransmission
+	// Init rng, used for the backoff
 	srand(clock(0));
 	init_GPIO(C);
 	// DEBUG: PC6 - Retransmission Timeout Period
@@ -63,247 +167,552 @@ void transmitter_init(uint8_t src_addr, uint8_t dest_addr, bool packet_mode) {
 	enable_output_mode(C, 5);
 }
 
+/**
+ * sends a continuous PRBS instead of frames, for the peer to measure the bit error rate. See bertest.h
+ */
+void transmitter_setBerTest(BER_PATTERN pattern) {
+	berPattern = pattern;
+	if (pattern != BER_OFF)
+		prbs_init(&txPrbs, pattern);
+}
+
 void transmitter_mainRoutineUpdate() {
-	// only transmit a fully received message from the uart
-	static bool gotMessage = false;
-	// buffer to create packet header out of uart msg
-	static PacketHeader pkt = {0};
-	// buffer of the data sent through UART
-	static uint8_t dataBuf[PH_MSG_SIZE];
-	// cursor that makes sure not to retrieve more than PH_MSG_SIZE bytes into dataBuf
-	static int dataCur = 0;
-
-	if (inTransmission && transmissionComplete) {
-//		if (currByte > 2*7 + 2*5) {
-//			monitor_jam();
-//		}
-	}
-	else if (!inTransmission && transmissionComplete) {
-		char c = usart2_getch();
-
-		// data to transmit received, transmit it
-		if (c == '\r') {
-			dataBuf[dataCur] = '\0';
-
-			// just pressed enter. Don't care about that message
-			if (!strcmp((char*)dataBuf, "\0e\0p")) {
-				dataBuf[0] = dataCur = 0;
-				gotMessage = false;
-			}
-			else {
-				gotMessage = true;
-			}
-		}
-		// read in data until new line or max buffer size reached
-		else if (dataCur < PH_MSG_SIZE-1) {
-			dataBuf[dataCur++] = c;
+	TxLink *primary = &links[LINK_PRIMARY];
+
+	// BER test: the sequence never ends, it is kept on the line whenever the line is free
+	if (berPattern != BER_OFF) {
+		if (monitor_getState(LINK_PRIMARY) == MS_IDLE && !primary->inTransmission) {
+			primary->syncPending = true;
+			// a collision stopped it, back off a random time first
+			if (!primary->transmissionComplete)
+				scheduleRetransmission(primary);
+			else
+				startTransmission(primary);
 		}
+		return;
+	}
 
-		// start transmission when in TS_IDLE, and there's something to transmit
-		if (monitor_getState() == MS_IDLE && !inTransmission && gotMessage) {
-			currByte = 0;
-			gotMessage = false;
-
-			// transmit all characters
-			transBuf.put = transBuf.get = 0;
-
-			if (packetMode) {
-				// create packet
-				ph_create(&pkt, src, dest, true, &dataBuf, dataCur);
-				if (pkt.length < PH_MSG_SIZE-1)
-					pkt.msg[pkt.length] = '\0'; // this is to display the string, since the null terminator of a string literal is not part of the msg
-				// echo packet
-				printf("> src=%x, dest=%x, length=%d, crc8=%x\r\n", pkt.src, pkt.dest, pkt.length, pkt.crc8_fcs);
-				printf("> %s\r\n", pkt.msg);
-				// setup for transmission
-				transmitMessage(&pkt);
-			}
-			else {
-				if (dataCur < PH_MSG_SIZE-1)
-					dataBuf[dataCur++] = '\0'; // this is to display the string, since the null terminator of a string literal is not part of the msg
-				printf("> %s\r\n", dataBuf);
-				for (int i=0; i<dataCur; i++) {
-					transmitByte(dataBuf[i]);
-				}
-			}
-
-			// clear message
-			dataBuf[0] = dataCur = 0;
-
-			startTransmission();
+	// link control frames, such as TDMA beacons or the token, go out ahead of the messages
+	if (!primary->inTransmission) {
+		Frame *control = mac_pollControlFrame(peekFrame(primary) != NULL);
+		if (control) {
+			lat_stamp(control, FP_ENQUEUED);
+			fq_pushFront(&primary->classes[control->cls].queue, control);
+			// in CSMA the only link control is the CTS answering an RTS, it goes out without contending
+			if (mac_getMode() == MAC_CSMA)
+				primary->reservationFrame = control;
 		}
 	}
-	// retransmit after a timeout period
-	else if (monitor_getState() == MS_IDLE && !inTransmission && !transmissionComplete){
-		currByte = currBit = 0; // transmit same message from the start
-		toggleRetransmission(true);
-		startTransmission();
+
+	// ARQ retransmissions and acknowledgements, time sync packets, packets sent on to their next hop
+	if (packetMode) {
+		Frame *arqFrame, *syncFrame, *netFrame;
+		while ((arqFrame = arq_pollFrame()))
+			queueFrame(primary, arqFrame);
+		if ((syncFrame = timesync_pollFrame()))
+			queueFrame(primary, syncFrame);
+		while ((netFrame = net_pollFrame()))
+			queueFrame(primary, netFrame);
 	}
+
+	for (int i = 0; i < link_count(); i++) {
+		Frame *bridged;
+		// frames forwarded from the bridge's other port, already being received
+		while ((bridged = bridge_pollFrame(i)))
+			queueFrame(&links[i], bridged);
+	}
+
+	for (int i = 0; i < link_count(); i++)
+		serviceLink(&links[i]);
 }
 
 /**
- * Initiates the timer for the transmission on the PC9 line
+ * start transmission when in TS_IDLE, there's something to transmit, and the MAC allows it
  */
-static void initTransmissionTimer() {
-	enable_timer_clk(TRANSMITTER_TIMER);
-	set_arr(TRANSMITTER_TIMER, TRANSMISSION_TICKS);
-	set_ccr1(TRANSMITTER_TIMER, TRANSMISSION_TICKS);
-	set_psc(TRANSMITTER_TIMER, 0);
-	// enables toggle on CCR1
-	set_to_output_cmp_mode(TRANSMITTER_TIMER);
-	// enables output in CCER
-	enable_output_output_cmp_mode(TRANSMITTER_TIMER);
-	clear_cnt(TRANSMITTER_TIMER);
-	start_counter(TRANSMITTER_TIMER);
-	enable_output_cmp_mode_interrupt(TRANSMITTER_TIMER);
-	// register and enable within the NVIC
-	log_tim_interrupt(TRANSMITTER_TIMER);
+static void serviceLink(TxLink *l) {
+	if (l->inTransmission || monitor_getState(l->iface) != MS_IDLE)
+		return;
+
+	Frame *frame = nextFrame(l);
+	if (frame && mayStart(l, frame)) {
+		// the acknowledgement a packet carries is as recent as it gets
+		if (packetMode && l->iface == LINK_PRIMARY)
+			arq_stamp(frame);
+		startFrame(l, frame, true);
+		startTransmission(l);
+	}
+}
+
+/**
+ * asks the MAC whether a frame may be put on the line now. The other interfaces only ever contend
+ */
+static bool mayStart(TxLink *l, const Frame *frame) {
+	return l->iface != LINK_PRIMARY || mac_mayTransmit(frame, frameBits(frame));
+}
+
+/**
+ * @return the length of a frame on the line, at most in stream mode
+ */
+static unsigned int frameBits(const Frame *frame) {
+	return streamMode ? HDLC_MAX_STUFFED_BITS(frame->len) : 8*frame->len;
 }
 
 /**
- * toggles the function of the timer from transmission to retransission timeout
- * or vice versa. This is to use the same timer for the random timeout period.
- * if set to retransmission mode, this computes a random time and sets the ticks to that
- * and starts the timer.
+ * queues a frame for transmission on the primary interface, in its traffic class. Main routine only
  */
-static void toggleRetransmission(bool retransmission) {
-	retransmissionTimeoutActive = retransmission;
-	stop_counter(TRANSMITTER_TIMER);
-	if (retransmission) {
-		// configure timer for retransmission timeout
-		set_psc(TRANSMITTER_TIMER, 16000); // ms scale
-		// generate exact timeout
-		int N = rand() % TRANSMITTER_N_MAX;
-		int w = N *1000/TRANSMITTER_N_MAX;
-		printf(">> Retransmitting in %d ms...\r\n", w);
-		// set count
-		set_arr(TRANSMITTER_TIMER, w);
-		set_ccr1(TRANSMITTER_TIMER, w);
+void transmitter_queue(Frame *frame) {
+	queueFrame(&links[LINK_PRIMARY], frame);
+}
+
+/**
+ * queues a frame at the back of its class
+ */
+static void queueFrame(TxLink *l, Frame *frame) {
+	lat_stamp(frame, FP_ENQUEUED);
+	fq_push(&l->classes[frame->cls].queue, frame);
+}
+
+/**
+ * @return the front frame of the highest class with one queued, NULL if none is
+ */
+static Frame *peekFrame(TxLink *l) {
+	for (int c = PH_NUM_CLASSES-1; c >= 0; c--) {
+		if (fq_peek(&l->classes[c].queue))
+			return fq_peek(&l->classes[c].queue);
 	}
-	else {
-		set_psc(TRANSMITTER_TIMER, 0); // cpu scale
-		set_arr(TRANSMITTER_TIMER, TRANSMISSION_TICKS);
-		set_ccr1(TRANSMITTER_TIMER, TRANSMISSION_TICKS);
+	return NULL;
+}
+
+/**
+ * picks the frame to start on the IDLE line. Under CSMA the traffic classes contend for it, and a long frame that
+ * wins it reserves it with an RTS first
+ * @return the frame, NULL if none may start now
+ */
+static Frame *nextFrame(TxLink *l) {
+	if (l->iface != LINK_PRIMARY)
+		return contend(l);
+
+	if (mac_getMode() != MAC_CSMA)
+		return peekFrame(l);
+
+	if (l->reservationFrame)
+		return l->reservationFrame;
+
+	switch (mac_reservation()) {
+	case MAC_RES_PENDING:
+		return NULL;
+	case MAC_RES_GRANTED:
+		mac_endReservation();
+		return fq_peek(&l->classes[l->reservedCls].queue);
+	case MAC_RES_FAILED:
+		// the destination never answered, as good as a collision. The line was ours while waiting for the CTS, the
+		// new backoff counts from now. Otherwise every node whose RTS collided would go again at its deadline
+		mac_endReservation();
+		frameCollided(l, l->reservedCls);
+		monitor_setNav(l->iface, monitor_now());
+		return NULL;
+	default:
+		break;
 	}
 
+	Frame *frame = contend(l);
+	if (!frame || !packetMode || !mac_needsReservation(frame))
+		return frame;
+
+	Frame *rts = mac_requestToSend(frame, frameBits(frame));
+	if (!rts)
+		return NULL;
+	l->reservedCls = frame->cls;
+	lat_stamp(rts, FP_ENQUEUED);
+	fq_pushFront(&l->classes[l->reservedCls].queue, rts);
+	l->reservationFrame = rts;
+	return rts;
 }
 
 /**
- * This resets itself to transmit as long as the transmission buffer is not empty.
- * It changes the PC9 line every half-clock period in order to match the required bit rate.
+ * CSMA contention. Every class with a frame counts down its AIFS and backoff over the same idle line, so a higher
+ * class usually gets there first. The countdowns freeze while the line is busy or reserved by the NAV.
+ * @return the front frame of the class whose countdown ran out, the highest one if several did. NULL if none did
  */
-void TIM2_IRQHandler(){
-	clear_output_cmp_mode_pending_flag(TRANSMITTER_TIMER);
-
-	// retransmission mode, start transmission after timeout
-	if (retransmissionTimeoutActive) {
-		toggleRetransmission(false);
-		startTransmission();
-		// TODO DEBUG PC6: to confirm timeout period
-//		clear_cnt(TRANSMITTER_TIMER);
-//		select_gpio(C)->ODR ^= (1<<6);
-		return;
+static Frame *contend(TxLink *l) {
+	uint32_t from = monitor_getIdleSince(l->iface);
+
+	// the line was busy or reserved since the last look, the idle period counted so far is over
+	if (from != l->idleFrom) {
+		for (int c = 0; c < PH_NUM_CLASSES; c++)
+			consumeIdle(l, c, l->idleUs);
+		l->idleFrom = from;
+		l->idleUs = 0;
 	}
-
-	// Transmission complete, nothing else to transmit
-	if (!hasElement(&transBuf) || currByte == transBuf.put) {
-			stopTransmission();
-			transmissionComplete = true;
-			// DEBUG PC5: use as sync signal
-			GPIOC_BASE->ODR &= ~(1<<5);
-			return;
+	// the monitor posts the line going IDLE, the timer the end of the NAV
+	if (monitor_getState(l->iface) != MS_IDLE)
+		return NULL;
+	if ((int32_t)(monitor_now() - from) < 0) {
+		tw_start(&l->contentionTimer, from - monitor_now(), sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+		return NULL;
 	}
-	// Cease transmission if a collision occurs. Prepare to retransmit message
-	else if (monitor_getState() == MS_COLLISION) {
-		stopTransmission();
-		transmissionComplete = false;
-		// TODO PC5: use as sync signal
-		GPIOC_BASE->ODR &= ~(1<<5);
+	l->idleUs = monitor_now() - from;
+
+	Frame *winner = NULL;
+	uint32_t firstDue = UINT32_MAX;
+	for (int c = 0; c < PH_NUM_CLASSES; c++) {
+		TxClass *tc = &l->classes[c];
+		if (!fq_peek(&tc->queue))
+			continue;
+		if (!tc->backoffDrawn)
+			drawBackoff(l, tc);
+		uint32_t due = edcaParams[c].aifsn*TRANSMITTER_SLOT_US + tc->backoffUs;
+		if (l->idleUs >= due)
+			winner = fq_peek(&tc->queue);
+		else if (due - l->idleUs < firstDue)
+			firstDue = due - l->idleUs;
+	}
+	// the line may stay IDLE until a countdown runs out, with nothing else waking the transmitter
+	if (!winner && firstDue != UINT32_MAX)
+		tw_start(&l->contentionTimer, firstDue, sched_postTimer, SCHED_TIMER_ARG(SCHED_EV_TX));
+	return winner;
+}
+
+/**
+ * draws a random backoff from the contention window of a class. The window widens up to
+ * TRANSMITTER_BACKOFF_SCALE times as collisions get likelier
+ */
+static void drawBackoff(TxLink *l, TxClass *tc) {
+	uint32_t slots = rand() % (tc->cw + 1);
+	slots += (uint64_t)slots*(TRANSMITTER_BACKOFF_SCALE-1) * monitor_getCollisionProbability(l->iface) / MONITOR_Q16_ONE;
+	tc->backoffUs = slots*TRANSMITTER_SLOT_US;
+	tc->backoffDrawn = true;
+}
+
+/**
+ * counts an idle period that is over off the backoff of a class, past its AIFS
+ */
+static void consumeIdle(TxLink *l, int cls, uint32_t idle) {
+	TxClass *tc = &l->classes[cls];
+	uint32_t aifs = edcaParams[cls].aifsn*TRANSMITTER_SLOT_US;
+
+	if (!tc->backoffDrawn || idle <= aifs)
 		return;
+	tc->backoffUs = idle - aifs >= tc->backoffUs ? 0 : tc->backoffUs - (idle - aifs);
+}
 
+/**
+ * hands a frame the transmitter is done with back to whoever owns it. ARQ keeps its packets until they are
+ * acknowledged, and reports them itself, the bridge those still being received
+ * @param sent false if it was dropped after too many collisions
+ */
+static void releaseFrame(Frame *frame, bool sent) {
+	// the next frame of its class may go, and the owner of this one is told
+	sched_post(SCHED_EV_TX);
+	if (bridge_release(frame) || arq_release(frame))
+		return;
+	llc_complete(frame, sent);
+	fp_free(frame);
+}
+
+/**
+ * releases a sent frame from the front of its class, the next one contends from the smallest window
+ */
+static void frameSent(TxLink *l, Frame *frame) {
+	TxClass *tc = &l->classes[frame->cls];
+	int cls = frame->cls;
+
+	fq_pop(&tc->queue);
+	lat_stamp(frame, FP_LAST_EDGE);
+	lat_txDone(frame);
+	releaseFrame(frame, true);
+	// an RTS or CTS only leads the exchange, the contention state is the data frame's
+	if (frame == l->reservationFrame) {
+		l->reservationFrame = NULL;
+		return;
 	}
+	tc->cw = edcaParams[cls].cwMin;
+	tc->retries = 0;
+	tc->backoffDrawn = false;
+}
 
-	if (currByte == 0 && currBit == 0) {
-		// TODO PC5: use as sync signal
-		GPIOC_BASE->ODR |= (1<<5);
+/**
+ * the front frame of a class collided. It contends again from a doubled window, unless it ran out of retries
+ */
+static void frameCollided(TxLink *l, int cls) {
+	TxClass *tc = &l->classes[cls];
+
+	tc->backoffDrawn = false;
+	if (++tc->retries > edcaParams[cls].retryLimit) {
+		releaseFrame(fq_pop(&tc->queue), false);
+		llc_report(LLC_EV_TX_DROPPED, l->iface, 0, 1, NULL);
+		tc->cw = edcaParams[cls].cwMin;
+		tc->retries = 0;
+		return;
 	}
+	tc->cw = 2*tc->cw + 1 < edcaParams[cls].cwMax ? 2*tc->cw + 1 : edcaParams[cls].cwMax;
+}
 
-	// Transmit the one bit by setting its value in the transmission line. bits are sent MSB -> LSB.
-	if ((transBuf.buffer[currByte] & (1<<(7-currBit))) != 0)
-		select_gpio(TRANSMISSION_GPIO)->ODR |= 1<<TRANSMISSION_PIN;
-	else
-		select_gpio(TRANSMISSION_GPIO)->ODR &= ~(1<<TRANSMISSION_PIN);
+/**
+ * the RTS or CTS on the line collided. It is dropped, a collided RTS counts against the frame it was for
+ */
+static void reservationCollided(TxLink *l) {
+	fp_free(fq_pop(&l->classes[l->reservationFrame->cls].queue));
+	l->reservationFrame = NULL;
+	if (mac_reservation() == MAC_RES_PENDING) {
+		mac_endReservation();
+		frameCollided(l, l->reservedCls);
+	}
+}
 
-	// increment the bit to transfer for next ISR call
-	currBit++;
+/**
+ * Initiates the timer for the transmission on an interface's transmit pin
+ */
+static void initTransmissionTimer(enum TIMs timer) {
+	enable_timer_clk(timer);
+	set_arr(timer, TRANSMISSION_TICKS);
+	set_ccr1(timer, TRANSMISSION_TICKS);
+	set_psc(timer, 0);
+	// enables toggle on CCR1
+	set_to_output_cmp_mode(timer);
+	// enables output in CCER
+	enable_output_output_cmp_mode(timer);
+	clear_cnt(timer);
+	start_counter(timer);
+	enable_output_cmp_mode_interrupt(timer);
+	// register and enable within the NVIC
+	log_tim_interrupt(timer);
+}
 
-	// move on to next byte if reached end of byte
-	if (currBit == 8) {
-		currBit = 0;
-		currByte++;
-	}
+/**
+ * backs off a random time before the BER test sequence goes again after a collision, on the timer wheel. The line
+ * is held meanwhile. The window widens up to TRANSMITTER_BACKOFF_SCALE seconds as collisions get likelier
+ */
+static void scheduleRetransmission(TxLink *l) {
+	int N = rand() % TRANSMITTER_N_MAX;
+	int windowMs = 1000 + (int)((uint64_t)(TRANSMITTER_BACKOFF_SCALE-1)*1000 * monitor_getCollisionProbability(l->iface) / MONITOR_Q16_ONE);
+	int w = N *windowMs/TRANSMITTER_N_MAX;
+
+	llc_report(LLC_EV_BER_BACKOFF, l->iface, 0, w, NULL);
+	l->inTransmission = true;
+	tw_start(&l->retransmissionTimer, w*1000, onRetransmissionTimeout, l);
+}
 
+/**
+ * the random timeout of scheduleRetransmission is over, the BER test sequence goes again
+ */
+static void onRetransmissionTimeout(void *arg) {
+	startTransmission(arg);
+}
+
+// the counter runs at F_CPU and restarts on the match of the bit, so it holds the cycles since. Each timer clocks
+// the interface of its entry in link_configs
+void TIM2_IRQHandler(){
+	IsrTiming t;
+	isr_start(&t);
+	isr_entered(ISR_TIM2, TIM2_BASE->CNT);
+	onTimer(0);
+	isr_exited(ISR_TIM2, &t);
+}
+
+void TIM3_IRQHandler(){
+	IsrTiming t;
+	isr_start(&t);
+	isr_entered(ISR_TIM3, TIM3_BASE->CNT);
+	onTimer(1);
+	isr_exited(ISR_TIM3, &t);
 }
 
 /**
- * This converts the byte to manchester encoding, and sets it up for transmission.
-*/
-static void transmitByte(uint8_t byte) {
-	uint16_t manchesterSymbol = encodeManchester(byte);
-	// set the uint16_t manchester encoded byte for transmission
-	put(&transBuf, manchesterSymbol >> 8);
-	put(&transBuf, manchesterSymbol & 0xFF);
+ * @return true if the interface sends the BER test sequence rather than frames
+ */
+static inline bool berActive(const TxLink *l) {
+	return l->iface == LINK_PRIMARY && berPattern != BER_OFF;
+}
+
+/**
+ * This resets itself to transmit as long as there is a frame to transmit.
+ * It changes the transmit pin every half-clock period in order to match the required bit rate.
+ */
+static inline void onTimer(int iface){
+	uint32_t start = link_isrEnter();
+	TxLink *l = &links[iface];
+	const LinkConfig *cfg = &link_configs[iface];
+	// the PC5 sync signal follows the primary interface, writing a mask of 0 to BSRR leaves it alone
+	uint32_t syncPin = iface == LINK_PRIMARY ? 1<<5 : 0;
+
+	clear_output_cmp_mode_pending_flag(cfg->txTimer);
+	isr_edgeCleared(cfg->rxIsr);
+
+	if (l->syncPending) {
+		// TODO PC5: use as sync signal
+		gpio_writeBsrr(GPIOC_BASE, syncPin);
+		l->syncPending = false;
+	}
+
+	int level = nextHalfBit(l);
+
+	// Lost the arbitration. The line is released, the frame goes again once the winner's is over
+	if (level == ARBITRATION_LOST) {
+		stopTransmission(l);
+		gpio_writeBsrr(GPIOC_BASE, syncPin << BSRR_RESET);
+	}
+	// Transmission complete, nothing else to transmit
+	else if (level < 0) {
+			stopTransmission(l);
+			l->transmissionComplete = true;
+			// DEBUG PC5: use as sync signal
+			gpio_writeBsrr(GPIOC_BASE, syncPin << BSRR_RESET);
+	}
+	// Cease transmission if a collision occurs. Prepare to retransmit message
+	else if (monitor_getState(iface) == MS_COLLISION) {
+		stopTransmission(l);
+		l->transmissionComplete = false;
+		if (l->txFrame && l->txFrame == l->reservationFrame)
+			reservationCollided(l);
+		else if (l->txFrame)
+			frameCollided(l, l->txFrame->cls);
+		l->txFrame = NULL;
+		if (iface == LINK_PRIMARY)
+			mac_onCollision();
+		// TODO PC5: use as sync signal
+		gpio_writeBsrr(GPIOC_BASE, syncPin << BSRR_RESET);
+	}
+	// Transmit the half-bit by setting its value in the transmission line.
+	else {
+		// stamped first, the edge ISR preempts this one as soon as the edge is back on the receive pin
+		if (level != ((select_gpio(cfg->txGpio)->ODR >> cfg->txPin) & 1))
+			isr_edgeDriven(cfg->rxIsr);
+		write_pin(cfg->txGpio, cfg->txPin, level);
+		if (l->stampPending && l->txFrame) {
+			lat_stamp(l->txFrame, FP_FIRST_EDGE);
+			l->stampPending = false;
+		}
+	}
+	link_isrExit(iface, start);
 }
 
 /**
- * Transmits all of the bytes of the packet header, taking into account
- * that message is not necessarily maximum length
+ * prepares the ISR to send a frame from its beginning
+ * @param openFlag stream mode, false if the frame directly follows another one
  */
-static void transmitMessage(const PacketHeader *pkt) {
-	transmitByte(pkt->synch);
-	transmitByte(pkt->ver);
-	transmitByte(pkt->src);
-	transmitByte(pkt->dest);
-	transmitByte(pkt->length);
-	transmitByte(pkt->crc_flag);
-	for (int i = 0; i<pkt->length; i++)
-		transmitByte(pkt->msg[i]);
-	transmitByte(pkt->crc8_fcs);
+static void startFrame(TxLink *l, Frame *frame, bool openFlag) {
+	l->txFrame = frame;
+	l->currByte = l->currBit = 0;
+	l->secondHalf = false;
+	lat_stamp(frame, FP_ACQUIRED);
+	l->stampPending = true;
+	if (openFlag)
+		l->syncPending = true;
+	// a frame following another one in stream mode already holds the line
+	l->arbBit = arbitration && l->iface == LINK_PRIMARY && openFlag ? 0 : MAC_ARB_BITS;
+	l->arbSecondHalf = false;
+	l->arbField = mac_arbitrationField(MAC_ARB_CLASS_PRIORITY(frame->cls));
+	if (streamMode)
+		hdlc_txStart(&l->hdlcTx, frame->data, frame->len, openFlag);
 }
 
 /**
- * Takes in a byte of data, and converts it to manchester encoding for transmission
- * for each bit:
+ * Manchester encodes the frame on the fly, for each bit:
  * 	0 -> 0b01
  * 	1 -> 0b10
- * This is set so it can be transmitted directly to a pin from bits 0 up to 15,
- * every half-clock period.
+ * sent MSB first, so the first half-bit is the inverted bit, and the second half-bit the bit itself.
+ * Once a frame is sent it is released, and in stream mode the next queued frame follows it directly.
+ * In arbitration mode the arbitration field goes first.
+ * @return the level to put on the line for this half-bit period, -1 if there is nothing left to send,
+ * or ARBITRATION_LOST
  */
-static uint16_t encodeManchester(uint8_t data){
-	uint16_t output = 0;
-	for (int i=0; i<8; i++) {
-		int bit = (data & (1<<i)) >> i;
-		output |= (0^bit) << (i*2);
-		output |= (1^bit) << (i*2+1); // TODO 1 0 -> 0 1
+static inline int nextHalfBit(TxLink *l) {
+	if (l->arbBit < MAC_ARB_BITS)
+		return nextArbitrationHalfBit(l);
+
+	if (l->secondHalf) {
+		l->secondHalf = false;
+		return l->currDataBit;
 	}
-	return output;
+
+	if (!l->txFrame && !berActive(l))
+		return -1;
+
+	int bit = nextDataBit(l);
+	if (bit < 0) {
+		// frame sent. An RTS or CTS releases the line for the answer or the frame it reserved
+		bool reserving = l->txFrame == l->reservationFrame;
+		frameSent(l, l->txFrame);
+		l->txFrame = NULL;
+		// the line is held, the next frame goes without contending for it
+		Frame *next = peekFrame(l);
+		if (!streamMode || reserving || !next || !mayStart(l, next))
+			return -1;
+		// its closing flag opens the next frame
+		startFrame(l, next, false);
+		bit = nextDataBit(l);
+	}
+
+	l->currDataBit = bit;
+	l->secondHalf = true;
+	return !bit;
+}
+
+/**
+ * @return the next bit of txFrame, or -1 at its end. Bits are sent MSB -> LSB
+ */
+static inline int nextDataBit(TxLink *l) {
+	if (berActive(l))
+		return prbs_next(&txPrbs);
+
+	if (streamMode) {
+		int bit = hdlc_txNextBit(&l->hdlcTx);
+		return bit == HDLC_TX_DONE ? -1 : bit;
+	}
+
+	// a cut-through frame cut short, or sent faster than it is received, ends where its bytes do
+	if (l->currByte >= l->txFrame->len)
+		return -1;
+
+	int bit = (l->txFrame->data[l->currByte] >> (7-l->currBit)) & 1;
+
+	// move on to next byte if reached end of byte
+	if (++l->currBit == 8) {
+		l->currBit = 0;
+		l->currByte++;
+	}
+	return bit;
+}
+
+/**
+ * NRZ codes the arbitration field, each bit held for both half-bit periods. The line is read back in the middle
+ * of the bit, after the first half: reading dominant while sending recessive means a lower field is on the line.
+ * @return the level to put on the line, or ARBITRATION_LOST
+ */
+static inline int nextArbitrationHalfBit(TxLink *l) {
+	const LinkConfig *cfg = &link_configs[l->iface];
+	int bit = (l->arbField >> (MAC_ARB_BITS-1 - l->arbBit)) & 1;
+
+	if (!l->arbSecondHalf) {
+		l->arbSecondHalf = true;
+		return bit;
+	}
+
+	if (bit && !read_pin(cfg->rxGpio, cfg->rxPin))
+		return ARBITRATION_LOST;
+	l->arbSecondHalf = false;
+	l->arbBit++;
+	return bit;
 }
 
 /**
  * Starts transmission by resetting and enabling the transmission timer's counter.
  * Should only start when in the idle state
  */
-static inline void startTransmission() {
-	inTransmission = true;
-	clear_cnt(TRANSMITTER_TIMER);
-	start_counter(TRANSMITTER_TIMER);
+static inline void startTransmission(TxLink *l) {
+	l->inTransmission = true;
+	clear_cnt(link_configs[l->iface].txTimer);
+	start_counter(link_configs[l->iface].txTimer);
 }
 
 /**
  * Stop transmission, either due to reaching the end of transmission or due to a collision
  */
-static inline void stopTransmission() {
-	inTransmission = false;
-	select_gpio(TRANSMISSION_GPIO)->ODR |= 1<<TRANSMISSION_PIN;
-	stop_counter(TRANSMITTER_TIMER);
+static inline void stopTransmission(TxLink *l) {
+	const LinkConfig *cfg = &link_configs[l->iface];
+
+	l->inTransmission = false;
+	set_pin(cfg->txGpio, cfg->txPin);
+	stop_counter(cfg->txTimer);
 }
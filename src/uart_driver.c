@@ -2,18 +2,59 @@
 #include "ringbuffer.h"
 #include "gpio.h"
 #include "isr.h"
+#include "sched.h"
 #include <inttypes.h>
 #include <stdio.h>
 
+// bytes received by the RXNE interrupt, until they are read. The ISR puts, the main routine gets
+RING_DEFINE(UartRing, uring, char, UART_RX_SIZE)
+static UartRing rxRing = {0};
+// bytes dropped by the ISR because rxRing was full
+static volatile uint32_t rxOverruns = 0;
+
+/**
+ * USART2 ISR -- takes the received byte into rxRing, and posts it to the scheduler. Reading DR clears RXNE,
+ * and an overrun along with it. When rxRing is full the byte is dropped, and counted
+ */
+void USART2_IRQHandler()
+{
+    IsrTiming t;
+    isr_start(&t);
+    while ((*(USART_SR ) & (1 << RXNE)) != 0) {
+        if (!uring_put(&rxRing, (char) *USART_DR))
+            rxOverruns++;
+        sched_post(SCHED_EV_UART);
+    }
+    isr_exited(ISR_USART2, &t);
+}
+
+/**
+ * blocks until a character was received, see usart2_hasch
+ */
 char usart2_getch()
 {
     char c;
-    while ((*(USART_SR ) & (1 << RXNE)) != (1 << RXNE))
+    while (!uring_get(&rxRing, &c))
         ;
-    c = ((char) *USART_DR ); // Read character from usart
     return c;
 }
 
+/**
+ * returns non-zero if a character was received, so usart2_getch won't block
+ */
+int usart2_hasch()
+{
+    return uring_count(&rxRing) != 0;
+}
+
+/**
+ * returns the bytes received but dropped so far, rxRing being full
+ */
+uint32_t usart2_overruns()
+{
+    return rxOverruns;
+}
+
 void usart2_putch(char c)
 {
     while ((*(USART_SR ) & (1 << TXE)) != (1 << TXE))
@@ -38,11 +79,12 @@ void init_usart2(uint32_t baud, uint32_t sysclk)
     // over8 = 0..oversample by 16
     // M = 0..1 start bit, data size is 8, 1 stop bit
     // PCE= 0..Parity check not enabled
-    // no interrupts... using polling
-    *(USART_CR1 ) = (1 << UE) | (1 << TE) | (1 << RE); // Enable UART, Tx and Rx
+    // received bytes interrupt, sent ones are polled
+    *(USART_CR1 ) = (1 << UE) | (1 << TE) | (1 << RE) | (1 << RXNEIE); // Enable UART, Tx and Rx
     *(USART_CR2 ) = 0; // This is the default, but do it anyway
     *(USART_CR3 ) = 0; // This is the default, but do it anyway
     *(USART_BRR ) = sysclk / baud;
+    isr_enableIrq(IRQ_USART2);
 
     /* I'm not sure if this is needed for standard IO*/
     //setvbuf(stderr, NULL, _IONBF, 0);
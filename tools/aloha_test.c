@@ -0,0 +1,359 @@
+/**
+ * @file aloha_test.c
+ * Host simulation of slotted ALOHA (MAC_SLOTTED_ALOHA in mac.h), offered load against throughput. Every node is
+ * an instance of the real mac.c, see host_instance: node 0 is the coordinator and sends the beacons, which every
+ * node syncs to, and whether a frame may start is up to mac_mayTransmit. The simulation plays the line: frames
+ * starting in the same slot collide, and their nodes are told through mac_onCollision.
+ * - nodes poll on a 1 ms tick of their own phase, as the transmitter does. For the throughput against the offered
+ *   load the attempts are Poisson, as in the textbook model of an infinite population: in every slot each node gets
+ *   a new frame with the probability G/N, and a frame that collided or was deferred is dropped, its retry being one
+ *   of the later attempts. The offered load G then rises steadily with the sweep, and with carrier sense off the
+ *   throughput S follows G e^-G, peaking at 1/e for G = 1, past the 1/(2e) of unslotted ALOHA
+ * - the transmitter only starts on an IDLE line, and a frame shows on the line half a bit after it starts. With
+ *   that carrier sense, a node polling after another one started defers to the next slot, and the peak is higher
+ * - with every node backlogged, the MAC's own backoff makes the load: the backoff does not grow with it, so every
+ *   node attempts in a slot with a probability p = 2 / (1 + MAC_ALOHA_BACKOFF_SLOTS), and the throughput falls to
+ *   N p (1-p)^(N-1)
+ * - every frame starts within MAC_ALOHA_START_US of a slot boundary, and a collided frame is retried 1 to
+ *   MAC_ALOHA_BACKOFF_SLOTS slots later, evenly. The beacon's slot is counted, a retry falling on it goes in the
+ *   slot after
+ * The runs go past the MONITOR_TIMER wrapping, a backoff deadline must not block a node once it is 2^31 us old.
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/mac.c -o mac.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/aloha_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o aloha_test
+ * Usage:
+ *   aloha_test [mac.so] [nodes] [superframes]   (default ./mac.so, 32 nodes, 1000 superframes per load. With
+ *   fewer nodes the attempts are too far from Poisson past G = 1)
+ */
+
+#include "host.h"
+#include "mac.h"
+#include "monitor.h"
+#include "link.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define MAX_NODES 64
+#define TICK_US 1000
+// a frame's first edge, and the monitor going BUSY, comes half a bit after it starts
+#define SENSE_US (MAC_BIT_US / 2)
+// slots in a superframe, the beacon's first
+#define SF_SLOTS (1 + MAC_ALOHA_SLOTS)
+
+typedef struct {
+	void (*init)(MAC_MODE mode, uint8_t addr);
+	void (*setCoordinator)(const uint8_t *schedule, int slots);
+	Frame *(*pollControlFrame)(bool dataPending);
+	bool (*mayTransmit)(const Frame *frame, unsigned int bits);
+	void (*onCollision)();
+	bool (*onFrame)(const Frame *frame);
+
+	Frame frame;
+	bool pending;
+	uint32_t phase;
+	// the frame was started in this slot, and the slot it last collided in, counting the beacons'
+	bool started;
+	long collidedIn;
+} Node;
+
+typedef struct {
+	double g;
+	double s;
+	unsigned long outsideWindow;
+	// retries by the slots waited, of collisions with no beacon before the retry. 0 counts the early or late ones
+	unsigned long backoffHist[MAC_ALOHA_BACKOFF_SLOTS + 1];
+} Result;
+
+static Node nodes[MAX_NODES];
+// the nodes in the order of their phases
+static Node *order[MAX_NODES];
+static int numNodes;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 11;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void setTime(uint32_t t) {
+	MONITOR_TIMER_BASE->CNT = t;
+}
+
+static void loadNodes(const char *lib) {
+	for (int i = 0; i < numNodes; i++) {
+		Node *n = &nodes[i];
+		void *mac = host_instance(lib);
+		n->init = host_symbol(mac, "mac_init");
+		n->setCoordinator = host_symbol(mac, "mac_setCoordinator");
+		n->pollControlFrame = host_symbol(mac, "mac_pollControlFrame");
+		n->mayTransmit = host_symbol(mac, "mac_mayTransmit");
+		n->onCollision = host_symbol(mac, "mac_onCollision");
+		n->onFrame = host_symbol(mac, "mac_onFrame");
+		// the same phases for every run, so that carrier sense defers the same nodes at every load
+		n->phase = xorshift() % TICK_US;
+	}
+}
+
+static int byPhase(const void *a, const void *b) {
+	const Node *x = *(Node * const *)a, *y = *(Node * const *)b;
+	return (x->phase > y->phase) - (x->phase < y->phase);
+}
+
+/**
+ * a data frame from a node, the longest a slot fits
+ */
+static void makeFrame(Frame *frame, uint8_t src) {
+	PacketHeader pkt;
+	uint8_t msg[MAC_SLOT_MAX_FRAME] = {0};
+
+	ph_create(&pkt, src, 0xFF, true, msg, MAC_SLOT_MAX_FRAME - PH_OVERHEAD);
+	frame->len = ph_serialize(frame->data, &pkt);
+	frame->cls = PH_CLASS_BEST_EFFORT;
+}
+
+/**
+ * the coordinator's beacon goes out at the start of the superframe and is heard by every node
+ */
+static void beacon(uint32_t start) {
+	setTime(start);
+	Frame *frame = nodes[0].pollControlFrame(false);
+	if (!frame)
+		return;
+	frame->stamps[FP_FIRST_EDGE] = start;
+	setTime(start + 8 * frame->len * MAC_BIT_US + TRANSMISSION_TIMEOUT_US);
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].onFrame(frame);
+	fp_free(frame);
+}
+
+/**
+ * counts a retry in slot to of a frame collided in slot from. A beacon in between takes a slot of the backoff
+ */
+static void retried(Result *r, long from, long to) {
+	long waited = to - from;
+
+	if (from % SF_SLOTS + MAC_ALOHA_BACKOFF_SLOTS < SF_SLOTS)
+		r->backoffHist[waited >= 1 && waited <= MAC_ALOHA_BACKOFF_SLOTS ? waited : 0]++;
+	else if (waited < 1 || waited > MAC_ALOHA_BACKOFF_SLOTS + 1)
+		r->backoffHist[0]++;
+}
+
+/**
+ * runs the nodes for a number of superframes, each node getting a new frame in a slot with the given probability.
+ * With poisson set, a frame is only attempted in the slot it came in and dropped if it did not go through, else a
+ * node gets a new frame once it has none left and retries a collided one as the MAC lets it
+ */
+static void run(Result *r, double arrival, bool sense, bool poisson, int superframes) {
+	uint32_t t = monitor_now() + 1000;
+	unsigned long slots = 0, attempts = 0, offered = 0, successes = 0;
+
+	memset(r, 0, sizeof(*r));
+	host_quiet(true);
+	for (int i = 0; i < numNodes; i++) {
+		Node *n = &nodes[i];
+		n->init(MAC_SLOTTED_ALOHA, i + 1);
+		makeFrame(&n->frame, i + 1);
+		n->pending = false;
+		n->collidedIn = -1;
+		order[i] = n;
+	}
+	qsort(order, numNodes, sizeof(order[0]), byPhase);
+	nodes[0].setCoordinator(NULL, 0);
+
+	for (int sf = 0; sf < superframes; sf++) {
+		beacon(t);
+		for (int slot = 1; slot < SF_SLOTS; slot++, slots++) {
+			uint32_t slotStart = t + slot * MAC_SLOT_US;
+			uint32_t firstStart = 0;
+			int starters = 0;
+
+			for (int i = 0; i < numNodes; i++) {
+				if ((poisson || !nodes[i].pending) && xorshift() < arrival * 4294967296.0)
+					nodes[i].pending = true;
+				offered += nodes[i].pending;
+				nodes[i].started = false;
+			}
+			// two ticks of every node fall in the start window
+			for (int tick = 0; tick < MAC_ALOHA_START_US / TICK_US; tick++) {
+				for (int i = 0; i < numNodes; i++) {
+					Node *n = order[i];
+					if (!n->pending || n->started)
+						continue;
+					uint32_t now = slotStart + tick * TICK_US + n->phase;
+					// the line is BUSY for the transmitter, it does not ask the MAC
+					if (sense && starters && now - firstStart >= SENSE_US)
+						continue;
+					setTime(now);
+					if (!n->mayTransmit(&n->frame, 8 * n->frame.len))
+						continue;
+					n->started = true;
+					if (!starters++)
+						firstStart = now;
+					r->outsideWindow += now - slotStart >= MAC_ALOHA_START_US;
+					if (n->collidedIn >= 0)
+						retried(r, n->collidedIn, (long)sf * SF_SLOTS + slot);
+					n->collidedIn = -1;
+				}
+			}
+
+			// the transmitter hears the collision once the frames are over
+			setTime(slotStart + MAC_SLOT_US - MAC_SLOT_GUARD_US);
+			attempts += starters;
+			for (int i = 0; i < numNodes; i++) {
+				Node *n = &nodes[i];
+				if (poisson) {
+					successes += n->started && starters == 1;
+					n->pending = false;
+					continue;
+				}
+				if (!n->started)
+					continue;
+				if (starters == 1) {
+					n->pending = false;
+					successes++;
+				}
+				else {
+					// the transmitter asks again as soon as the line is IDLE, which starts the backoff
+					n->onCollision();
+					n->collidedIn = (long)sf * SF_SLOTS + slot;
+					n->mayTransmit(&n->frame, 8 * n->frame.len);
+				}
+			}
+		}
+		t += SF_SLOTS * MAC_SLOT_US;
+	}
+	host_quiet(false);
+	// a deferred Poisson attempt counts, it is dropped as a collided one is
+	r->g = (double)(poisson ? offered : attempts) / slots;
+	r->s = (double)successes / slots;
+}
+
+/**
+ * a node that has not collided for half the MONITOR_TIMER period may still send
+ */
+static void staleBackoff() {
+	Node *n = &nodes[1];
+	bool ok = true;
+
+	host_quiet(true);
+	nodes[0].init(MAC_SLOTTED_ALOHA, 1);
+	n->init(MAC_SLOTTED_ALOHA, 2);
+	makeFrame(&n->frame, 2);
+	// never collided, then collided once right after the first beacon
+	for (int collided = 0; collided < 2; collided++) {
+		for (uint32_t t = 0; t < 8; t++) {
+			uint32_t start = t << 29;
+			setTime(start);
+			nodes[0].init(MAC_SLOTTED_ALOHA, 1);
+			nodes[0].setCoordinator(NULL, 0);
+			beacon(start);
+			if (collided && !t) {
+				setTime(start + MAC_SLOT_US + MAC_SLOT_US / 2);
+				n->onCollision();
+				n->mayTransmit(&n->frame, 8 * n->frame.len);
+				continue;
+			}
+			setTime(start + MAC_SLOT_US);
+			ok &= n->mayTransmit(&n->frame, 8 * n->frame.len);
+		}
+	}
+	host_quiet(false);
+	check(ok, "a node may send whatever the MONITOR_TIMER, a backoff deadline does not come back after a wrap");
+}
+
+/**
+ * runs the offered loads in turn, with Poisson attempts
+ * @param steady set to whether the measured G rose with every load
+ * @return true if the throughput stayed within 0.02 of G e^-G
+ */
+static bool sweep(bool sense, int superframes, Result *total, Result *peak, bool *steady) {
+	bool poisson = true;
+	double lastG = 0;
+	Result r;
+
+	memset(peak, 0, sizeof(*peak));
+	*steady = true;
+	printf("%d nodes, Poisson attempts, carrier sense %s:\n", numNodes, sense ? "on" : "off");
+	printf("  offered G  throughput S  G e^-G\n");
+	// attempts per slot, over all the nodes
+	for (int i = 1; i <= 30; i++) {
+		run(&r, i / 10.0 / numNodes, sense, true, superframes);
+		printf("  %9.3f  %12.3f  %6.3f\n", r.g, r.s, r.g * exp(-r.g));
+		poisson &= fabs(r.s - r.g * exp(-r.g)) < 0.02;
+		*steady &= r.g > lastG;
+		lastG = r.g;
+		total->outsideWindow += r.outsideWindow;
+		if (r.s > peak->s)
+			*peak = r;
+	}
+	printf("  peak S %.3f at G %.3f\n", peak->s, peak->g);
+	return poisson;
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./mac.so";
+	numNodes = argc > 2 ? atoi(argv[2]) : 32;
+	int superframes = argc > 3 ? atoi(argv[3]) : 1000;
+	Result total, pure, sensed, saturated;
+	bool steady, sensedSteady;
+
+	if (numNodes < 2 || numNodes > MAX_NODES)
+		numNodes = 32;
+	host_init();
+	srand(1);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	loadNodes(lib);
+
+	staleBackoff();
+	memset(&total, 0, sizeof(total));
+	bool poisson = sweep(false, superframes, &total, &pure, &steady);
+	check(steady, "the offered load G rises with every step of the sweep");
+	check(poisson, "the throughput follows G e^-G");
+	check(fabs(pure.s - 1 / M_E) < 0.02 && fabs(pure.g - 1) < 0.3, "the throughput peaks at 1/e for G about 1");
+	sweep(true, superframes, &total, &sensed, &sensedSteady);
+	check(sensedSteady && sensed.s > pure.s, "carrier sense over the start window raises the peak");
+
+	run(&saturated, 1, false, false, superframes);
+	double p = 2.0 / (1 + MAC_ALOHA_BACKOFF_SLOTS);
+	double expected = numNodes * p * pow(1 - p, numNodes - 1);
+	printf("every node backlogged: G %.3f, S %.4f, N p (1-p)^(N-1) %.4f\n", saturated.g, saturated.s, expected);
+	check(fabs(saturated.g - numNodes * p) < 0.2 * numNodes * p && fabs(saturated.s - expected) < 0.3 * expected + 0.001,
+			"with every node backlogged the fixed backoff gives N p (1-p)^(N-1)");
+	total.outsideWindow += saturated.outsideWindow;
+	check(total.outsideWindow == 0, "frames only start within MAC_ALOHA_START_US of a slot boundary");
+
+	unsigned long retries = 0;
+	bool even = saturated.backoffHist[0] == 0;
+	printf("retries after");
+	for (int b = 1; b <= MAC_ALOHA_BACKOFF_SLOTS; b++) {
+		printf(" %lu", saturated.backoffHist[b]);
+		retries += saturated.backoffHist[b];
+	}
+	printf(" for 1..%d slots, %lu out of range\n", MAC_ALOHA_BACKOFF_SLOTS, saturated.backoffHist[0]);
+	for (int b = 1; b <= MAC_ALOHA_BACKOFF_SLOTS; b++)
+		even &= fabs(saturated.backoffHist[b] - (double)retries / MAC_ALOHA_BACKOFF_SLOTS) < 0.05 * retries / MAC_ALOHA_BACKOFF_SLOTS;
+	check(retries > 0 && even, "a collided frame is retried 1 to MAC_ALOHA_BACKOFF_SLOTS slots later, evenly");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * @file arbitration_test.c
+ * Host simulation of the bitwise arbitration (MAC_ARBITRATION in mac.h). One node is the real transmitter, driven
+ * by its TIM2 interrupt every half-bit, and the others are scripted senders following the same rule: a sender
+ * reading dominant while sending recessive stops driving. Every sender's field comes from mac_arbitrationField,
+ * of an instance of the real mac.c per node, see host_instance. The line is the wired-AND of the senders, and its
+ * edges go through the monitor, which the transmitter waits IDLE on.
+ * Senders with a frame all start together once the line is IDLE, and in every round:
+ * - the sender with the lowest field wins, whatever the priorities and addresses, and the others stop driving
+ *   within the bit they lost on
+ * - the winner's field and frame go through undisturbed, the line is exactly what it sends
+ * - the losers go again once the winner's frame is over, until every frame is sent. Nothing collides, and the
+ *   transmitter's frame is released once it is sent
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/mac.c -o mac.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/arbitration_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o arbitration_test
+ * Usage:
+ *   arbitration_test [mac.so] [trials]   (default ./mac.so, 2000 trials)
+ */
+
+#include "host.h"
+#include "mac.h"
+#include "monitor.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include "transmitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define HALFBIT_US (MAC_BIT_US / 2)
+#define MAX_SENDERS 4
+#define MAX_BYTES 12
+// the transmitter's own address
+#define OWN_ADDR 0x40
+
+typedef struct {
+	void (*init)(MAC_MODE mode, uint8_t addr);
+	uint16_t (*arbitrationField)(uint8_t priority);
+} MacInstance;
+
+// a scripted sender, or the transmitter when real is set
+typedef struct {
+	bool real;
+	bool pending;
+	bool driving;
+	uint16_t field;
+	uint8_t data[MAX_BYTES];
+	int len;
+	// half-bits sent of the field then the frame
+	int half;
+	int level;
+} Sender;
+
+static MacInstance macs[MAX_SENDERS];
+static Sender senders[MAX_SENDERS];
+static int numSenders;
+// the line during the last half-bit, and the transmitter's pin
+static int line = 1;
+static const LinkConfig *cfg;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 17;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * @return the level of a sender for a half-bit: the field NRZ, then the frame Manchester coded. 1 once done
+ */
+static int expectedLevel(const Sender *s, int half) {
+	if (half < 2 * MAC_ARB_BITS)
+		return (s->field >> (MAC_ARB_BITS-1 - half / 2)) & 1;
+	half -= 2 * MAC_ARB_BITS;
+	if (half >= 16 * s->len)
+		return 1;
+	int bit = (s->data[half / 16] >> (7 - half / 2 % 8)) & 1;
+	return half % 2 ? bit : !bit;
+}
+
+/**
+ * the next half-bit of a scripted sender. A recessive field bit read back dominant after its first half loses
+ */
+static void scriptedHalfBit(Sender *s) {
+	if (!s->driving)
+		return;
+	if (s->half < 2 * MAC_ARB_BITS && s->half % 2 && s->level && !line) {
+		s->driving = false;
+		s->level = 1;
+		return;
+	}
+	if (s->half >= 2 * (MAC_ARB_BITS + 8 * s->len)) {
+		s->driving = s->pending = false;
+		s->level = 1;
+		return;
+	}
+	s->level = expectedLevel(s, s->half++);
+}
+
+static void setLine(int level) {
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	monitor_onEdge(LINK_PRIMARY);
+}
+
+static bool txRunning() {
+	return tim_regs(cfg->txTimer)->CR1 & (1 << CEN);
+}
+
+/**
+ * a new frame for the transmitter, with a random class
+ */
+static void queueOwn(Sender *s) {
+	Frame *frame = fp_alloc();
+	uint8_t cls = xorshift() % PH_NUM_CLASSES;
+
+	frame->len = 1 + xorshift() % MAX_BYTES;
+	frame->cls = cls;
+	for (int i = 0; i < frame->len; i++)
+		frame->data[i] = xorshift();
+	memcpy(s->data, frame->data, frame->len);
+	s->len = frame->len;
+	s->field = macs[0].arbitrationField(MAC_ARB_CLASS_PRIORITY(cls));
+	s->pending = true;
+	transmitter_queue(frame);
+}
+
+typedef struct {
+	unsigned long rounds;
+	unsigned long wrongWinner;
+	unsigned long disturbed;
+	unsigned long lateRelease;
+	unsigned long unsent;
+	unsigned long ownWins;
+	unsigned long ownLosses;
+} Result;
+
+/**
+ * one round: every sender with a frame starts on the IDLE line, the line is run until it is IDLE again
+ * @return false if nobody started
+ */
+static bool runRound(Result *r) {
+	Sender *own = &senders[0];
+	uint16_t lowest = 0xFFFF;
+	int starters = 0;
+
+	// the transmitter's main routine starts it on the IDLE line
+	transmitter_mainRoutineUpdate();
+	if (own->pending && !txRunning())
+		return false;
+	for (int i = 0; i < numSenders; i++) {
+		Sender *s = &senders[i];
+		if (!s->pending)
+			continue;
+		s->driving = true;
+		s->half = 0;
+		s->level = 1;
+		starters++;
+		if (s->field < lowest)
+			lowest = s->field;
+	}
+	if (!starters)
+		return false;
+	r->rounds++;
+
+	Sender *winner = NULL;
+	for (int half = 0; ; half++) {
+		host_advance(HALFBIT_US);
+		int level = 1;
+		for (int i = 0; i < numSenders; i++) {
+			Sender *s = &senders[i];
+			if (s->real) {
+				bool wasDriving = s->driving;
+				if (txRunning()) {
+					TIM2_IRQHandler();
+				}
+				s->level = (select_gpio(cfg->txGpio)->ODR >> cfg->txPin) & 1;
+				s->driving = txRunning();
+				if (wasDriving && !s->driving) {
+					// lost in its field, or done
+					if (s->half < 2 * MAC_ARB_BITS) {
+						r->ownLosses++;
+						r->lateRelease += s->half % 2 == 0;
+					}
+					else {
+						s->pending = false;
+					}
+				}
+				if (s->driving)
+					s->half++;
+			}
+			else {
+				scriptedHalfBit(s);
+			}
+			level &= s->level;
+		}
+		setLine(level);
+
+		// once past the field one sender is left, and the line is what it sends
+		if (half == 2 * MAC_ARB_BITS) {
+			for (int i = 0; i < numSenders; i++) {
+				if (senders[i].driving)
+					winner = winner ? (r->wrongWinner++, winner) : &senders[i];
+			}
+			if (!winner || winner->field != lowest)
+				r->wrongWinner++;
+		}
+		if (winner && half < 2 * MAC_ARB_BITS + 16 * winner->len)
+			r->disturbed += level != expectedLevel(winner, half);
+		if (half < 2 * MAC_ARB_BITS)
+			continue;
+		bool anyDriving = false;
+		for (int i = 0; i < numSenders; i++)
+			anyDriving |= senders[i].driving;
+		if (!anyDriving)
+			break;
+	}
+	if (winner == own)
+		r->ownWins++;
+	// the monitor goes IDLE after the last edge
+	host_advance(TRANSMISSION_TIMEOUT_US + 1);
+	return true;
+}
+
+/**
+ * senders with random priorities and addresses, and a frame each, go in rounds until every frame is sent
+ */
+static void trial(Result *r) {
+	uint8_t used[256] = {0};
+
+	numSenders = 2 + xorshift() % (MAX_SENDERS - 1);
+	used[OWN_ADDR] = 1;
+	queueOwn(&senders[0]);
+	for (int i = 1; i < numSenders; i++) {
+		Sender *s = &senders[i];
+		uint8_t addr;
+		do
+			addr = xorshift();
+		while (used[addr]);
+		used[addr] = 1;
+		macs[i].init(MAC_ARBITRATION, addr);
+		s->field = macs[i].arbitrationField(MAC_ARB_CLASS_PRIORITY(xorshift() % PH_NUM_CLASSES));
+		s->len = 1 + xorshift() % MAX_BYTES;
+		for (int b = 0; b < s->len; b++)
+			s->data[b] = xorshift();
+		s->pending = true;
+	}
+
+	for (int rounds = 0; rounds < 2 * numSenders; rounds++)
+		runRound(r);
+	for (int i = 0; i < numSenders; i++)
+		r->unsent += senders[i].pending;
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./mac.so";
+	int trials = argc > 2 ? atoi(argv[2]) : 2000;
+	Result r = {0};
+	MonitorStats stats;
+
+	host_init();
+	srand(1);
+	ph_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	// the idle line is high
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	monitor_start(false);
+	tw_init();
+	host_quiet(true);
+	mac_init(MAC_ARBITRATION, OWN_ADDR);
+	transmitter_init(false, false);
+	host_quiet(false);
+	for (int i = 0; i < MAX_SENDERS; i++) {
+		void *mac = host_instance(lib);
+		macs[i].init = host_symbol(mac, "mac_init");
+		macs[i].arbitrationField = host_symbol(mac, "mac_arbitrationField");
+	}
+	// the transmitter's field, from an instance of its own
+	macs[0].init(MAC_ARBITRATION, OWN_ADDR);
+	senders[0].real = true;
+	unsigned int pool = fp_available();
+
+	host_quiet(true);
+	for (int t = 0; t < trials; t++)
+		trial(&r);
+	host_quiet(false);
+	monitor_getStats(LINK_PRIMARY, &stats);
+
+	printf("%lu rounds of %d trials: the transmitter won %lu and lost %lu, %lu transmissions, %lu collisions\n",
+			r.rounds, trials, r.ownWins, r.ownLosses, (unsigned long)stats.transmissions,
+			(unsigned long)stats.collisions);
+	check(r.wrongWinner == 0, "the lowest field wins every round");
+	check(r.lateRelease == 0, "a loser stops driving within the bit it lost on");
+	check(r.disturbed == 0, "the winner's field and frame go through undisturbed");
+	check(r.unsent == 0 && stats.collisions == 0, "the losers go again after the winner, until every frame is sent");
+	check(fp_available() == pool, "the transmitter releases its frames once sent");
+	check(r.ownWins == (unsigned long)trials && r.ownLosses > 0, "the transmitter both wins and loses rounds");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,317 @@
+/**
+ * @file arq_test.c
+ * Host simulation of the selective-repeat ARQ, see arq.h. Two nodes, each an instance of the real ARQ with its own
+ * frame pool, see host_instance. The tool plays the transmitter: it queues what arq_pollFrame returns, stamps each
+ * packet as it goes on the line and hands it back once sent. The line is half-duplex, each packet holds it for
+ * its airtime and the turnaround, and the nodes take turns when both have something to send. A lost packet has
+ * a bit flipped, so the receiver's CRC rejects it, each packet is lost with the same probability.
+ * Saturated with 32 byte messages from A to B, for every window size and loss rate:
+ * - every message is delivered in order, exactly once, and a corrupted packet never is
+ * - without loss nothing is retransmitted, the timeout adapts to the round trip time
+ * - goodput falls as the loss rate rises. Under loss a window of 4 or more beats stop-and-wait, by half again at
+ *   30% loss. A window of 2 may not: the acknowledgement of every other packet waits behind the next one, the round
+ *   trip time varies by a whole packet and the timeout after a lost acknowledgement is long
+ * A single lost packet is handed back for retransmission once the next one is acknowledged, without waiting for
+ * its timeout.
+ * And with messages both ways, the acknowledgements ride on the data: few ACK packets are sent.
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/arq.c src/framepool.c -o arq.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/arq_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o arq_test
+ * Usage:
+ *   arq_test [arq.so] [seconds]   (default ./arq.so, 300 s of each run)
+ */
+
+#include "host.h"
+#include "arq.h"
+#include "mac.h"
+#include "monitor.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NODE_A 0
+#define NODE_B 1
+#define ADDR(node) (0x20 + (node))
+// nothing compares on the MONITOR_TIMER here, time moves a step at once
+#define STEP_US 1000
+#define MSG_LEN 32
+// the packet lost alone, by its ARQ sequence number
+#define LOST_SEQ 20
+
+typedef struct {
+	void (*init)(uint8_t addr, unsigned int window);
+	bool (*mayQueue)(uint8_t dest);
+	void (*track)(Frame *frame);
+	void (*stamp)(Frame *frame);
+	bool (*release)(Frame *frame);
+	Frame *(*pollFrame)();
+	bool (*onFrame)(Frame *frame);
+	Frame *(*pollDelivery)();
+	void (*fpInit)();
+	Frame *(*alloc)();
+	void (*free)(Frame *frame);
+	// packets waiting for the line, and whether each window slot's packet is yet to go for the first time
+	FrameQueue queue;
+	bool firstTry[ARQ_MAX_WINDOW];
+	// the next message to send, and to be delivered from the peer
+	uint32_t nextSent;
+	uint32_t nextDelivered;
+} Node;
+
+typedef struct {
+	unsigned long delivered;
+	unsigned long outOfOrder;
+	unsigned long corruptDelivered;
+	unsigned long dataSent;
+	unsigned long retransmitted;
+	unsigned long acks;
+	// from the end of the packet lost alone until it is handed back for retransmission, us
+	uint32_t recovery;
+} Result;
+
+static Node nodes[2];
+// lose LOST_SEQ the first time rather than at random, and when it went
+static bool loseOne;
+static bool lostOne;
+static uint32_t lostAt;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 43;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * queues the node's next message to its peer while its window has room and a frame is free. The message
+ * starts with its number
+ */
+static void sendMessages(Node *n, int node) {
+	static PacketHeader pkt;
+	uint8_t msg[MSG_LEN];
+	uint8_t dest = ADDR(!node);
+
+	while (n->mayQueue(dest)) {
+		Frame *frame = n->alloc();
+		if (!frame)
+			return;
+		memset(msg, 0, sizeof(msg));
+		for (int i = 0; i < 4; i++)
+			msg[i] = n->nextSent >> 8*(3 - i);
+		ph_create(&pkt, ADDR(node), dest, true, msg, MSG_LEN);
+		frame->len = ph_serialize(frame->data, &pkt);
+		// reported back through llc_complete, which clears it
+		frame->handle = 1;
+		n->track(frame);
+		n->firstTry[frame->data[PH_MSG_OFFSET] % ARQ_MAX_WINDOW] = true;
+		fq_push(&n->queue, frame);
+		n->nextSent++;
+	}
+}
+
+/**
+ * a packet is over on the line: the sender is done with it, and the peer receives it, or a corrupted copy
+ */
+static void transfer(Node *from, Node *to, Frame *frame, double loss, Result *r) {
+	bool lost = xorshift() < loss * 4294967296.0;
+	uint8_t flags = frame->data[PH_FLAGS_OFFSET];
+
+	if (loseOne && !lostOne && PH_GET_TYPE(flags) == PH_TYPE_DATA && frame->data[PH_MSG_OFFSET] == LOST_SEQ) {
+		lost = lostOne = true;
+		lostAt = monitor_now();
+	}
+	Frame *rx = to->alloc();
+
+	if (rx) {
+		memcpy(rx->data, frame->data, frame->len);
+		rx->len = frame->len;
+		if (lost) {
+			int bit = xorshift() % (8 * rx->len);
+			rx->data[bit / 8] ^= 1 << bit % 8;
+		}
+		// the receiver displays what isn't for the ARQ, which is only a corrupted packet here
+		if (!to->onFrame(rx))
+			to->free(rx);
+	}
+	r->acks += PH_GET_TYPE(flags) == PH_TYPE_ACK;
+	if (!from->release(frame))
+		from->free(frame);
+}
+
+/**
+ * takes the messages the node had delivered. Each must be the next one
+ */
+static void takeDeliveries(Node *n, Result *r) {
+	Frame *frame;
+	static PacketHeader pkt;
+
+	while ((frame = n->pollDelivery())) {
+		if (!ph_parse(&pkt, frame->data, frame->len) || pkt.length != MSG_LEN) {
+			r->corruptDelivered++;
+		}
+		else {
+			uint32_t seq = 0;
+			for (int i = 0; i < 4; i++)
+				seq = seq << 8 | pkt.msg[i];
+			r->outOfOrder += seq != n->nextDelivered;
+			n->nextDelivered = seq + 1;
+			r->delivered++;
+		}
+		n->free(frame);
+	}
+}
+
+/**
+ * runs the nodes on fresh instances of the ARQ for a while
+ * @param both messages go both ways, else from A to B only
+ */
+static void run(const char *lib, unsigned int window, double loss, bool both, uint32_t seconds, Result *r) {
+	Frame *onAir = NULL;
+	int sender = NODE_B;
+	uint32_t busyUntil = 0;
+
+	memset(r, 0, sizeof(*r));
+	lostOne = false;
+	host_init();
+	ph_init();
+	tw_init();
+	rng = 43;
+	for (int i = 0; i < 2; i++) {
+		Node *n = &nodes[i];
+		void *arq = host_instance(lib);
+		memset(n, 0, sizeof(*n));
+		n->init = host_symbol(arq, "arq_init");
+		n->mayQueue = host_symbol(arq, "arq_mayQueue");
+		n->track = host_symbol(arq, "arq_track");
+		n->stamp = host_symbol(arq, "arq_stamp");
+		n->release = host_symbol(arq, "arq_release");
+		n->pollFrame = host_symbol(arq, "arq_pollFrame");
+		n->onFrame = host_symbol(arq, "arq_onFrame");
+		n->pollDelivery = host_symbol(arq, "arq_pollDelivery");
+		n->fpInit = host_symbol(arq, "fp_init");
+		n->alloc = host_symbol(arq, "fp_alloc");
+		n->free = host_symbol(arq, "fp_free");
+		n->fpInit();
+		n->init(ADDR(i), window);
+	}
+
+	for (uint32_t t = 0; t < seconds * 1000000; t += STEP_US) {
+		MONITOR_TIMER_BASE->CNT += STEP_US;
+		tw_run();
+		uint32_t now = monitor_now();
+
+		if (onAir && (int32_t)(now - busyUntil) >= 0) {
+			transfer(&nodes[sender], &nodes[!sender], onAir, loss, r);
+			onAir = NULL;
+		}
+		for (int i = 0; i < 2; i++) {
+			Node *n = &nodes[i];
+			Frame *frame;
+			while ((frame = n->pollFrame())) {
+				if (lostOne && !r->recovery && i == NODE_A && frame->data[PH_MSG_OFFSET] == LOST_SEQ)
+					r->recovery = now - lostAt;
+				fq_push(&n->queue, frame);
+			}
+			if (i == NODE_A || both)
+				sendMessages(n, i);
+			takeDeliveries(n, r);
+		}
+		if (onAir)
+			continue;
+
+		// the nodes take turns for the line
+		for (int k = 1; k <= 2 && !onAir; k++) {
+			int i = (sender + k) % 2;
+			Frame *frame = fq_pop(&nodes[i].queue);
+			if (!frame)
+				continue;
+			nodes[i].stamp(frame);
+			onAir = frame;
+			sender = i;
+			busyUntil = now + 8 * frame->len * MAC_BIT_US + MAC_TURNAROUND_US;
+			if (PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]) == PH_TYPE_DATA) {
+				bool *firstTry = &nodes[i].firstTry[frame->data[PH_MSG_OFFSET] % ARQ_MAX_WINDOW];
+				r->dataSent++;
+				r->retransmitted += !*firstTry;
+				*firstTry = false;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./arq.so";
+	uint32_t seconds = argc > 2 ? atoi(argv[2]) : 300;
+	const unsigned int windows[] = {1, 2, 4, 8};
+	const double losses[] = {0, 0.05, 0.1, 0.2, 0.3};
+	const int numWindows = sizeof(windows) / sizeof(windows[0]);
+	const int numLosses = sizeof(losses) / sizeof(losses[0]);
+	double goodput[numWindows][numLosses];
+	Result r;
+	bool exact = true, noRetransmissions = true, fallsWithLoss = true, risesWithWindow = true;
+
+	printf("goodput in bps of %d byte messages from A to B over %lu s, by window and loss rate:\n", MSG_LEN,
+			(unsigned long)seconds);
+	printf("  window");
+	for (int l = 0; l < numLosses; l++)
+		printf("  %9.0f%%", 100 * losses[l]);
+	printf("\n");
+	for (int w = 0; w < numWindows; w++) {
+		printf("  %6u", windows[w]);
+		for (int l = 0; l < numLosses; l++) {
+			host_quiet(true);
+			run(lib, windows[w], losses[l], false, seconds, &r);
+			host_quiet(false);
+			goodput[w][l] = 8.0 * MSG_LEN * r.delivered / seconds;
+			printf("  %6.1f/%-3lu", goodput[w][l], r.retransmitted * 100 / (r.dataSent ? r.dataSent : 1));
+			exact &= r.outOfOrder == 0 && r.corruptDelivered == 0 && r.delivered > 0;
+			if (losses[l] == 0)
+				noRetransmissions &= r.retransmitted == 0;
+			if (l > 0)
+				fallsWithLoss &= goodput[w][l] < goodput[w][l-1];
+			if (windows[w] >= 4 && losses[l] > 0)
+				risesWithWindow &= goodput[w][l] > goodput[0][l];
+		}
+		printf("\n");
+	}
+	printf("  (goodput/percentage of the data packets that were retransmissions)\n");
+
+	loseOne = true;
+	run(lib, 4, 0, false, 60, &r);
+	loseOne = false;
+	printf("window 4, packet %d lost alone: handed back %lu ms after, %lu retransmissions\n", LOST_SEQ,
+			(unsigned long)r.recovery / 1000, r.retransmitted);
+	// the next packet, the one after it which the acknowledgement waits behind, then the ACK packet. Each a step late
+	uint32_t acked = (2 * (PH_OVERHEAD + ARQ_HEADER_LEN + MSG_LEN) + PH_OVERHEAD + 2) * 8 * MAC_BIT_US
+			+ 3 * (MAC_TURNAROUND_US + STEP_US);
+	check(r.retransmitted == 1 && r.recovery <= acked, "a lost packet goes again once the next one is acknowledged");
+
+	host_quiet(true);
+	run(lib, 4, 0.1, true, seconds, &r);
+	host_quiet(false);
+	printf("both ways, window 4, 10%% loss: %lu delivered, %lu data packets, %lu ACK packets\n", r.delivered,
+			r.dataSent, r.acks);
+
+	check(exact, "every message is delivered in order and exactly once, never a corrupted one");
+	check(noRetransmissions, "without loss nothing is retransmitted");
+	check(fallsWithLoss, "goodput falls as the loss rate rises");
+	check(risesWithWindow && goodput[numWindows-1][numLosses-1] > 1.5 * goodput[0][numLosses-1],
+			"under loss a larger window beats stop-and-wait");
+	check(r.outOfOrder == 0 && r.acks * 4 < r.dataSent, "with data both ways, the acknowledgements ride on it");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
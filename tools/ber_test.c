@@ -0,0 +1,184 @@
+/**
+ * @file ber_test.c
+ * Host loopback test of the bit error rate test mode (bertest.h). The PRBS generator feeds the checker through a
+ * channel that injects known errors, and the checker's statistics are compared with what was injected:
+ * - every generator has its maximal period of 2^order - 1
+ * - a clean sequence syncs within order + BER_SYNC_BITS bits and counts no errors, a stuck line never syncs
+ * - single errors injected at a given rate are each counted exactly once, as bursts of one bit
+ * - errors closer than BER_BURST_GAP bits form one burst, of the length from the first to the last error
+ * - a dropped or inserted bit loses sync, and the sync found again is counted as a slip
+ * - random garbage loses sync without a slip
+ *
+ * Build:
+ *   gcc -O2 -Iinc tools/ber_test.c src/bertest.c -o ber_test
+ * Usage:
+ *   ber_test
+ */
+
+#include "bertest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// bits sent before errors are injected, the checker is in sync by then
+#define SETTLE_BITS 1000
+
+static const BER_PATTERN patterns[] = {BER_PRBS7, BER_PRBS15, BER_PRBS23};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, BER_PATTERN pattern) {
+	printf("%s: PRBS%d %s\n", ok ? "ok  " : "FAIL", pattern, what);
+	failures += !ok;
+}
+
+static uint32_t rng = 7;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void period(BER_PATTERN pattern) {
+	Prbs g;
+	uint32_t n = 0;
+
+	prbs_init(&g, pattern);
+	uint32_t start = g.state;
+	do {
+		prbs_next(&g);
+		n++;
+	} while (g.state != start && n <= g.mask);
+	check(n == g.mask, "has the maximal period", pattern);
+}
+
+static void clean(BER_PATTERN pattern) {
+	Prbs g;
+
+	prbs_init(&g, pattern);
+	ber_init(pattern);
+	int synced = -1;
+	for (int i = 0; i < 100000; i++) {
+		ber_rxBit(prbs_next(&g));
+		if (synced < 0 && ber_getStats()->bits)
+			synced = i;
+	}
+	const BerStats *s = ber_getStats();
+	check(synced >= 0 && synced <= (int)pattern + BER_SYNC_BITS, "syncs on a clean sequence", pattern);
+	check(s->errors == 0 && s->syncLosses == 0 && s->bursts == 0, "counts no errors on a clean sequence", pattern);
+
+	ber_init(pattern);
+	for (int i = 0; i < 10000; i++)
+		ber_rxBit(0);
+	check(ber_getStats()->bits == 0, "never syncs on a stuck line", pattern);
+}
+
+/**
+ * injects an error into one in oneIn bits on average, never closer than a burst gap to the last one
+ */
+static void singleErrors(BER_PATTERN pattern, uint32_t oneIn) {
+	Prbs g;
+	uint32_t injected = 0, sent = 0, since = 0;
+
+	prbs_init(&g, pattern);
+	ber_init(pattern);
+	for (int i = 0; i < 2000000; i++) {
+		int bit = prbs_next(&g);
+		if (i >= SETTLE_BITS) {
+			sent++;
+			since++;
+			if (since > BER_BURST_GAP && xorshift() % oneIn == 0) {
+				bit ^= 1;
+				injected++;
+				since = 0;
+			}
+		}
+		ber_rxBit(bit);
+	}
+	const BerStats *s = ber_getStats();
+	uint32_t ppb = (uint32_t)((uint64_t)s->errors * 1000000000ULL / s->bits);
+	printf("      PRBS%d 1 in %lu: injected %lu in %lu bits, counted %lu in %lu, ber %lu ppb\n", pattern,
+			(unsigned long)oneIn, (unsigned long)injected, (unsigned long)sent, (unsigned long)s->errors,
+			(unsigned long)s->bits, (unsigned long)ppb);
+	check(s->errors == injected && s->syncLosses == 0, "counts each injected error once", pattern);
+	check(s->bursts == injected && s->burstHist[0] == injected && s->maxBurstLen == 1,
+			"counts isolated errors as bursts of one bit", pattern);
+}
+
+static void burst(BER_PATTERN pattern) {
+	Prbs g;
+	// errors at these offsets: one burst of 1 + 3 + 10 + 16 = 30 bits, then one of 1 bit BER_BURST_GAP+1 later
+	const int offsets[] = {0, 3, 13, 29, 29 + BER_BURST_GAP + 1};
+	unsigned int next = 0;
+
+	prbs_init(&g, pattern);
+	ber_init(pattern);
+	for (int i = 0; i < SETTLE_BITS + 200; i++) {
+		int bit = prbs_next(&g);
+		if (next < sizeof(offsets)/sizeof(offsets[0]) && i == SETTLE_BITS + offsets[next]) {
+			bit ^= 1;
+			next++;
+		}
+		ber_rxBit(bit);
+	}
+	const BerStats *s = ber_getStats();
+	check(s->errors == 5 && s->bursts == 2 && s->maxBurstLen == 30 && s->burstHist[4] == 1 && s->burstHist[0] == 1,
+			"groups errors closer than the burst gap", pattern);
+}
+
+static void slip(BER_PATTERN pattern, bool drop) {
+	Prbs g;
+
+	prbs_init(&g, pattern);
+	ber_init(pattern);
+	for (int i = 0; i < 20000; i++) {
+		if (i == 5000) {
+			// a bit lost on the line, or one sampled twice
+			if (drop)
+				prbs_next(&g);
+			else
+				ber_rxBit(g.state & 1);
+		}
+		ber_rxBit(prbs_next(&g));
+	}
+	const BerStats *s = ber_getStats();
+	check(s->syncLosses == 1 && s->slips == 1, drop ? "detects a dropped bit as a slip" : "detects an inserted bit as a slip",
+			pattern);
+}
+
+static void garbage(BER_PATTERN pattern) {
+	Prbs g;
+
+	prbs_init(&g, pattern);
+	ber_init(pattern);
+	for (int i = 0; i < 20000; i++) {
+		if (i == 5000) {
+			for (int k = 0; k < 500; k++)
+				ber_rxBit(xorshift() & 1);
+			// the sequence goes on about 60 bits off the phase it would have had, even for PRBS7's period of 127
+			for (int k = 0; k < 560; k++)
+				prbs_next(&g);
+		}
+		ber_rxBit(prbs_next(&g));
+	}
+	const BerStats *s = ber_getStats();
+	check(s->syncLosses == 1 && s->slips == 0, "loses sync on garbage, without a slip", pattern);
+}
+
+int main() {
+	for (unsigned int i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++) {
+		BER_PATTERN pattern = patterns[i];
+		period(pattern);
+		clean(pattern);
+		singleErrors(pattern, 1000);
+		singleErrors(pattern, 100000);
+		burst(pattern);
+		slip(pattern, true);
+		slip(pattern, false);
+		garbage(pattern);
+	}
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,635 @@
+/**
+ * @file bridge_test.c
+ * Host simulation of the two-port learning bridge, see bridge.h, between two bus segments: A0 and A1 with the
+ * bridge's port 0 on one, B0 and B1 with its port 1 on the other. Every node is an instance of its real transmitter,
+ * MAC, monitor, links, bridge and frame pool, built together as one library, see host_instance. Its registers are
+ * swapped in while its code runs, and the line each port sees is the wired-AND of the pins on its segment, as in
+ * rtscts_test. The bridge hears each segment on its port's receive pin, its own frames too: the tool plays its
+ * receiver, filling a frame byte by byte and reporting it through bridge_onHeader and bridge_onFrameEnd as
+ * receiveByte does. The bridge sends what it forwards through its transmitter, no further help from the tool.
+ * A0 sends packets to B0 one at a time, the next once the last arrived:
+ * - cut-through, a packet arrives the frame's airtime and the bridge's delay after A0 started it. Store-and-forward,
+ *   with the bridge told of a frame once its last byte is received, it takes a second airtime but the header
+ * - every copy the bridge sends is heard back on its port and dropped, none goes back to A's segment
+ * And with every end node sending to its neighbour on the segment, a packet always queued:
+ * - the split bus carries about twice the packets of all four nodes on one segment, the bridge filters them
+ * And with A0 moving to B's segment, A1 still sending to it:
+ * - A0's first frame there relearns it, A1's packets are forwarded to it from then on
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c src/mac.c src/monitor.c src/link.c src/bridge.c src/framepool.c -o bridgenode.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/bridge_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o bridge_test
+ * Usage:
+ *   bridge_test [bridgenode.so] [seconds]   (default ./bridgenode.so, 300 s of each run)
+ */
+
+#include "host.h"
+#include "bridge.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "mac.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NODE_A0 0
+#define NODE_A1 1
+#define NODE_B0 2
+#define NODE_B1 3
+#define NUM_END_NODES 4
+#define NODE_BRIDGE 4
+#define NUM_NODES 5
+// the end nodes' ports, then the bridge's
+#define NUM_PORTS (NUM_END_NODES + BRIDGE_NUM_PORTS)
+#define BRIDGE_PORT(p) (NUM_END_NODES + (p))
+#define ADDR(node) (0x20 + (node))
+// the main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// payload of the packets, starting with their number
+#define MSG_LEN 40
+// one at a time, a node sends the next packet once the last one arrived, or after this long
+#define PACKET_TIMEOUT_US 10000000
+
+// how the bridge is told of a frame
+typedef enum {
+	// once its dest byte is received, as receiveByte does
+	CUT_THROUGH,
+	// once its last byte is received
+	STORE_AND_FORWARD,
+} Forwarding;
+
+// how the end nodes send their packets
+typedef enum {
+	LOAD_ONE_AT_A_TIME,
+	LOAD_SATURATED,
+} Load;
+
+typedef struct {
+	void (*linkInit)(int link_count);
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*txIsr[BRIDGE_NUM_PORTS])();
+	void (*monitorStart)(bool exti9_enable);
+	void (*monitorIsr)();
+	void (*onEdge)(int iface);
+	void (*jam)(int iface);
+	void (*macInit)(MAC_MODE mode, uint8_t addr);
+	void (*bridgeInit)(bool enabled);
+	BRIDGE_DECISION (*onHeader)(int port, Frame *frame);
+	void (*onFrameEnd)(int port, bool complete);
+	void (*fpInit)();
+	Frame *(*alloc)();
+	void (*free)(Frame *frame);
+	unsigned int (*available)();
+	// its interfaces in use, and their transmit timers, pins and monitor channels while its code is not running
+	int numPorts;
+	TIMER tim[BRIDGE_NUM_PORTS];
+	uint32_t odr[BRIDGE_NUM_PORTS];
+	uint32_t idr[BRIDGE_NUM_PORTS];
+	uint32_t ccr[BRIDGE_NUM_PORTS];
+	uint32_t dier;
+	uint32_t sr;
+	// end nodes: the node it sends to, -1 for none. Its packet queued, its number and when it started on the line
+	int dest;
+	Frame *data;
+	uint32_t packet;
+	uint32_t queuedAt;
+	uint32_t sentAt;
+	bool arrived;
+} Node;
+
+// an interface of a node, on a segment
+typedef struct {
+	int node;
+	int iface;
+	int segment;
+	// the line as the port sees it
+	int line;
+	// sending: the half-bits so far, from the pin
+	bool running;
+	uint32_t nextIsr;
+	uint32_t startedAt;
+	uint8_t halfBits[16 * FP_FRAME_SIZE];
+	int numHalfBits;
+	// whether the port heard the frame of each port intact so far
+	bool intact[NUM_PORTS];
+	// the bridge's ports: the frame being received and the port sending it, -1 for none, as the receiver would
+	Frame *rx;
+	int rxFrom;
+	bool rxForwarded;
+	bool rxIgnored;
+} Port;
+
+typedef struct {
+	unsigned long queued;
+	unsigned long delivered;
+	unsigned long duplicates;
+	// A1's packets to A0 after A0 moved, and those delivered
+	unsigned long queuedAfterMove;
+	unsigned long deliveredAfterMove;
+	// from a packet starting on the line to its delivery
+	uint64_t latencyUs;
+	// frames each port sent
+	unsigned long sent[NUM_PORTS];
+	// the bridge's decisions, and frames it received with none free
+	unsigned long forwarded;
+	unsigned long filtered;
+	unsigned long echoes;
+	unsigned long noFrame;
+} Result;
+
+static Node nodes[NUM_NODES];
+static Port ports[NUM_PORTS];
+static Forwarding forwarding;
+// when A0 moved to B's segment, 0 while it hasn't
+static uint32_t movedAt;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static void swapIn(Node *n) {
+	for (int p = 0; p < BRIDGE_NUM_PORTS; p++) {
+		const LinkConfig *cfg = &link_configs[p];
+		memcpy((void *)tim_regs(cfg->txTimer), &n->tim[p], sizeof(n->tim[p]));
+		select_gpio(cfg->txGpio)->ODR = n->odr[p];
+		select_gpio(cfg->rxGpio)->IDR = n->idr[p];
+		(&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel] = n->ccr[p];
+	}
+	MONITOR_TIMER_BASE->DIER = n->dier;
+	MONITOR_TIMER_BASE->SR = n->sr;
+}
+
+static void swapOut(Node *n) {
+	for (int p = 0; p < BRIDGE_NUM_PORTS; p++) {
+		const LinkConfig *cfg = &link_configs[p];
+		memcpy(&n->tim[p], (void *)tim_regs(cfg->txTimer), sizeof(n->tim[p]));
+		n->odr[p] = select_gpio(cfg->txGpio)->ODR;
+		n->idr[p] = select_gpio(cfg->rxGpio)->IDR;
+		n->ccr[p] = (&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel];
+	}
+	n->dier = MONITOR_TIMER_BASE->DIER;
+	n->sr = MONITOR_TIMER_BASE->SR;
+}
+
+/**
+ * @return the level a port drives its segment to
+ */
+static int pin(const Port *p) {
+	return (nodes[p->node].odr[p->iface] >> link_configs[p->iface].txPin) & 1;
+}
+
+/**
+ * the MONITOR_TIMER ticks for a step. A node's monitor interrupts once its counter reached a compare channel,
+ * the channel only matching on the tick of the step it was due at
+ */
+static void advance() {
+	uint32_t from = MONITOR_TIMER_BASE->CNT;
+
+	for (int i = 0; i < STEP_US; i++)
+		host_tick();
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		uint32_t flags = 0;
+		for (int p = 0; p < n->numPorts; p++) {
+			uint32_t flag = 1 << (CC1IF + link_configs[p].monitorChannel);
+			if (n->ccr[p] - from - 1 < STEP_US)
+				n->sr |= flag;
+			flags |= flag;
+		}
+		if (n->sr & n->dier & flags) {
+			swapIn(n);
+			n->monitorIsr();
+			swapOut(n);
+		}
+	}
+}
+
+/**
+ * the bridge's receiver decides on the frame of a port, see receiveByte
+ */
+static void decide(Port *l, Result *r) {
+	Node *b = &nodes[l->node];
+
+	switch (b->onHeader(l->iface, l->rx)) {
+	case BRIDGE_FORWARD:
+		l->rxForwarded = true;
+		r->forwarded++;
+		break;
+	case BRIDGE_ECHO:
+		b->free(l->rx);
+		l->rx = NULL;
+		l->rxIgnored = true;
+		r->echoes++;
+		break;
+	default:
+		r->filtered++;
+		break;
+	}
+}
+
+/**
+ * a byte of the frame a port sends is received by a bridge port on its segment, as receiveByte would
+ */
+static void receiveByte(Port *l, int from, uint8_t byte, Result *r) {
+	Node *b = &nodes[l->node];
+
+	if (l->rxFrom < 0)
+		l->rxFrom = from;
+	if (l->rxFrom != from || l->rxIgnored)
+		return;
+	if (!l->rx) {
+		l->rx = b->alloc();
+		if (!l->rx) {
+			l->rxIgnored = true;
+			r->noFrame++;
+			return;
+		}
+	}
+	if (l->rx->len < FP_FRAME_SIZE)
+		l->rx->data[l->rx->len++] = byte;
+	if (forwarding == CUT_THROUGH && l->rx->len == PH_DEST_OFFSET+1)
+		decide(l, r);
+	// the length byte tells the last one, it is received before the line goes IDLE and the copy is handed back
+	if (forwarding == STORE_AND_FORWARD && l->rx->len > PH_LENGTH_OFFSET
+			&& l->rx->len == PH_OVERHEAD + l->rx->data[PH_LENGTH_OFFSET]) {
+		decide(l, r);
+		if (l->rxForwarded) {
+			b->onFrameEnd(l->iface, true);
+			l->rx = NULL;
+			l->rxForwarded = false;
+		}
+	}
+}
+
+/**
+ * the frame a bridge port receives ends, as completeFrame or dropFrame would
+ */
+static void endFrame(Port *l, bool complete) {
+	Node *b = &nodes[l->node];
+
+	if (l->rxForwarded)
+		b->onFrameEnd(l->iface, complete);
+	else if (l->rx)
+		b->free(l->rx);
+	l->rx = NULL;
+	l->rxForwarded = false;
+}
+
+/**
+ * queues an end node's next packet once the last one is done with, as llc_send would: a best effort data packet
+ */
+static void queueData(int node, Load load, Result *r, uint32_t now) {
+	static PacketHeader pkt;
+	uint8_t msg[MSG_LEN];
+	Node *n = &nodes[node];
+
+	if (n->dest < 0 || (n->data && n->data->handle))
+		return;
+	if (n->data && load == LOAD_ONE_AT_A_TIME && !n->arrived && now - n->queuedAt < PACKET_TIMEOUT_US)
+		return;
+	Frame *frame = n->alloc();
+	if (!frame)
+		return;
+	n->packet++;
+	msg[0] = n->packet >> 8;
+	msg[1] = n->packet;
+	for (int i = 2; i < MSG_LEN; i++)
+		msg[i] = n->packet + i;
+	ph_create(&pkt, ADDR(node), ADDR(n->dest), true, msg, MSG_LEN);
+	PH_SET_CLASS(&pkt, PH_CLASS_BEST_EFFORT);
+	frame->cls = PH_CLASS_BEST_EFFORT;
+	frame->len = ph_serialize(frame->data, &pkt);
+	// reported back through llc_complete, which clears it
+	frame->handle = 1;
+	n->data = frame;
+	n->queuedAt = now;
+	n->arrived = false;
+	swapIn(n);
+	n->queue(frame);
+	swapOut(n);
+	r->queued++;
+	if (movedAt && node == NODE_A1 && n->dest == NODE_A0)
+		r->queuedAfterMove++;
+}
+
+/**
+ * a port stopped sending. Each port on its segment that heard its frame intact gets it: a bridge port ends its
+ * reception, an end node takes a packet for it
+ */
+static void finished(int sender, Result *r, uint32_t now) {
+	static PacketHeader pkt;
+	Port *s = &ports[sender];
+	uint8_t data[FP_FRAME_SIZE] = {0};
+	int len = s->numHalfBits / 16;
+
+	// transmitter_init starts the timer, with nothing to send
+	if (!s->numHalfBits)
+		return;
+	r->sent[sender]++;
+	// the second half of a bit is the bit
+	for (int i = 0; i < 8 * len; i++)
+		data[i / 8] |= s->halfBits[2*i + 1] << (7 - i % 8);
+	bool valid = len >= (int)PH_OVERHEAD && ph_parse(&pkt, data, len) && pkt.length == MSG_LEN;
+
+	for (int i = 0; i < NUM_PORTS; i++) {
+		Port *l = &ports[i];
+		if (l->segment != s->segment)
+			continue;
+		if (l->node == NODE_BRIDGE) {
+			// cut short by a collision, it was dropped then
+			if (l->rxFrom == sender && l->intact[sender])
+				endFrame(l, true);
+			if (l->rxFrom == sender)
+				l->rxFrom = -1;
+			continue;
+		}
+		if (i == sender || !l->intact[sender] || !valid || pkt.dest != ADDR(l->node))
+			continue;
+		Node *src = &nodes[pkt.src - ADDR(0)];
+		uint32_t packet = pkt.msg[0] << 8 | pkt.msg[1];
+		if (packet != src->packet || src->arrived) {
+			r->duplicates += packet == src->packet;
+			continue;
+		}
+		src->arrived = true;
+		r->delivered++;
+		r->latencyUs += now - src->sentAt;
+		if (movedAt && pkt.src == ADDR(NODE_A1) && l->node == NODE_A0)
+			r->deliveredAfterMove++;
+	}
+}
+
+/**
+ * attaches the ports to their segments: the end nodes on the bridge's port they are behind, all on segment 0
+ * without the bridge
+ */
+static void attach(bool bridged) {
+	for (int i = 0; i < NUM_PORTS; i++) {
+		Port *p = &ports[i];
+		memset(p, 0, sizeof(*p));
+		p->node = i < NUM_END_NODES ? i : NODE_BRIDGE;
+		p->iface = i < NUM_END_NODES ? LINK_PRIMARY : i - NUM_END_NODES;
+		p->segment = !bridged ? 0 : i < NUM_END_NODES ? (i >= NODE_B0) : p->iface;
+		// the bridge's ports are left on no segment without it
+		if (!bridged && p->node == NODE_BRIDGE)
+			p->segment = -1 - i;
+		p->line = 1;
+		p->rxFrom = -1;
+	}
+}
+
+/**
+ * runs the nodes on fresh instances for a while
+ * @param dests the node each end node sends to, -1 for none
+ * @param bridged false for all end nodes on one segment, without the bridge
+ * @param moveAt time A0 moves to B's segment and sends to B0, 0 for never
+ */
+static void run(const char *lib, const int dests[NUM_END_NODES], bool bridged, Load load, uint32_t seconds,
+		uint32_t moveAt, Result *r) {
+	memset(r, 0, sizeof(*r));
+	movedAt = 0;
+	host_init();
+	ph_init();
+	fp_init();
+	link_init(1);
+	tw_init();
+	attach(bridged);
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		void *node = host_instance(lib);
+		memset(n, 0, sizeof(*n));
+		n->linkInit = host_symbol(node, "link_init");
+		n->init = host_symbol(node, "transmitter_init");
+		n->queue = host_symbol(node, "transmitter_queue");
+		n->update = host_symbol(node, "transmitter_mainRoutineUpdate");
+		n->txIsr[0] = host_symbol(node, "TIM2_IRQHandler");
+		n->txIsr[1] = host_symbol(node, "TIM3_IRQHandler");
+		n->monitorStart = host_symbol(node, "monitor_start");
+		n->monitorIsr = host_symbol(node, "TIM5_IRQHandler");
+		n->onEdge = host_symbol(node, "monitor_onEdge");
+		n->jam = host_symbol(node, "monitor_jam");
+		n->macInit = host_symbol(node, "mac_init");
+		n->bridgeInit = host_symbol(node, "bridge_init");
+		n->onHeader = host_symbol(node, "bridge_onHeader");
+		n->onFrameEnd = host_symbol(node, "bridge_onFrameEnd");
+		n->fpInit = host_symbol(node, "fp_init");
+		n->alloc = host_symbol(node, "fp_alloc");
+		n->free = host_symbol(node, "fp_free");
+		n->available = host_symbol(node, "fp_available");
+		n->fpInit();
+		n->numPorts = i == NODE_BRIDGE ? BRIDGE_NUM_PORTS : 1;
+		n->dest = i < NUM_END_NODES ? dests[i] : -1;
+
+		// the idle line is high, and so are the transmit pins
+		swapIn(n);
+		n->linkInit(n->numPorts);
+		for (int p = 0; p < BRIDGE_NUM_PORTS; p++)
+			select_gpio(link_configs[p].rxGpio)->IDR |= 1 << link_configs[p].rxPin;
+		n->monitorStart(false);
+		n->macInit(MAC_CSMA, ADDR(i));
+		n->bridgeInit(i == NODE_BRIDGE);
+		n->init(true, false);
+		for (int p = 0; p < BRIDGE_NUM_PORTS; p++)
+			set_pin(link_configs[p].txGpio, link_configs[p].txPin);
+		swapOut(n);
+	}
+	// the transmitters draw their backoffs from rand, seeded with the time. Every run draws the same
+	srand(1);
+
+	for (uint32_t t = 0; t < seconds * 1000000; t += STEP_US) {
+		advance();
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// A0 moves once it is not sending
+		if (moveAt && !movedAt && t >= moveAt && !ports[NODE_A0].running) {
+			movedAt = now;
+			ports[NODE_A0].segment = 1;
+			nodes[NODE_A0].dest = NODE_B0;
+		}
+
+		// the half-bits of the senders, each byte received by the bridge's port on the segment
+		for (int i = 0; i < NUM_PORTS; i++) {
+			Port *s = &ports[i];
+			Node *n = &nodes[s->node];
+			if (!s->running || now != s->nextIsr)
+				continue;
+			swapIn(n);
+			n->txIsr[s->iface]();
+			swapOut(n);
+			s->nextIsr += HALFBIT_US;
+			s->running = n->tim[s->iface].CR1 & (1 << CEN);
+			if (!s->running) {
+				finished(i, r, now);
+				continue;
+			}
+			if (s->numHalfBits < (int)sizeof(s->halfBits))
+				s->halfBits[s->numHalfBits++] = pin(s);
+			if (s->numHalfBits % 16)
+				continue;
+			uint8_t byte = 0;
+			for (int b = 0; b < 8; b++)
+				byte |= s->halfBits[s->numHalfBits - 16 + 2*b + 1] << (7 - b);
+			for (int j = 0; j < NUM_PORTS; j++) {
+				Port *l = &ports[j];
+				if (l->node == NODE_BRIDGE && l->segment == s->segment && l->intact[i])
+					receiveByte(l, i, byte, r);
+			}
+		}
+
+		// the line each port sees, garbled if it hears two senders
+		for (int i = 0; i < NUM_PORTS; i++) {
+			Port *l = &ports[i];
+			Node *n = &nodes[l->node];
+			const LinkConfig *cfg = &link_configs[l->iface];
+			int level = 1, senders = 0;
+			for (int j = 0; j < NUM_PORTS; j++) {
+				if (ports[j].segment != l->segment)
+					continue;
+				level &= pin(&ports[j]);
+				senders += ports[j].running;
+			}
+			if (level == l->line && senders < 2)
+				continue;
+			swapIn(n);
+			if (level != l->line) {
+				l->line = level;
+				if (level)
+					select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+				else
+					select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+				n->onEdge(l->iface);
+			}
+			if (senders > 1) {
+				n->jam(l->iface);
+				for (int j = 0; j < NUM_PORTS; j++)
+					l->intact[j] &= !(ports[j].segment == l->segment && ports[j].running);
+			}
+			swapOut(n);
+			// the bridge drops the frame it was receiving
+			if (l->rxFrom >= 0 && !l->intact[l->rxFrom] && !l->rxIgnored) {
+				endFrame(l, false);
+				l->rxIgnored = true;
+			}
+		}
+
+		// the main routines
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			if (i < NUM_END_NODES && t < seconds * 1000000 - PACKET_TIMEOUT_US)
+				queueData(i, load, r, now);
+			swapIn(n);
+			n->update();
+			swapOut(n);
+		}
+		for (int i = 0; i < NUM_PORTS; i++) {
+			Port *s = &ports[i];
+			Node *n = &nodes[s->node];
+			if (s->running || !(n->tim[s->iface].CR1 & (1 << CEN)))
+				continue;
+			s->running = true;
+			s->nextIsr = now + HALFBIT_US;
+			s->startedAt = now;
+			s->numHalfBits = 0;
+			if (s->node != NODE_BRIDGE)
+				n->sentAt = now;
+			for (int j = 0; j < NUM_PORTS; j++) {
+				Port *l = &ports[j];
+				l->intact[i] = true;
+				// a new frame on a segment, the bridge's port receives it afresh
+				if (l->segment == s->segment && l->rxFrom < 0)
+					l->rxIgnored = false;
+			}
+		}
+	}
+}
+
+/**
+ * @return true if every node got all its frames back
+ */
+static bool noLeak() {
+	bool ok = true;
+	for (int i = 0; i < NUM_NODES; i++)
+		ok &= nodes[i].available() == FP_NUM_FRAMES;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./bridgenode.so";
+	uint32_t seconds = argc > 2 ? atoi(argv[2]) : 300;
+	const int toB0[NUM_END_NODES] = {NODE_B0, -1, -1, -1};
+	const int toNeighbour[NUM_END_NODES] = {NODE_A1, NODE_A0, NODE_B1, NODE_B0};
+	const int toA0[NUM_END_NODES] = {NODE_A1, NODE_A0, -1, -1};
+	const int packetLen = MSG_LEN + PH_OVERHEAD;
+	const double airtime = 8.0 * packetLen * MAC_BIT_US / 1000;
+	const double header = 8.0 * (PH_DEST_OFFSET+1) * MAC_BIT_US / 1000;
+	// the other port goes IDLE, then the best effort AIFS and a backoff of up to its first contention window, 3 and 15
+	// slots. The backoff stretches with the collision probability the monitor estimates
+	const double maxForward = (TRANSMISSION_TIMEOUT_US + (3 + 15 * TRANSMITTER_BACKOFF_SCALE) * TRANSMITTER_SLOT_US
+			+ STEP_US) / 1000.0;
+	double latency[2], throughput[2];
+	bool leaked = false;
+	Result r;
+
+	printf("A0, A1 - bridge - B0, B1, %d byte packets, %lu s of each run:\n", packetLen, (unsigned long)seconds);
+	for (int k = 0; k < 2; k++) {
+		forwarding = k ? STORE_AND_FORWARD : CUT_THROUGH;
+		host_quiet(true);
+		run(lib, toB0, true, LOAD_ONE_AT_A_TIME, seconds, 0, &r);
+		host_quiet(false);
+		leaked |= !noLeak();
+		latency[k] = r.delivered ? r.latencyUs / 1000.0 / r.delivered : 0;
+		printf("  A0 to B0 %s: %4lu of %4lu delivered, latency %6.1f ms, the bridge sent %lu on A's segment and "
+				"%lu on B's, %lu heard back\n", k ? "store-and-forward" : "cut-through      ", r.delivered, r.queued,
+				latency[k], r.sent[BRIDGE_PORT(0)], r.sent[BRIDGE_PORT(1)], r.echoes);
+		check(r.delivered > 0 && r.delivered + 1 >= r.queued && r.duplicates == 0 && r.sent[BRIDGE_PORT(0)] == 0
+				&& r.echoes == r.sent[BRIDGE_PORT(1)] && r.forwarded == r.sent[BRIDGE_PORT(1)],
+				"every copy the bridge sends is heard back and dropped, none is forwarded back");
+	}
+	check(latency[0] > airtime && latency[0] <= airtime + header + maxForward,
+			"cut-through, a packet arrives the airtime, the header and the bridge's delay after it started");
+	check(latency[1] >= 2 * airtime && latency[1] - latency[0] >= airtime - header - maxForward,
+			"store-and-forward takes a second airtime, but the header");
+
+	forwarding = CUT_THROUGH;
+	for (int k = 0; k < 2; k++) {
+		host_quiet(true);
+		run(lib, toNeighbour, !k, LOAD_SATURATED, seconds, 0, &r);
+		host_quiet(false);
+		leaked |= !noLeak();
+		throughput[k] = 8.0 * MSG_LEN * r.delivered / seconds;
+		printf("  each node to its neighbour, %s: %5lu delivered, %6.1f bps", k ? "one segment" : "split bus  ",
+				r.delivered, throughput[k]);
+		if (!k)
+			printf(", the bridge forwarded %lu and filtered %lu", r.forwarded, r.filtered);
+		printf("\n");
+		check(r.delivered > 0 && r.duplicates == 0, "every packet delivered once");
+	}
+	check(throughput[0] >= 1.5 * throughput[1], "the split bus carries about twice the packets of one segment");
+
+	host_quiet(true);
+	run(lib, toA0, true, LOAD_ONE_AT_A_TIME, seconds, seconds / 2 * 1000000, &r);
+	host_quiet(false);
+	leaked |= !noLeak();
+	printf("A0 moved to B's segment at %.1f s: %lu of A1's %lu packets to it delivered since\n", movedAt / 1e6,
+			r.deliveredAfterMove, r.queuedAfterMove);
+	check(r.queuedAfterMove > 0 && r.deliveredAfterMove + 1 >= r.queuedAfterMove,
+			"a node moving to the other segment is relearned by its first frame there");
+	check(!leaked, "no frame is leaked");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,544 @@
+/**
+ * @file capture_decoder.c
+ * Host-side decoder for captures of the line, e.g. the files in "Test Files" or logic analyzer exports.
+ * Frames are decoded with the same rules as the firmware: the receiver's edge based manchester sampling
+ * (receiver.c), the monitor's idle timeout to delimit frames (monitor.c), ph_parse and, in stream mode,
+ * the HDLC flag decoder.
+ *
+ * Supported inputs, all read through mmap:
+ * - .csv: one sample per line, either "value" or "time,value". Samples are 1/rate apart.
+ * - .vcd: value change dump. The first 1-bit variable is decoded unless another is named with -n.
+ * - .bin: packed-bit capture. A 24 byte header followed by the samples packed 64 to a word:
+ *         char magic[4] = "MCAP"; uint32_t version = 1; uint64_t sample_rate; uint64_t n_samples;
+ *         uint64_t words[(n_samples+63)/64]; // sample i is bit i%64 of words[i/64], little endian
+ *
+ * Edges in packed captures are found 64 samples at a time: (w ^ (w<<1 | carry)) has a bit set on every
+ * sample that differs from the one before it, so runs without edges cost one xor per word.
+ *
+ * Build:
+ *   gcc -O2 -Iinc tools/capture_decoder.c src/packet_header.c src/hdlc.c -o capture_decoder
+ * Usage:
+ *   capture_decoder [-r rate] [-n signal] [-s] [-x] [-q] capture.{csv,vcd,bin}
+ *   capture_decoder -g out.bin -m megabytes [-r rate] [-s]   (generates a benchmark capture)
+ *   -r sample rate in Hz for csv and generated captures (default 2000, one sample per half-bit)
+ *   -s stream mode (HDLC flag delimited frames), -x print frames as hex instead of parsing packets
+ *   -q only print the summary and throughput
+ */
+
+#include "packet_header.h"
+#include "hdlc.h"
+#include "monitor.h"
+#include "receiver.h"
+#include "transmitter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MAGIC "MCAP"
+#define CAPTURE_VERSION 1
+
+// bit rate of the line, and the receiver's timeouts converted from timer ticks to seconds
+#define BIT_RATE (F_CPU / (2.0 * TRANSMISSION_TICKS))
+#define HALFBIT_TIMEOUT_S (HALFBIT_TIMEOUT_TICKS / (double)F_CPU)
+#define IDLE_TIMEOUT_S (TRANSMISSION_TIMEOUT_US / 1E6)
+
+// large enough for the longest stuffed frame, so garbage between idles can't overflow it
+#define FRAME_BUF_SIZE 1024
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sampleRate;
+	uint64_t nSamples;
+} CaptureHeader;
+
+typedef struct {
+	// timing, in ticks of the capture's time base
+	double ticksPerSec;
+	uint64_t halfbitTimeout;
+	uint64_t idleTimeout;
+	uint64_t lastEdge;
+	uint64_t lastSample;
+	uint64_t frameStart;
+	// line and sampling state, mirroring receiver.c
+	int level;
+	bool busy;
+	bool sample;
+	uint8_t byte;
+	int nbits;
+	uint8_t frame[FRAME_BUF_SIZE];
+	unsigned int len;
+	// stream mode
+	bool stream;
+	HdlcRx hdlc;
+	// output
+	bool hex;
+	bool quiet;
+	unsigned long frames, badFrames, collisions;
+} Decoder;
+
+static void decoder_init(Decoder *d, double ticksPerSec, bool stream, bool hex, bool quiet);
+static inline void decoder_edge(Decoder *d, uint64_t t, int level);
+static void decoder_finish(Decoder *d, uint64_t t);
+static void endFrame(Decoder *d, uint64_t t);
+static void deliver(Decoder *d, uint64_t t);
+static inline void receiveBit(Decoder *d, uint64_t t, int bit);
+static inline void decodeWords(Decoder *d, const uint64_t *words, uint64_t nWords, uint64_t base);
+static inline void decodeTail(Decoder *d, const uint64_t *words, uint64_t from, uint64_t to, uint64_t base);
+static void decodePacked(Decoder *d, const uint64_t *words, uint64_t nSamples);
+static uint64_t decodeCsv(Decoder *d, const char *data, size_t size);
+static bool decodeVcd(Decoder *d, const char *data, size_t size, const char *signal);
+static int generate(const char *path, uint64_t megabytes, uint64_t rate, bool stream);
+
+int main(int argc, char **argv) {
+	double rate = 2000;
+	const char *signal = NULL, *genPath = NULL;
+	uint64_t megabytes = 1024;
+	bool stream = false, hex = false, quiet = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:n:sxqg:m:")) != -1) {
+		switch (opt) {
+		case 'r': rate = atof(optarg); break;
+		case 'n': signal = optarg; break;
+		case 's': stream = true; break;
+		case 'x': hex = true; break;
+		case 'q': quiet = true; break;
+		case 'g': genPath = optarg; break;
+		case 'm': megabytes = strtoull(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-r rate] [-n signal] [-s] [-x] [-q] capture.{csv,vcd,bin}\n"
+					"       %s -g out.bin -m megabytes [-r rate] [-s]\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+
+	ph_init();
+
+	if (genPath)
+		return generate(genPath, megabytes, (uint64_t)rate, stream);
+
+	if (optind >= argc) {
+		fprintf(stderr, "%s: no capture given\n", argv[0]);
+		return 2;
+	}
+
+	const char *path = argv[optind];
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size <= 0) {
+		perror(path);
+		return 1;
+	}
+	size_t size = (size_t)st.st_size;
+	const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	Decoder d;
+	uint64_t nSamples = 0;
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	const char *ext = strrchr(path, '.');
+	if (ext && !strcmp(ext, ".bin")) {
+		const CaptureHeader *hdr = (const CaptureHeader*)data;
+		if (size < sizeof(CaptureHeader) || memcmp(&hdr->magic, CAPTURE_MAGIC, 4) || hdr->version != CAPTURE_VERSION
+				|| size < sizeof(CaptureHeader) + (hdr->nSamples+63)/64*8) {
+			fprintf(stderr, "%s: not a packed-bit capture\n", path);
+			return 1;
+		}
+		nSamples = hdr->nSamples;
+		decoder_init(&d, hdr->sampleRate, stream, hex, quiet);
+		decodePacked(&d, (const uint64_t*)(hdr+1), nSamples);
+	}
+	else if (ext && !strcmp(ext, ".vcd")) {
+		decoder_init(&d, 1, stream, hex, quiet);
+		if (!decodeVcd(&d, data, size, signal)) {
+			fprintf(stderr, "%s: no usable signal\n", path);
+			return 1;
+		}
+	}
+	else {
+		decoder_init(&d, rate, stream, hex, quiet);
+		nSamples = decodeCsv(&d, data, size);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1E9;
+
+	printf("%lu frames, %lu invalid, %lu collisions\n", d.frames, d.badFrames, d.collisions);
+	if (nSamples)
+		fprintf(stderr, "%llu samples (%.1f MB) in %.3f s: %.1f Msamples/s\n", (unsigned long long)nSamples,
+				size / 1E6, elapsed, nSamples / elapsed / 1E6);
+
+	munmap((void*)data, size);
+	close(fd);
+	return 0;
+}
+
+static void decoder_init(Decoder *d, double ticksPerSec, bool stream, bool hex, bool quiet) {
+	memset(d, 0, sizeof(*d));
+	d->ticksPerSec = ticksPerSec;
+	d->halfbitTimeout = HALFBIT_TIMEOUT_S * ticksPerSec;
+	d->idleTimeout = IDLE_TIMEOUT_S * ticksPerSec;
+	d->level = 1; // the line idles high
+	d->sample = true;
+	d->stream = stream;
+	d->hex = hex;
+	d->quiet = quiet;
+	hdlc_rxReset(&d->hdlc);
+}
+
+/**
+ * processes one edge of the line at time t, leaving it at level.
+ * Same rules as the firmware: the monitor times out after TRANSMISSION_TIMEOUT_US without edges,
+ * and an edge is sampled unless it follows a sampled edge within HALFBIT_TIMEOUT_TICKS (TIM4).
+ */
+static inline void decoder_edge(Decoder *d, uint64_t t, int level) {
+	if (d->busy && t - d->lastEdge > d->idleTimeout)
+		endFrame(d, d->lastEdge + d->idleTimeout);
+
+	if (!d->busy) {
+		d->busy = true;
+		d->frameStart = t;
+		d->sample = true;
+		d->nbits = d->len = 0;
+	}
+
+	// the TIM4 timeout would have fired, so this is a half bit period edge
+	if (d->sample || t - d->lastSample > d->halfbitTimeout) {
+		d->lastSample = t;
+		d->sample = false;
+		receiveBit(d, t, level);
+	}
+	else {
+		// bit period edge, the next one is always sampled
+		d->sample = true;
+	}
+
+	d->level = level;
+	d->lastEdge = t;
+}
+
+/**
+ * the capture ended at time t. A frame still on the line is delivered as far as it got
+ */
+static void decoder_finish(Decoder *d, uint64_t t) {
+	if (d->busy && t - d->lastEdge > d->idleTimeout)
+		endFrame(d, d->lastEdge + d->idleTimeout);
+	else if (d->busy && !d->stream && d->len)
+		deliver(d, d->frameStart);
+}
+
+/**
+ * the monitor timed out at time t: IDLE if the line is high, COLLISION otherwise
+ */
+static void endFrame(Decoder *d, uint64_t t) {
+	d->busy = false;
+	if (d->level == 0) {
+		d->collisions++;
+		if (!d->quiet)
+			printf("%12.6f collision\n", t / d->ticksPerSec);
+	}
+	else if (!d->stream && d->len) {
+		deliver(d, d->frameStart);
+	}
+	d->len = 0;
+	hdlc_rxReset(&d->hdlc);
+}
+
+static inline void receiveBit(Decoder *d, uint64_t t, int bit) {
+	if (d->stream) {
+		uint8_t byte;
+		switch (hdlc_rxBit(&d->hdlc, bit, &byte)) {
+		case HDLC_RX_BYTE:
+			if (d->len == 0)
+				d->frameStart = t;
+			if (d->len < FRAME_BUF_SIZE)
+				d->frame[d->len++] = byte;
+			break;
+		case HDLC_RX_FRAME:
+			deliver(d, d->frameStart);
+			d->len = 0;
+			break;
+		case HDLC_RX_ABORT:
+			d->len = 0;
+			break;
+		default:
+			break;
+		}
+		return;
+	}
+
+	d->byte = (d->byte << 1) | bit;
+	if (++d->nbits == 8) {
+		if (d->len < FRAME_BUF_SIZE)
+			d->frame[d->len++] = d->byte;
+		d->nbits = 0;
+	}
+}
+
+static void deliver(Decoder *d, uint64_t t) {
+	static PacketHeader pkt;
+	bool valid = d->hex || ph_parse(&pkt, d->frame, d->len);
+
+	d->frames++;
+	if (!valid)
+		d->badFrames++;
+	if (d->quiet)
+		return;
+
+	printf("%12.6f len=%-3u ", t / d->ticksPerSec, d->len);
+	if (d->hex) {
+		for (unsigned int i = 0; i<d->len; i++)
+			printf("%02x", d->frame[i]);
+		printf("\n");
+	}
+	else if (!valid) {
+		printf("invalid packet\n");
+	}
+	else {
+		printf("src=%x dest=%x crc8=%x \"%.*s\"\n", pkt.src, pkt.dest, pkt.crc8_fcs, pkt.length, pkt.msg);
+	}
+}
+
+/**
+ * finds the edges of nWords packed words 64 samples at a time. base is the index of the first sample
+ */
+static inline void decodeWords(Decoder *d, const uint64_t *words, uint64_t nWords, uint64_t base) {
+	// the line level is the value of the last sample processed
+	uint64_t carry = d->level;
+
+	for (uint64_t i = 0; i<nWords; i++) {
+		uint64_t w = words[i];
+		uint64_t edges = w ^ ((w << 1) | carry);
+		carry = w >> 63;
+		while (edges) {
+			int bit = __builtin_ctzll(edges);
+			edges &= edges - 1;
+			decoder_edge(d, base + i*64 + bit, (w >> bit) & 1);
+		}
+	}
+}
+
+/**
+ * decodes the samples one at a time, for the tail of a capture that doesn't fill a word
+ */
+static inline void decodeTail(Decoder *d, const uint64_t *words, uint64_t from, uint64_t to, uint64_t base) {
+	for (uint64_t i = from; i<to; i++) {
+		int level = (words[(i-base)/64] >> ((i-base)%64)) & 1;
+		if (level != d->level)
+			decoder_edge(d, i, level);
+	}
+}
+
+static void decodePacked(Decoder *d, const uint64_t *words, uint64_t nSamples) {
+	decodeWords(d, words, nSamples/64, 0);
+	decodeTail(d, words, nSamples/64*64, nSamples, 0);
+	decoder_finish(d, nSamples);
+}
+
+/**
+ * packs the csv samples into words and decodes them like a packed capture
+ * @return number of samples
+ */
+static uint64_t decodeCsv(Decoder *d, const char *data, size_t size) {
+	uint64_t words[1024];
+	uint64_t n = 0, base = 0;
+	int value = -1;
+
+	memset(words, 0, sizeof(words));
+	for (size_t i = 0; i<=size; i++) {
+		char c = i < size ? data[i] : '\n';
+		if (c == '0' || c == '1') {
+			// for "time,value" lines the value is the last digit
+			value = c - '0';
+		}
+		else if (c == ',' || c == ';') {
+			value = -1;
+		}
+		else if (c == '\n' && value >= 0) {
+			uint64_t k = n - base;
+			words[k/64] |= (uint64_t)value << (k%64);
+			n++;
+			value = -1;
+			if (n - base == sizeof(words)*8) {
+				decodeWords(d, words, sizeof(words)/8, base);
+				base = n;
+				memset(words, 0, sizeof(words));
+			}
+		}
+	}
+
+	decodeTail(d, words, base, n, base);
+	decoder_finish(d, n);
+	return n;
+}
+
+/**
+ * decodes the value changes of one 1-bit signal of a value change dump
+ */
+static bool decodeVcd(Decoder *d, const char *data, size_t size, const char *signal) {
+	const char *p = data, *end = data + size;
+	char id[32] = "";
+	double timescale = 1E-9;
+	uint64_t t = 0;
+	bool started = false;
+
+	while (p < end) {
+		// next whitespace delimited token
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+			p++;
+		const char *tok = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+			p++;
+		size_t len = p - tok;
+		if (len == 0)
+			break;
+
+		if (!started) {
+			if (len == 10 && !strncmp(tok, "$timescale", len)) {
+				char unit[8] = "";
+				double mult = 1;
+				sscanf(p, " %lf %7[a-z]", &mult, unit);
+				double scale = !strncmp(unit, "fs", 2) ? 1E-15 : !strncmp(unit, "ps", 2) ? 1E-12 :
+						!strncmp(unit, "ns", 2) ? 1E-9 : !strncmp(unit, "us", 2) ? 1E-6 :
+						!strncmp(unit, "ms", 2) ? 1E-3 : 1;
+				timescale = mult * scale;
+			}
+			else if (len == 4 && !strncmp(tok, "$var", len)) {
+				char type[16], ref[64], code[32];
+				int width;
+				if (sscanf(p, " %15s %d %31s %63s", type, &width, code, ref) == 4 && width == 1
+						&& !id[0] && (!signal || !strcmp(ref, signal)))
+					strcpy(id, code);
+			}
+			else if (len == 15 && !strncmp(tok, "$enddefinitions", len)) {
+				if (!id[0])
+					return false;
+				decoder_init(d, 1 / timescale, d->stream, d->hex, d->quiet);
+				started = true;
+			}
+			continue;
+		}
+
+		if (tok[0] == '#') {
+			t = strtoull(tok+1, NULL, 10);
+		}
+		else if ((tok[0] == '0' || tok[0] == '1') && len-1 == strlen(id) && !strncmp(tok+1, id, len-1)) {
+			int level = tok[0] - '0';
+			if (level != d->level)
+				decoder_edge(d, t, level);
+		}
+	}
+
+	decoder_finish(d, UINT64_MAX);
+	return started;
+}
+
+/**
+ * Run-length bit writer for generated captures
+ */
+typedef struct {
+	FILE *f;
+	uint64_t word;
+	uint64_t n;
+	uint64_t buf[4096];
+	int nbuf;
+} BitWriter;
+
+static void writeRun(BitWriter *w, int level, uint64_t count) {
+	while (count) {
+		unsigned int k = w->n % 64;
+		uint64_t take = 64 - k < count ? 64 - k : count;
+		if (level)
+			w->word |= (take == 64 ? ~0ULL : ((1ULL << take) - 1)) << k;
+		w->n += take;
+		count -= take;
+		if (w->n % 64 == 0) {
+			w->buf[w->nbuf++] = w->word;
+			w->word = 0;
+			if (w->nbuf == sizeof(w->buf)/8) {
+				fwrite(w->buf, 8, w->nbuf, w->f);
+				w->nbuf = 0;
+			}
+		}
+	}
+}
+
+/**
+ * writes a packed-bit capture of about megabytes MB holding numbered packets, sampled at rate
+ */
+static int generate(const char *path, uint64_t megabytes, uint64_t rate, bool stream) {
+	BitWriter w = {.f = fopen(path, "wb")};
+	if (!w.f) {
+		perror(path);
+		return 1;
+	}
+	CaptureHeader hdr = {0, CAPTURE_VERSION, rate, 0};
+	memcpy(&hdr.magic, CAPTURE_MAGIC, 4);
+	fwrite(&hdr, sizeof(hdr), 1, w.f);
+
+	uint64_t halfbit = rate / (2 * BIT_RATE);
+	uint64_t gap = 5 * IDLE_TIMEOUT_S * rate;
+	uint64_t target = megabytes * 1000000 * 8;
+	unsigned long count = 0;
+	if (halfbit == 0) {
+		fprintf(stderr, "sample rate must be at least %.0f Hz\n", 2 * BIT_RATE);
+		return 1;
+	}
+
+	writeRun(&w, 1, gap);
+	while (w.n < target) {
+		PacketHeader pkt;
+		uint8_t frame[sizeof(PacketHeader)];
+		char msg[32];
+		HdlcTx tx;
+		int len = snprintf(msg, sizeof(msg), "packet %lu", count++);
+		ph_create(&pkt, 0xAA, 0xBB, true, msg, len);
+		unsigned int size = ph_serialize(frame, &pkt);
+
+		// manchester as sent by the transmitter, the first half-bit is the inverted bit. See encodeManchester
+		// back-to-back frames share their flags
+		hdlc_txStart(&tx, frame, size, count == 1);
+		for (unsigned int i = 0; ; i++) {
+			int bit;
+			if (stream) {
+				if ((bit = hdlc_txNextBit(&tx)) == HDLC_TX_DONE)
+					break;
+			}
+			else {
+				if (i == 8*size)
+					break;
+				bit = (frame[i/8] >> (7 - i%8)) & 1;
+			}
+			writeRun(&w, !bit, halfbit);
+			writeRun(&w, bit, halfbit);
+		}
+		// stream mode goes back-to-back, idle mode needs the line to time out
+		writeRun(&w, 1, stream ? 0 : gap);
+	}
+	writeRun(&w, 1, gap);
+
+	uint64_t n = w.n;
+	if (n % 64)
+		writeRun(&w, 1, 64 - n % 64);
+	fwrite(w.buf, 8, w.nbuf, w.f);
+	hdr.nSamples = n;
+	fseek(w.f, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, w.f);
+	fclose(w.f);
+
+	fprintf(stderr, "%s: %lu packets, %llu samples at %llu Hz\n", path, count,
+			(unsigned long long)n, (unsigned long long)rate);
+	return 0;
+}
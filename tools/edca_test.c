@@ -0,0 +1,366 @@
+/**
+ * @file edca_test.c
+ * Host simulation of the traffic classes of the CSMA path, see transmitter.c. Every node is an instance of the real
+ * transmitter, see host_instance, so the classes contend through its own AIFS, backoff and contention windows. The
+ * registers of its timer and pins are swapped in while a node's code runs. The line is the wired-AND of the nodes'
+ * pins, fed to the monitor, and two nodes sending at once are jammed into a collision, as the garbled line would be.
+ * - mixed saturated load: every node keeps a frame queued in every class. A frame only starts past the AIFS of its
+ *   class, the higher the class, the larger its share of the line and the shorter its wait for it, and the nodes
+ *   share the line evenly. The wait of each class, from being queued to winning the line, is reported
+ * - alarms: short frames from one node, behind long ones in the background and best effort classes from the others.
+ *   Sent as voice they wait far less than sent as best effort
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c -o transmitter.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/edca_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o edca_test
+ * Usage:
+ *   edca_test [transmitter.so] [seconds]   (default ./transmitter.so, 300 s of each run)
+ */
+
+#include "host.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "mac.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NUM_NODES 3
+// the main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+#define MAX_SAMPLES 20000
+
+// AIFSN of each class, as in edcaParams
+static const int aifsn[PH_NUM_CLASSES] = {7, 3, 2, 2};
+static const char *classNames[PH_NUM_CLASSES] = {"background", "best effort", "video", "voice"};
+
+// traffic of a node in a class: frames of len bytes, queued gapUs at most after the last one is done. 0 for none
+typedef struct {
+	int len;
+	uint32_t gapUs;
+} Traffic;
+
+typedef struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*isr)();
+	// the registers of its transmit timer and pins, while its code is not running
+	TIMER tim;
+	uint32_t odr;
+	bool running;
+	uint32_t nextIsr;
+	const Traffic *traffic;
+	// the frame of each class, and when the next one is queued once it is done
+	Frame *frames[PH_NUM_CLASSES];
+	uint32_t queueAt[PH_NUM_CLASSES];
+} Node;
+
+typedef struct {
+	uint32_t waits[PH_NUM_CLASSES][MAX_SAMPLES];
+	unsigned long queued[PH_NUM_CLASSES];
+	unsigned long sent[PH_NUM_CLASSES];
+	unsigned long dropped[PH_NUM_CLASSES];
+	uint64_t airUs[PH_NUM_CLASSES];
+	unsigned long earlyStarts;
+	unsigned long nodeSent[NUM_NODES];
+	// the waits of node 0, which sends the alarms
+	uint32_t alarmWaits[MAX_SAMPLES];
+	MonitorStats stats;
+} Result;
+
+static Node nodes[NUM_NODES];
+static const LinkConfig *cfg;
+static int line = 1;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 37;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void swapIn(Node *n) {
+	memcpy((void *)tim_regs(cfg->txTimer), &n->tim, sizeof(n->tim));
+	select_gpio(cfg->txGpio)->ODR = n->odr;
+}
+
+static void swapOut(Node *n) {
+	memcpy(&n->tim, (void *)tim_regs(cfg->txTimer), sizeof(n->tim));
+	n->odr = select_gpio(cfg->txGpio)->ODR;
+}
+
+static void setLine(int level) {
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	monitor_onEdge(LINK_PRIMARY);
+}
+
+/**
+ * queues the next frame of a class, if it is due
+ */
+static void queueFrame(Node *n, int cls, uint32_t now, Result *r) {
+	if (!n->traffic[cls].len || n->frames[cls] || (int32_t)(now - n->queueAt[cls]) < 0)
+		return;
+	Frame *frame = fp_alloc();
+	frame->len = n->traffic[cls].len;
+	frame->cls = cls;
+	// reported back through llc_complete, which clears it
+	frame->handle = 1;
+	memset(frame->stamps, 0, sizeof(frame->stamps));
+	for (int i = 0; i < frame->len; i++)
+		frame->data[i] = xorshift();
+	n->frames[cls] = frame;
+	r->queued[cls]++;
+	swapIn(n);
+	n->queue(frame);
+	swapOut(n);
+}
+
+/**
+ * takes the frames the node is done with, sent or dropped after too many collisions
+ */
+static void collect(Node *n, int node, Result *r, uint32_t now) {
+	for (int c = 0; c < PH_NUM_CLASSES; c++) {
+		Frame *frame = n->frames[c];
+		if (!frame || frame->handle)
+			continue;
+		if (frame->stamps[FP_LAST_EDGE]) {
+			if (r->sent[c] < MAX_SAMPLES)
+				r->waits[c][r->sent[c]] = frame->stamps[FP_ACQUIRED] - frame->stamps[FP_ENQUEUED];
+			r->sent[c]++;
+			r->airUs[c] += frame->stamps[FP_LAST_EDGE] - frame->stamps[FP_ACQUIRED];
+			if (node == 0 && r->nodeSent[0] < MAX_SAMPLES)
+				r->alarmWaits[r->nodeSent[0]] = frame->stamps[FP_ACQUIRED] - frame->stamps[FP_ENQUEUED];
+			r->nodeSent[node]++;
+		}
+		else {
+			r->dropped[c]++;
+		}
+		n->frames[c] = NULL;
+		n->queueAt[c] = now + (n->traffic[c].gapUs ? xorshift() % (2 * n->traffic[c].gapUs) : 0);
+	}
+}
+
+/**
+ * a node just started sending. It must have waited out the AIFS of its frame's class since the line went IDLE
+ */
+static void started(Node *n, Result *r, uint32_t now) {
+	uint32_t idleSince = monitor_getIdleSince(LINK_PRIMARY);
+
+	for (int c = 0; c < PH_NUM_CLASSES; c++) {
+		Frame *frame = n->frames[c];
+		if (frame && frame->stamps[FP_ACQUIRED] == now)
+			r->earlyStarts += (int32_t)(now - idleSince) < aifsn[c] * TRANSMITTER_SLOT_US;
+	}
+}
+
+/**
+ * runs the nodes on fresh instances of the transmitter for a while
+ */
+static void run(const char *lib, const Traffic traffic[NUM_NODES][PH_NUM_CLASSES], uint32_t seconds, Result *r) {
+	memset(r, 0, sizeof(*r));
+	host_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	// the idle line is high
+	line = 1;
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, 0x10);
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		void *tx = host_instance(lib);
+		memset(n, 0, sizeof(*n));
+		n->init = host_symbol(tx, "transmitter_init");
+		n->queue = host_symbol(tx, "transmitter_queue");
+		n->update = host_symbol(tx, "transmitter_mainRoutineUpdate");
+		n->isr = host_symbol(tx, "TIM2_IRQHandler");
+		n->traffic = traffic[i];
+		n->init(false, false);
+		// its pin idles high, as once a transmission is stopped
+		set_pin(cfg->txGpio, cfg->txPin);
+		swapOut(n);
+	}
+	// the transmitters draw their backoffs from rand, seeded with the time
+	srand(1);
+
+	for (uint32_t t = 0; t < seconds * 1000000; t += STEP_US) {
+		host_advance(STEP_US);
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// the half-bits of the senders, then the line they make
+		int level = 1, senders = 0;
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			if (n->running && now == n->nextIsr) {
+				swapIn(n);
+				n->isr();
+				swapOut(n);
+				n->nextIsr += HALFBIT_US;
+				n->running = n->tim.CR1 & (1 << CEN);
+			}
+			level &= (n->odr >> cfg->txPin) & 1;
+			senders += n->running;
+		}
+		setLine(level);
+		if (senders > 1)
+			monitor_jam(LINK_PRIMARY);
+
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			for (int c = 0; c < PH_NUM_CLASSES; c++)
+				queueFrame(n, c, now, r);
+			swapIn(n);
+			n->update();
+			swapOut(n);
+			if (!n->running && (n->tim.CR1 & (1 << CEN))) {
+				n->running = true;
+				n->nextIsr = now + HALFBIT_US;
+				started(n, r, now);
+			}
+			collect(n, i, r, now);
+		}
+	}
+	monitor_getStats(LINK_PRIMARY, &r->stats);
+}
+
+static int compareWaits(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * sorts waits and prints their distribution
+ * @return their mean in ms
+ */
+static double distribution(uint32_t *w, unsigned long n) {
+	uint64_t total = 0;
+
+	if (n > MAX_SAMPLES)
+		n = MAX_SAMPLES;
+	if (!n)
+		return 0;
+	qsort(w, n, sizeof(*w), compareWaits);
+	for (unsigned long i = 0; i < n; i++)
+		total += w[i];
+	double mean = total / 1000.0 / n;
+	printf("wait mean %7.1f p50 %7.1f p90 %7.1f p99 %7.1f max %7.1f ms\n", mean, w[n / 2] / 1000.0,
+			w[n * 9 / 10] / 1000.0, w[n * 99 / 100] / 1000.0, w[n - 1] / 1000.0);
+	return mean;
+}
+
+/**
+ * prints the frames and waits of every class with traffic
+ * @param means the mean wait of each class in ms
+ */
+static void report(Result *r, double means[PH_NUM_CLASSES]) {
+	uint64_t air = 0;
+
+	for (int c = 0; c < PH_NUM_CLASSES; c++)
+		air += r->airUs[c];
+	for (int c = PH_NUM_CLASSES-1; c >= 0; c--) {
+		means[c] = 0;
+		if (!r->queued[c])
+			continue;
+		if (!r->sent[c]) {
+			printf("  %-12s %6lu sent, starved\n", classNames[c], r->sent[c]);
+			continue;
+		}
+		printf("  %-12s %6lu sent, %4lu dropped, %5.1f%% of the airtime, ", classNames[c], r->sent[c],
+				r->dropped[c], 100.0 * r->airUs[c] / air);
+		means[c] = distribution(r->waits[c], r->sent[c]);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./transmitter.so";
+	uint32_t seconds = argc > 2 ? atoi(argv[2]) : 300;
+	static Result r;
+	double means[PH_NUM_CLASSES];
+
+	// every node keeps an 8 byte frame queued in every class
+	Traffic saturated[NUM_NODES][PH_NUM_CLASSES];
+	for (int i = 0; i < NUM_NODES; i++) {
+		for (int c = 0; c < PH_NUM_CLASSES; c++)
+			saturated[i][c] = (Traffic){8, 0};
+	}
+	host_quiet(true);
+	run(lib, saturated, seconds, &r);
+	host_quiet(false);
+	printf("mixed saturated load, %d nodes, %lu s: %lu transmissions, %lu collisions\n", NUM_NODES,
+			(unsigned long)seconds, (unsigned long)r.stats.transmissions, (unsigned long)r.stats.collisions);
+	report(&r, means);
+
+	// a class may be starved by the ones above it, it never waited for long enough
+	bool ordered = true;
+	for (int c = 0; c < PH_NUM_CLASSES-1; c++)
+		ordered &= r.sent[c+1] > r.sent[c] && (!r.sent[c] || means[c] > means[c+1]);
+	unsigned long total = 0, lowest = ~0ul, highest = 0;
+	for (int i = 0; i < NUM_NODES; i++) {
+		total += r.nodeSent[i];
+		lowest = r.nodeSent[i] < lowest ? r.nodeSent[i] : lowest;
+		highest = r.nodeSent[i] > highest ? r.nodeSent[i] : highest;
+	}
+	printf("  frames sent per node %lu..%lu\n", lowest, highest);
+	check(r.earlyStarts == 0, "a frame only starts past the AIFS of its class");
+	check(ordered, "the higher the class, the more frames it sends and the shorter it waits");
+	check(r.stats.collisions > 0 && r.dropped[PH_CLASS_VOICE] + r.dropped[PH_CLASS_VIDEO] < total / 100,
+			"frames that collide are retried from a wider window, and seldom dropped");
+	check(lowest * NUM_NODES > total * 9 / 10 && highest * NUM_NODES < total * 11 / 10,
+			"the nodes share the line evenly");
+
+	// 4 byte alarms from node 0, about every 2 s, behind 64 byte frames from the others
+	const int alarmClasses[] = {PH_CLASS_VOICE, PH_CLASS_BEST_EFFORT};
+	double alarmMeans[2];
+	uint32_t alarmP90[2];
+	for (int a = 0; a < 2; a++) {
+		Traffic alarms[NUM_NODES][PH_NUM_CLASSES] = {{{0, 0}}};
+		alarms[0][alarmClasses[a]] = (Traffic){4, 2000000};
+		for (int i = 1; i < NUM_NODES; i++) {
+			alarms[i][PH_CLASS_BACKGROUND] = (Traffic){64, 0};
+			alarms[i][PH_CLASS_BEST_EFFORT] = (Traffic){64, 0};
+		}
+		host_quiet(true);
+		run(lib, alarms, seconds, &r);
+		host_quiet(false);
+		printf("alarms sent as %s, behind 64 byte frames, %lu s:\n", classNames[alarmClasses[a]],
+				(unsigned long)seconds);
+		report(&r, means);
+		printf("  %lu alarms, ", r.nodeSent[0]);
+		alarmMeans[a] = distribution(r.alarmWaits, r.nodeSent[0]);
+		unsigned long n = r.nodeSent[0] < MAX_SAMPLES ? r.nodeSent[0] : MAX_SAMPLES;
+		alarmP90[a] = n ? r.alarmWaits[n * 9 / 10] : 0;
+	}
+	check(alarmMeans[0] > 0 && alarmMeans[0] * 2 < alarmMeans[1] && alarmP90[0] < alarmP90[1],
+			"alarms sent as voice wait far less than as best effort");
+
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,273 @@
+/**
+ * @file framepool_test.c
+ * Host simulation of a node receiving a burst of back-to-back frames into the frame pool, see framepool.h. The
+ * node runs its real receiver and monitor under the link layer, and takes the frames through llc_pollRx as an
+ * application does. The sender is a peer, an instance of the real transmitter with a pool of its own, see
+ * host_instance. It keeps frames queued, so that they go out back-to-back: in idle mode as soon as the line has
+ * been IDLE for their AIFS and backoff, in stream mode right after each other, a flag between them. Its transmit
+ * pin drives the node's receive pin. The tool plays the hardware as link_test does, on a 1 us grid.
+ * - the application stalls for a burst longer than the pool: the receiver completes the frames from its ISRs and
+ *   holds FP_NUM_FRAMES of them, all delivered in order once the application polls again. The ones past that are
+ *   dropped and reported through LLC_EV_RX_DROPPED, none is lost without a report
+ * - a long burst with the application polling from its main loop: every frame is delivered, in order, and none
+ *   is dropped
+ * - every frame is back in the pool once the line is IDLE
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c src/framepool.c -o txnode.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/framepool_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o framepool_test
+ * Usage:
+ *   framepool_test [txnode.so] [frames]   (default ./txnode.so, 1000 frames in the long burst)
+ */
+
+#include "host.h"
+#include "llc.h"
+#include "link.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "monitor.h"
+#include "mac.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include "gpio.h"
+#include "tim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SRC 0xAA
+#define DEST 0xBB
+// the main routine runs this often
+#define MAIN_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// payload of the frames, starting with their number
+#define MSG_LEN 8
+// frames the peer keeps queued, out of its own pool
+#define QUEUED 8
+// frames of the stalled burst past what the pool holds
+#define EXCESS 4
+
+// the peer, an instance of the transmitter
+static struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*isr)();
+	Frame *(*alloc)();
+	unsigned int (*available)();
+	bool running;
+	uint32_t nextIsr;
+	int queued;
+} peer;
+
+// what the application got
+static struct {
+	unsigned long delivered;
+	unsigned long outOfOrder;
+	unsigned long dropped;
+	int expected;
+	uint32_t firstStart;
+	uint32_t lastStart;
+} app;
+
+static int line;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static void onReceive(const LlcPacket *packet) {
+	int number = packet->length == MSG_LEN ? packet->msg[0] << 8 | packet->msg[1] : -1;
+
+	if (!packet->valid || packet->src != SRC)
+		return;
+	if (!app.delivered)
+		app.firstStart = packet->start;
+	app.lastStart = packet->start;
+	app.delivered++;
+	app.outOfOrder += number != app.expected;
+	app.expected = number + 1;
+}
+
+static void onEvent(const LlcLinkEvent *event) {
+	if (event->type == LLC_EV_RX_DROPPED)
+		app.dropped += event->value;
+}
+
+/**
+ * keeps QUEUED frames queued at the peer, each carrying its number, until limit are
+ */
+static void refill(int limit) {
+	static PacketHeader pkt;
+	uint8_t msg[MSG_LEN];
+
+	while (peer.queued < limit && peer.available() > FP_NUM_FRAMES - QUEUED) {
+		Frame *frame = peer.alloc();
+		msg[0] = peer.queued >> 8;
+		msg[1] = peer.queued;
+		for (int b = 2; b < MSG_LEN; b++)
+			msg[b] = peer.queued + b;
+		ph_create(&pkt, SRC, DEST, true, msg, MSG_LEN);
+		frame->cls = PH_CLASS_BEST_EFFORT;
+		frame->len = ph_serialize(frame->data, &pkt);
+		frame->handle = 0;
+		peer.queue(frame);
+		peer.queued++;
+	}
+}
+
+/**
+ * the node's receive pin follows the peer's transmit pin, each edge interrupts
+ */
+static void drive() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	int level = (select_gpio(cfg->txGpio)->ODR >> cfg->txPin) & 1;
+
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	*(EXTI_PR) |= 1 << cfg->rxPin;
+	EXTI4_IRQHandler();
+}
+
+/**
+ * the receive timer counts for a us while it runs. At HALFBIT_TIMEOUT_TICKS it interrupts, and restarts from 0
+ */
+static void countHalfBit() {
+	volatile TIMER *tim = tim_regs(link_configs[LINK_PRIMARY].halfBitTimer);
+
+	if (!(tim->CR1 & (1 << CEN)))
+		return;
+	tim->CNT += F_CPU / 1000000;
+	if (tim->CNT < HALFBIT_TIMEOUT_TICKS)
+		return;
+	tim->CNT -= HALFBIT_TIMEOUT_TICKS;
+	tim->SR |= 1 << CC1IF;
+	TIM4_IRQHandler();
+}
+
+/**
+ * the peer sends frames up to limit, the node's application polling or not. Runs until the line has been IDLE
+ * for a while after the last one
+ */
+static void run(int limit, bool polling) {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	const uint32_t channels = ((1 << 4) - 1) << CC1IF;
+	uint32_t quietUs = 0;
+
+	for (uint32_t t = 0; quietUs < 100000; t++) {
+		host_tick();
+		if (MONITOR_TIMER_BASE->SR & MONITOR_TIMER_BASE->DIER & channels)
+			TIM5_IRQHandler();
+		uint32_t now = monitor_now();
+
+		countHalfBit();
+		if (peer.running && now == peer.nextIsr) {
+			tim_regs(cfg->txTimer)->SR |= 1 << CC1IF;
+			peer.isr();
+			peer.nextIsr += HALFBIT_US;
+			peer.running = tim_regs(cfg->txTimer)->CR1 & (1 << CEN);
+			drive();
+		}
+		bool done = peer.queued == limit && peer.available() == FP_NUM_FRAMES && !peer.running;
+		quietUs = done && monitor_getState(LINK_PRIMARY) == MS_IDLE ? quietUs + 1 : 0;
+
+		if (t % MAIN_US)
+			continue;
+		tw_run();
+		refill(limit);
+		peer.update();
+		if (!peer.running && (tim_regs(cfg->txTimer)->CR1 & (1 << CEN))) {
+			peer.running = true;
+			peer.nextIsr = now + HALFBIT_US;
+		}
+		if (polling)
+			llc_pollRx();
+	}
+}
+
+/**
+ * a stalled application, then a polling one, in one framing mode
+ */
+static void burst(const char *lib, bool streamMode, int frames) {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	const LlcCallbacks callbacks = {.onReceive = onReceive, .onEvent = onEvent};
+	const char *mode = streamMode ? "stream mode" : "idle mode";
+	char what[120];
+
+	memset(&peer, 0, sizeof(peer));
+	memset(&app, 0, sizeof(app));
+	host_init();
+	host_quiet(true);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, DEST);
+	// the idle line is high
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	line = 1;
+	// the node's own transmitter is started, but never polled. The peer's takes over its timer and pin
+	llc_init(DEST, true, streamMode, &callbacks);
+	void *tx = host_instance(lib);
+	peer.init = host_symbol(tx, "transmitter_init");
+	peer.queue = host_symbol(tx, "transmitter_queue");
+	peer.update = host_symbol(tx, "transmitter_mainRoutineUpdate");
+	peer.isr = host_symbol(tx, "TIM2_IRQHandler");
+	peer.alloc = host_symbol(tx, "fp_alloc");
+	peer.available = host_symbol(tx, "fp_available");
+	((void (*)())host_symbol(tx, "fp_init"))();
+	peer.init(true, streamMode);
+	set_pin(cfg->txGpio, cfg->txPin);
+	srand(1);
+
+	// stalled: the pool fills, then receptions are dropped, and reported once the application polls
+	run(FP_NUM_FRAMES + EXCESS, false);
+	unsigned int heldFree = fp_available();
+	llc_pollRx();
+	unsigned long stalledDelivered = app.delivered, stalledDropped = app.dropped;
+	bool stalledOrdered = !app.outOfOrder;
+
+	// polling: the numbers go on from the dropped ones
+	app.delivered = app.dropped = app.outOfOrder = 0;
+	app.expected = peer.queued;
+	run(peer.queued + frames, true);
+	host_quiet(false);
+
+	printf("%s, %d byte frames:\n", mode, (int)(PH_OVERHEAD + MSG_LEN));
+	printf("  stalled for %d frames: %lu held and delivered, %lu reported dropped, %u of %d pool frames free meanwhile\n",
+			FP_NUM_FRAMES + EXCESS, stalledDelivered, stalledDropped, heldFree, FP_NUM_FRAMES);
+	printf("  polling, %d frames: %lu delivered, %lu dropped, %.1f ms from one frame's start to the next\n", frames,
+			app.delivered, app.dropped,
+			app.delivered > 1 ? (app.lastStart - app.firstStart) / 1e3 / (app.delivered - 1) : 0);
+	snprintf(what, sizeof(what), "%s: a stalled application gets the FP_NUM_FRAMES frames the pool held, in order",
+			mode);
+	check(stalledDelivered == FP_NUM_FRAMES && stalledOrdered && heldFree == 0, what);
+	snprintf(what, sizeof(what), "%s: the frames past them are all reported dropped", mode);
+	check(stalledDelivered + stalledDropped == FP_NUM_FRAMES + EXCESS, what);
+	snprintf(what, sizeof(what), "%s: polling, every frame of the burst is delivered in order, none dropped", mode);
+	check(app.delivered == (unsigned long)frames && !app.outOfOrder && !app.dropped, what);
+	snprintf(what, sizeof(what), "%s: every frame is back in the pool", mode);
+	check(fp_available() == FP_NUM_FRAMES, what);
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./txnode.so";
+	int frames = argc > 2 ? atoi(argv[2]) : 1000;
+
+	printf("a pool of %d frames of %lu bytes on this host\n", FP_NUM_FRAMES, (unsigned long)sizeof(Frame));
+	burst(lib, false, frames);
+	burst(lib, true, frames);
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
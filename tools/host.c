@@ -0,0 +1,138 @@
+/**
+ * @file host.c
+ * The hardware of the host builds, see host.h.
+ */
+
+#include "host.h"
+#include "monitor.h"
+#include "io_definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// the compare channels of the MONITOR_TIMER
+#define HOST_CHANNELS 4
+
+// APB1, APB2 and AHB1, then the Cortex-M4 private peripherals
+static const struct {
+	uintptr_t base;
+	size_t len;
+} regions[] = {
+	{0x40000000, 0x30000},
+	{0xE0000000, 0x100000},
+};
+
+/**
+ * maps the peripheral regions, or clears them if they are already. Every register reads 0, as after a reset
+ */
+void host_init() {
+	static int mapped = 0;
+
+	for (unsigned int i = 0; i < sizeof(regions)/sizeof(regions[0]); i++) {
+		if (!mapped && mmap((void *)regions[i].base, regions[i].len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			perror("mmap");
+			exit(2);
+		}
+		memset((void *)regions[i].base, 0, regions[i].len);
+	}
+	mapped = 1;
+}
+
+/**
+ * one MONITOR_TIMER tick. The compare flags are raised on the tick the counter becomes equal to the channel,
+ * whether or not it interrupts
+ */
+void host_tick() {
+	uint32_t cnt = MONITOR_TIMER_BASE->CNT + 1;
+
+	MONITOR_TIMER_BASE->CNT = cnt;
+	*(DWT_CYCCNT) += F_CPU / 1000000;
+	for (int ch = 0; ch < HOST_CHANNELS; ch++) {
+		if ((&MONITOR_TIMER_BASE->CCR1)[ch] == cnt)
+			MONITOR_TIMER_BASE->SR |= 1 << (CC1IF + ch);
+	}
+}
+
+/**
+ * ticks for a number of us, taking the MONITOR_TIMER interrupt after every tick that raised an enabled flag
+ */
+void host_advance(uint32_t us) {
+	const uint32_t channels = ((1 << HOST_CHANNELS) - 1) << CC1IF;
+
+	while (us--) {
+		host_tick();
+		if (MONITOR_TIMER_BASE->SR & MONITOR_TIMER_BASE->DIER & channels)
+			TIM5_IRQHandler();
+	}
+}
+
+/**
+ * loads a new instance of a module built as a shared library, with its own copy of its state. The library is
+ * copied first, the same file would only be loaded once
+ */
+void *host_instance(const char *lib) {
+	char path[] = "/tmp/host_instance_XXXXXX";
+	char buf[4096];
+	ssize_t n;
+
+	int in = open(lib, O_RDONLY);
+	int out = mkstemp(path);
+	if (in < 0 || out < 0) {
+		perror(lib);
+		exit(2);
+	}
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			perror(path);
+			exit(2);
+		}
+	}
+	close(in);
+	close(out);
+
+	void *instance = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	unlink(path);
+	if (!instance) {
+		fprintf(stderr, "%s\n", dlerror());
+		exit(2);
+	}
+	return instance;
+}
+
+/**
+ * @return the function or variable of an instance, see host_instance
+ */
+void *host_symbol(void *instance, const char *name) {
+	void *sym = dlsym(instance, name);
+
+	if (!sym) {
+		fprintf(stderr, "%s\n", dlerror());
+		exit(2);
+	}
+	return sym;
+}
+
+/**
+ * silences what the firmware prints to the uart, while the tool prints its results
+ */
+void host_quiet(bool quiet) {
+	static int saved = -1;
+
+	fflush(stdout);
+	if (quiet && saved < 0) {
+		saved = dup(STDOUT_FILENO);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	}
+	else if (!quiet && saved >= 0) {
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+		saved = -1;
+	}
+}
@@ -0,0 +1,36 @@
+/**
+ * @file host.h
+ * Runs the firmware on the host, for the tools that test it. Every source but main.c, syscalls.c and led.c is
+ * built for the host, and the peripheral regions are mapped as plain memory at their real addresses, so registers
+ * read back what was last written and the tool plays the part of the hardware:
+ * - host_tick advances the MONITOR_TIMER and the DWT cycle counter by 1 us, and raises the flags of the compare
+ *   channels that match, as the timer would
+ * - host_advance does so for a while, calling TIM5_IRQHandler whenever an enabled flag is raised. ISRs take no
+ *   time, they run between two ticks
+ * - the tool calls the other ISRs and the tasks itself, when their hardware would have interrupted or their
+ *   events were posted. It plays the line too, from the pins in ODR to IDR
+ * - a module whose state is per node, such as the MAC, is also built as a shared library, and host_instance loads
+ *   a copy of it per node. Its calls out go to the modules of the tool, which are shared like the line is
+ * Inline asm is left out of the host builds, see critical.h, and status flags are cleared and pins driven as on
+ * the hardware, see tim_clearFlags and gpio_writeBsrr.
+ *
+ * Build, with the sources of a tool:
+ *   gcc -O2 -Iinc -Itools tools/<tool>.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o <tool>
+ * and with -rdynamic -ldl for per node modules, each built as
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/<module>.c -o <module>.so
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+void host_init();
+void host_tick();
+void host_advance(uint32_t us);
+void *host_instance(const char *lib);
+void *host_symbol(void *instance, const char *name);
+void host_quiet(bool quiet);
+
+#endif /* HOST_H_ */
@@ -0,0 +1,414 @@
+/**
+ * @file isrcount_test.c
+ * Host instruction counts of the ISRs of the primary interface, a proxy for their cycles on the board where the
+ * DWT counters of isr.h can't be read. The firmware is built for the host and runs in a child process that the
+ * tool traces: around every handler call the child signals itself, and the tool single-steps it from one signal to
+ * the next, counting the instructions and the calls they make. What the signals cost on their own is measured
+ * the same way with nothing between them, and taken off. The handler's own call is counted, an interrupt entry
+ * on the board is not a call.
+ * - the monitor's edge handling, on a burst of edges half a bit or a bit apart, and the MONITOR_TIMER compare ISR
+ *   it leaves to time the burst out, per edge
+ * - TIM2_IRQHandler, the transmitter's half-bit, and EXTI4_IRQHandler, the receiver's edge, while the node sends
+ *   FRAMES frames to itself, its transmit pin looped back to the receive pin as in link_test
+ * The child runs twice, every count must come out the same.
+ * The peripherals are mapped here rather than through host.c, and the calls that changed name are weak, so that
+ * the file builds against older trees too: the figures before a change come from it built in a checkout of the
+ * commit before. A tree without llc.h has no frame queue to send from, only its monitor is counted.
+ *
+ * Build:
+ *   gcc -O2 -Iinc tools/isrcount_test.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o isrcount_test -lm
+ * A tree from before the host builds first needs its inline asm left out, and its status flag and BSRR writes made
+ * to act on plain memory, as tim_clearFlags and gpio_writeBsrr do in the host builds since:
+ *   sed -i 's/__asm volatile/if (0) __asm volatile/' inc/critical.h src/sched.c
+ *   grep -rl -e '->SR = ~' inc src | xargs -r sed -i 's/->SR = ~/->SR \&= ~/'
+ *   grep -rl -e '->BSRR = ' inc src | xargs -r perl -pi -e 's/(\S+)->BSRR = (.+);/{ volatile GPIO *g = $1; uint32_t b = $2; g->ODR = (g->ODR \& ~(b >> 16)) | (b \& 0xFFFF); }/'
+ * Usage:
+ *   isrcount_test [edges]   (default 1000)
+ */
+
+#include "monitor.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "gpio.h"
+#include "tim.h"
+#include "io_definitions.h"
+#if __has_include("llc.h")
+#include "link.h"
+#include "mac.h"
+#include "timerwheel.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#define SRC 0xAA
+#define DEST 0xBB
+// the main routine runs this often
+#define MAIN_US 50
+#define FRAMES 3
+#define MSG_LEN 15
+// the MONITOR_TIMER by address, older trees have no TIM5_BASE
+#define COUNT_TIM5 ((volatile TIMER2to5 *)0x40000C00)
+#define COUNT_RX_PIN 4
+#define COUNT_TX_PIN 9
+
+// the monitor's edge handling, by its name in the tree: monitor_Edge_Intrr before there were several interfaces.
+// And the MONITOR_TIMER compare ISR, which the SysTick came before
+void monitor_onEdge(int iface) __attribute__((weak));
+void monitor_Edge_Intrr() __attribute__((weak));
+void TIM5_IRQHandler() __attribute__((weak));
+
+// what is counted, the signal the child sends before a call says which
+typedef enum {
+	CNT_NONE,
+	CNT_SIGNALS,
+	CNT_EDGE,
+	CNT_TIM5,
+	CNT_TIM2,
+	CNT_EXTI4,
+	NUM_CNTS
+} CNT;
+
+static const char *cntNames[NUM_CNTS] = {"", "signals", "monitor edge", "MONITOR_TIMER compare", "TIM2_IRQHandler",
+		"EXTI4_IRQHandler"};
+
+typedef struct {
+	unsigned long runs;
+	unsigned long insns;
+	unsigned long calls;
+	unsigned long maxInsns;
+} Count;
+
+// in the child, read by the tracer when it stops
+static volatile int counting;
+static int numEdges;
+static int line;
+static bool running;
+static uint32_t nextIsr;
+static uint32_t rng = 19;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * the child stops here, the tracer counts from one mark to the next
+ */
+static void __attribute__((noinline)) mark(int cnt) {
+	counting = cnt;
+	kill(getpid(), SIGUSR1);
+}
+
+/**
+ * maps APB1, APB2 and AHB1, then the Cortex-M4 private peripherals as plain memory, every register reads 0
+ */
+static void mapPeripherals() {
+	static const struct {
+		uintptr_t base;
+		size_t len;
+	} regions[] = {
+		{0x40000000, 0x30000},
+		{0xE0000000, 0x100000},
+	};
+
+	for (unsigned int i = 0; i < sizeof(regions)/sizeof(regions[0]); i++) {
+		if (mmap((void *)regions[i].base, regions[i].len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			perror("mmap");
+			exit(2);
+		}
+	}
+}
+
+/**
+ * one us of the MONITOR_TIMER, its compare ISR taken if a flag it enabled is raised, and counted if asked
+ */
+static void tick(bool count) {
+	uint32_t cnt = COUNT_TIM5->CNT + 1;
+
+	COUNT_TIM5->CNT = cnt;
+	*(DWT_CYCCNT) += F_CPU / 1000000;
+	for (int ch = 0; ch < 4; ch++) {
+		if ((&COUNT_TIM5->CCR1)[ch] == cnt)
+			COUNT_TIM5->SR |= 1 << (CC1IF + ch);
+	}
+	if (!TIM5_IRQHandler || !(COUNT_TIM5->SR & COUNT_TIM5->DIER & (0xF << CC1IF)))
+		return;
+	if (count)
+		mark(CNT_TIM5);
+	TIM5_IRQHandler();
+	if (count)
+		mark(CNT_NONE);
+}
+
+static void setLine(int level) {
+	if (level)
+		GPIOC_BASE->IDR |= 1 << COUNT_RX_PIN;
+	else
+		GPIOC_BASE->IDR &= ~(1 << COUNT_RX_PIN);
+	line = level;
+}
+
+/**
+ * a burst of edges half a bit or a bit apart, as Manchester coding has them, through the monitor alone. Then the
+ * line rests, for the compare to time it out
+ */
+static void countMonitor() {
+#if __has_include("llc.h")
+	link_init(1);
+#endif
+	monitor_start(false);
+	setLine(1);
+	for (int i = 0; i < numEdges; i++) {
+		uint32_t gap = xorshift() % 2 ? 1000 : 500;
+		for (uint32_t us = 0; us < gap; us++)
+			tick(true);
+		setLine(!line);
+		mark(CNT_EDGE);
+		if (monitor_onEdge)
+			monitor_onEdge(0);
+		else
+			monitor_Edge_Intrr();
+		mark(CNT_NONE);
+	}
+	for (uint32_t us = 0; us < 3 * TRANSMISSION_TIMEOUT_US; us++)
+		tick(true);
+}
+
+#if __has_include("llc.h")
+/**
+ * the receive pin follows the transmit pin, each edge interrupts
+ */
+static void loopBack() {
+	int level = (GPIOC_BASE->ODR >> COUNT_TX_PIN) & 1;
+
+	if (level == line)
+		return;
+	setLine(level);
+	*(EXTI_PR) |= 1 << COUNT_RX_PIN;
+	mark(CNT_EXTI4);
+	EXTI4_IRQHandler();
+	mark(CNT_NONE);
+}
+
+/**
+ * the receive timer counts for a us while it runs. At HALFBIT_TIMEOUT_TICKS it interrupts, and restarts from 0
+ */
+static void countHalfBit() {
+	if (!(TIM4_BASE->CR1 & (1 << CEN)))
+		return;
+	TIM4_BASE->CNT += F_CPU / 1000000;
+	if (TIM4_BASE->CNT < HALFBIT_TIMEOUT_TICKS)
+		return;
+	TIM4_BASE->CNT -= HALFBIT_TIMEOUT_TICKS;
+	TIM4_BASE->SR |= 1 << CC1IF;
+	TIM4_IRQHandler();
+}
+
+/**
+ * the node sends FRAMES frames to itself, queued at once, until it received them and the line is IDLE
+ */
+static void countFrames() {
+	static PacketHeader pkt;
+	uint8_t msg[MSG_LEN];
+	int received = 0;
+
+	memset((void *)0x40000000, 0, 0x30000);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, SRC);
+	setLine(1);
+	running = false;
+	transmitter_init(true, false);
+	receiver_init(true, false);
+	GPIOC_BASE->ODR |= 1 << COUNT_TX_PIN;
+	// the transmitter seeds its backoff from the clock
+	srand(1);
+	for (int i = 0; i < FRAMES; i++) {
+		Frame *frame = fp_alloc();
+		for (int b = 0; b < MSG_LEN; b++)
+			msg[b] = i + b;
+		ph_create(&pkt, SRC, DEST, true, msg, MSG_LEN);
+		frame->cls = PH_CLASS_BEST_EFFORT;
+		frame->len = ph_serialize(frame->data, &pkt);
+		frame->handle = 0;
+		transmitter_queue(frame);
+	}
+
+	for (uint32_t t = 0; t < 60000000 && (received < FRAMES || monitor_getState(LINK_PRIMARY) != MS_IDLE); t++) {
+		tick(false);
+		uint32_t now = COUNT_TIM5->CNT;
+
+		countHalfBit();
+		if (running && now == nextIsr) {
+			TIM2_BASE->SR |= 1 << CC1IF;
+			mark(CNT_TIM2);
+			TIM2_IRQHandler();
+			mark(CNT_NONE);
+			nextIsr += MAC_BIT_US / 2;
+			running = TIM2_BASE->CR1 & (1 << CEN);
+			loopBack();
+		}
+
+		if (t % MAIN_US)
+			continue;
+		tw_run();
+		transmitter_mainRoutineUpdate();
+		if (!running && (TIM2_BASE->CR1 & (1 << CEN))) {
+			running = true;
+			nextIsr = now + MAC_BIT_US / 2;
+		}
+		Frame *frame;
+		while ((frame = receiver_pollFrame())) {
+			received++;
+			fp_free(frame);
+		}
+	}
+}
+#endif
+
+/**
+ * the traced child: the signals alone, then what is counted. What the firmware prints is dropped
+ */
+static void child() {
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+	raise(SIGSTOP);
+
+	mapPeripherals();
+	for (int i = 0; i < 100; i++) {
+		mark(CNT_SIGNALS);
+		mark(CNT_NONE);
+	}
+	countMonitor();
+#if __has_include("llc.h")
+	countFrames();
+#endif
+	exit(0);
+}
+
+/**
+ * @return true if the instruction at addr is a call: E8, or FF /2 and /3, behind any prefixes
+ */
+static bool isCall(pid_t pid, unsigned long addr) {
+	unsigned long word = ptrace(PTRACE_PEEKTEXT, pid, (void *)addr, NULL);
+	const uint8_t *op = (const uint8_t *)&word;
+	int i = 0;
+
+	while (i < 4 && (op[i] == 0x66 || op[i] == 0xF2 || op[i] == 0xF3 || op[i] == 0x3E || (op[i] & 0xF0) == 0x40))
+		i++;
+	return op[i] == 0xE8 || (op[i] == 0xFF && ((op[i+1] >> 3) & 7) >= 2 && ((op[i+1] >> 3) & 7) <= 3);
+}
+
+/**
+ * runs the child and counts every call it marks, the signals not taken off yet
+ * @return false if the child failed
+ */
+static bool trace(Count *counts) {
+	int status;
+	pid_t pid = fork();
+
+	if (pid == 0)
+		child();
+	memset(counts, 0, NUM_CNTS * sizeof(Count));
+	waitpid(pid, &status, 0);
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)PTRACE_O_EXITKILL);
+	ptrace(PTRACE_CONT, pid, NULL, NULL);
+	while (waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+		if (WSTOPSIG(status) != SIGUSR1) {
+			ptrace(PTRACE_CONT, pid, NULL, (void *)(long)WSTOPSIG(status));
+			continue;
+		}
+		int cnt = ptrace(PTRACE_PEEKDATA, pid, (void *)&counting, NULL);
+		unsigned long insns = 0, calls = 0;
+		// from this mark to the next, the signal of this one suppressed
+		for (;;) {
+			unsigned long rip = ptrace(PTRACE_PEEKUSER, pid, (void *)offsetof(struct user_regs_struct, rip), NULL);
+			calls += isCall(pid, rip);
+			ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL);
+			if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status))
+				return false;
+			if (WSTOPSIG(status) == SIGUSR1)
+				break;
+			insns++;
+		}
+		if (cnt > CNT_NONE && cnt < NUM_CNTS) {
+			Count *c = &counts[cnt];
+			c->runs++;
+			c->insns += insns;
+			c->calls += calls;
+			if (insns > c->maxInsns)
+				c->maxInsns = insns;
+		}
+		// the end mark, its signal suppressed too
+		ptrace(PTRACE_CONT, pid, NULL, NULL);
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv) {
+	numEdges = argc > 1 ? atoi(argv[1]) : 1000;
+	Count first[NUM_CNTS], second[NUM_CNTS];
+
+	bool ran = trace(first) && trace(second);
+	check(ran, "the traced child runs to the end");
+	if (!ran) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	const Count *sig = &first[CNT_SIGNALS];
+	double sigInsns = sig->runs ? (double)sig->insns / sig->runs : 0;
+	double sigCalls = sig->runs ? (double)sig->calls / sig->runs : 0;
+	printf("host instructions per call, gcc %s -O2, the signals (%.0f instructions) taken off:\n", __VERSION__,
+			sigInsns);
+	printf("  %-22s %7s %9s %6s %8s\n", "", "runs", "mean", "max", "calls");
+	for (int c = CNT_EDGE; c < NUM_CNTS; c++) {
+		const Count *n = &first[c];
+		if (!n->runs) {
+			printf("  %-22s %7s\n", cntNames[c], "-");
+			continue;
+		}
+		printf("  %-22s %7lu %9.1f %6.0f %8.1f\n", cntNames[c], n->runs, (double)n->insns / n->runs - sigInsns,
+				n->maxInsns - sigInsns, (double)n->calls / n->runs - sigCalls);
+	}
+	const Count *edge = &first[CNT_EDGE], *tim5 = &first[CNT_TIM5];
+	if (edge->runs)
+		printf("  monitor per edge, with its compare ISR: %.1f\n",
+				(double)edge->insns / edge->runs - sigInsns
+				+ (tim5->runs ? (tim5->insns - sigInsns * tim5->runs) / edge->runs : 0));
+
+	check(!memcmp(first, second, sizeof(first)), "every count comes out the same on a second run");
+	check(edge->runs == (unsigned long)numEdges, "the monitor handled every edge of the burst");
+#if __has_include("llc.h")
+	check(first[CNT_TIM2].runs > FRAMES * 8 * (PH_OVERHEAD + MSG_LEN) && first[CNT_EXTI4].runs > 0,
+			"TIM2 ran for every half-bit of the frames, EXTI4 for their edges");
+#endif
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file link_test.c
+ * Host simulation of a node running both its network interfaces at full rate at once, see link.h: its real
+ * transmitter, receiver, monitor and bridge, each interface's transmit pin looped back to its receive pin as on the
+ * board, PC9 -> PC4 and PC10 -> PC2. The tool plays the hardware of each interface: it takes the transmit timer
+ * ISR every half-bit while the timer runs, the EXTI ISR on every edge of the receive pin, and the half-bit
+ * timeout ISR once the receive timer counts up to HALFBIT_TIMEOUT_TICKS, on a 1 us grid.
+ * Frames are kept queued on the primary interface. The node bridges, so each one it hears back there is forwarded
+ * to the second interface cut-through, which sends it while the primary one still does:
+ * - both interfaces are busy most of the time, and at once
+ * - every copy on the second interface is the frame, as the primary receiver decoded it while it was sent
+ * - the second receiver tells every copy for the bridge's own, none is forwarded back to the primary interface
+ * Then the ISRs each interface takes per second at that rate, counted by link_isrExit. ISRs take no time on the
+ * host, the cycles each takes are the target's: see link_printLoad, typed as MONITOR_LOAD_COMMAND.
+ *
+ * Build:
+ *   gcc -O2 -Iinc -Itools tools/link_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o link_test
+ * Usage:
+ *   link_test [seconds]   (default 60 s)
+ */
+
+#include "host.h"
+#include "link.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "monitor.h"
+#include "mac.h"
+#include "bridge.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include "gpio.h"
+#include "tim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SRC 0xAA
+#define DEST 0xBB
+// the main routine runs this often
+#define MAIN_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// payload of the frames, starting with their number
+#define MSG_LEN 40
+// frames kept queued on the primary interface
+#define QUEUED 3
+
+typedef struct {
+	// sending: the half-bits so far, from the pin
+	bool running;
+	uint32_t nextIsr;
+	uint8_t halfBits[16 * FP_FRAME_SIZE];
+	int numHalfBits;
+	// the level on the receive pin
+	int line;
+	unsigned long sent;
+	unsigned long intact;
+} Iface;
+
+static Iface ifaces[LINK_MAX];
+// the frames queued, and the handle each was queued with. llc_complete clears it once the transmitter is done
+static Frame *queued[QUEUED];
+static uint32_t handles[QUEUED];
+static uint32_t nextPacket;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+/**
+ * keeps QUEUED frames queued on the primary interface, as llc_send would: best effort data frames
+ */
+static void refill(unsigned long *numQueued) {
+	static PacketHeader pkt;
+	uint8_t msg[MSG_LEN];
+
+	for (int i = 0; i < QUEUED; i++) {
+		if (queued[i] && queued[i]->handle == handles[i])
+			continue;
+		Frame *frame = fp_alloc();
+		if (!frame)
+			return;
+		msg[0] = nextPacket >> 8;
+		msg[1] = nextPacket;
+		for (int b = 2; b < MSG_LEN; b++)
+			msg[b] = nextPacket + b;
+		nextPacket++;
+		ph_create(&pkt, SRC, DEST, true, msg, MSG_LEN);
+		PH_SET_CLASS(&pkt, PH_CLASS_BEST_EFFORT);
+		frame->cls = PH_CLASS_BEST_EFFORT;
+		frame->len = ph_serialize(frame->data, &pkt);
+		frame->handle = handles[i] = nextPacket;
+		queued[i] = frame;
+		transmitter_queue(frame);
+		(*numQueued)++;
+	}
+}
+
+/**
+ * @return true if a frame is one the tool queued, as it was queued. Its number is set
+ */
+static bool intact(const uint8_t *data, int len, uint32_t *packet) {
+	static PacketHeader pkt;
+
+	if (len < (int)PH_OVERHEAD || !ph_parse(&pkt, data, len) || pkt.src != SRC || pkt.dest != DEST
+			|| pkt.length != MSG_LEN)
+		return false;
+	*packet = pkt.msg[0] << 8 | pkt.msg[1];
+	for (int i = 2; i < MSG_LEN; i++) {
+		if (pkt.msg[i] != (uint8_t)(*packet + i))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * an interface stopped sending, the frame on its pin is checked
+ */
+static void finished(int iface) {
+	Iface *f = &ifaces[iface];
+	uint8_t data[FP_FRAME_SIZE] = {0};
+	int len = f->numHalfBits / 16;
+	uint32_t packet;
+
+	// transmitter_init starts the timers, with nothing to send
+	if (!f->numHalfBits)
+		return;
+	f->sent++;
+	// the second half of a bit is the bit
+	for (int i = 0; i < 8 * len; i++)
+		data[i / 8] |= f->halfBits[2*i + 1] << (7 - i % 8);
+	f->intact += intact(data, len, &packet);
+}
+
+/**
+ * @return the level the transmit pin of an interface drives
+ */
+static int txLevel(int iface) {
+	return (select_gpio(link_configs[iface].txGpio)->ODR >> link_configs[iface].txPin) & 1;
+}
+
+/**
+ * the receive pin of an interface follows its transmit pin, each edge interrupts
+ */
+static void loopBack(int iface) {
+	const LinkConfig *cfg = &link_configs[iface];
+	Iface *f = &ifaces[iface];
+	int level = txLevel(iface);
+
+	if (level == f->line)
+		return;
+	f->line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	*(EXTI_PR) |= 1 << cfg->rxPin;
+	if (iface == 0)
+		EXTI4_IRQHandler();
+	else
+		EXTI2_IRQHandler();
+}
+
+/**
+ * the receive timer of an interface counts for a us while it runs. At HALFBIT_TIMEOUT_TICKS it interrupts, and
+ * restarts from 0
+ */
+static void countHalfBit(int iface) {
+	volatile TIMER *tim = tim_regs(link_configs[iface].halfBitTimer);
+
+	if (!(tim->CR1 & (1 << CEN)))
+		return;
+	tim->CNT += F_CPU / 1000000;
+	if (tim->CNT < HALFBIT_TIMEOUT_TICKS)
+		return;
+	tim->CNT -= HALFBIT_TIMEOUT_TICKS;
+	tim->SR |= 1 << CC1IF;
+	if (iface == 0)
+		TIM4_IRQHandler();
+	else
+		TIM1_BRK_TIM9_IRQHandler();
+}
+
+int main(int argc, char **argv) {
+	uint32_t seconds = argc > 1 ? atoi(argv[1]) : 60;
+	const uint32_t channels = ((1 << 4) - 1) << CC1IF;
+	unsigned long numQueued = 0, bothBusyUs = 0;
+	uint32_t calls[LINK_MAX];
+
+	host_init();
+	host_quiet(true);
+	ph_init();
+	fp_init();
+	link_init(2);
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, SRC);
+	bridge_init(true);
+	for (int i = 0; i < link_count(); i++) {
+		const LinkConfig *cfg = &link_configs[i];
+		// the idle line is high, and so are the transmit pins
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+		ifaces[i].line = 1;
+	}
+	transmitter_init(true, false);
+	receiver_init(true, false);
+	for (int i = 0; i < link_count(); i++)
+		set_pin(link_configs[i].txGpio, link_configs[i].txPin);
+	srand(1);
+	uint32_t startedAt = monitor_now();
+	for (int i = 0; i < link_count(); i++)
+		calls[i] = link_isrCalls[i];
+
+	for (uint32_t t = 0; t < seconds * 1000000; t++) {
+		host_tick();
+		if (MONITOR_TIMER_BASE->SR & MONITOR_TIMER_BASE->DIER & channels)
+			TIM5_IRQHandler();
+		uint32_t now = monitor_now();
+
+		for (int i = 0; i < link_count(); i++) {
+			Iface *f = &ifaces[i];
+			const LinkConfig *cfg = &link_configs[i];
+			countHalfBit(i);
+			if (!f->running || now != f->nextIsr)
+				continue;
+			tim_regs(cfg->txTimer)->SR |= 1 << CC1IF;
+			if (i == 0)
+				TIM2_IRQHandler();
+			else
+				TIM3_IRQHandler();
+			f->nextIsr += HALFBIT_US;
+			f->running = tim_regs(cfg->txTimer)->CR1 & (1 << CEN);
+			if (f->running && f->numHalfBits < (int)sizeof(f->halfBits))
+				f->halfBits[f->numHalfBits++] = txLevel(i);
+			else if (!f->running)
+				finished(i);
+			loopBack(i);
+		}
+		bothBusyUs += ifaces[0].running && ifaces[1].running;
+
+		if (t % MAIN_US)
+			continue;
+		tw_run();
+		// the frames queued last are sent by the end
+		if (t < seconds * 1000000 - 5000000)
+			refill(&numQueued);
+		transmitter_mainRoutineUpdate();
+		for (int i = 0; i < link_count(); i++) {
+			Iface *f = &ifaces[i];
+			if (f->running || !(tim_regs(link_configs[i].txTimer)->CR1 & (1 << CEN)))
+				continue;
+			f->running = true;
+			f->nextIsr = now + HALFBIT_US;
+			f->numHalfBits = 0;
+		}
+	}
+	host_quiet(false);
+
+	uint32_t elapsed = monitor_now() - startedAt;
+	printf("both interfaces looped back, %d byte frames kept queued on the primary one and bridged, %lu s:\n",
+			MSG_LEN + (int)PH_OVERHEAD, (unsigned long)seconds);
+	for (int i = 0; i < link_count(); i++) {
+		MonitorStats s;
+		monitor_getStats(i, &s);
+		uint32_t isrs = link_isrCalls[i] - calls[i];
+		printf("  interface %d: %5lu frames sent, %5lu intact, busy %4.1f%%, %lu collisions, %6.1f isrs/s\n", i,
+				ifaces[i].sent, ifaces[i].intact, 100.0 * s.busyUs / elapsed, (unsigned long)s.collisions,
+				isrs / (elapsed / 1e6));
+	}
+	printf("  %lu frames queued, both interfaces busy %4.1f%% of the time\n", numQueued, 100.0 * bothBusyUs / elapsed);
+
+	check(ifaces[0].sent > 0 && ifaces[1].sent == ifaces[0].sent && ifaces[0].intact == ifaces[0].sent
+			&& ifaces[1].intact == ifaces[1].sent, "the second interface sends a copy of every frame of the primary one, intact");
+	check(ifaces[0].sent == numQueued, "no copy is forwarded back to the primary interface");
+	check(bothBusyUs > elapsed / 2, "both interfaces are busy at once most of the time");
+	check(fp_available() == FP_NUM_FRAMES, "no frame is leaked");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file llc_test.c
+ * Host benchmark of the link layer API, see llc.h, on the real layers below in packet mode. What the calls cost on
+ * their own, the time of the ISRs that send and receive the frames left out:
+ * - llc_send of a 5, 15 and 45 byte message: the frame is allocated, built and queued. Timed in batches that
+ *   leave a frame of the pool free, the link layer is started again in between
+ * - llc_complete of a frame from the transmitter's ISR, and llc_pollTx handing the completion to onSent
+ * - llc_pollRx handing received frames to onReceive. The frames are received first, sent by the node to itself,
+ *   its transmit pin looped back to the receive pin as in link_test, the application stalled meanwhile
+ * - llc_poll with nothing to do, what the main loop costs while the link is quiet
+ * Every message sent is reported once through onSent, and every frame received through onReceive, intact.
+ *
+ * Build:
+ *   gcc -O2 -Iinc -Itools tools/llc_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o llc_test
+ * Usage:
+ *   llc_test [iterations]   (default 2000000)
+ */
+
+#include "host.h"
+#include "llc.h"
+#include "link.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "monitor.h"
+#include "mac.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include "network.h"
+#include "gpio.h"
+#include "tim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define ADDR 0xAA
+#define DEST 0xBB
+// the main routine runs this often
+#define MAIN_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// frames received before llc_pollRx is timed, and how many times
+#define HELD 6
+#define ROUNDS 50
+// llc_send batches leave a frame free
+#define BATCH (FP_NUM_FRAMES - 1)
+
+static const unsigned int lengths[] = {5, 15, 45};
+#define NUM_LENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+
+static unsigned long iterations;
+// what the callbacks saw
+static unsigned long sent, failed, received, intact;
+static int line;
+static bool running;
+static uint32_t nextIsr;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static void onSent(int handle) {
+	(void)handle;
+	sent++;
+}
+
+static void onFailed(int handle) {
+	(void)handle;
+	failed++;
+}
+
+static void onReceive(const LlcPacket *packet) {
+	received++;
+	intact += packet->valid && packet->src == ADDR && packet->dest == DEST && packet->length == lengths[1];
+}
+
+static const LlcCallbacks callbacks = {.onSent = onSent, .onFailed = onFailed, .onReceive = onReceive};
+
+static double nsSince(const struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
+
+/**
+ * starts the layers, the pool all free
+ */
+static void start() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+
+	host_init();
+	host_quiet(true);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, ADDR);
+	// every dest on the bus, as main has it
+	net_init(ADDR);
+	// the idle line is high, and so is the transmit pin
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	line = 1;
+	running = false;
+	llc_init(ADDR, true, false, &callbacks);
+	set_pin(cfg->txGpio, cfg->txPin);
+	srand(1);
+}
+
+/**
+ * the receive pin follows the transmit pin, each edge interrupts
+ */
+static void loopBack() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	int level = (select_gpio(cfg->txGpio)->ODR >> cfg->txPin) & 1;
+
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	*(EXTI_PR) |= 1 << cfg->rxPin;
+	EXTI4_IRQHandler();
+}
+
+/**
+ * the receive timer counts for a us while it runs. At HALFBIT_TIMEOUT_TICKS it interrupts, and restarts from 0
+ */
+static void countHalfBit() {
+	volatile TIMER *tim = tim_regs(link_configs[LINK_PRIMARY].halfBitTimer);
+
+	if (!(tim->CR1 & (1 << CEN)))
+		return;
+	tim->CNT += F_CPU / 1000000;
+	if (tim->CNT < HALFBIT_TIMEOUT_TICKS)
+		return;
+	tim->CNT -= HALFBIT_TIMEOUT_TICKS;
+	tim->SR |= 1 << CC1IF;
+	TIM4_IRQHandler();
+}
+
+/**
+ * sends a message to the node itself and plays the hardware until it is received, the application stalled: the
+ * frame waits for llc_pollRx
+ */
+static void receiveOne() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	const uint32_t channels = ((1 << 4) - 1) << CC1IF;
+	uint8_t msg[PH_MSG_SIZE] = {0};
+	unsigned long before = sent;
+
+	// sent once onSent reports it, received once the line is IDLE after it
+	llc_send(DEST, msg, lengths[1], 0);
+	for (uint32_t t = 0; sent == before || monitor_getState(LINK_PRIMARY) != MS_IDLE; t++) {
+		host_tick();
+		if (MONITOR_TIMER_BASE->SR & MONITOR_TIMER_BASE->DIER & channels)
+			TIM5_IRQHandler();
+		uint32_t now = monitor_now();
+
+		countHalfBit();
+		if (running && now == nextIsr) {
+			tim_regs(cfg->txTimer)->SR |= 1 << CC1IF;
+			TIM2_IRQHandler();
+			nextIsr += HALFBIT_US;
+			running = tim_regs(cfg->txTimer)->CR1 & (1 << CEN);
+			loopBack();
+		}
+
+		if (t % MAIN_US)
+			continue;
+		tw_run();
+		llc_pollTx();
+		if (!running && (tim_regs(cfg->txTimer)->CR1 & (1 << CEN))) {
+			running = true;
+			nextIsr = now + HALFBIT_US;
+		}
+	}
+}
+
+/**
+ * @return the cost of llc_send of a message of len bytes, ns
+ */
+static double timeSend(unsigned int len, unsigned long *queued) {
+	uint8_t msg[PH_MSG_SIZE];
+	struct timespec t0;
+	double ns = 0;
+	unsigned long sends = 0;
+
+	for (unsigned int i = 0; i < len; i++)
+		msg[i] = i;
+	for (unsigned long done = 0; done < iterations; done += BATCH) {
+		start();
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (int i = 0; i < BATCH; i++)
+			*queued += llc_send(DEST, msg, len, 0) > 0;
+		ns += nsSince(&t0);
+		sends += BATCH;
+	}
+	host_quiet(false);
+	return ns / sends;
+}
+
+int main(int argc, char **argv) {
+	iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+	unsigned long queued = 0, batches = (iterations + BATCH - 1) / BATCH;
+	double sendNs[NUM_LENGTHS], completeNs = 0, pollTxNs = 0, pollRxNs = 0, idleNs, heldNs = 0;
+	Frame *frames[BATCH];
+	struct timespec t0;
+
+	for (unsigned int l = 0; l < NUM_LENGTHS; l++)
+		sendNs[l] = timeSend(lengths[l], &queued);
+	check(queued == NUM_LENGTHS * batches * BATCH, "llc_send queues every message while a frame is free");
+
+	// llc_complete from the ISR, then the poll hands it to onSent
+	start();
+	sent = failed = 0;
+	for (unsigned long done = 0; done < iterations; done += BATCH) {
+		for (int i = 0; i < BATCH; i++) {
+			frames[i] = fp_alloc();
+			frames[i]->handle = i + 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (int i = 0; i < BATCH; i++)
+			llc_complete(frames[i], true);
+		completeNs += nsSince(&t0);
+		for (int i = 0; i < BATCH; i++) {
+			llc_complete(frames[i], true);
+			fp_free(frames[i]);
+		}
+		llc_pollTx();
+	}
+	for (unsigned long i = 0; i < iterations; i++) {
+		Frame *frame = fp_alloc();
+		frame->handle = 1;
+		llc_complete(frame, true);
+		fp_free(frame);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		llc_pollTx();
+		pollTxNs += nsSince(&t0);
+	}
+	completeNs /= batches * BATCH;
+	pollTxNs /= iterations;
+	host_quiet(false);
+	check(sent == batches * BATCH + iterations && !failed,
+			"every completion is reported once through onSent, a second llc_complete of a frame is ignored");
+
+	// nothing to do
+	start();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned long i = 0; i < iterations; i++)
+		llc_poll();
+	idleNs = nsSince(&t0) / iterations;
+
+	// frames held by the receiver, handed out at once
+	received = intact = 0;
+	for (int round = 0; round < ROUNDS; round++) {
+		for (int i = 0; i < HELD; i++)
+			receiveOne();
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		llc_pollRx();
+		heldNs += nsSince(&t0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int round = 0; round < ROUNDS; round++)
+		llc_pollRx();
+	pollRxNs = (heldNs - nsSince(&t0)) / (ROUNDS * HELD);
+	host_quiet(false);
+	check(received == ROUNDS * HELD && intact == received, "every frame received is handed to onReceive, intact");
+	check(fp_available() == FP_NUM_FRAMES, "every frame is back in the pool");
+
+	printf("link layer API on this host, packet mode, %lu iterations:\n", iterations);
+	for (unsigned int l = 0; l < NUM_LENGTHS; l++)
+		printf("  llc_send, %2u byte message     %7.1f ns\n", lengths[l], sendNs[l]);
+	printf("  llc_complete                  %7.1f ns\n", completeNs);
+	printf("  llc_pollTx, one completion    %7.1f ns\n", pollTxNs);
+	printf("  llc_pollRx, per frame held    %7.1f ns, %d frames of %d bytes at a time\n", pollRxNs, HELD,
+			(int)(PH_OVERHEAD + lengths[1]));
+	printf("  llc_poll, nothing to do       %7.1f ns\n", idleNs);
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file lq_test.c
+ * Host test of the link quality indicator (linkquality.h). Synthetic edge streams, one or two half-bits apart
+ * with known jitter, are fed to lq_edge, and the per frame statistics and the histogram are checked against
+ * what the jitter implies:
+ * - uniform jitter of +-400 cycles lands in the four central 256 cycle bins in the ratio of their overlap with
+ *   the jitter, 144:256:256:145, with a mean |deviation| of 200 cycles and nothing out of window
+ * - an interval is matched to the closer of one and two half-bits
+ * - edges further than LQ_WINDOW off are counted out of window, and left out of the histogram and the min/max
+ *
+ * Build:
+ *   gcc -O2 -Iinc tools/lq_test.c src/linkquality.c -o lq_test
+ * Usage:
+ *   lq_test [edges]   (default 100000 edges of jitter)
+ */
+
+#include "linkquality.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define JITTER 400
+// LinkQuality counts edges in 16 bits, a 255 byte packet has about 4100
+#define FRAME_EDGES 4000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 1;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void uniformJitter(int edges) {
+	LinkQualityState s;
+	LinkQuality q;
+	uint32_t now = 12345;
+	// bins of [-512, -256), [-256, 0), [0, 256) and [256, 512) cycles hold this many of the 801 deviations each
+	const int overlap[4] = {144, 256, 256, 145};
+	const int first = LQ_HIST_BINS/2 - 2;
+	// totals over the frames
+	int32_t minDev = INT32_MAX, maxDev = INT32_MIN;
+	uint64_t sumAbsDev = 0;
+	unsigned long inWindow = 0, outOfWindow = 0;
+
+	lq_init(&s);
+	for (int i = 0; i < edges; i++) {
+		// frames of up to FRAME_EDGES, about those of a full packet
+		if (i % FRAME_EDGES == 0)
+			lq_frameStart(&s, now);
+		int dev = (int)(xorshift() % (2*JITTER + 1)) - JITTER;
+		now += (xorshift() & 1 ? 2 : 1) * LQ_HALFBIT_CYCLES + dev;
+		lq_edge(&s, now);
+		if (i % FRAME_EDGES == FRAME_EDGES-1 || i == edges-1) {
+			lq_frameEnd(&s, &q);
+			minDev = q.minDev < minDev ? q.minDev : minDev;
+			maxDev = q.maxDev > maxDev ? q.maxDev : maxDev;
+			sumAbsDev += q.sumAbsDev;
+			inWindow += q.edges;
+			outOfWindow += q.outOfWindow;
+		}
+	}
+
+	printf("uniform +-%d cycles over %d edges: min %ld max %ld mean |dev| %lu, bins", JITTER, edges,
+			(long)minDev, (long)maxDev, (unsigned long)(sumAbsDev / inWindow));
+	for (int i = first; i < first + 4; i++)
+		printf(" %lu", (unsigned long)s.hist[i]);
+	printf("\n");
+
+	bool inRatio = true;
+	unsigned long outside = 0;
+	for (int i = 0; i < LQ_HIST_BINS; i++) {
+		if (i >= first && i < first + 4) {
+			double expected = (double)edges * overlap[i - first] / (2*JITTER + 1);
+			inRatio &= abs((int)s.hist[i] - (int)expected) < expected * 0.03;
+		}
+		else {
+			outside += s.hist[i];
+		}
+	}
+	check(inWindow == (unsigned long)edges && outOfWindow == 0 && s.histOutOfWindow == 0, "every edge in window");
+	check(minDev >= -JITTER && maxDev <= JITTER && minDev < -JITTER + 10 && maxDev > JITTER - 10,
+			"min/max span the jitter");
+	check(abs((int)(sumAbsDev / inWindow) - JITTER/2) <= 5, "mean |dev| is half the jitter");
+	check(inRatio && outside == 0, "central bins in the ratio 144:256:256:145");
+}
+
+static void classification() {
+	LinkQualityState s;
+	LinkQuality q;
+	uint32_t now = 0;
+
+	lq_init(&s);
+	// just under and just over 1.5 half-bits go to one and two half-bits
+	now += 3*LQ_HALFBIT_CYCLES/2 - 1;
+	lq_edge(&s, now);
+	now += 3*LQ_HALFBIT_CYCLES/2;
+	lq_edge(&s, now);
+	lq_frameEnd(&s, &q);
+	// both are a quarter half-bit off, out of window
+	check(q.outOfWindow == 2 && q.edges == 0, "a 1.5 half-bit interval is out of window either way");
+
+	lq_frameStart(&s, now);
+	now += LQ_HALFBIT_CYCLES + 100;
+	lq_edge(&s, now);
+	now += 2*LQ_HALFBIT_CYCLES - 100;
+	lq_edge(&s, now);
+	now += 2*LQ_HALFBIT_CYCLES + LQ_WINDOW;
+	lq_edge(&s, now);
+	now += LQ_HALFBIT_CYCLES - LQ_WINDOW - 1;
+	lq_edge(&s, now);
+	lq_frameEnd(&s, &q);
+	check(q.edges == 2 && q.minDev == -100 && q.maxDev == 100 && q.sumAbsDev == 200,
+			"one and two half-bit intervals give their deviation");
+	check(q.outOfWindow == 2 && s.histOutOfWindow == 4, "edges LQ_WINDOW off are out of window");
+	// the frame that follows starts from the last edge
+	now += LQ_HALFBIT_CYCLES;
+	lq_edge(&s, now);
+	lq_frameEnd(&s, &q);
+	check(q.edges == 1 && q.minDev == 0 && q.maxDev == 0, "the next frame starts at the last edge");
+}
+
+int main(int argc, char **argv) {
+	int edges = argc > 1 ? atoi(argv[1]) : 100000;
+
+	uniformJitter(edges);
+	classification();
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,333 @@
+/**
+ * @file monitor_test.c
+ * Host test of the monitor's timeout (monitor.h), run on the host hardware of host.h. Frames of edges with known
+ * timing are fed to monitor_onEdge, and the transitions the timeout makes are timed against their last edge:
+ * - the line goes IDLE, or COLLISION if it was left low, exactly TRANSMISSION_TIMEOUT_US after the last edge of
+ *   every frame, whatever the jitter of the edges before, and never during a frame
+ * - the utilization and collision probability EWMAs average to the load they are fed, follow a step in it at their
+ *   weight, and forget it over a long idle stretch. The busy total is exact
+ * - an arbitration window keeps the line BUSY through a low field longer than the timeout
+ * - the counter going past the deadline while the timeout ISR moves it never leaves the timeout waiting for the
+ *   counter to wrap. The timer ticks from a signal for this part, so that it can tick anywhere in the ISR
+ *
+ * Build:
+ *   gcc -O2 -Iinc -Itools tools/monitor_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -lm -o monitor_test
+ * Usage:
+ *   monitor_test [frames] [race seconds]   (default 2000 frames, 2 s)
+ */
+
+#include "host.h"
+#include "monitor.h"
+#include "link.h"
+#include "gpio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+
+// edges are 1 or 2 half-bits of 500 us apart, give or take this much
+#define JITTER_US 50
+#define HALFBIT_US 500
+#define ARBITRATION_US 5000
+// a collision jams the line low this long after the timeout found it
+#define JAM_US 300
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 3;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// the transitions of the primary interface, as its callback saw them
+static int transitions;
+static MONITOR_STATE lastState;
+static uint32_t lastAt;
+
+static void onState(int iface, MONITOR_STATE state) {
+	(void)iface;
+	transitions++;
+	lastState = state;
+	lastAt = monitor_now();
+}
+
+/**
+ * the receive pin of the primary interface changes to level, and its edge interrupt is taken
+ */
+static void edge(int level) {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	monitor_onEdge(LINK_PRIMARY);
+}
+
+/**
+ * sends a frame of edges 1 or 2 half-bits apart, with jitter, on an idle line. It ends high, or low for a
+ * collision, and the time is that of its last edge
+ */
+static void frame(int edges, bool collide) {
+	int level = 1;
+
+	for (int e = 0; e < edges; e++) {
+		if (e) {
+			int jitter = (int)(xorshift() % (2*JITTER_US + 1)) - JITTER_US;
+			host_advance((xorshift() & 1 ? 2 : 1) * HALFBIT_US + jitter);
+		}
+		level = !level;
+		edge(level);
+	}
+	if (level == collide) {
+		host_advance(HALFBIT_US);
+		edge(!level);
+	}
+}
+
+static void start() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+
+	host_init();
+	// the idle line is high
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	link_init(1);
+	monitor_start(false);
+	monitor_setCallback(LINK_PRIMARY, onState);
+}
+
+static void accuracy(int frames) {
+	int collisions = 0, early = 0, late = 0;
+	int32_t minErr = INT32_MAX, maxErr = INT32_MIN;
+	int64_t sumErr = 0;
+
+	start();
+	for (int f = 0; f < frames; f++) {
+		int edges = 20 + xorshift() % 200;
+		// a frame ends high, a collision leaves the line low for the timeout to find
+		bool collide = xorshift() % 4 == 0;
+
+		transitions = 0;
+		frame(edges, collide);
+		uint32_t last = monitor_getLastEdge(LINK_PRIMARY);
+		// only the first edge made a transition so far
+		early += transitions != 1 || lastState != MS_BUSY;
+		host_advance(TRANSMISSION_TIMEOUT_US + 100 + xorshift() % 5000);
+		if (transitions != 2 || lastState != (collide ? MS_COLLISION : MS_IDLE)) {
+			late++;
+			continue;
+		}
+		int32_t err = (int32_t)(lastAt - last) - TRANSMISSION_TIMEOUT_US;
+		minErr = err < minErr ? err : minErr;
+		maxErr = err > maxErr ? err : maxErr;
+		sumErr += err;
+		if (collide) {
+			// the line is released, and goes IDLE without another transmission
+			collisions++;
+			edge(1);
+			host_advance(TRANSMISSION_TIMEOUT_US + 1);
+			late += lastState != MS_IDLE;
+		}
+	}
+
+	MonitorStats s;
+	monitor_getStats(LINK_PRIMARY, &s);
+	printf("%d frames, edges +-%d us: timeout after the last edge %+ld..%+ld us off, mean %+.2f us\n", frames,
+			JITTER_US, (long)minErr, (long)maxErr, (double)sumErr / (frames - late));
+	check(early == 0, "no transition during a frame");
+	check(late == 0, "every frame times out to IDLE or COLLISION, by the line it left");
+	check(minErr == 0 && maxErr == 0, "the timeout is exactly TRANSMISSION_TIMEOUT_US after the last edge");
+	check(s.transmissions == (uint32_t)frames && s.collisions == (uint32_t)collisions,
+			"the totals count every frame and collision");
+}
+
+// what was sent, to compare the estimates with
+typedef struct {
+	uint64_t busyUs;
+	uint32_t frames;
+	uint32_t collisions;
+} Traffic;
+
+/**
+ * sends random frames for a while, the line busy busyPct of the time and collisionPct of the frames colliding
+ */
+static void traffic(Traffic *t, int busyPct, int collisionPct, uint32_t us) {
+	uint32_t end = monitor_now() + us;
+
+	while ((int32_t)(end - monitor_now()) > 0) {
+		uint32_t first = monitor_now();
+		bool collide = (int)(xorshift() % 100) < collisionPct;
+		frame(10 + xorshift() % 20, collide);
+		// the timeout dates the end of the frame back to its last edge
+		uint32_t busy = monitor_getLastEdge(LINK_PRIMARY) - first;
+		host_advance(TRANSMISSION_TIMEOUT_US);
+		if (collide) {
+			// the line is in COLLISION from the last edge until the jam ends
+			host_advance(JAM_US);
+			edge(1);
+			host_advance(TRANSMISSION_TIMEOUT_US);
+			busy += TRANSMISSION_TIMEOUT_US + JAM_US;
+		}
+		// idle long enough to keep the share, give or take half
+		uint32_t idle = busy * (100 - busyPct) / busyPct;
+		host_advance(idle / 2 + xorshift() % (idle + 1) + 1);
+		t->busyUs += busy;
+		t->frames++;
+		t->collisions += collide;
+	}
+}
+
+static double q16(uint32_t estimate) {
+	return estimate / (double)MONITOR_Q16_ONE;
+}
+
+/**
+ * the EWMA estimates against the load they were fed: their mean and spread window by window at a steady load,
+ * how fast they follow a step, and what they keep over a long idle stretch
+ */
+static void load(int windows) {
+	Traffic all = {0}, steady = {0};
+	double sumU = 0, sumP = 0, maxDevU = 0;
+
+	start();
+	traffic(&all, 30, 20, 50 * MONITOR_LOAD_WINDOW_US);
+	uint32_t since = monitor_now();
+	for (int w = 0; w < windows; w++) {
+		traffic(&steady, 30, 20, MONITOR_LOAD_WINDOW_US);
+		double u = q16(monitor_getUtilization(LINK_PRIMARY));
+		sumU += u;
+		sumP += q16(monitor_getCollisionProbability(LINK_PRIMARY));
+		maxDevU = fabs(u - 0.3) > maxDevU ? fabs(u - 0.3) : maxDevU;
+	}
+	double busy = (double)steady.busyUs / (monitor_now() - since);
+	double collisions = (double)steady.collisions / steady.frames;
+	printf("%d windows at %.3f busy, %.3f colliding: utilization mean %.3f, max |dev| %.3f, collision "
+			"probability mean %.3f\n", windows, busy, collisions, sumU / windows, maxDevU, sumP / windows);
+	check(fabs(sumU / windows - busy) < 0.01, "the utilization averages to the busy share");
+	check(fabs(sumP / windows - collisions) < 0.03, "the collision probability averages to the colliding share");
+
+	// the EWMA covers a step by 1/2^MONITOR_EWMA_SHIFT per window
+	double before = q16(monitor_getUtilization(LINK_PRIMARY));
+	Traffic step = {0};
+	since = monitor_now();
+	traffic(&step, 70, 20, 8 * MONITOR_LOAD_WINDOW_US);
+	double keep = pow(1 - 1.0 / (1 << MONITOR_EWMA_SHIFT), (monitor_now() - since) / MONITOR_LOAD_WINDOW_US);
+	double expected = before * keep + (double)step.busyUs / (monitor_now() - since) * (1 - keep);
+	double u = q16(monitor_getUtilization(LINK_PRIMARY));
+	printf("step from %.3f to 0.7 busy: %.3f after 8 windows, expected %.3f\n", before, u, expected);
+	check(fabs(u - expected) < 0.05, "the utilization follows a step at the EWMA weight");
+
+	double p = q16(monitor_getCollisionProbability(LINK_PRIMARY));
+	host_advance(100 * MONITOR_LOAD_WINDOW_US);
+	check(q16(monitor_getUtilization(LINK_PRIMARY)) < 0.001, "a long idle stretch leaves no utilization");
+	check(q16(monitor_getCollisionProbability(LINK_PRIMARY)) == p,
+			"windows without a transmission leave the collision probability alone");
+
+	MonitorStats s;
+	monitor_getStats(LINK_PRIMARY, &s);
+	all.busyUs += steady.busyUs + step.busyUs;
+	all.frames += steady.frames + step.frames;
+	all.collisions += steady.collisions + step.collisions;
+	check(s.busyUs == all.busyUs && s.transmissions == all.frames && s.collisions == all.collisions,
+			"the totals are those sent");
+}
+
+static void arbitration() {
+	start();
+	monitor_setArbitrationWindow(LINK_PRIMARY, ARBITRATION_US);
+	transitions = 0;
+	edge(0);
+	uint32_t first = monitor_getLastEdge(LINK_PRIMARY);
+	// the low field is longer than the timeout, and ends well before the window
+	host_advance(ARBITRATION_US - 1000);
+	check(transitions == 1 && monitor_getState(LINK_PRIMARY) == MS_BUSY, "an arbitration window holds the line BUSY");
+	edge(1);
+	host_advance(ARBITRATION_US);
+	check(transitions == 2 && lastState == MS_IDLE && lastAt - first == ARBITRATION_US + TRANSMISSION_TIMEOUT_US,
+			"the line goes IDLE TRANSMISSION_TIMEOUT_US after the window");
+	monitor_setArbitrationWindow(LINK_PRIMARY, 0);
+}
+
+// the timer ticks from the signal while the ISR runs, and is stopped while a trial is set up and checked
+static volatile sig_atomic_t hwRunning = 0;
+
+static void onSignal(int sig) {
+	(void)sig;
+	if (hwRunning)
+		host_tick();
+}
+
+/**
+ * every trial has the timeout ISR move the deadline 1 or 2 us ahead, to the last edge of the frame, while the
+ * timer ticks from the signal. The counter goes past the deadline inside the ISR in some of them
+ */
+static void race(int seconds) {
+	unsigned long trials = 0, passed = 0, stuck = 0;
+	struct itimerval it = {.it_interval = {0, 10}, .it_value = {0, 10}};
+	time_t end = time(NULL) + seconds;
+
+	start();
+	signal(SIGALRM, onSignal);
+	setitimer(ITIMER_REAL, &it, NULL);
+	while (time(NULL) < end) {
+		uint32_t t0 = monitor_now() + 100;
+		uint32_t ahead = 1 + (trials & 1);
+
+		MONITOR_TIMER_BASE->CNT = t0;
+		edge(0);
+		MONITOR_TIMER_BASE->CNT = t0 + ahead;
+		edge(1);
+		// the compare of the first edge matches
+		MONITOR_TIMER_BASE->CNT = t0 + TRANSMISSION_TIMEOUT_US - 1;
+		host_tick();
+
+		hwRunning = 1;
+		TIM5_IRQHandler();
+		hwRunning = 0;
+		trials++;
+		if (monitor_getState(LINK_PRIMARY) != MS_BUSY) {
+			passed++;
+			continue;
+		}
+		// the timer goes on past the deadline
+		host_advance(ahead + 2);
+		if (monitor_getState(LINK_PRIMARY) == MS_BUSY) {
+			stuck++;
+			// it would time out once the counter wrapped around to the deadline
+			MONITOR_TIMER_BASE->CNT = t0 + ahead + TRANSMISSION_TIMEOUT_US - 1;
+			host_advance(1);
+		}
+	}
+	it.it_value.tv_usec = 0;
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	printf("%lu trials, the counter went past the deadline inside the ISR in %lu, %lu left waiting for the wrap\n",
+			trials, passed, stuck);
+	check(stuck == 0, "the timeout is taken when the counter passes the deadline as the ISR moves it");
+	if (!passed)
+		printf("      the counter never ticked inside the ISR, run longer\n");
+}
+
+int main(int argc, char **argv) {
+	int frames = argc > 1 ? atoi(argv[1]) : 2000;
+	int seconds = argc > 2 ? atoi(argv[2]) : 2;
+
+	accuracy(frames);
+	load(200);
+	arbitration();
+	race(seconds);
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
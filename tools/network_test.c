@@ -0,0 +1,528 @@
+/**
+ * @file network_test.c
+ * Host simulation of multi-hop forwarding (see network.h) over a chain of three bus segments: A - R1 - R2 - B,
+ * each node hearing only its neighbours, so the segments share the routers. Every node is an instance of its real
+ * transmitter, MAC, monitor, network layer and frame pool, built together as one library, see host_instance. Its
+ * registers are swapped in while its code runs, and the line each node sees is the wired-AND of the pins it hears, as in
+ * rtscts_test. A frame heard intact is handed to the network layer once the node's monitor is IDLE, as the receiver
+ * would. The routers send on what they forward through their transmitter, no further help from the tool.
+ * A sends packets to R1, R2 or B, that is 1, 2 or 3 hops away. One at a time, the next once the last arrived:
+ * - each router starts sending a packet on soon after it was received: the IDLE line, and the backoff
+ * - the latency grows by a hop each, the frame's airtime and the router's delay
+ * And with a packet always queued at A:
+ * - throughput falls with the hops, the segments share the line
+ * - every packet delivered is the one A sent, with its origin restored. None is delivered twice
+ * And with the routers sending B's packets to each other, every packet is dropped once its TTL runs out, after
+ * exactly NET_DEFAULT_TTL transmissions, and no frame is leaked.
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c src/mac.c src/monitor.c src/network.c src/framepool.c -o netnode.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/network_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o network_test
+ * Usage:
+ *   network_test [netnode.so] [seconds]   (default ./netnode.so, 300 s of each run)
+ */
+
+#include "host.h"
+#include "network.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "mac.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NUM_NODES 4
+#define NODE_A 0
+#define NODE_R1 1
+#define NODE_R2 2
+#define NODE_B 3
+#define ADDR(node) (0x10 + (node))
+// the main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// payload of A's packets, starting with their number
+#define MSG_LEN 40
+// one at a time, A sends the next packet once the last one arrived, or after this long. In a routing loop, this
+// often: it is done with its hops before the next
+#define PACKET_TIMEOUT_US 10000000
+// packets remembered by their number, for the latencies
+#define NUM_TRACKED 64
+
+// each node hears its neighbours in the chain
+static const bool hears[NUM_NODES][NUM_NODES] = {
+	[NODE_A] = {[NODE_A] = true, [NODE_R1] = true},
+	[NODE_R1] = {[NODE_A] = true, [NODE_R1] = true, [NODE_R2] = true},
+	[NODE_R2] = {[NODE_R1] = true, [NODE_R2] = true, [NODE_B] = true},
+	[NODE_B] = {[NODE_R2] = true, [NODE_B] = true},
+};
+
+// how A sends its packets
+typedef enum {
+	LOAD_ONE_AT_A_TIME,
+	LOAD_SATURATED,
+	// the routers send B's packets to each other, A's to B are never delivered
+	LOAD_LOOP,
+} Load;
+
+typedef struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*txIsr)();
+	void (*monitorStart)(bool exti9_enable);
+	void (*monitorIsr)();
+	void (*onEdge)(int iface);
+	void (*jam)(int iface);
+	MONITOR_STATE (*getState)(int iface);
+	void (*macInit)(MAC_MODE mode, uint8_t addr);
+	void (*netInit)(uint8_t addr);
+	void (*addRoute)(uint8_t dest, uint8_t via);
+	void (*route)(Frame *frame);
+	bool (*netOnFrame)(Frame *frame);
+	Frame *(*pollDelivery)();
+	void (*fpInit)();
+	Frame *(*alloc)();
+	void (*free)(Frame *frame);
+	unsigned int (*available)();
+	// its transmit timer, pins and monitor channel, while its code is not running
+	TIMER tim;
+	uint32_t odr;
+	uint32_t idr;
+	uint32_t ccr;
+	uint32_t dier;
+	uint32_t sr;
+	// the line as the node sees it
+	int line;
+	// sending: the half-bits so far, from the pin
+	bool running;
+	uint32_t nextIsr;
+	uint32_t startedAt;
+	uint8_t halfBits[16 * FP_FRAME_SIZE];
+	int numHalfBits;
+	// whether the node heard the frame of each sender intact so far
+	bool intact[NUM_NODES];
+	// a frame heard intact, for the network layer once the line is IDLE
+	bool pending;
+	Frame heard;
+	// A: its packet queued. Every node: when it last sent each packet, by its number
+	Frame *data;
+	uint32_t sentPacket[NUM_TRACKED];
+	uint32_t sentStart[NUM_TRACKED];
+	uint32_t sentEnd[NUM_TRACKED];
+	bool sent[NUM_TRACKED];
+} Node;
+
+typedef struct {
+	unsigned long queued;
+	unsigned long delivered;
+	unsigned long corrupted;
+	unsigned long duplicates;
+	// transmissions of A's packets, and those the node they were for didn't get
+	unsigned long transmissions;
+	unsigned long lost;
+	// frames heard intact but dropped, the node's pool was empty
+	unsigned long noFrame;
+	// from the end of a packet on the segment before to its start on the next, by the router sending it on
+	uint64_t forwardUs[NUM_NODES];
+	uint32_t maxForwardUs[NUM_NODES];
+	unsigned long forwards[NUM_NODES];
+	// from A starting a packet to its delivery
+	uint64_t latencyUs;
+} Result;
+
+static Node nodes[NUM_NODES];
+static const LinkConfig *cfg;
+// A's packets delivered, by their number
+static bool got[1 << 16];
+static uint32_t nextPacket;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static void swapIn(Node *n) {
+	memcpy((void *)tim_regs(cfg->txTimer), &n->tim, sizeof(n->tim));
+	select_gpio(cfg->txGpio)->ODR = n->odr;
+	select_gpio(cfg->rxGpio)->IDR = n->idr;
+	(&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel] = n->ccr;
+	MONITOR_TIMER_BASE->DIER = n->dier;
+	MONITOR_TIMER_BASE->SR = n->sr;
+}
+
+static void swapOut(Node *n) {
+	memcpy(&n->tim, (void *)tim_regs(cfg->txTimer), sizeof(n->tim));
+	n->odr = select_gpio(cfg->txGpio)->ODR;
+	n->idr = select_gpio(cfg->rxGpio)->IDR;
+	n->ccr = (&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel];
+	n->dier = MONITOR_TIMER_BASE->DIER;
+	n->sr = MONITOR_TIMER_BASE->SR;
+}
+
+/**
+ * the MONITOR_TIMER ticks for a step. A node's monitor interrupts once its counter reached the compare channel,
+ * the channel only matching on the tick of the step it was due at
+ */
+static void advance() {
+	uint32_t from = MONITOR_TIMER_BASE->CNT;
+	uint32_t flag = 1 << (CC1IF + cfg->monitorChannel);
+
+	for (int i = 0; i < STEP_US; i++)
+		host_tick();
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		if (n->ccr - from - 1 < STEP_US)
+			n->sr |= flag;
+		if (n->sr & n->dier & flag) {
+			swapIn(n);
+			n->monitorIsr();
+			swapOut(n);
+		}
+	}
+}
+
+/**
+ * @return the number of A's packet in a message: a ROUTED one, or one delivered without its network header
+ */
+static uint32_t packetNumber(const uint8_t *msg) {
+	return msg[0] << 8 | msg[1];
+}
+
+/**
+ * queues A's next packet to dest once the last one is done with, as llc_send would: a best effort data packet,
+ * ROUTED by A's network layer
+ */
+static void queueData(int dest, Load load, Result *r, uint32_t now) {
+	static PacketHeader pkt;
+	static uint32_t queuedAt;
+	uint8_t msg[MSG_LEN];
+	Node *a = &nodes[NODE_A];
+	bool arrived = nextPacket && got[(nextPacket - 1) & 0xFFFF];
+
+	if (a->data && a->data->handle)
+		return;
+	if (nextPacket && now - queuedAt < PACKET_TIMEOUT_US && (load == LOAD_LOOP || (load == LOAD_ONE_AT_A_TIME && !arrived)))
+		return;
+	Frame *frame = a->alloc();
+	if (!frame)
+		return;
+	msg[0] = nextPacket >> 8;
+	msg[1] = nextPacket;
+	for (int i = 2; i < MSG_LEN; i++)
+		msg[i] = nextPacket + i;
+	got[nextPacket++ & 0xFFFF] = false;
+	ph_create(&pkt, ADDR(NODE_A), ADDR(dest), true, msg, MSG_LEN);
+	PH_SET_CLASS(&pkt, PH_CLASS_BEST_EFFORT);
+	frame->cls = PH_CLASS_BEST_EFFORT;
+	frame->len = ph_serialize(frame->data, &pkt);
+	// reported back through llc_complete, which clears it
+	frame->handle = 1;
+	a->data = frame;
+	queuedAt = now;
+	swapIn(a);
+	a->route(frame);
+	a->queue(frame);
+	swapOut(a);
+	r->queued++;
+}
+
+/**
+ * a node stopped sending. Each node that heard its frame intact gets it. A ROUTED packet's times are kept, the
+ * router sending it on tells how long it took
+ */
+static void finished(Node *n, int node, Result *r, uint32_t now) {
+	uint8_t data[FP_FRAME_SIZE] = {0};
+	int len = n->numHalfBits / 16;
+
+	// transmitter_init starts the timer, with nothing to send
+	if (!n->numHalfBits)
+		return;
+	// the second half of a bit is the bit
+	for (int i = 0; i < 8 * len; i++)
+		data[i / 8] |= n->halfBits[2*i + 1] << (7 - i % 8);
+	bool complete = n->intact[node] && len >= (int)PH_OVERHEAD;
+	int dest = data[PH_DEST_OFFSET] - ADDR(0);
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *l = &nodes[i];
+		if (i == node || !hears[i][node] || !l->intact[node] || !complete)
+			continue;
+		memset(&l->heard, 0, sizeof(l->heard));
+		memcpy(l->heard.data, data, len);
+		l->heard.len = len;
+		l->heard.stamps[FP_FIRST_EDGE] = n->startedAt;
+		l->pending = true;
+	}
+
+	if (!complete || PH_GET_TYPE(data[PH_FLAGS_OFFSET]) != PH_TYPE_ROUTED)
+		return;
+	uint32_t packet = packetNumber(&data[PH_MSG_OFFSET + NET_HEADER_LEN]);
+	int slot = packet % NUM_TRACKED;
+	r->transmissions++;
+	r->lost += dest < 0 || dest >= NUM_NODES || !nodes[dest].intact[node];
+	// sent on by a router: since the node before it in the chain sent it
+	int from = node - 1;
+	if (node != NODE_A && from >= 0 && nodes[from].sent[slot] && nodes[from].sentPacket[slot] == packet) {
+		uint32_t forward = n->startedAt - nodes[from].sentEnd[slot];
+		r->forwardUs[node] += forward;
+		r->forwards[node]++;
+		if (forward > r->maxForwardUs[node])
+			r->maxForwardUs[node] = forward;
+	}
+	n->sentPacket[slot] = packet;
+	n->sentStart[slot] = n->startedAt;
+	n->sentEnd[slot] = now;
+	n->sent[slot] = true;
+}
+
+/**
+ * takes the packets a node had delivered. Each must be one of A's, as A sent it, and new
+ */
+static void takeDeliveries(Node *n, Result *r, uint32_t now) {
+	static PacketHeader pkt;
+	Frame *frame;
+
+	while ((frame = n->pollDelivery())) {
+		uint32_t packet = packetNumber(&frame->data[PH_MSG_OFFSET]);
+		bool intact = ph_parse(&pkt, frame->data, frame->len) && pkt.src == ADDR(NODE_A) && pkt.length == MSG_LEN
+				&& PH_GET_TYPE(frame->data[PH_FLAGS_OFFSET]) == PH_TYPE_DATA;
+		for (int i = 2; i < MSG_LEN && intact; i++)
+			intact = pkt.msg[i] == (uint8_t)(packet + i);
+		if (!intact) {
+			r->corrupted++;
+		}
+		else if (got[packet & 0xFFFF]) {
+			r->duplicates++;
+		}
+		else {
+			Node *a = &nodes[NODE_A];
+			int slot = packet % NUM_TRACKED;
+			got[packet & 0xFFFF] = true;
+			r->delivered++;
+			if (a->sent[slot] && a->sentPacket[slot] == packet)
+				r->latencyUs += now - a->sentStart[slot];
+		}
+		n->free(frame);
+	}
+}
+
+/**
+ * runs the nodes on fresh instances for a while
+ * @param dest the node A sends to
+ */
+static void run(const char *lib, int dest, Load load, uint32_t seconds, Result *r) {
+	memset(r, 0, sizeof(*r));
+	nextPacket = 0;
+	host_init();
+	ph_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	tw_init();
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		void *node = host_instance(lib);
+		memset(n, 0, sizeof(*n));
+		n->init = host_symbol(node, "transmitter_init");
+		n->queue = host_symbol(node, "transmitter_queue");
+		n->update = host_symbol(node, "transmitter_mainRoutineUpdate");
+		n->txIsr = host_symbol(node, "TIM2_IRQHandler");
+		n->monitorStart = host_symbol(node, "monitor_start");
+		n->monitorIsr = host_symbol(node, "TIM5_IRQHandler");
+		n->onEdge = host_symbol(node, "monitor_onEdge");
+		n->jam = host_symbol(node, "monitor_jam");
+		n->getState = host_symbol(node, "monitor_getState");
+		n->macInit = host_symbol(node, "mac_init");
+		n->netInit = host_symbol(node, "net_init");
+		n->addRoute = host_symbol(node, "net_addRoute");
+		n->route = host_symbol(node, "net_route");
+		n->netOnFrame = host_symbol(node, "net_onFrame");
+		n->pollDelivery = host_symbol(node, "net_pollDelivery");
+		n->fpInit = host_symbol(node, "fp_init");
+		n->alloc = host_symbol(node, "fp_alloc");
+		n->free = host_symbol(node, "fp_free");
+		n->available = host_symbol(node, "fp_available");
+		n->fpInit();
+
+		// the idle line is high, and so is the transmit pin
+		n->line = 1;
+		swapIn(n);
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+		n->monitorStart(false);
+		n->macInit(MAC_CSMA, ADDR(i));
+		n->netInit(ADDR(i));
+		n->init(true, false);
+		set_pin(cfg->txGpio, cfg->txPin);
+		swapOut(n);
+	}
+	// down the chain, each node reaches the next directly
+	nodes[NODE_A].addRoute(ADDR(NODE_R2), ADDR(NODE_R1));
+	nodes[NODE_A].addRoute(ADDR(NODE_B), ADDR(NODE_R1));
+	nodes[NODE_R1].addRoute(ADDR(NODE_B), ADDR(NODE_R2));
+	if (load == LOAD_LOOP)
+		nodes[NODE_R2].addRoute(ADDR(NODE_B), ADDR(NODE_R1));
+	// the transmitters draw their backoffs from rand, seeded with the time. Every run draws the same
+	srand(1);
+
+	for (uint32_t t = 0; t < seconds * 1000000; t += STEP_US) {
+		advance();
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// the half-bits of the senders
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			if (!n->running || now != n->nextIsr)
+				continue;
+			swapIn(n);
+			n->txIsr();
+			swapOut(n);
+			n->nextIsr += HALFBIT_US;
+			n->running = n->tim.CR1 & (1 << CEN);
+			if (n->running && n->numHalfBits < (int)sizeof(n->halfBits))
+				n->halfBits[n->numHalfBits++] = (n->odr >> cfg->txPin) & 1;
+			else if (!n->running)
+				finished(n, i, r, now);
+		}
+
+		// the line each node sees, garbled if it hears two senders
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			int level = 1, senders = 0;
+			for (int j = 0; j < NUM_NODES; j++) {
+				if (!hears[i][j])
+					continue;
+				level &= (nodes[j].odr >> cfg->txPin) & 1;
+				senders += nodes[j].running;
+			}
+			if (level == n->line && senders < 2)
+				continue;
+			swapIn(n);
+			if (level != n->line) {
+				n->line = level;
+				if (level)
+					select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+				else
+					select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+				n->onEdge(LINK_PRIMARY);
+			}
+			if (senders > 1) {
+				n->jam(LINK_PRIMARY);
+				for (int j = 0; j < NUM_NODES; j++)
+					n->intact[j] &= !(hears[i][j] && nodes[j].running);
+			}
+			swapOut(n);
+		}
+
+		// the main routines, and the frames heard handed to the network layer, as the receiver would
+		if (t < seconds * 1000000 - 2 * PACKET_TIMEOUT_US)
+			queueData(dest, load, r, now);
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			swapIn(n);
+			if (n->pending && n->getState(LINK_PRIMARY) == MS_IDLE) {
+				Frame *frame = n->alloc();
+				if (frame) {
+					memcpy(frame, &n->heard, sizeof(*frame));
+					if (!n->netOnFrame(frame))
+						n->free(frame);
+				}
+				r->noFrame += !frame;
+				n->pending = false;
+			}
+			n->update();
+			swapOut(n);
+			takeDeliveries(n, r, now);
+			if (!n->running && (n->tim.CR1 & (1 << CEN))) {
+				n->running = true;
+				n->nextIsr = now + HALFBIT_US;
+				n->startedAt = now;
+				n->numHalfBits = 0;
+				for (int j = 0; j < NUM_NODES; j++)
+					nodes[j].intact[i] = true;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./netnode.so";
+	uint32_t seconds = argc > 2 ? atoi(argv[2]) : 300;
+	const int dests[] = {NODE_R1, NODE_R2, NODE_B};
+	const int numDests = sizeof(dests) / sizeof(dests[0]);
+	const int packetLen = MSG_LEN + PH_OVERHEAD + NET_HEADER_LEN;
+	// the line goes IDLE, then the best effort AIFS and a backoff of up to its first contention window, 3 and 15
+	// slots. The backoff stretches with the collision probability the monitor estimates
+	const uint32_t maxForward = TRANSMISSION_TIMEOUT_US + (3 + 15 * TRANSMITTER_BACKOFF_SCALE) * TRANSMITTER_SLOT_US
+			+ STEP_US;
+	double throughput[numDests], latency[numDests];
+	bool exact = true, prompt = true, hopLatency = true, falls = true, leaked = false;
+	Result r;
+
+	printf("chain A - R1 - R2 - B, %d byte packets from A, %lu s of each run:\n", packetLen, (unsigned long)seconds);
+	for (int k = 0; k < numDests; k++) {
+		host_quiet(true);
+		run(lib, dests[k], LOAD_ONE_AT_A_TIME, seconds, &r);
+		host_quiet(false);
+		latency[k] = r.delivered ? r.latencyUs / 1000.0 / r.delivered : 0;
+		printf("  %d hop%s, one at a time: %4lu of %4lu delivered, latency %6.1f ms", k + 1, k ? "s" : " ",
+				r.delivered, r.queued, latency[k]);
+		for (int i = NODE_R1; i < dests[k]; i++) {
+			double forward = r.forwards[i] ? r.forwardUs[i] / 1000.0 / r.forwards[i] : 0;
+			printf(", R%d sends on after %4.1f ms (at most %4.1f)", i, forward, r.maxForwardUs[i] / 1000.0);
+			prompt &= r.forwards[i] > 0 && r.maxForwardUs[i] <= maxForward;
+		}
+		printf("\n");
+		for (int i = 0; i < NUM_NODES; i++)
+			leaked |= nodes[i].available() != FP_NUM_FRAMES;
+		exact &= r.delivered > 0 && r.corrupted == 0 && r.duplicates == 0;
+		// each hop adds the airtime, and the router's delay
+		if (k > 0) {
+			double added = latency[k] - latency[k-1] - 8.0 * packetLen * MAC_BIT_US / 1000;
+			hopLatency &= added > 0 && added <= maxForward / 1000.0;
+		}
+	}
+
+	for (int k = 0; k < numDests; k++) {
+		host_quiet(true);
+		run(lib, dests[k], LOAD_SATURATED, seconds, &r);
+		host_quiet(false);
+		throughput[k] = 8.0 * MSG_LEN * r.delivered / seconds;
+		printf("  %d hop%s, saturated:    %4lu of %4lu delivered, %5.1f bps, %4lu transmissions, %3lu lost in "
+				"collisions, %3lu dropped for want of a frame\n", k + 1, k ? "s" : " ", r.delivered, r.queued,
+				throughput[k], r.transmissions, r.lost, r.noFrame);
+		for (int i = 0; i < NUM_NODES; i++)
+			leaked |= nodes[i].available() != FP_NUM_FRAMES;
+		exact &= r.delivered > 0 && r.corrupted == 0 && r.duplicates == 0;
+		if (k > 0)
+			falls &= throughput[k] < throughput[k-1];
+	}
+
+	host_quiet(true);
+	run(lib, NODE_B, LOAD_LOOP, seconds, &r);
+	host_quiet(false);
+	for (int i = 0; i < NUM_NODES; i++)
+		leaked |= nodes[i].available() != FP_NUM_FRAMES;
+	printf("routers looping B's packets: %lu queued, %lu delivered, %lu transmissions, %lu lost\n", r.queued,
+			r.delivered, r.transmissions, r.lost);
+
+	check(prompt, "a router sends a packet on after the IDLE line and its backoff");
+	check(hopLatency, "each hop adds the airtime and the router's delay to the latency");
+	check(falls, "throughput falls with the hops");
+	check(exact, "every packet delivered is the one A sent, once");
+	check(r.queued > 0 && r.delivered == 0 && r.lost == 0 && r.transmissions == r.queued * NET_DEFAULT_TTL,
+			"in a routing loop a packet is dropped after NET_DEFAULT_TTL transmissions");
+	check(!leaked, "no frame is leaked");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file ph_test.c
+ * Host test of the packet header's frame check (packet_header.h). Packets of every type are serialized, corrupted
+ * and parsed again:
+ * - every packet parses back to what was serialized, with the CRC computed after the type and class were set
+ * - every single bit error, and every burst of up to 8 bits, from src to the FCS is rejected. The header is
+ *   covered as well as the message, so no corrupted type makes a data packet a link control frame, and a length
+ *   that isn't the size of the frame is rejected
+ * - without the CRC only data is valid, a type changed by a bit error is rejected
+ *
+ * Build:
+ *   gcc -O2 -Iinc tools/ph_test.c src/packet_header.c -o ph_test
+ * Usage:
+ *   ph_test
+ */
+
+#include "packet_header.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NUM_TYPES 12
+#define BURST_BITS 8
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 5;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * serializes a random packet of a type
+ * @return its size
+ */
+static unsigned int randomPacket(uint8_t *buf, PH_TYPE type, bool crc) {
+	PacketHeader pkt;
+	uint8_t msg[PH_MSG_SIZE];
+	uint8_t len = 1 + xorshift() % 40;
+
+	for (int i = 0; i < len; i++)
+		msg[i] = xorshift();
+	ph_create(&pkt, xorshift(), xorshift(), crc, msg, len);
+	PH_SET_TYPE(&pkt, type);
+	PH_SET_CLASS(&pkt, xorshift() % PH_NUM_CLASSES);
+	return ph_serialize(buf, &pkt);
+}
+
+static void roundTrip() {
+	uint8_t buf[sizeof(PacketHeader)];
+	PacketHeader out;
+	bool ok = true;
+
+	for (int type = 0; type < NUM_TYPES; type++) {
+		for (int i = 0; i < 100; i++) {
+			unsigned int size = randomPacket(buf, type, true);
+			ok &= ph_parse(&out, buf, size) && PH_GET_TYPE(out.crc_flag) == type && out.src == buf[PH_SRC_OFFSET]
+					&& out.length == buf[PH_LENGTH_OFFSET] && !memcmp(out.msg, &buf[PH_MSG_OFFSET], out.length);
+		}
+	}
+	check(ok, "every type parses back to what was serialized");
+}
+
+static void bitErrors() {
+	uint8_t buf[sizeof(PacketHeader)], bad[sizeof(PacketHeader)];
+	PacketHeader out;
+	unsigned long tried = 0, accepted = 0, typeChanged = 0;
+
+	for (int type = 0; type < NUM_TYPES; type++) {
+		for (int i = 0; i < 20; i++) {
+			unsigned int size = randomPacket(buf, type, true);
+			// bursts from the first to the last bit flipped, with any of the bits between flipped too
+			for (unsigned int start = PH_SRC_OFFSET * 8; start < size * 8; start++) {
+				for (int len = 1; len <= BURST_BITS && start + len <= size * 8; len++) {
+					uint32_t inner = len > 2 ? xorshift() & ((1 << (len - 2)) - 1) : 0;
+					uint32_t pattern = 1 | (len > 1 ? 1 << (len - 1) : 0) | inner << 1;
+					memcpy(bad, buf, size);
+					for (int b = 0; b < len; b++) {
+						if (pattern & 1 << b)
+							bad[(start + b) / 8] ^= 0x80 >> ((start + b) % 8);
+					}
+					// the frame is received at its size, whatever its length field says
+					tried++;
+					if (ph_parse(&out, bad, size)) {
+						accepted++;
+						typeChanged += PH_GET_TYPE(out.crc_flag) != type;
+					}
+				}
+			}
+		}
+	}
+	printf("%lu bursts of 1 to %d bits from src to the FCS: %lu accepted, %lu of those with another type\n", tried,
+			BURST_BITS, accepted, typeChanged);
+	check(accepted == 0, "every burst of up to 8 bits in the header or the message is rejected");
+}
+
+static void withoutCrc() {
+	uint8_t buf[sizeof(PacketHeader)];
+	PacketHeader out;
+	bool typeCaught = true;
+
+	unsigned int size = randomPacket(buf, PH_TYPE_DATA, false);
+	check(ph_parse(&out, buf, size), "data without the CRC is valid");
+	for (int bit = PH_TYPE_SHIFT; bit < 8; bit++) {
+		buf[PH_FLAGS_OFFSET] ^= 1 << bit;
+		typeCaught &= !ph_parse(&out, buf, size);
+		buf[PH_FLAGS_OFFSET] ^= 1 << bit;
+	}
+	check(typeCaught, "without the CRC, a bit error in the type is rejected");
+
+	bool controlRejected = true;
+	for (int type = 1; type < NUM_TYPES; type++) {
+		size = randomPacket(buf, type, false);
+		controlRejected &= !ph_parse(&out, buf, size);
+	}
+	check(controlRejected, "every type but data needs the CRC");
+}
+
+int main() {
+	ph_init();
+	roundTrip();
+	bitErrors();
+	withoutCrc();
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
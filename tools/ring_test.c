@@ -0,0 +1,216 @@
+/**
+ * @file ring_test.c
+ * Host stress test and benchmark of the SPSC ring (ringbuffer.h). A producer thread plays the ISR and a consumer
+ * thread the main routine, passing sequence numbers through a small ring so that it runs full and empty all the
+ * time. On one core the threads preempt each other anywhere, as the ISR preempts the main routine; on several
+ * they run at once, as the acquire and release counts must allow as well:
+ * - every number comes out once and in order, put and taken one at a time, in random chunks of putN and getN, and
+ *   in place through writeSpan/commit and readSpan/consume
+ * - full and empty hold across the wrap of the put and get counts at 2^32, and a full ring refuses elements
+ * Then the throughput between the threads in each mode, and the cost of a put and get, and of putN and getN of 64
+ * bytes, on one thread.
+ *
+ * Build, inc quoted only so that it doesn't hide the system's sched.h:
+ *   gcc -O2 -pthread -iquote inc tools/ring_test.c -o ring_test
+ * Usage:
+ *   ring_test [elements]   (default 20000000 per mode)
+ */
+
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// as small as the uart's, so that it runs full
+#define RING_SIZE 256
+#define MAX_CHUNK 64
+
+RING_DEFINE(SeqRing, sr, uint32_t, RING_SIZE)
+RING_DEFINE(ByteRing, br, uint8_t, RING_SIZE)
+
+typedef enum {
+	MODE_SINGLE,
+	MODE_BULK,
+	MODE_SPAN,
+	NUM_MODES
+} Mode;
+
+static const char *modeNames[NUM_MODES] = {"single", "putN/getN", "spans"};
+
+static SeqRing ring;
+static Mode mode;
+static uint32_t numElements;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+/**
+ * @return a chunk of 1..MAX_CHUNK elements, drawn from a generator of the thread's own
+ */
+static uint32_t chunk(uint32_t *rng) {
+	*rng ^= *rng << 13;
+	*rng ^= *rng >> 17;
+	*rng ^= *rng << 5;
+	return 1 + *rng % MAX_CHUNK;
+}
+
+static void *produce(void *arg) {
+	uint32_t rng = 7, next = 0, buf[MAX_CHUNK];
+	(void)arg;
+
+	while (next < numElements) {
+		uint32_t n = chunk(&rng);
+		if (n > numElements - next)
+			n = numElements - next;
+		if (mode == MODE_SINGLE) {
+			next += sr_put(&ring, next);
+		}
+		else if (mode == MODE_BULK) {
+			for (uint32_t i = 0; i < n; i++)
+				buf[i] = next + i;
+			next += sr_putN(&ring, buf, n);
+		}
+		else {
+			uint32_t *span;
+			uint32_t room = sr_writeSpan(&ring, &span);
+			if (n > room)
+				n = room;
+			for (uint32_t i = 0; i < n; i++)
+				span[i] = next + i;
+			sr_commit(&ring, n);
+			next += n;
+		}
+		// a full ring: on one core the consumer would only run once the time slice is over
+		if (sr_space(&ring) == 0)
+			sched_yield();
+	}
+	return NULL;
+}
+
+/**
+ * counts the numbers that came out of order, or were lost or repeated, into arg
+ */
+static void *consume(void *arg) {
+	uint32_t rng = 11, next = 0, buf[MAX_CHUNK];
+	unsigned long *errors = arg;
+
+	while (next < numElements) {
+		uint32_t n, element, *elements = buf;
+		if (mode == MODE_SINGLE) {
+			n = sr_get(&ring, &element);
+			elements = &element;
+		}
+		else if (mode == MODE_BULK) {
+			n = sr_getN(&ring, buf, chunk(&rng));
+		}
+		else {
+			n = sr_readSpan(&ring, &elements);
+			uint32_t want = chunk(&rng);
+			n = n < want ? n : want;
+		}
+		for (uint32_t i = 0; i < n; i++, next++)
+			*errors += elements[i] != next;
+		if (mode == MODE_SPAN)
+			sr_consume(&ring, n);
+		if (!n)
+			sched_yield();
+	}
+	return NULL;
+}
+
+static double secondsSince(const struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * passes numElements through the ring between two threads
+ * @return the elements per second
+ */
+static double stress(Mode m, unsigned long *errors) {
+	pthread_t producer, consumer;
+	struct timespec t0;
+
+	mode = m;
+	sr_init(&ring);
+	*errors = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&consumer, NULL, consume, errors);
+	pthread_create(&producer, NULL, produce, NULL);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+	double elapsed = secondsSince(&t0);
+	*errors += sr_count(&ring) != 0;
+	return numElements / elapsed;
+}
+
+/**
+ * fills and empties the ring around the wrap of its counts
+ */
+static bool wrapsAround() {
+	uint32_t element;
+	bool ok = true;
+
+	// a few elements short of the wrap, so that it falls within a full ring
+	ring.put = ring.get = -(uint32_t)(RING_SIZE / 2 + 3);
+	ok &= sr_count(&ring) == 0 && !sr_get(&ring, &element);
+	for (uint32_t i = 0; i < RING_SIZE; i++)
+		ok &= sr_put(&ring, i);
+	ok &= sr_count(&ring) == RING_SIZE && sr_space(&ring) == 0 && !sr_put(&ring, RING_SIZE);
+	ok &= sr_putN(&ring, &element, 1) == 0;
+	for (uint32_t i = 0; i < RING_SIZE; i++)
+		ok &= sr_get(&ring, &element) && element == i;
+	ok &= sr_count(&ring) == 0 && !sr_get(&ring, &element) && ring.put < RING_SIZE;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	numElements = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000000;
+	double rates[NUM_MODES];
+	unsigned long errors, allErrors = 0;
+	struct timespec t0;
+
+	printf("%lu elements through a ring of %d between two threads:\n", (unsigned long)numElements, RING_SIZE);
+	for (int m = 0; m < NUM_MODES; m++) {
+		rates[m] = stress(m, &errors);
+		allErrors += errors;
+		printf("  %-10s %6.1f M elements/s, %lu errors\n", modeNames[m], rates[m] / 1e6, errors);
+	}
+	check(!allErrors, "every element comes out once and in order, in every mode");
+	check(wrapsAround(), "full and empty hold across the wrap of the counts, a full ring refuses elements");
+
+	// one thread, the ring never full
+	static ByteRing bytes;
+	uint8_t in[MAX_CHUNK] = {0}, out[MAX_CHUNK];
+	uint8_t byte = 0;
+	volatile uint32_t sum = 0;
+	br_init(&bytes);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (uint32_t i = 0; i < numElements; i++) {
+		br_put(&bytes, i);
+		br_get(&bytes, &byte);
+		sum += byte;
+	}
+	double singleNs = secondsSince(&t0) * 1e9 / numElements;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (uint32_t i = 0; i < numElements / MAX_CHUNK; i++) {
+		in[0] = i;
+		br_putN(&bytes, in, MAX_CHUNK);
+		br_getN(&bytes, out, MAX_CHUNK);
+		sum += out[0];
+	}
+	double bulkNs = secondsSince(&t0) * 1e9 / (numElements / MAX_CHUNK * MAX_CHUNK);
+	printf("one thread: put and get %.2f ns, putN and getN of %d bytes %.3f ns per byte\n", singleNs, MAX_CHUNK,
+			bulkNs);
+
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
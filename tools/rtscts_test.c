@@ -0,0 +1,380 @@
+/**
+ * @file rtscts_test.c
+ * Host simulation of the RTS/CTS reservation (see mac.h) with a hidden node. Nodes A and C both send to B, and
+ * hear B but not each other. Every node is an instance of its real transmitter, MAC and monitor, built together
+ * as one library, see host_instance. The registers of its timer, pins and monitor channel are swapped in while
+ * a node's code runs. Each node sees the wired-AND of the pins it hears, and a node hearing two senders at once
+ * is jammed into a collision, as its garbled line would be. A frame heard intact is handed to the MAC once the
+ * node's monitor is IDLE, as the receiver would.
+ * A and C always have a data frame to B queued. Of every size, with and without RTS/CTS:
+ * - frames below the RTS threshold are sent as they are, as without RTS/CTS
+ * - with RTS/CTS, the hidden node defers on the CTS: a data frame sent on a reservation always gets through
+ * - with RTS/CTS, a collision only wastes the RTS, so the wasted airtime per collision falls and more data gets
+ *   through, the longer the frames
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c src/mac.c src/monitor.c -o node.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/rtscts_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o rtscts_test
+ * Usage:
+ *   rtscts_test [node.so] [seconds]   (default ./node.so, 300 s of each run)
+ */
+
+#include "host.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "mac.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NUM_NODES 3
+#define NODE_A 0
+#define NODE_B 1
+#define NODE_C 2
+#define ADDR(node) (0x10 + (node))
+// the main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+
+// A and C are hidden from each other
+static const bool hears[NUM_NODES][NUM_NODES] = {
+	[NODE_A] = {[NODE_A] = true, [NODE_B] = true},
+	[NODE_B] = {[NODE_A] = true, [NODE_B] = true, [NODE_C] = true},
+	[NODE_C] = {[NODE_B] = true, [NODE_C] = true},
+};
+
+typedef struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*txIsr)();
+	void (*monitorStart)(bool exti9_enable);
+	void (*monitorIsr)();
+	void (*onEdge)(int iface);
+	void (*jam)(int iface);
+	MONITOR_STATE (*getState)(int iface);
+	void (*macInit)(MAC_MODE mode, uint8_t addr);
+	bool (*onFrame)(const Frame *frame);
+	void (*setRtsThreshold)(unsigned int bytes);
+	// its transmit timer, pins and monitor channel, while its code is not running
+	TIMER tim;
+	uint32_t odr;
+	uint32_t idr;
+	uint32_t ccr;
+	uint32_t dier;
+	uint32_t sr;
+	// the line as the node sees it
+	int line;
+	// sending: the half-bits so far, from the pin
+	bool running;
+	uint32_t nextIsr;
+	uint32_t startedAt;
+	uint8_t halfBits[16 * FP_FRAME_SIZE];
+	int numHalfBits;
+	// whether the node heard the frame of each sender intact so far
+	bool intact[NUM_NODES];
+	// a frame heard intact, for the MAC once the line is IDLE
+	bool pending;
+	Frame heard;
+	// its data frame to B
+	Frame *data;
+} Node;
+
+typedef struct {
+	unsigned long sent;
+	unsigned long delivered;
+	unsigned long reservations;
+	// transmissions their destination did not get, and their airtime
+	unsigned long collisions;
+	uint64_t wastedUs;
+	uint64_t deliveredUs;
+} Result;
+
+static Node nodes[NUM_NODES];
+static const LinkConfig *cfg;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 41;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void swapIn(Node *n) {
+	memcpy((void *)tim_regs(cfg->txTimer), &n->tim, sizeof(n->tim));
+	select_gpio(cfg->txGpio)->ODR = n->odr;
+	select_gpio(cfg->rxGpio)->IDR = n->idr;
+	(&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel] = n->ccr;
+	MONITOR_TIMER_BASE->DIER = n->dier;
+	MONITOR_TIMER_BASE->SR = n->sr;
+}
+
+static void swapOut(Node *n) {
+	memcpy(&n->tim, (void *)tim_regs(cfg->txTimer), sizeof(n->tim));
+	n->odr = select_gpio(cfg->txGpio)->ODR;
+	n->idr = select_gpio(cfg->rxGpio)->IDR;
+	n->ccr = (&MONITOR_TIMER_BASE->CCR1)[cfg->monitorChannel];
+	n->dier = MONITOR_TIMER_BASE->DIER;
+	n->sr = MONITOR_TIMER_BASE->SR;
+}
+
+/**
+ * the MONITOR_TIMER ticks for a step. A node's monitor interrupts once its counter reached the compare channel,
+ * the channel only matching on the tick of the step it was due at
+ */
+static void advance() {
+	uint32_t from = MONITOR_TIMER_BASE->CNT;
+	uint32_t flag = 1 << (CC1IF + cfg->monitorChannel);
+
+	for (int i = 0; i < STEP_US; i++)
+		host_tick();
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		if (n->ccr - from - 1 < STEP_US)
+			n->sr |= flag;
+		if (n->sr & n->dier & flag) {
+			swapIn(n);
+			n->monitorIsr();
+			swapOut(n);
+		}
+	}
+}
+
+/**
+ * queues A's or C's next data frame to B once the last one is done with
+ */
+static void queueData(Node *n, int node, int msgLen) {
+	static PacketHeader pkt;
+	uint8_t msg[PH_MSG_SIZE];
+
+	if (n->data && n->data->handle)
+		return;
+	for (int i = 0; i < msgLen; i++)
+		msg[i] = xorshift();
+	ph_create(&pkt, ADDR(node), ADDR(NODE_B), true, msg, msgLen);
+	Frame *frame = fp_alloc();
+	frame->len = ph_serialize(frame->data, &pkt);
+	// reported back through llc_complete, which clears it
+	frame->handle = 1;
+	n->data = frame;
+	swapIn(n);
+	n->queue(frame);
+	swapOut(n);
+}
+
+/**
+ * a node stopped sending. Each node that heard its frame intact gets it, the airtime is wasted if the destination
+ * didn't
+ */
+static void finished(Node *n, int node, Result *r, uint32_t now) {
+	uint8_t data[FP_FRAME_SIZE] = {0};
+	int len = n->numHalfBits / 16;
+
+	// transmitter_init starts the timer, with nothing to send
+	if (!n->numHalfBits)
+		return;
+	// the second half of a bit is the bit
+	for (int i = 0; i < 8 * len; i++)
+		data[i / 8] |= n->halfBits[2*i + 1] << (7 - i % 8);
+	uint8_t type = PH_GET_TYPE(data[PH_FLAGS_OFFSET]);
+	bool complete = n->intact[node] && len >= (int)PH_OVERHEAD;
+	int dest = data[PH_DEST_OFFSET] - ADDR(0);
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *l = &nodes[i];
+		if (i == node || !hears[i][node] || !l->intact[node] || !complete)
+			continue;
+		memset(&l->heard, 0, sizeof(l->heard));
+		memcpy(l->heard.data, data, len);
+		l->heard.len = len;
+		l->heard.stamps[FP_FIRST_EDGE] = n->startedAt;
+		l->pending = true;
+	}
+
+	bool delivered = complete && dest >= 0 && dest < NUM_NODES && nodes[dest].intact[node];
+	if (!delivered) {
+		r->collisions++;
+		r->wastedUs += now - n->startedAt;
+	}
+	if (complete && type == PH_TYPE_RTS)
+		r->reservations++;
+	if (n->intact[node] && type == PH_TYPE_DATA) {
+		r->sent++;
+		r->delivered += delivered;
+		r->deliveredUs += delivered ? now - n->startedAt : 0;
+	}
+}
+
+/**
+ * runs the nodes on fresh instances for a while
+ * @param rts whether frames above the RTS threshold reserve the line
+ */
+static void run(const char *lib, int msgLen, bool rts, uint32_t seconds, Result *r) {
+	memset(r, 0, sizeof(*r));
+	host_init();
+	ph_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	tw_init();
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		void *node = host_instance(lib);
+		memset(n, 0, sizeof(*n));
+		n->init = host_symbol(node, "transmitter_init");
+		n->queue = host_symbol(node, "transmitter_queue");
+		n->update = host_symbol(node, "transmitter_mainRoutineUpdate");
+		n->txIsr = host_symbol(node, "TIM2_IRQHandler");
+		n->monitorStart = host_symbol(node, "monitor_start");
+		n->monitorIsr = host_symbol(node, "TIM5_IRQHandler");
+		n->onEdge = host_symbol(node, "monitor_onEdge");
+		n->jam = host_symbol(node, "monitor_jam");
+		n->getState = host_symbol(node, "monitor_getState");
+		n->macInit = host_symbol(node, "mac_init");
+		n->onFrame = host_symbol(node, "mac_onFrame");
+		n->setRtsThreshold = host_symbol(node, "mac_setRtsThreshold");
+
+		// the idle line is high, and so is the transmit pin
+		n->line = 1;
+		swapIn(n);
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+		n->monitorStart(false);
+		n->macInit(MAC_CSMA, ADDR(i));
+		n->setRtsThreshold(rts ? MAC_RTS_THRESHOLD : 0);
+		n->init(true, false);
+		set_pin(cfg->txGpio, cfg->txPin);
+		swapOut(n);
+	}
+	// the transmitters draw their backoffs from rand, seeded with the time. Every run draws the same
+	srand(1);
+	rng = 41;
+
+	for (uint32_t t = 0; t < seconds * 1000000; t += STEP_US) {
+		advance();
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// the half-bits of the senders
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			if (!n->running || now != n->nextIsr)
+				continue;
+			swapIn(n);
+			n->txIsr();
+			swapOut(n);
+			n->nextIsr += HALFBIT_US;
+			n->running = n->tim.CR1 & (1 << CEN);
+			if (n->running && n->numHalfBits < (int)sizeof(n->halfBits))
+				n->halfBits[n->numHalfBits++] = (n->odr >> cfg->txPin) & 1;
+			else if (!n->running)
+				finished(n, i, r, now);
+		}
+
+		// the line each node sees, garbled if it hears two senders
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			int level = 1, senders = 0;
+			for (int j = 0; j < NUM_NODES; j++) {
+				if (!hears[i][j])
+					continue;
+				level &= (nodes[j].odr >> cfg->txPin) & 1;
+				senders += nodes[j].running;
+			}
+			if (level == n->line && senders < 2)
+				continue;
+			swapIn(n);
+			if (level != n->line) {
+				n->line = level;
+				if (level)
+					select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+				else
+					select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+				n->onEdge(LINK_PRIMARY);
+			}
+			if (senders > 1) {
+				n->jam(LINK_PRIMARY);
+				for (int j = 0; j < NUM_NODES; j++)
+					n->intact[j] &= !(hears[i][j] && nodes[j].running);
+			}
+			swapOut(n);
+		}
+
+		// the main routines, and the frames heard handed to the MAC
+		for (int i = 0; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			if (i != NODE_B)
+				queueData(n, i, msgLen);
+			swapIn(n);
+			if (n->pending && n->getState(LINK_PRIMARY) == MS_IDLE) {
+				n->onFrame(&n->heard);
+				n->pending = false;
+			}
+			n->update();
+			swapOut(n);
+			if (!n->running && (n->tim.CR1 & (1 << CEN))) {
+				n->running = true;
+				n->nextIsr = now + HALFBIT_US;
+				n->startedAt = now;
+				n->numHalfBits = 0;
+				for (int j = 0; j < NUM_NODES; j++)
+					nodes[j].intact[i] = true;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./node.so";
+	uint32_t seconds = argc > 2 ? atoi(argv[2]) : 300;
+	const int msgLens[] = {40, 120, 240};
+	const int numLens = sizeof(msgLens) / sizeof(msgLens[0]);
+	Result r[2];
+	double waste[2][numLens];
+	bool lostReserved = false, shortSame = true, rtsBetter = true;
+
+	printf("A and C hidden from each other, both sending to B, %lu s of each:\n", (unsigned long)seconds);
+	for (int s = 0; s < numLens; s++) {
+		for (int rts = 0; rts < 2; rts++) {
+			Result *res = &r[rts];
+			host_quiet(true);
+			run(lib, msgLens[s], rts, seconds, res);
+			host_quiet(false);
+			waste[rts][s] = res->collisions ? res->wastedUs / 1000.0 / res->collisions : 0;
+			printf("  %3d byte frames, RTS/CTS %-3s: %4lu data frames sent, %4lu delivered, %4lu RTS, "
+					"%4lu collisions wasting %7.1f ms each, %5.1f%% of the time delivering data\n",
+					msgLens[s] + (int)PH_OVERHEAD, rts ? "on" : "off", res->sent, res->delivered, res->reservations,
+					res->collisions, waste[rts][s], 100.0 * res->deliveredUs / (seconds * 1000000.0));
+		}
+		if (msgLens[s] + PH_OVERHEAD <= MAC_RTS_THRESHOLD) {
+			shortSame &= r[1].reservations == 0 && r[0].sent == r[1].sent && r[0].delivered == r[1].delivered;
+			continue;
+		}
+		// with RTS/CTS, data frames only go once reserved
+		lostReserved |= r[1].sent != r[1].delivered;
+		rtsBetter &= r[1].reservations > 0 && waste[1][s] * 2 < waste[0][s] && r[1].deliveredUs > r[0].deliveredUs;
+	}
+	check(shortSame, "frames below the RTS threshold are sent as they are");
+	check(!lostReserved, "the hidden node defers on the CTS, a data frame sent on a reservation gets through");
+	check(rtsBetter, "with RTS/CTS a collision wastes far less airtime, and more data gets through");
+	check(waste[1][numLens-1] < waste[1][1] * 1.5 && waste[0][numLens-1] > waste[0][1] * 1.5,
+			"the waste per collision grows with the frames without RTS/CTS, not with it");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
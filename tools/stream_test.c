@@ -0,0 +1,259 @@
+/**
+ * @file stream_test.c
+ * Host simulation of a long burst of small frames, sent by a node to itself in either framing mode: its real
+ * transmitter, receiver and monitor, the transmit pin looped back to the receive pin as on the board, PC9 -> PC4.
+ * The tool plays the hardware as link_test does: the transmit timer ISR every half-bit while the timer runs, the
+ * EXTI ISR on every edge of the receive pin, and the half-bit timeout ISR, on a 1 us grid.
+ * - idle mode: frames are delimited by the line going IDLE, so every frame waits out the monitor's timeout, then
+ *   contends for the line again with its AIFS and backoff
+ * - stream mode (stream_mode in transmitter_init and receiver_init, see hdlc.h): the frames are bit stuffed and
+ *   delimited by flags, and the sender keeps the line from one frame to the next, a flag between them
+ * In both, every frame of the burst is received intact and in order. The goodput, the payload bits received per
+ * second from the first frame queued to the last one received, is higher in stream mode.
+ *
+ * Build:
+ *   gcc -O2 -Iinc -Itools tools/stream_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o stream_test
+ * Usage:
+ *   stream_test [frames] [payload]   (default 500 frames of 4 bytes)
+ */
+
+#include "host.h"
+#include "link.h"
+#include "transmitter.h"
+#include "receiver.h"
+#include "monitor.h"
+#include "mac.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include "gpio.h"
+#include "tim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SRC 0xAA
+#define DEST 0xBB
+// the main routine runs this often
+#define MAIN_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+// frames kept queued, the rest of the pool is left to the receiver
+#define QUEUED 4
+// the burst must be over by then
+#define LIMIT_US 3600000000u
+
+typedef struct {
+	unsigned long received;
+	unsigned long intact;
+	unsigned long outOfOrder;
+	uint32_t elapsedUs;
+	double goodput;
+	unsigned long frameBits;
+	// frames of the pool not back once the line is IDLE
+	int leaked;
+} Result;
+
+static int numFrames;
+static int payload;
+// the level on the receive pin
+static int line;
+static bool running;
+static uint32_t nextIsr;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+/**
+ * keeps QUEUED frames queued, each carrying its number, until the burst is all queued
+ * @return the number of frames queued so far
+ */
+static int refill(int next, Frame **queued, uint32_t *handles) {
+	static PacketHeader pkt;
+	uint8_t msg[PH_MSG_SIZE];
+
+	for (int i = 0; i < QUEUED && next < numFrames; i++) {
+		if (queued[i] && queued[i]->handle == handles[i])
+			continue;
+		Frame *frame = fp_alloc();
+		if (!frame)
+			break;
+		msg[0] = next >> 8;
+		msg[1] = next;
+		for (int b = 2; b < payload; b++)
+			msg[b] = next + b;
+		ph_create(&pkt, SRC, DEST, true, msg, payload);
+		frame->cls = PH_CLASS_BEST_EFFORT;
+		frame->len = ph_serialize(frame->data, &pkt);
+		// llc_complete clears it once the transmitter is done
+		frame->handle = handles[i] = next + 1;
+		queued[i] = frame;
+		transmitter_queue(frame);
+		next++;
+	}
+	return next;
+}
+
+/**
+ * @return true if a frame is one the tool queued, as it was queued. Its number is set
+ */
+static bool intact(const Frame *frame, int *number) {
+	static PacketHeader pkt;
+
+	if (frame->len < PH_OVERHEAD || !ph_parse(&pkt, frame->data, frame->len) || pkt.src != SRC || pkt.dest != DEST
+			|| pkt.length != payload)
+		return false;
+	*number = pkt.msg[0] << 8 | pkt.msg[1];
+	for (int i = 2; i < payload; i++) {
+		if (pkt.msg[i] != (uint8_t)(*number + i))
+			return false;
+	}
+	return true;
+}
+
+static int txLevel() {
+	return (select_gpio(link_configs[LINK_PRIMARY].txGpio)->ODR >> link_configs[LINK_PRIMARY].txPin) & 1;
+}
+
+/**
+ * the receive pin follows the transmit pin, each edge interrupts
+ */
+static void loopBack() {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	int level = txLevel();
+
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	*(EXTI_PR) |= 1 << cfg->rxPin;
+	EXTI4_IRQHandler();
+}
+
+/**
+ * the receive timer counts for a us while it runs. At HALFBIT_TIMEOUT_TICKS it interrupts, and restarts from 0
+ */
+static void countHalfBit() {
+	volatile TIMER *tim = tim_regs(link_configs[LINK_PRIMARY].halfBitTimer);
+
+	if (!(tim->CR1 & (1 << CEN)))
+		return;
+	tim->CNT += F_CPU / 1000000;
+	if (tim->CNT < HALFBIT_TIMEOUT_TICKS)
+		return;
+	tim->CNT -= HALFBIT_TIMEOUT_TICKS;
+	tim->SR |= 1 << CC1IF;
+	TIM4_IRQHandler();
+}
+
+/**
+ * sends the burst to the node itself in one framing mode
+ */
+static void burst(bool streamMode, Result *r) {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+	const uint32_t channels = ((1 << 4) - 1) << CC1IF;
+	Frame *queued[QUEUED] = {NULL};
+	uint32_t handles[QUEUED] = {0};
+	int next = 0, expected = 0;
+
+	memset(r, 0, sizeof(*r));
+	host_init();
+	host_quiet(true);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, SRC);
+	// the idle line is high, and so is the transmit pin
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	line = 1;
+	running = false;
+	transmitter_init(true, streamMode);
+	receiver_init(true, streamMode);
+	set_pin(cfg->txGpio, cfg->txPin);
+	srand(1);
+	uint32_t startedAt = monitor_now();
+
+	// on until the line is IDLE after the last frame
+	uint32_t end = LIMIT_US;
+	for (uint32_t t = 0; t < end; t++) {
+		host_tick();
+		if (MONITOR_TIMER_BASE->SR & MONITOR_TIMER_BASE->DIER & channels)
+			TIM5_IRQHandler();
+		uint32_t now = monitor_now();
+
+		countHalfBit();
+		if (running && now == nextIsr) {
+			tim_regs(cfg->txTimer)->SR |= 1 << CC1IF;
+			TIM2_IRQHandler();
+			nextIsr += HALFBIT_US;
+			running = tim_regs(cfg->txTimer)->CR1 & (1 << CEN);
+			loopBack();
+		}
+
+		if (t % MAIN_US)
+			continue;
+		tw_run();
+		next = refill(next, queued, handles);
+		transmitter_mainRoutineUpdate();
+		if (!running && (tim_regs(cfg->txTimer)->CR1 & (1 << CEN))) {
+			running = true;
+			nextIsr = now + HALFBIT_US;
+		}
+		Frame *frame;
+		while ((frame = receiver_pollFrame())) {
+			int number;
+			r->received++;
+			if (intact(frame, &number)) {
+				r->intact++;
+				r->outOfOrder += number != expected;
+				expected = number + 1;
+				r->elapsedUs = now - startedAt;
+			}
+			fp_free(frame);
+		}
+		if (r->received == (unsigned long)numFrames && end == LIMIT_US)
+			end = t + MAC_SLOT_GUARD_US;
+	}
+	host_quiet(false);
+
+	r->leaked = FP_NUM_FRAMES - fp_available();
+	r->frameBits = 8 * (PH_OVERHEAD + payload);
+	r->goodput = r->elapsedUs ? r->intact * 8.0 * payload * 1e6 / r->elapsedUs : 0;
+}
+
+int main(int argc, char **argv) {
+	numFrames = argc > 1 ? atoi(argv[1]) : 500;
+	payload = argc > 2 ? atoi(argv[2]) : 4;
+	Result idle, stream;
+
+	// the frame number goes in the first two bytes
+	if (payload < 2 || payload > MAC_SLOT_MAX_FRAME)
+		payload = 4;
+	burst(false, &idle);
+	burst(true, &stream);
+
+	printf("a burst of %d frames of %d payload bytes, %lu bits with the header, at %d bps:\n", numFrames, payload,
+			idle.frameBits, (int)(1000000 / MAC_BIT_US));
+	printf("                  idle mode  stream mode\n");
+	printf("  received       %10lu   %10lu\n", idle.received, stream.received);
+	printf("  intact         %10lu   %10lu\n", idle.intact, stream.intact);
+	printf("  time (s)       %10.1f   %10.1f\n", idle.elapsedUs / 1e6, stream.elapsedUs / 1e6);
+	printf("  per frame (ms) %10.1f   %10.1f\n", idle.elapsedUs / 1e3 / numFrames, stream.elapsedUs / 1e3 / numFrames);
+	printf("  goodput (bps)  %10.1f   %10.1f\n", idle.goodput, stream.goodput);
+	check(idle.intact == (unsigned long)numFrames && !idle.outOfOrder, "idle mode: every frame arrives intact and in order");
+	check(stream.intact == (unsigned long)numFrames && !stream.outOfOrder,
+			"stream mode: every frame arrives intact and in order");
+	check(stream.goodput > idle.goodput, "stream mode has the higher goodput");
+	check(!idle.leaked && !stream.leaked, "no frame is leaked");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
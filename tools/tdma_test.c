@@ -0,0 +1,441 @@
+/**
+ * @file tdma_test.c
+ * Host simulation of TDMA (MAC_TDMA in mac.h) against CSMA under a heavy load, 2 to 32 nodes each keeping a frame
+ * of MAC_SLOT_MAX_FRAME bytes queued at all times: the throughput, and the worst-case latency of a frame from
+ * being queued to its last bit on the line.
+ * - TDMA: every node is an instance of the real mac.c, see host_instance, as in aloha_test. Node 0 is the
+ *   coordinator and sends the beacons, which every node syncs to, and whether a frame may start is up to
+ *   mac_mayTransmit. The nodes poll on a 1 ms tick of their own phase, as the transmitter does, and only while the
+ *   line is IDLE. Each node owns one slot. Past MAC_TDMA_MAX_SLOTS nodes they take turns: the coordinator hands out
+ *   the slots of a cycle of superframes, a new schedule after every beacon
+ * - every frame starts and ends within a slot of its node, so nothing collides, and every node gets a slot per
+ *   cycle. A frame then waits a cycle at most, the bound asserted on the worst-case latency
+ * - CSMA: every node is an instance of the real transmitter with a frame pool of its own, contending through its
+ *   backoff as in edca_test. The line is the wired-AND of their pins, and two of them sending at once are jammed
+ *   into a collision, as the garbled line would be. With frames this long it keeps more of the line busy than
+ *   TDMA, which gives up the beacon's slot and the rest of every slot, but its worst case grows with the nodes and
+ *   the length of the run, and frames are dropped once they collided too often
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/mac.c -o mac.so
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c src/framepool.c -o txnode.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/tdma_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o tdma_test
+ * Usage:
+ *   tdma_test [mac.so] [txnode.so] [seconds]   (default ./mac.so, ./txnode.so, 120 s of each run)
+ */
+
+#include "host.h"
+#include "mac.h"
+#include "transmitter.h"
+#include "monitor.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define MAX_NODES 32
+#define TICK_US 1000
+// the transmitters' main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+#define FRAME_BITS (8 * MAC_SLOT_MAX_FRAME)
+
+typedef struct {
+	void (*init)(MAC_MODE mode, uint8_t addr);
+	void (*setCoordinator)(const uint8_t *schedule, int slots);
+	Frame *(*pollControlFrame)(bool dataPending);
+	bool (*mayTransmit)(const Frame *frame, unsigned int bits);
+	bool (*onFrame)(const Frame *frame);
+
+	uint8_t addr;
+	Frame frame;
+	uint32_t phase;
+	// when the frame was queued, the last one being done
+	uint32_t queuedAt;
+	unsigned long sent;
+} Node;
+
+// a node of the CSMA run, an instance of the transmitter
+typedef struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*isr)();
+	Frame *(*alloc)();
+	// the registers of its transmit timer and pins, while its code is not running
+	TIMER tim;
+	uint32_t odr;
+	bool running;
+	uint32_t nextIsr;
+	Frame *frame;
+	uint32_t queuedAt;
+	unsigned long sent;
+} Station;
+
+typedef struct {
+	double throughput;
+	uint32_t worstUs;
+	unsigned long sent;
+	unsigned long dropped;
+	unsigned long minSent;
+	// TDMA: frames started outside a slot of their node, or running past its end
+	unsigned long outsideSlot;
+} Result;
+
+static Node nodes[MAX_NODES];
+static Station stations[MAX_NODES];
+static int numNodes;
+static uint32_t runUs;
+static const LinkConfig *cfg;
+static int line = 1;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 29;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void setTime(uint32_t t) {
+	MONITOR_TIMER_BASE->CNT = t;
+}
+
+/**
+ * a data frame from a node, the longest a slot fits
+ */
+static void makeFrame(Frame *frame, uint8_t src) {
+	PacketHeader pkt;
+	uint8_t msg[MAC_SLOT_MAX_FRAME] = {0};
+
+	ph_create(&pkt, src, 0xFF, true, msg, MAC_SLOT_MAX_FRAME - PH_OVERHEAD);
+	frame->len = ph_serialize(frame->data, &pkt);
+	frame->cls = PH_CLASS_BEST_EFFORT;
+}
+
+static void loadNodes(const char *lib) {
+	for (int i = 0; i < MAX_NODES; i++) {
+		Node *n = &nodes[i];
+		void *mac = host_instance(lib);
+		n->init = host_symbol(mac, "mac_init");
+		n->setCoordinator = host_symbol(mac, "mac_setCoordinator");
+		n->pollControlFrame = host_symbol(mac, "mac_pollControlFrame");
+		n->mayTransmit = host_symbol(mac, "mac_mayTransmit");
+		n->onFrame = host_symbol(mac, "mac_onFrame");
+		n->addr = i + 1;
+		n->phase = xorshift() % TICK_US;
+		makeFrame(&n->frame, n->addr);
+	}
+}
+
+/**
+ * @return the number of superframes a cycle takes, each node owning one slot of one of them
+ */
+static int cycleSuperframes() {
+	return (numNodes + MAC_TDMA_MAX_SLOTS - 1) / MAC_TDMA_MAX_SLOTS;
+}
+
+/**
+ * @param sf the superframe's number in the cycle
+ * @return its slots, the nodes being shared evenly, and their owners in schedule
+ */
+static int groupSchedule(int sf, uint8_t *schedule) {
+	int cycle = cycleSuperframes();
+	int first = numNodes * sf / cycle, last = numNodes * (sf + 1) / cycle;
+
+	for (int i = first; i < last; i++)
+		schedule[i - first] = nodes[i].addr;
+	return last - first;
+}
+
+/**
+ * @return the longest a cycle of superframes takes, each a beacon slot and those of its owners
+ */
+static uint32_t cycleUs() {
+	return (cycleSuperframes() + numNodes) * MAC_SLOT_US;
+}
+
+/**
+ * the coordinator's beacon goes out when it is due, and is heard by every node. The schedule of the superframe
+ * after it is handed to the coordinator once it is heard
+ * @return true if it went out
+ */
+static bool beacon(uint32_t now, int next) {
+	uint8_t schedule[MAC_TDMA_MAX_SLOTS];
+
+	setTime(now);
+	Frame *frame = nodes[0].pollControlFrame(true);
+	if (!frame)
+		return false;
+	frame->stamps[FP_FIRST_EDGE] = now;
+	setTime(now + 8 * frame->len * MAC_BIT_US + TRANSMISSION_TIMEOUT_US);
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].onFrame(frame);
+	fp_free(frame);
+	int slots = groupSchedule(next, schedule);
+	nodes[0].setCoordinator(schedule, slots);
+	return true;
+}
+
+/**
+ * @return true if the node owns the slot of the superframe started at sfStart that t falls in, and a frame started
+ * at t is over before the slot is
+ */
+static bool inOwnSlot(const Node *n, int sf, uint32_t sfStart, uint32_t t) {
+	uint8_t schedule[MAC_TDMA_MAX_SLOTS];
+	int slots = groupSchedule(sf, schedule);
+	int slot = (t - sfStart) / MAC_SLOT_US - 1;
+
+	if (slot < 0 || slot >= slots || schedule[slot] != n->addr)
+		return false;
+	return t + FRAME_BITS * MAC_BIT_US + TRANSMISSION_TIMEOUT_US <= sfStart + (slot + 2) * MAC_SLOT_US;
+}
+
+/**
+ * runs the nodes in TDMA for runUs, every node polling at each of its ticks while the line is IDLE
+ */
+static void runTdma(Result *r) {
+	uint8_t schedule[MAC_TDMA_MAX_SLOTS];
+	uint32_t t0 = monitor_now() + 1000, end = t0 + runUs;
+	// the superframe the last beacon started, its number in the cycle, and when the line is IDLE again
+	uint32_t sfStart = 0, idleAt = t0;
+	int sf = -1;
+	uint64_t dataUs = 0;
+
+	memset(r, 0, sizeof(*r));
+	host_quiet(true);
+	for (int i = 0; i < numNodes; i++) {
+		nodes[i].init(MAC_TDMA, nodes[i].addr);
+		nodes[i].queuedAt = t0;
+		nodes[i].sent = 0;
+	}
+	setTime(t0);
+	nodes[0].setCoordinator(schedule, groupSchedule(0, schedule));
+
+	for (uint32_t t = t0; (int32_t)(end - t) > 0; t += TICK_US) {
+		// the coordinator polls first, its beacon goes ahead of its data
+		if ((int32_t)(t - idleAt) >= 0 && beacon(t, (sf + 2) % cycleSuperframes())) {
+			sf = (sf + 1) % cycleSuperframes();
+			sfStart = t;
+			idleAt = monitor_now();
+		}
+		for (int i = 0; i < numNodes; i++) {
+			Node *n = &nodes[i];
+			uint32_t now = t + n->phase;
+			// the transmitter only asks the MAC on an IDLE line
+			if ((int32_t)(now - idleAt) < 0)
+				continue;
+			setTime(now);
+			if (!n->mayTransmit(&n->frame, FRAME_BITS))
+				continue;
+			r->outsideSlot += sf < 0 || !inOwnSlot(n, sf, sfStart, now);
+			uint32_t last = now + FRAME_BITS * MAC_BIT_US;
+			if (last - n->queuedAt > r->worstUs)
+				r->worstUs = last - n->queuedAt;
+			n->queuedAt = last;
+			n->sent++;
+			dataUs += FRAME_BITS * MAC_BIT_US;
+			idleAt = last + TRANSMISSION_TIMEOUT_US;
+		}
+	}
+	host_quiet(false);
+
+	r->minSent = -1UL;
+	for (int i = 0; i < numNodes; i++) {
+		r->sent += nodes[i].sent;
+		r->minSent = nodes[i].sent < r->minSent ? nodes[i].sent : r->minSent;
+	}
+	r->throughput = (double)dataUs / runUs;
+}
+
+static void swapIn(Station *st) {
+	memcpy((void *)tim_regs(cfg->txTimer), &st->tim, sizeof(st->tim));
+	select_gpio(cfg->txGpio)->ODR = st->odr;
+}
+
+static void swapOut(Station *st) {
+	memcpy(&st->tim, (void *)tim_regs(cfg->txTimer), sizeof(st->tim));
+	st->odr = select_gpio(cfg->txGpio)->ODR;
+}
+
+static void setLine(int level) {
+	if (level == line)
+		return;
+	line = level;
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	monitor_onEdge(LINK_PRIMARY);
+}
+
+/**
+ * takes the frame a node is done with, sent or dropped after too many collisions. The transmitter has freed it
+ * to its own pool and reported it through llc_complete, which clears its handle
+ */
+static void collect(Station *st, Result *r) {
+	if (!st->frame || st->frame->handle)
+		return;
+	uint32_t last = st->frame->stamps[FP_LAST_EDGE];
+	if (last) {
+		st->sent++;
+		if (last - st->queuedAt > r->worstUs)
+			r->worstUs = last - st->queuedAt;
+	}
+	else {
+		r->dropped++;
+	}
+	st->frame = NULL;
+}
+
+/**
+ * runs the same load on fresh instances of the transmitter in CSMA
+ */
+static void runCsma(const char *lib, Result *r) {
+	uint64_t dataUs = 0;
+
+	memset(r, 0, sizeof(*r));
+	host_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	// the idle line is high
+	line = 1;
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, 0x10);
+	for (int i = 0; i < numNodes; i++) {
+		Station *st = &stations[i];
+		void *tx = host_instance(lib);
+		memset(st, 0, sizeof(*st));
+		st->init = host_symbol(tx, "transmitter_init");
+		st->queue = host_symbol(tx, "transmitter_queue");
+		st->update = host_symbol(tx, "transmitter_mainRoutineUpdate");
+		st->isr = host_symbol(tx, "TIM2_IRQHandler");
+		st->alloc = host_symbol(tx, "fp_alloc");
+		((void (*)())host_symbol(tx, "fp_init"))();
+		st->init(false, false);
+		// its pin idles high, as once a transmission is stopped
+		set_pin(cfg->txGpio, cfg->txPin);
+		swapOut(st);
+	}
+	// the transmitters draw their backoffs from rand
+	srand(1);
+
+	for (uint32_t t = 0; t < runUs; t += STEP_US) {
+		host_advance(STEP_US);
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// the half-bits of the senders, then the line they make
+		int level = 1, senders = 0;
+		for (int i = 0; i < numNodes; i++) {
+			Station *st = &stations[i];
+			if (st->running && now == st->nextIsr) {
+				swapIn(st);
+				st->isr();
+				swapOut(st);
+				st->nextIsr += HALFBIT_US;
+				st->running = st->tim.CR1 & (1 << CEN);
+			}
+			level &= (st->odr >> cfg->txPin) & 1;
+			senders += st->running;
+		}
+		setLine(level);
+		if (senders > 1)
+			monitor_jam(LINK_PRIMARY);
+
+		for (int i = 0; i < numNodes; i++) {
+			Station *st = &stations[i];
+			collect(st, r);
+			if (!st->frame) {
+				st->frame = st->alloc();
+				makeFrame(st->frame, nodes[i].addr);
+				// reported back through llc_complete, which clears it
+				st->frame->handle = 1;
+				memset(st->frame->stamps, 0, sizeof(st->frame->stamps));
+				st->queuedAt = now;
+				swapIn(st);
+				st->queue(st->frame);
+				swapOut(st);
+			}
+			swapIn(st);
+			st->update();
+			swapOut(st);
+			if (!st->running && (st->tim.CR1 & (1 << CEN))) {
+				st->running = true;
+				st->nextIsr = now + HALFBIT_US;
+			}
+			collect(st, r);
+		}
+	}
+
+	r->minSent = -1UL;
+	for (int i = 0; i < numNodes; i++) {
+		r->sent += stations[i].sent;
+		r->minSent = stations[i].sent < r->minSent ? stations[i].sent : r->minSent;
+	}
+	// only the frames that went through count, not the collided ones
+	dataUs = (uint64_t)r->sent * FRAME_BITS * MAC_BIT_US;
+	r->throughput = (double)dataUs / runUs;
+}
+
+int main(int argc, char **argv) {
+	const char *macLib = argc > 1 ? argv[1] : "./mac.so";
+	const char *txLib = argc > 2 ? argv[2] : "./txnode.so";
+	runUs = (argc > 3 ? atoi(argv[3]) : 120) * 1000000u;
+	const int sweep[] = {2, 4, 8, 16, 24, 32};
+	bool bounded = true, noneOutside = true, everyNode = true, tdmaBetter = true;
+
+	host_init();
+	srand(1);
+	ph_init();
+	fp_init();
+	link_init(1);
+	monitor_start(false);
+	tw_init();
+	loadNodes(macLib);
+
+	printf("every node backlogged with %d byte frames for %lu s:\n", MAC_SLOT_MAX_FRAME,
+			(unsigned long)(runUs / 1000000));
+	printf("         ----------------- TDMA -----------------  ------------- CSMA -------------\n");
+	printf("  nodes  throughput  worst (ms)  bound (ms)  frames  throughput  worst (ms)  dropped\n");
+	for (unsigned int k = 0; k < sizeof(sweep)/sizeof(sweep[0]); k++) {
+		Result tdma, csma;
+		numNodes = sweep[k];
+		runTdma(&tdma);
+		runCsma(txLib, &csma);
+		uint32_t bound = cycleUs() + MAC_SLOT_US;
+
+		printf("  %5d  %10.3f  %10lu  %10lu  %6lu  %10.3f  %10lu  %7lu\n", numNodes, tdma.throughput,
+				(unsigned long)tdma.worstUs / 1000, (unsigned long)bound / 1000, tdma.sent, csma.throughput,
+				(unsigned long)csma.worstUs / 1000, csma.dropped);
+		bounded &= tdma.worstUs <= bound;
+		noneOutside &= tdma.outsideSlot == 0;
+		everyNode &= tdma.minSent > 0;
+		// past a handful of nodes, contention makes the wait of CSMA the longer one
+		if (numNodes >= 8)
+			tdmaBetter &= tdma.worstUs < csma.worstUs || csma.dropped > 0;
+	}
+	check(noneOutside, "TDMA frames start and end within a slot of their node");
+	check(everyNode, "every node sends in TDMA, past MAC_TDMA_MAX_SLOTS nodes too");
+	check(bounded, "a TDMA frame waits a cycle of superframes at most");
+	check(tdmaBetter, "from 8 nodes up, CSMA has the worse worst case, or drops frames");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
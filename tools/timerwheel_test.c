@@ -0,0 +1,268 @@
+/**
+ * @file timerwheel_test.c
+ * Host simulation and benchmark of the timer wheel, see timerwheel.h. The MONITOR_TIMER is stepped straight to
+ * the compare channel of the wheel whenever it is armed, as the ISR would wake the timers task there, and tw_run
+ * is called. The counter starts close to wrapping around, so it does on the way.
+ * TW_NUM_TIMERS timers are started over spans that reach every level: within a turn of level 0, of level 1 and of
+ * level 2, and up to an hour on level 3. Meanwhile the main routine cancels and restarts random ones at every
+ * wakeup, a share of them are periodic and start themselves again from their callback:
+ * - every timer runs once per start, never early and less than two ticks late, however many levels it was moved
+ *   down on the way
+ * - a cancelled timer never runs, a restarted one only at its new time
+ * - the compare channel wakes for nothing at most once per turn of level 0 and once per cancel
+ * Then the benchmark: the cost of tw_start, tw_cancel and of restarting an active timer with TW_NUM_TIMERS active,
+ * and of tw_run per wakeup and per timer run over 10 s, against polling as many deadlines.
+ *
+ * Build:
+ *   gcc -O2 -Iinc -Itools tools/timerwheel_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -o timerwheel_test
+ * Usage:
+ *   timerwheel_test [timers]   (default 10000)
+ */
+
+#include "host.h"
+#include "timerwheel.h"
+#include "monitor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define TW_NUM_TIMERS 10000
+// the main routine cancels or restarts timers at wakeups until then, us
+#define CHURN_US 60000000u
+// a periodic timer runs this many times
+#define PERIODS 5
+// the counter wraps around this long into the run, us
+#define WRAP_US 5000000u
+#define BENCH_US 10000000u
+
+typedef struct {
+	TwTimer timer;
+	// the last start: when, and how long for
+	uint32_t startedAt;
+	uint32_t us;
+	bool armed;
+	bool periodic;
+	int runs;
+} Sim;
+
+static Sim *sims;
+static int numSims;
+
+// what the callbacks saw
+static unsigned long numRuns, early, unarmed;
+static uint32_t maxLateUs;
+static bool ranThisWakeup;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 47;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * @return a timeout on one of the levels, us: within a turn of level 0 (16 ms), of level 1 (1 s), of level 2
+ * (67 s), or up to an hour
+ */
+static uint32_t randomUs() {
+	static const uint32_t spans[] = {
+		TW_SLOTS * TW_TICK_US,
+		TW_SLOTS * TW_SLOTS * TW_TICK_US,
+		TW_SLOTS * TW_SLOTS * TW_SLOTS * TW_TICK_US,
+		3600000000u,
+	};
+	return 1 + xorshift() % spans[xorshift() % 4];
+}
+
+static void onTimer(void *arg);
+
+static void start(Sim *s, uint32_t us) {
+	s->startedAt = MONITOR_TIMER_BASE->CNT;
+	s->us = us;
+	s->armed = true;
+	tw_start(&s->timer, us, onTimer, s);
+}
+
+/**
+ * a timer ran: it is checked against the time it was due at, and a periodic one starts again
+ */
+static void onTimer(void *arg) {
+	Sim *s = arg;
+	int32_t late = MONITOR_TIMER_BASE->CNT - (s->startedAt + s->us);
+
+	numRuns++;
+	ranThisWakeup = true;
+	unarmed += !s->armed;
+	early += late < 0;
+	if (late > (int32_t)maxLateUs)
+		maxLateUs = late;
+	s->armed = false;
+	if (s->periodic && ++s->runs < PERIODS)
+		start(s, s->us);
+}
+
+/**
+ * @return true if the compare channel of the wheel interrupts. The counter is stepped to it first, if it is no
+ * more than limit us after from
+ */
+static bool wake(uint32_t from, uint32_t limit) {
+	volatile TIMER2to5 *tim = MONITOR_TIMER_BASE;
+	uint32_t at = (&tim->CCR1)[TW_CHANNEL];
+
+	if (!(tim->DIER & (1 << (CC1IE + TW_CHANNEL))))
+		return false;
+	if ((int32_t)(at - tim->CNT) > 0) {
+		if (at - from > limit)
+			return false;
+		tim->CNT = at;
+	}
+	return true;
+}
+
+static double nsSince(const struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
+
+/**
+ * starts the timers, churns them for CHURN_US, then runs the wheel until it is empty
+ */
+static void simulate() {
+	unsigned long wakeups = 0, emptyWakeups = 0, cancels = 0, restarts = 0;
+	uint32_t startedAt;
+	int numPeriodic = 0;
+
+	host_init();
+	MONITOR_TIMER_BASE->CNT = -WRAP_US;
+	startedAt = MONITOR_TIMER_BASE->CNT;
+	tw_init();
+	memset(sims, 0, numSims * sizeof(Sim));
+	for (int i = 0; i < numSims; i++) {
+		// periodic ones come back within a second, so that they restart from their callback during the run
+		sims[i].periodic = i % 8 == 0;
+		numPeriodic += sims[i].periodic;
+		start(&sims[i], sims[i].periodic ? 1 + xorshift() % 1000000 : randomUs());
+	}
+
+	while (wake(startedAt, 4000000000u)) {
+		uint32_t now = MONITOR_TIMER_BASE->CNT;
+		ranThisWakeup = false;
+		tw_run();
+		wakeups++;
+		emptyWakeups += !ranThisWakeup;
+		if (now - startedAt >= CHURN_US)
+			continue;
+		for (int k = 0; k < 2; k++) {
+			Sim *s = &sims[xorshift() % numSims];
+			if (s->periodic)
+				continue;
+			if (tw_active(&s->timer) && xorshift() % 2) {
+				tw_cancel(&s->timer);
+				s->armed = false;
+				cancels++;
+			}
+			else {
+				start(s, randomUs());
+				restarts++;
+			}
+		}
+	}
+
+	uint32_t elapsed = MONITOR_TIMER_BASE->CNT - startedAt;
+	unsigned long left = 0, periodsMissed = 0;
+	for (int i = 0; i < numSims; i++) {
+		left += sims[i].armed || tw_active(&sims[i].timer);
+		periodsMissed += sims[i].periodic && sims[i].runs != PERIODS;
+	}
+	unsigned long turns = elapsed / (TW_SLOTS * TW_TICK_US) + 1;
+
+	printf("%d timers over every level, %d of them periodic, %lu cancelled and %lu restarted, %.1f s:\n", numSims,
+			numPeriodic, cancels, restarts, elapsed / 1e6);
+	printf("  %lu runs, %lu wakeups of which %lu ran nothing, %lu turns of level 0, latest run %lu us late\n",
+			numRuns, wakeups, emptyWakeups, turns, (unsigned long)maxLateUs);
+	check(!left && !periodsMissed && !early && maxLateUs < 2 * TW_TICK_US,
+			"every timer runs once per start, never early and less than two ticks late");
+	check(!unarmed, "a cancelled timer never runs, a restarted one only at its new time");
+	check(emptyWakeups <= turns + cancels, "the compare channel wakes for nothing at most once per turn and cancel");
+}
+
+/**
+ * times the wheel's calls with numSims timers active
+ */
+static void benchmark() {
+	struct timespec t0;
+	double startNs, cancelNs, restartNs, runNs = 0, pollNs;
+	unsigned long wakeups = 0, runsBefore;
+	uint32_t *deadlines = malloc(numSims * sizeof(uint32_t));
+	volatile unsigned long due = 0;
+
+	host_init();
+	tw_init();
+	memset(sims, 0, numSims * sizeof(Sim));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < numSims; i++)
+		tw_start(&sims[i].timer, 1000 + xorshift() % (BENCH_US - 1000), onTimer, &sims[i]);
+	startNs = nsSince(&t0) / numSims;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < numSims; i++)
+		tw_cancel(&sims[i].timer);
+	cancelNs = nsSince(&t0) / numSims;
+
+	for (int i = 0; i < numSims; i++) {
+		deadlines[i] = 1000 + xorshift() % (BENCH_US - 1000);
+		start(&sims[i], deadlines[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < numSims; i++)
+		tw_start(&sims[i].timer, sims[i].us, onTimer, &sims[i]);
+	restartNs = nsSince(&t0) / numSims;
+
+	runsBefore = numRuns;
+	while (wake(0, 2 * BENCH_US)) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		tw_run();
+		runNs += nsSince(&t0);
+		wakeups++;
+	}
+	unsigned long ran = numRuns - runsBefore;
+
+	// what the wheel replaces: every deadline checked at every wakeup
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int pass = 0; pass < 1000; pass++) {
+		uint32_t now = pass * 10000;
+		for (int i = 0; i < numSims; i++)
+			due += (int32_t)(now - deadlines[i]) >= 0;
+	}
+	pollNs = nsSince(&t0) / 1000;
+
+	printf("%d active timers over up to %.0f s:\n", numSims, BENCH_US / 1e6);
+	printf("  start %.1f ns, cancel %.1f ns, restart of an active timer %.1f ns\n", startNs, cancelNs, restartNs);
+	printf("  %lu wakeups, %.1f ns each, %.1f ns per timer run. Polling the deadlines instead: %.0f ns per pass\n",
+			wakeups, wakeups ? runNs / wakeups : 0, ran ? runNs / ran : 0, pollNs);
+	check(ran == (unsigned long)numSims, "every timer of the benchmark runs");
+	free(deadlines);
+}
+
+int main(int argc, char **argv) {
+	numSims = argc > 1 ? atoi(argv[1]) : TW_NUM_TIMERS;
+	sims = calloc(numSims, sizeof(Sim));
+
+	simulate();
+	benchmark();
+	printf("%s\n", failures ? "FAILED" : "passed");
+	free(sims);
+	return failures != 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * @file timesync_test.c
+ * Host simulation of the bus-wide time synchronization, see timesync.h. A master and slaves, each an instance of
+ * the real timesync.c, see host_instance, with a MONITOR_TIMER of its own: it runs fast or slow by the node's clock
+ * skew and starts from a random time, and is swapped in around the node's calls. The master's SYNC and FOLLOW_UP
+ * packets go on the line after a random queueing delay, every node timestamps the first edge of a frame with its
+ * own clock and a random latency, and a frame is lost to a node at times.
+ * Slaves spread over the skew given, against the master, for every skew of the sweep up to it:
+ * - every slave is synced by the second SYNC and FOLLOW_UP pair, though clocks wrap around on the way
+ * - from then on the synchronized clock of every slave stays within three timestamp latencies of the master's,
+ *   and a few us as clocks count whole us. Sampled every 10 ms, so in between the samples too
+ * - a master restarting with another clock is followed again, the slaves restart their filter
+ * - once the master goes silent the slaves are synced for TIMESYNC_LOSS_PERIODS periods, not after
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/timesync.c -o timesync.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/timesync_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o timesync_test
+ * Usage:
+ *   timesync_test [timesync.so] [max skew ppm] [latency us] [seconds]   (default ./timesync.so, 10000 ppm as the
+ *   HSI's 1%, 10 us, 600 s of each run)
+ */
+
+#include "host.h"
+#include "timesync.h"
+#include "mac.h"
+#include "monitor.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define MASTER 0
+#define NUM_SLAVES 4
+#define NUM_NODES (1 + NUM_SLAVES)
+#define ADDR(node) (0x30 + (node))
+#define STEP_US 1000
+// the error is sampled this often
+#define SAMPLE_US 10000
+// a frame is lost to a node this often
+#define LOSS 0.01
+// the SYNC waits up to this long behind other frames
+#define MAX_QUEUEING_US 50000
+// from a SYNC being due until its FOLLOW_UP is over: both wait behind other frames, then go on the line
+#define SAMPLE_DELAY_US ((int64_t)(2 * MAX_QUEUEING_US + 8 * (2 * PH_OVERHEAD + 6) * MAC_BIT_US + MAC_TURNAROUND_US))
+// frames of the master on the line or waiting for it
+#define MAX_ON_LINE 4
+
+typedef struct {
+	void (*init)(uint8_t addr, bool master);
+	Frame *(*pollFrame)();
+	bool (*onFrame)(const Frame *frame);
+	bool (*synced)();
+	uint32_t (*now)();
+	// the clock: local time at true time t is start + t * (1 + skew)
+	uint32_t start;
+	double skew;
+} Node;
+
+typedef struct {
+	// true times, us: every slave was synced, then a slave was not for the first and the last time. -1 for never
+	int64_t synced;
+	int64_t firstLost;
+	int64_t lastLost;
+	// of the synchronized clocks against the master's once settled, us
+	double maxError;
+	double rmsError;
+} Result;
+
+// a frame of the master and the true time it starts on the line
+typedef struct {
+	Frame *frame;
+	int64_t start;
+} OnLine;
+
+static Node nodes[NUM_NODES];
+static OnLine line[MAX_ON_LINE];
+static int numOnLine;
+// the longest latency of an edge timestamp, us
+static uint32_t latencyUs;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static uint32_t rng = 29;
+
+static uint32_t xorshift() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/**
+ * @return the local time of a node at true time t, us
+ */
+static uint32_t localTime(const Node *n, int64_t t) {
+	return n->start + (uint32_t)(int64_t)llround(t * (1 + n->skew));
+}
+
+/**
+ * sets the MONITOR_TIMER to the node's clock, before calling it
+ */
+static void swapIn(const Node *n, int64_t t) {
+	MONITOR_TIMER_BASE->CNT = localTime(n, t);
+}
+
+/**
+ * @return the true time a frame is over on the line
+ */
+static int64_t frameEnd(const OnLine *o) {
+	return o->start + 8 * o->frame->len * MAC_BIT_US;
+}
+
+/**
+ * a frame of the master is over on the line: every node hears it but when lost, timestamped by its own clock
+ */
+static void broadcast(const Frame *frame, int64_t start, int64_t end) {
+	Frame rx;
+
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		// the master's own SYNC is always heard back, its timestamp is what it follows up with
+		if (i != MASTER && xorshift() < LOSS * 4294967296.0)
+			continue;
+		memcpy(&rx, frame, sizeof(rx));
+		rx.stamps[FP_FIRST_EDGE] = localTime(n, start) + xorshift() % (latencyUs + 1);
+		swapIn(n, end);
+		n->onFrame(&rx);
+	}
+}
+
+/**
+ * runs the master and slaves, each slave's clock skew spread up to maxSkew
+ * @param restartAt true time the master restarts with another clock, 0 for never
+ * @param silentAt true time the master stops, 0 for never
+ */
+static void run(const char *lib, double maxSkew, int64_t seconds, int64_t restartAt, int64_t silentAt, Result *r) {
+	int64_t settleAt = 2 * TIMESYNC_PERIOD_US + SAMPLE_DELAY_US + STEP_US;
+	int64_t lineFree = 0;
+	double sumSquares = 0;
+	unsigned long numErrors = 0;
+
+	memset(r, 0, sizeof(*r));
+	numOnLine = 0;
+	r->synced = r->firstLost = r->lastLost = -1;
+	for (int i = 0; i < NUM_NODES; i++) {
+		Node *n = &nodes[i];
+		void *ts = host_instance(lib);
+		n->init = host_symbol(ts, "timesync_init");
+		n->pollFrame = host_symbol(ts, "timesync_pollFrame");
+		n->onFrame = host_symbol(ts, "timesync_onFrame");
+		n->synced = host_symbol(ts, "timesync_synced");
+		n->now = host_symbol(ts, "timesync_now");
+		// every clock wraps around during the run
+		n->start = -(uint32_t)(xorshift() % (uint32_t)(seconds * 1000000));
+		n->skew = i == MASTER ? 0 : maxSkew * (2.0 * (i - 1) / (NUM_SLAVES - 1) - 1);
+		swapIn(n, 0);
+		n->init(ADDR(i), i == MASTER);
+	}
+
+	for (int64_t t = STEP_US; t < seconds * 1000000; t += STEP_US) {
+		Node *master = &nodes[MASTER];
+		if (restartAt && t == restartAt) {
+			master->start = xorshift();
+			swapIn(master, t);
+			master->init(ADDR(MASTER), true);
+			settleAt = t + 3 * TIMESYNC_PERIOD_US + SAMPLE_DELAY_US + STEP_US;
+		}
+
+		if (!silentAt || t < silentAt) {
+			Frame *frame;
+			swapIn(master, t);
+			while (numOnLine < MAX_ON_LINE && (frame = master->pollFrame())) {
+				OnLine *o = &line[numOnLine++];
+				o->frame = frame;
+				o->start = t + xorshift() % MAX_QUEUEING_US;
+				if (o->start < lineFree)
+					o->start = lineFree;
+				lineFree = frameEnd(o) + MAC_TURNAROUND_US;
+			}
+		}
+		while (numOnLine && frameEnd(&line[0]) <= t) {
+			broadcast(line[0].frame, line[0].start, frameEnd(&line[0]));
+			fp_free(line[0].frame);
+			memmove(line, line + 1, --numOnLine * sizeof(line[0]));
+		}
+
+		if (t % SAMPLE_US)
+			continue;
+		bool allSynced = true;
+		for (int i = 1; i < NUM_NODES; i++) {
+			Node *n = &nodes[i];
+			swapIn(n, t);
+			bool synced = n->synced();
+			uint32_t now = n->now();
+			allSynced &= synced;
+			if (!synced && r->synced >= 0) {
+				r->firstLost = r->firstLost < 0 ? t : r->firstLost;
+				r->lastLost = t;
+			}
+			if (!synced || t < settleAt)
+				continue;
+			double error = (int32_t)(now - localTime(master, t));
+			sumSquares += error * error;
+			numErrors++;
+			if (fabs(error) > r->maxError)
+				r->maxError = fabs(error);
+		}
+		if (allSynced && r->synced < 0)
+			r->synced = t;
+	}
+	r->rmsError = numErrors ? sqrt(sumSquares / numErrors) : 0;
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./timesync.so";
+	double maxSkew = (argc > 2 ? atof(argv[2]) : 10000) / 1000000;
+	int64_t seconds = argc > 4 ? atoi(argv[4]) : 600;
+	const double skews[] = {0, maxSkew / 100, maxSkew / 10, maxSkew};
+	const int numSkews = sizeof(skews) / sizeof(skews[0]);
+	bool synced = true, accurate = true;
+	Result r;
+
+	latencyUs = argc > 3 ? atoi(argv[3]) : 10;
+	// a sample is off by up to the latency, the filter follows it by half and carries some into the drift
+	double bound = 3 * latencyUs + 8;
+	host_init();
+	ph_init();
+	fp_init();
+
+	printf("%d slaves spread over the skew against the master, timestamp latency up to %lu us, %lu s:\n",
+			NUM_SLAVES, (unsigned long)latencyUs, (unsigned long)seconds);
+	printf("  skew ppm   synced after   max error   rms error\n");
+	for (int k = 0; k < numSkews; k++) {
+		run(lib, skews[k], seconds, 0, 0, &r);
+		printf("  %8.0f   %9.3f s   %6.1f us   %6.2f us\n", skews[k] * 1000000, r.synced / 1e6, r.maxError,
+				r.rmsError);
+		synced &= r.synced >= 0 && r.synced <= 2 * TIMESYNC_PERIOD_US + SAMPLE_DELAY_US + SAMPLE_US
+				&& r.firstLost < 0;
+		accurate &= r.maxError <= bound;
+	}
+	check(synced, "every slave is synced by the second sample and stays so");
+	check(accurate, "the synchronized clocks stay within three timestamp latencies and a few us of the master's");
+
+	int64_t at = seconds / 2 * 1000000;
+	run(lib, maxSkew, seconds, at, 0, &r);
+	printf("master restarted at %lu s: slaves not synced from %.3f to %.3f s, then max error %.1f us\n",
+			(unsigned long)seconds / 2, r.firstLost / 1e6, r.lastLost / 1e6, r.maxError);
+	check(r.firstLost >= at && r.lastLost <= at + 3 * TIMESYNC_PERIOD_US + SAMPLE_DELAY_US + SAMPLE_US
+			&& r.maxError <= bound, "a master restarting with another clock is followed again");
+
+	// half a period after the last SYNC was due. The slaves count the periods on their own clocks
+	run(lib, maxSkew, seconds, 0, at + TIMESYNC_PERIOD_US / 2, &r);
+	int64_t lossPeriods = TIMESYNC_LOSS_PERIODS * TIMESYNC_PERIOD_US;
+	printf("master silent from %.1f s, after a SYNC at %lu s: slaves first not synced at %.3f s\n",
+			(at + TIMESYNC_PERIOD_US / 2) / 1e6, (unsigned long)seconds / 2, r.firstLost / 1e6);
+	check(r.firstLost >= at + lossPeriods / (1 + maxSkew) - SAMPLE_US
+			&& r.firstLost <= at + MAX_QUEUEING_US + lossPeriods / (1 - maxSkew) + SAMPLE_US
+			&& r.lastLost >= seconds * 1000000 - SAMPLE_US,
+			"the slaves are synced for TIMESYNC_LOSS_PERIODS periods after the master goes silent");
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,578 @@
+/**
+ * @file token_test.c
+ * Host simulation of the token ring (MAC_TOKEN in mac.h). Every node is an instance of the real mac.c, see
+ * host_instance, polled every millisecond as by the transmitter. The simulation plays the line: a frame is an edge
+ * per bit through the shared monitor, so the MAC sees the line BUSY and its last edge, and once over it is heard by
+ * every node running, the sender too.
+ * - nodes started one by one form the ring. The first regenerates the token, the others join at a solicit, and
+ *   every node with data gets to send
+ * - once the ring formed, the line is never quiet for MAC_TOKEN_LOSS_US, whether the holders have data or not,
+ *   and alone in the ring. No node regenerates a token, and no two transmissions collide
+ * - with every node backlogged, each sends MAC_TOKEN_MAX_FRAMES per hold and gets an even share of the line
+ * - a node that stops is dropped from the ring after two unanswered passes, a node that leaves is dropped at its
+ *   last pass, and both are back after a solicit once they rejoin
+ * - against CSMA: the same backlogged load, every node keeping a frame queued, is run on the token ring and then
+ *   on instances of the real transmitter in MAC_CSMA, contending through its own backoff as in edca_test. The
+ *   token ring shares the line more evenly, by Jain's index over the frames of each node, and does not collide
+ *
+ * Build:
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/mac.c -o mac.so
+ *   gcc -O2 -shared -fPIC -Wl,-Bsymbolic -Iinc src/transmitter.c -o transmitter.so
+ *   gcc -O2 -rdynamic -Iinc -Itools tools/token_test.c tools/host.c $(find src -name "*.c" ! -name main.c ! -name syscalls.c ! -name led.c) -ldl -lm -o token_test
+ * Usage:
+ *   token_test [mac.so] [nodes] [transmitter.so]   (default ./mac.so, 8 nodes, ./transmitter.so. FP_NUM_FRAMES
+ *   nodes at most)
+ */
+
+#include "host.h"
+#include "mac.h"
+#include "monitor.h"
+#include "link.h"
+#include "gpio.h"
+#include "tim.h"
+#include "framepool.h"
+#include "packet_header.h"
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// the CSMA run keeps a frame of the pool queued at every node
+#define MAX_NODES FP_NUM_FRAMES
+#define POLL_US 1000
+#define DATA_BYTES 16
+// a 16 byte frame is 128 ms at 1 kbps, a run checks a few rotations of the ring
+#define RUN_US (5 * MAC_TOKEN_SOLICIT_US)
+// the backlogged load of the comparison with CSMA runs this long in each mode, some 60 frames per node
+#define COMPARE_US 60000000u
+// the transmitters' main routines and ISRs run on this grid, the half-bit is a whole number of steps
+#define STEP_US 50
+#define HALFBIT_US (MAC_BIT_US / 2)
+
+typedef struct {
+	void (*init)(MAC_MODE mode, uint8_t addr);
+	Frame *(*pollControlFrame)(bool dataPending);
+	bool (*mayTransmit)(const Frame *frame, unsigned int bits);
+	void (*onCollision)();
+	bool (*onFrame)(const Frame *frame);
+	void (*leave)();
+	void (*join)();
+
+	uint8_t addr;
+	bool running;
+	// data frames queued, -1 for always
+	int queued;
+	Frame data;
+	unsigned long sent;
+	// data frames sent in a row, and the most of them
+	int run;
+	int maxRun;
+	unsigned long tokens;
+} Node;
+
+// a node of the CSMA run, an instance of the transmitter
+typedef struct {
+	void (*init)(bool packet_mode, bool stream_mode);
+	void (*queue)(Frame *frame);
+	void (*update)();
+	void (*isr)();
+	// the registers of its transmit timer and pins, while its code is not running
+	TIMER tim;
+	uint32_t odr;
+	bool running;
+	uint32_t nextIsr;
+	Frame *frame;
+	unsigned long sent;
+} Station;
+
+// the line under the load of the comparison, in each mode
+typedef struct {
+	unsigned long sent[MAX_NODES];
+	unsigned long total;
+	unsigned long minSent;
+	unsigned long maxSent;
+	double fairness;
+	double dataShare;
+	unsigned long collisions;
+} Share;
+
+// what is on the line
+static struct {
+	Frame frame;
+	Node *sender;
+	bool busy;
+	bool collided;
+	uint32_t end;
+	int level;
+	// the longest the line was quiet, and from when it is counted
+	uint32_t quietSince;
+	uint32_t maxQuiet;
+	unsigned long collisions;
+	unsigned long dataUs;
+} line;
+
+static Node nodes[MAX_NODES];
+static Station stations[MAX_NODES];
+static int numNodes;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	failures += !ok;
+}
+
+static void loadNodes(const char *lib) {
+	for (int i = 0; i < numNodes; i++) {
+		Node *n = &nodes[i];
+		void *mac = host_instance(lib);
+		n->init = host_symbol(mac, "mac_init");
+		n->pollControlFrame = host_symbol(mac, "mac_pollControlFrame");
+		n->mayTransmit = host_symbol(mac, "mac_mayTransmit");
+		n->onCollision = host_symbol(mac, "mac_onCollision");
+		n->onFrame = host_symbol(mac, "mac_onFrame");
+		n->leave = host_symbol(mac, "mac_leave");
+		n->join = host_symbol(mac, "mac_join");
+		// addresses in the ring aren't contiguous
+		n->addr = 3 + 5 * i;
+	}
+}
+
+/**
+ * the receive pin changes to level, and its edge interrupt is taken
+ */
+static void edge(int level) {
+	const LinkConfig *cfg = &link_configs[LINK_PRIMARY];
+
+	if (level)
+		select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	else
+		select_gpio(cfg->rxGpio)->IDR &= ~(1 << cfg->rxPin);
+	line.level = level;
+	monitor_onEdge(LINK_PRIMARY);
+}
+
+static void startNode(Node *n, int queued) {
+	n->init(MAC_TOKEN, n->addr);
+	n->running = true;
+	n->queued = queued;
+	n->run = 0;
+}
+
+static void transmit(Node *n, const Frame *frame) {
+	uint32_t now = monitor_now();
+
+	if (line.busy) {
+		// only ever a node with a duplicate token
+		line.collided = true;
+		return;
+	}
+	memcpy(&line.frame, frame, sizeof(*frame));
+	line.frame.stamps[FP_FIRST_EDGE] = now;
+	line.sender = n;
+	line.busy = true;
+	line.collided = false;
+	line.end = now + 8 * frame->len * MAC_BIT_US;
+	if (now - line.quietSince > line.maxQuiet)
+		line.maxQuiet = now - line.quietSince;
+	edge(!line.level);
+}
+
+/**
+ * ends the frame on the line, once its bits are over
+ */
+static void lineTick() {
+	uint32_t now = monitor_now();
+
+	if (!line.busy)
+		return;
+	edge(!line.level);
+	if ((int32_t)(now - line.end) < 0)
+		return;
+
+	line.busy = false;
+	// the line is left high
+	if (!line.level)
+		edge(1);
+	line.quietSince = now;
+	if (line.collided) {
+		line.collisions++;
+		for (int i = 0; i < numNodes; i++) {
+			if (nodes[i].running)
+				nodes[i].onCollision();
+		}
+		return;
+	}
+	for (int i = 0; i < numNodes; i++) {
+		if (nodes[i].running)
+			nodes[i].onFrame(&line.frame);
+	}
+}
+
+/**
+ * every running node polls its MAC once, in turn, as its main loop would
+ */
+static void pollNodes() {
+	for (int i = 0; i < numNodes; i++) {
+		Node *n = &nodes[i];
+		if (!n->running || monitor_getState(LINK_PRIMARY) != MS_IDLE)
+			continue;
+		bool pending = n->queued != 0;
+		Frame *control = n->pollControlFrame(pending);
+		if (control) {
+			if (PH_GET_TYPE(control->data[PH_FLAGS_OFFSET]) == PH_TYPE_TOKEN) {
+				n->tokens++;
+				n->run = 0;
+			}
+			transmit(n, control);
+			fp_free(control);
+			continue;
+		}
+		if (pending && n->mayTransmit(&n->data, 8 * n->data.len)) {
+			transmit(n, &n->data);
+			line.dataUs += 8 * n->data.len * MAC_BIT_US;
+			n->sent++;
+			if (++n->run > n->maxRun)
+				n->maxRun = n->run;
+			if (n->queued > 0)
+				n->queued--;
+		}
+	}
+}
+
+static void runFor(uint32_t us) {
+	for (uint32_t t = 0; t < us; t += POLL_US) {
+		host_advance(POLL_US);
+		lineTick();
+		pollNodes();
+	}
+}
+
+/**
+ * starts counting the quiet stretches and the sends anew
+ */
+static void resetStats() {
+	line.maxQuiet = 0;
+	line.quietSince = monitor_now();
+	line.collisions = line.dataUs = 0;
+	for (int i = 0; i < numNodes; i++) {
+		nodes[i].sent = nodes[i].tokens = 0;
+		nodes[i].maxRun = 0;
+	}
+}
+
+/**
+ * @return the longest the line was quiet since resetStats, up to now
+ */
+static uint32_t maxQuiet() {
+	uint32_t quiet = monitor_now() - line.quietSince;
+	return line.busy || quiet < line.maxQuiet ? line.maxQuiet : quiet;
+}
+
+static void makeData(Node *n) {
+	PacketHeader pkt;
+	uint8_t msg[DATA_BYTES] = {0};
+
+	ph_create(&pkt, n->addr, 0xFF, true, msg, DATA_BYTES - PH_OVERHEAD);
+	n->data.len = ph_serialize(n->data.data, &pkt);
+}
+
+static void form() {
+	bool everyone = true;
+
+	host_quiet(true);
+	// the first node alone and idle, then the others, each with a few frames
+	startNode(&nodes[0], 0);
+	runFor(MAC_TOKEN_LOSS_US + 100000);
+	resetStats();
+	runFor(MAC_TOKEN_SOLICIT_US / 2);
+	uint32_t aloneQuiet = maxQuiet();
+	for (int i = 1; i < numNodes; i++) {
+		startNode(&nodes[i], 0);
+		runFor(50000);
+	}
+	runFor(numNodes * MAC_TOKEN_SOLICIT_US);
+	resetStats();
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].queued = 3;
+	runFor(RUN_US);
+	host_quiet(false);
+
+	for (int i = 0; i < numNodes; i++)
+		everyone &= nodes[i].sent == 3;
+	printf("alone in the ring: line quiet %lu us at most\n", (unsigned long)aloneQuiet);
+	check(aloneQuiet < MAC_TOKEN_LOSS_US / 2, "a node alone in the ring is heard well within MAC_TOKEN_LOSS_US");
+	check(everyone, "nodes started one by one form a ring, and each sends what it has");
+}
+
+static void idleAndBusy() {
+	unsigned long tokens = 0, sent = 0;
+	unsigned long minSent = -1UL, maxSent = 0;
+	bool held = true;
+
+	host_quiet(true);
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].queued = 0;
+	resetStats();
+	runFor(RUN_US);
+	uint32_t idleQuiet = maxQuiet();
+	for (int i = 0; i < numNodes; i++)
+		tokens += nodes[i].tokens;
+	bool idleCirculates = tokens > 0;
+
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].queued = -1;
+	resetStats();
+	runFor(RUN_US);
+	uint32_t busyQuiet = maxQuiet();
+	host_quiet(false);
+	for (int i = 0; i < numNodes; i++) {
+		Node *n = &nodes[i];
+		sent += n->sent;
+		minSent = n->sent < minSent ? n->sent : minSent;
+		maxSent = n->sent > maxSent ? n->sent : maxSent;
+		held &= n->maxRun == MAC_TOKEN_MAX_FRAMES;
+	}
+	printf("idle ring: %lu passes, line quiet %lu us at most\n", tokens, (unsigned long)idleQuiet);
+	printf("backlogged ring: %lu frames, %lu to %lu per node, data %.0f%% of the line, line quiet %lu us at most, "
+			"%lu collisions\n", sent, minSent, maxSent, 100.0 * line.dataUs / RUN_US,
+			(unsigned long)busyQuiet, line.collisions);
+	check(idleCirculates && idleQuiet < MAC_TOKEN_LOSS_US / 2,
+			"with no data, the token goes around and the line is never quiet for long");
+	check(busyQuiet < MAC_TOKEN_LOSS_US / 2 && line.collisions == 0,
+			"with every node backlogged, the line is never quiet for long and nothing collides");
+	check(held, "a hold is MAC_TOKEN_MAX_FRAMES frames");
+	check(maxSent - minSent <= MAC_TOKEN_MAX_FRAMES, "every node gets an even share of the line");
+}
+
+static void failAndLeave() {
+	Node *dead = &nodes[numNodes / 2], *leaver = &nodes[numNodes - 1];
+
+	host_quiet(true);
+	dead->running = false;
+	runFor(MAC_TOKEN_SOLICIT_US);
+	resetStats();
+	runFor(RUN_US);
+	uint32_t deadQuiet = maxQuiet();
+	bool othersSend = true;
+	for (int i = 0; i < numNodes; i++)
+		othersSend &= &nodes[i] == dead || nodes[i].sent > 0;
+
+	// what it has queued still goes out first
+	leaver->queued = 0;
+	leaver->leave();
+	runFor(RUN_US);
+	resetStats();
+	runFor(RUN_US);
+	bool left = leaver->sent == 0 && leaver->tokens == 0;
+
+	startNode(dead, -1);
+	leaver->queued = -1;
+	leaver->join();
+	runFor(numNodes * MAC_TOKEN_SOLICIT_US);
+	resetStats();
+	runFor(RUN_US);
+	host_quiet(false);
+	bool back = dead->sent > 0 && leaver->sent > 0 && line.collisions == 0;
+
+	printf("a node stopped: line quiet %lu us at most\n", (unsigned long)deadQuiet);
+	check(othersSend && deadQuiet < MAC_TOKEN_LOSS_US, "a node that stops is dropped, the others keep sending");
+	check(left, "a node that leaves gets the token no more");
+	check(back, "both are back in the ring after a solicit");
+}
+
+/**
+ * sums up the frames each node sent under the load: their spread, and Jain's index (sum x)^2 / (n sum x^2), 1 for
+ * an even share
+ */
+static void share(Share *sh) {
+	double sum = 0, squares = 0;
+
+	sh->total = sh->maxSent = 0;
+	sh->minSent = -1UL;
+	for (int i = 0; i < numNodes; i++) {
+		sh->total += sh->sent[i];
+		sh->minSent = sh->sent[i] < sh->minSent ? sh->sent[i] : sh->minSent;
+		sh->maxSent = sh->sent[i] > sh->maxSent ? sh->sent[i] : sh->maxSent;
+		sum += sh->sent[i];
+		squares += (double)sh->sent[i] * sh->sent[i];
+	}
+	sh->fairness = squares ? sum * sum / (numNodes * squares) : 0;
+	sh->dataShare = (double)sh->total * 8 * DATA_BYTES * MAC_BIT_US / COMPARE_US;
+}
+
+static void swapIn(Station *st) {
+	memcpy((void *)tim_regs(link_configs[LINK_PRIMARY].txTimer), &st->tim, sizeof(st->tim));
+	select_gpio(link_configs[LINK_PRIMARY].txGpio)->ODR = st->odr;
+}
+
+static void swapOut(Station *st) {
+	memcpy(&st->tim, (void *)tim_regs(link_configs[LINK_PRIMARY].txTimer), sizeof(st->tim));
+	st->odr = select_gpio(link_configs[LINK_PRIMARY].txGpio)->ODR;
+}
+
+/**
+ * takes the frame a node is done with, sent or dropped after too many collisions. The transmitter has freed it
+ * and reported it through llc_complete, which clears its handle
+ */
+static void collect(Station *st) {
+	if (!st->frame || st->frame->handle)
+		return;
+	st->sent += st->frame->stamps[FP_LAST_EDGE] != 0;
+	st->frame = NULL;
+}
+
+/**
+ * the backlogged load on fresh instances of the transmitter in CSMA. The line is the wired-AND of their pins, and
+ * two of them sending at once are jammed into a collision, as the garbled line would be
+ */
+static void runCsma(const char *lib, Share *sh) {
+	const LinkConfig *cfg;
+	MonitorStats stats;
+
+	memset(sh, 0, sizeof(*sh));
+	host_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	line.level = 1;
+	monitor_start(false);
+	tw_init();
+	mac_init(MAC_CSMA, 0x10);
+	for (int i = 0; i < numNodes; i++) {
+		Station *st = &stations[i];
+		void *tx = host_instance(lib);
+		memset(st, 0, sizeof(*st));
+		st->init = host_symbol(tx, "transmitter_init");
+		st->queue = host_symbol(tx, "transmitter_queue");
+		st->update = host_symbol(tx, "transmitter_mainRoutineUpdate");
+		st->isr = host_symbol(tx, "TIM2_IRQHandler");
+		st->init(false, false);
+		// its pin idles high, as once a transmission is stopped
+		set_pin(cfg->txGpio, cfg->txPin);
+		swapOut(st);
+	}
+	// the transmitters draw their backoffs from rand
+	srand(1);
+
+	for (uint32_t t = 0; t < COMPARE_US; t += STEP_US) {
+		host_advance(STEP_US);
+		tw_run();
+		uint32_t now = monitor_now();
+
+		// the half-bits of the senders, then the line they make
+		int level = 1, senders = 0;
+		for (int i = 0; i < numNodes; i++) {
+			Station *st = &stations[i];
+			if (st->running && now == st->nextIsr) {
+				swapIn(st);
+				st->isr();
+				swapOut(st);
+				st->nextIsr += HALFBIT_US;
+				st->running = st->tim.CR1 & (1 << CEN);
+			}
+			level &= (st->odr >> cfg->txPin) & 1;
+			senders += st->running;
+		}
+		if (level != line.level)
+			edge(level);
+		if (senders > 1)
+			monitor_jam(LINK_PRIMARY);
+
+		// a frame done in the ISR is taken before another node can have it from the pool again
+		for (int i = 0; i < numNodes; i++)
+			collect(&stations[i]);
+		for (int i = 0; i < numNodes; i++) {
+			Station *st = &stations[i];
+			// every node keeps a frame queued, the next one as soon as the last is done
+			if (!st->frame) {
+				st->frame = fp_alloc();
+				memcpy(st->frame, &nodes[i].data, sizeof(Frame));
+				// reported back through llc_complete, which clears it
+				st->frame->handle = 1;
+				memset(st->frame->stamps, 0, sizeof(st->frame->stamps));
+				swapIn(st);
+				st->queue(st->frame);
+				swapOut(st);
+			}
+			swapIn(st);
+			st->update();
+			swapOut(st);
+			if (!st->running && (st->tim.CR1 & (1 << CEN))) {
+				st->running = true;
+				st->nextIsr = now + HALFBIT_US;
+			}
+			collect(st);
+		}
+	}
+	monitor_getStats(LINK_PRIMARY, &stats);
+	for (int i = 0; i < numNodes; i++)
+		sh->sent[i] = stations[i].sent;
+	sh->collisions = stats.collisions;
+	share(sh);
+}
+
+/**
+ * the same backlogged load on the token ring and on CSMA, side by side
+ */
+static void versusCsma(const char *txLib) {
+	Share token, csma;
+
+	host_quiet(true);
+	memset(&token, 0, sizeof(token));
+	for (int i = 0; i < numNodes; i++)
+		nodes[i].queued = -1;
+	resetStats();
+	runFor(COMPARE_US);
+	for (int i = 0; i < numNodes; i++)
+		token.sent[i] = nodes[i].sent;
+	token.collisions = line.collisions;
+	share(&token);
+	runCsma(txLib, &csma);
+	host_quiet(false);
+
+	printf("%d nodes backlogged with %d byte frames for %.0f s:\n", numNodes, DATA_BYTES, COMPARE_US / 1e6);
+	printf("                    token ring      CSMA\n");
+	printf("  frames            %10lu  %8lu\n", token.total, csma.total);
+	printf("  per node          %4lu to %3lu  %3lu to %lu\n", token.minSent, token.maxSent, csma.minSent,
+			csma.maxSent);
+	printf("  Jain's index      %10.3f  %8.3f\n", token.fairness, csma.fairness);
+	printf("  data of the line  %9.0f%%  %7.0f%%\n", 100 * token.dataShare, 100 * csma.dataShare);
+	printf("  collisions        %10lu  %8lu\n", token.collisions, csma.collisions);
+	check(token.fairness > csma.fairness, "the token ring shares the line more evenly than CSMA");
+	check(token.collisions < csma.collisions, "the token ring collides less than CSMA");
+}
+
+int main(int argc, char **argv) {
+	const char *lib = argc > 1 ? argv[1] : "./mac.so";
+	numNodes = argc > 2 ? atoi(argv[2]) : 8;
+	const LinkConfig *cfg;
+
+	const char *txLib = argc > 3 ? argv[3] : "./transmitter.so";
+
+	if (numNodes < 3 || numNodes > MAX_NODES)
+		numNodes = 8;
+	host_init();
+	srand(1);
+	ph_init();
+	fp_init();
+	link_init(1);
+	cfg = &link_configs[LINK_PRIMARY];
+	// the idle line is high
+	select_gpio(cfg->rxGpio)->IDR |= 1 << cfg->rxPin;
+	line.level = 1;
+	monitor_start(false);
+	tw_init();
+	loadNodes(lib);
+	for (int i = 0; i < numNodes; i++)
+		makeData(&nodes[i]);
+
+	form();
+	idleAndBusy();
+	failAndLeave();
+	versusCsma(txLib);
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}